@@ -0,0 +1,37 @@
+// Сценарии замеров на модели шторы без платы: контроллер, датчик, мотор
+// и модель из main/ поверх заглушек ESP-IDF. Код выхода 0 - прогон успешен
+#include "controller.h"
+#include "sim_bench.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *TAG = "sim_bench_host";
+
+#define HOST_START_DELAY_MS 500 // Датчик успевает выдать первый отсчет
+#define HOST_POLL_MS 100
+
+int main(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_init());
+    controller_init();
+    sim_bench_init();
+
+    vTaskDelay(pdMS_TO_TICKS(HOST_START_DELAY_MS));
+    ESP_ERROR_CHECK(sim_bench_start());
+    while (sim_bench_running())
+    {
+        vTaskDelay(pdMS_TO_TICKS(HOST_POLL_MS));
+    }
+
+    bool passed = sim_bench_passed();
+    ESP_LOGI(TAG, "Benchmark %s", passed ? "passed" : "failed");
+    fflush(stdout);
+
+    // Задачи не завершаются: выход без деструкторов статических объектов,
+    // которыми они еще пользуются
+    _Exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
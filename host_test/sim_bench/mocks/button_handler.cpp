@@ -0,0 +1,22 @@
+// Кнопки на хосте не подключены: события приходят только от сценариев
+#include "button_handler.h"
+#include <stddef.h>
+
+static button_callback_t button_callback = NULL;
+static void *button_user_data = NULL;
+
+void button_handler_init(void)
+{
+}
+
+void button_handler_set_callback(button_callback_t callback, void *user_data)
+{
+    button_callback = callback;
+    button_user_data = user_data;
+}
+
+void button_handler_get_queue_stats(uint32_t *depth, uint32_t *peak)
+{
+    *depth = 0;
+    *peak = 0;
+}
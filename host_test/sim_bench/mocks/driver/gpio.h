@@ -0,0 +1,56 @@
+// GPIO на хосте: уровни выводов хранятся в памяти
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef int gpio_num_t;
+
+#define GPIO_NUM_NC -1
+
+    typedef enum
+    {
+        GPIO_MODE_DISABLE = 0,
+        GPIO_MODE_INPUT = 1,
+        GPIO_MODE_OUTPUT = 2,
+        GPIO_MODE_INPUT_OUTPUT = 3,
+    } gpio_mode_t;
+
+    typedef enum
+    {
+        GPIO_PULLUP_DISABLE,
+        GPIO_PULLUP_ENABLE,
+    } gpio_pullup_t;
+
+    typedef enum
+    {
+        GPIO_PULLDOWN_DISABLE,
+        GPIO_PULLDOWN_ENABLE,
+    } gpio_pulldown_t;
+
+    typedef enum
+    {
+        GPIO_INTR_DISABLE,
+    } gpio_int_type_t;
+
+    typedef struct
+    {
+        uint64_t pin_bit_mask;
+        gpio_mode_t mode;
+        gpio_pullup_t pull_up_en;
+        gpio_pulldown_t pull_down_en;
+        gpio_int_type_t intr_type;
+    } gpio_config_t;
+
+    esp_err_t gpio_config(const gpio_config_t *config);
+    esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+    int gpio_get_level(gpio_num_t gpio_num);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+// GPIO и ADC на хосте
+#include "driver/gpio.h"
+#include "esp_adc/adc_oneshot.h"
+#include "soc/soc_caps.h"
+#include <atomic>
+
+static std::atomic<uint32_t> gpio_levels[SOC_GPIO_PIN_COUNT];
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    if (config == NULL || (config->pin_bit_mask >> SOC_GPIO_PIN_COUNT) != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= SOC_GPIO_PIN_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_levels[gpio_num] = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= SOC_GPIO_PIN_COUNT)
+    {
+        return 0;
+    }
+    return (int)gpio_levels[gpio_num].load();
+}
+
+// Дескриптору блока достаточно быть не NULL
+static int adc_unit_handle;
+
+esp_err_t adc_oneshot_new_unit(const adc_oneshot_unit_init_cfg_t *init_config, adc_oneshot_unit_handle_t *ret_unit)
+{
+    if (init_config == NULL || ret_unit == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ret_unit = (adc_oneshot_unit_handle_t)&adc_unit_handle;
+    return ESP_OK;
+}
+
+esp_err_t adc_oneshot_config_channel(adc_oneshot_unit_handle_t handle, adc_channel_t channel,
+                                     const adc_oneshot_chan_cfg_t *config)
+{
+    return handle != NULL && config != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t adc_oneshot_read(adc_oneshot_unit_handle_t handle, adc_channel_t chan, int *out_raw)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
@@ -0,0 +1,57 @@
+// ADC на хосте: настройка принимается, чтение не поддерживается (отсчеты
+// дает модель шторы)
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        ADC_UNIT_1,
+        ADC_UNIT_2,
+    } adc_unit_t;
+
+    typedef int adc_channel_t;
+
+    typedef enum
+    {
+        ADC_ATTEN_DB_0,
+        ADC_ATTEN_DB_2_5,
+        ADC_ATTEN_DB_6,
+        ADC_ATTEN_DB_12,
+    } adc_atten_t;
+
+    typedef enum
+    {
+        ADC_BITWIDTH_DEFAULT = 0,
+        ADC_BITWIDTH_12 = 12,
+    } adc_bitwidth_t;
+
+    typedef struct adc_oneshot_unit_ctx_t *adc_oneshot_unit_handle_t;
+
+    typedef struct
+    {
+        adc_unit_t unit_id;
+        int clk_src;
+        int ulp_mode;
+    } adc_oneshot_unit_init_cfg_t;
+
+    typedef struct
+    {
+        adc_atten_t atten;
+        adc_bitwidth_t bitwidth;
+    } adc_oneshot_chan_cfg_t;
+
+    esp_err_t adc_oneshot_new_unit(const adc_oneshot_unit_init_cfg_t *init_config,
+                                   adc_oneshot_unit_handle_t *ret_unit);
+    esp_err_t adc_oneshot_config_channel(adc_oneshot_unit_handle_t handle, adc_channel_t channel,
+                                         const adc_oneshot_chan_cfg_t *config);
+    esp_err_t adc_oneshot_read(adc_oneshot_unit_handle_t handle, adc_channel_t chan, int *out_raw);
+
+#ifdef __cplusplus
+}
+#endif
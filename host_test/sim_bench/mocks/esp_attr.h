@@ -0,0 +1,7 @@
+// Атрибуты размещения кода и данных: на хосте не нужны
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
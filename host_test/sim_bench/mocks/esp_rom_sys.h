@@ -0,0 +1,15 @@
+// Задержка из ROM
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void esp_rom_delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
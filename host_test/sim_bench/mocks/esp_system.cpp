@@ -0,0 +1,97 @@
+// Системные функции ESP-IDF на хосте: имена ошибок, время журнала, ROM
+// и перезапуск
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Полином 0xEDB88320 с инверсией на входе и выходе, как в ROM
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static std::mutex shutdown_lock;
+static std::vector<shutdown_handler_t> shutdown_handlers;
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    std::lock_guard<std::mutex> guard(shutdown_lock);
+    shutdown_handlers.push_back(handler);
+    return ESP_OK;
+}
+
+void esp_restart(void)
+{
+    std::vector<shutdown_handler_t> handlers;
+    {
+        std::lock_guard<std::mutex> guard(shutdown_lock);
+        handlers = shutdown_handlers;
+    }
+    for (auto it = handlers.rbegin(); it != handlers.rend(); ++it)
+    {
+        (*it)();
+    }
+    fprintf(stderr, "esp_restart() on host, exiting\n");
+    fflush(stdout);
+    _Exit(2);
+}
@@ -0,0 +1,20 @@
+// Перезапуск и обработчики выключения
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef void (*shutdown_handler_t)(void);
+
+    esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+
+    // Вызывает обработчики выключения и завершает процесс
+    void esp_restart(void) __attribute__((noreturn));
+
+#ifdef __cplusplus
+}
+#endif
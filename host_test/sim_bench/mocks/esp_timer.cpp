@@ -0,0 +1,170 @@
+// esp_timer на хосте. Один поток диспетчера выполняет callback по сроку,
+// как задача esp_timer: callback не вытесняют друг друга, блокировка
+// на время callback снята, и таймер можно перезапустить из него самого
+#include "esp_timer.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    std::string name;
+    bool armed = false;
+    int64_t deadline_us = 0;
+    uint64_t period_us = 0; // 0 - однократный
+    uint64_t sequence = 0;  // Порядок взведения при равных сроках
+};
+
+struct timer_order
+{
+    bool operator()(const esp_timer *a, const esp_timer *b) const
+    {
+        if (a->deadline_us != b->deadline_us)
+        {
+            return a->deadline_us < b->deadline_us;
+        }
+        return a->sequence < b->sequence;
+    }
+};
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+static std::mutex timer_lock;
+static std::condition_variable timer_changed;
+static std::set<esp_timer *, timer_order> armed_timers;
+static uint64_t next_sequence = 0;
+static bool dispatcher_started = false;
+
+int64_t esp_timer_get_time(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+static void timer_dispatch(void)
+{
+    std::unique_lock<std::mutex> lock(timer_lock);
+    while (true)
+    {
+        if (armed_timers.empty())
+        {
+            timer_changed.wait(lock);
+            continue;
+        }
+
+        esp_timer *timer = *armed_timers.begin();
+        int64_t now = esp_timer_get_time();
+        if (timer->deadline_us > now)
+        {
+            timer_changed.wait_for(lock, std::chrono::microseconds(timer->deadline_us - now));
+            continue;
+        }
+
+        armed_timers.erase(armed_timers.begin());
+        if (timer->period_us != 0)
+        {
+            timer->deadline_us += (int64_t)timer->period_us;
+            timer->sequence = next_sequence++;
+            armed_timers.insert(timer);
+        }
+        else
+        {
+            timer->armed = false;
+        }
+
+        esp_timer_cb_t callback = timer->callback;
+        void *arg = timer->arg;
+        lock.unlock();
+        callback(arg);
+        lock.lock();
+    }
+}
+
+// Вызывается под timer_lock
+static void timer_arm(esp_timer *timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (!dispatcher_started)
+    {
+        dispatcher_started = true;
+        std::thread(timer_dispatch).detach();
+    }
+
+    timer->armed = true;
+    timer->deadline_us = esp_timer_get_time() + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    timer->sequence = next_sequence++;
+    armed_timers.insert(timer);
+    timer_changed.notify_all();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_timer *timer = new esp_timer();
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name != NULL ? create_args->name : "";
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    std::lock_guard<std::mutex> guard(timer_lock);
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer_arm(timer, timeout_us, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    std::lock_guard<std::mutex> guard(timer_lock);
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer_arm(timer, period, period);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> guard(timer_lock);
+    if (!timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    armed_timers.erase(timer);
+    timer->armed = false;
+    timer_changed.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> guard(timer_lock);
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> guard(timer_lock);
+    return timer->armed;
+}
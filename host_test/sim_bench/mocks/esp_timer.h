@@ -0,0 +1,46 @@
+// esp_timer на хосте: монотонные часы и поток диспетчера, который, как
+// задача esp_timer, выполняет callback всех таймеров по очереди
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct esp_timer *esp_timer_handle_t;
+    typedef void (*esp_timer_cb_t)(void *arg);
+
+    typedef enum
+    {
+        ESP_TIMER_TASK,
+        ESP_TIMER_ISR,
+    } esp_timer_dispatch_t;
+
+    typedef struct
+    {
+        esp_timer_cb_t callback;
+        void *arg;
+        esp_timer_dispatch_t dispatch_method;
+        const char *name;
+        bool skip_unhandled_events;
+    } esp_timer_create_args_t;
+
+    // Микросекунды с запуска процесса
+    int64_t esp_timer_get_time(void);
+
+    esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+    // ESP_ERR_INVALID_STATE, если таймер уже взведен
+    esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+    esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+    // ESP_ERR_INVALID_STATE, если таймер не взведен
+    esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+    esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+    bool esp_timer_is_active(esp_timer_handle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
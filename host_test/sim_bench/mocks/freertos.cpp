@@ -0,0 +1,369 @@
+// FreeRTOS поверх потоков C++: задачи, уведомления, очереди, семафоры и
+// группы событий с той семантикой, на которую рассчитаны исходники main/
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct tskTaskControlBlock
+{
+    std::string name;
+    std::mutex lock;
+    std::condition_variable changed;
+    uint32_t notify_value = 0;
+    bool notify_pending = false;
+};
+
+struct QueueDefinition
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+struct EventGroupDef_t
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    EventBits_t bits = 0;
+};
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+// Задача потока. Потоки, созданные не через xTaskCreate (main, диспетчер
+// esp_timer), получают ее при первом обращении
+static thread_local TaskHandle_t current_task = NULL;
+
+static TaskHandle_t task_self(void)
+{
+    if (current_task == NULL)
+    {
+        current_task = new tskTaskControlBlock();
+        current_task->name = "host";
+    }
+    return current_task;
+}
+
+// Ожидание условия не дольше ticks, portMAX_DELAY - без ограничения
+template <typename Predicate>
+static bool wait_ticks(std::unique_lock<std::mutex> &lock, std::condition_variable &changed, TickType_t ticks,
+                       Predicate ready)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        changed.wait(lock, ready);
+        return true;
+    }
+    return changed.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(ticks)), ready);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&mux->mutex);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+void portMUX_INITIALIZE(portMUX_TYPE *mux)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mux->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    TaskHandle_t task = new tskTaskControlBlock();
+    task->name = name != NULL ? name : "";
+    if (created_task != NULL)
+    {
+        *created_task = task;
+    }
+
+    std::thread([task, function, parameter]() {
+        current_task = task;
+        pthread_setname_np(pthread_self(), task->name.substr(0, 15).c_str());
+        function(parameter);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    return xTaskCreate(function, name, stack_depth, parameter, priority, created_task);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != current_task)
+    {
+        fprintf(stderr, "vTaskDelete of another task is not supported on host\n");
+        abort();
+    }
+    // Дескриптор не освобождается: на него могут ссылаться другие задачи
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(pdTICKS_TO_MS(ticks)));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    return pdMS_TO_TICKS(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return task_self();
+}
+
+BaseType_t xTaskGenericNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t result = pdPASS;
+    {
+        std::lock_guard<std::mutex> guard(task->lock);
+        switch (action)
+        {
+        case eSetBits:
+            task->notify_value |= value;
+            break;
+        case eIncrement:
+            task->notify_value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notify_value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notify_pending)
+            {
+                result = pdFAIL;
+            }
+            else
+            {
+                task->notify_value = value;
+            }
+            break;
+        default:
+            break;
+        }
+        task->notify_pending = true;
+    }
+    task->changed.notify_all();
+    return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = task_self();
+    std::unique_lock<std::mutex> lock(task->lock);
+    if (!task->notify_pending)
+    {
+        task->notify_value &= ~clear_on_entry;
+    }
+
+    bool received = wait_ticks(lock, task->changed, ticks_to_wait, [task]() { return task->notify_pending; });
+    if (value != NULL)
+    {
+        *value = task->notify_value;
+    }
+    if (!received)
+    {
+        return pdFALSE;
+    }
+    task->notify_value &= ~clear_on_exit;
+    task->notify_pending = false;
+    return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = task_self();
+    std::unique_lock<std::mutex> lock(task->lock);
+    wait_ticks(lock, task->changed, ticks_to_wait, [task]() { return task->notify_value != 0; });
+
+    uint32_t value = task->notify_value;
+    if (value != 0)
+    {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = false;
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = new QueueDefinition();
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, bool front)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue->lock);
+        if (!wait_ticks(lock, queue->changed, ticks_to_wait,
+                        [queue]() { return queue->items.size() < queue->length; }))
+        {
+            return pdFAIL;
+        }
+
+        const uint8_t *bytes = (const uint8_t *)item;
+        std::vector<uint8_t> copy(bytes, bytes != NULL ? bytes + queue->item_size : bytes);
+        if (front)
+        {
+            queue->items.push_front(std::move(copy));
+        }
+        else
+        {
+            queue->items.push_back(std::move(copy));
+        }
+    }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait, bool remove)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue->lock);
+        if (!wait_ticks(lock, queue->changed, ticks_to_wait, [queue]() { return !queue->items.empty(); }))
+        {
+            return pdFAIL;
+        }
+
+        if (buffer != NULL && queue->item_size != 0)
+        {
+            memcpy(buffer, queue->items.front().data(), queue->item_size);
+        }
+        if (!remove)
+        {
+            return pdPASS;
+        }
+        queue->items.pop_front();
+    }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, buffer, ticks_to_wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, buffer, ticks_to_wait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return (UBaseType_t)queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+    xQueueSend(mutex, NULL, 0);
+    return mutex;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return new EventGroupDef_t();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t result;
+    {
+        std::lock_guard<std::mutex> guard(group->lock);
+        group->bits |= bits;
+        result = group->bits;
+    }
+    group->changed.notify_all();
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> guard(group->lock);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> guard(group->lock);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(group->lock);
+    auto ready = [group, bits, wait_for_all]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+
+    bool satisfied = wait_ticks(lock, group->changed, ticks_to_wait, ready);
+    EventBits_t result = group->bits;
+    if (satisfied && clear_on_exit)
+    {
+        group->bits &= ~bits;
+    }
+    return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct QueueDefinition *QueueHandle_t;
+
+    // Элемент нулевого размера - счетный семафор (semphr.h)
+    QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+    void vQueueDelete(QueueHandle_t queue);
+
+    BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+    BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+    BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+    BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+    UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSendToBack(queue, item, ticks) xQueueSend(queue, item, ticks)
+
+    static inline BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+    {
+        if (woken != NULL)
+        {
+            *woken = pdFALSE;
+        }
+        return xQueueSend(queue, item, 0);
+    }
+
+#ifdef __cplusplus
+}
+#endif
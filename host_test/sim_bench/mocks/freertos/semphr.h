@@ -0,0 +1,25 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef QueueHandle_t SemaphoreHandle_t;
+
+    // Мьютекс создается отпущенным, двоичный семафор - взятым. Наследование
+    // приоритета не нужно: приоритетов на хосте нет
+    SemaphoreHandle_t xSemaphoreCreateBinary(void);
+    SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+#define xSemaphoreTake(semaphore, ticks) xQueueReceive(semaphore, NULL, ticks)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
+#define xSemaphoreGiveFromISR(semaphore, woken) xQueueSendFromISR(semaphore, NULL, woken)
+
+#ifdef __cplusplus
+}
+#endif
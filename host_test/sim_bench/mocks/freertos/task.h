@@ -0,0 +1,60 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct tskTaskControlBlock *TaskHandle_t;
+    typedef void (*TaskFunction_t)(void *parameter);
+
+    typedef enum
+    {
+        eNoAction = 0,
+        eSetBits,
+        eIncrement,
+        eSetValueWithOverwrite,
+        eSetValueWithoutOverwrite,
+    } eNotifyAction;
+
+    // Задача - отсоединенный поток. Дескриптор пишется до запуска потока
+    BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter,
+                           UBaseType_t priority, TaskHandle_t *created_task);
+    BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                                       void *parameter, UBaseType_t priority, TaskHandle_t *created_task,
+                                       BaseType_t core_id);
+    // Удаляется только текущая задача (NULL или свой дескриптор)
+    void vTaskDelete(TaskHandle_t task);
+    void vTaskDelay(TickType_t ticks);
+    TickType_t xTaskGetTickCount(void);
+    TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+    BaseType_t xTaskGenericNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+    BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                               TickType_t ticks_to_wait);
+    uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#define xTaskNotify(task, value, action) xTaskGenericNotify(task, value, action)
+#define xTaskNotifyGive(task) xTaskGenericNotify(task, 0, eIncrement)
+
+    // Из ISR - то же, что из задачи: переключать контекст на хосте не нужно
+    static inline BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                                                BaseType_t *woken)
+    {
+        if (woken != NULL)
+        {
+            *woken = pdFALSE;
+        }
+        return xTaskGenericNotify(task, value, action);
+    }
+
+    static inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+    {
+        xTaskNotifyFromISR(task, 0, eIncrement, woken);
+    }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,28 @@
+// События кнопок espressif/button: только перечисление, кнопок на хосте нет
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        BUTTON_PRESS_DOWN = 0,
+        BUTTON_PRESS_UP,
+        BUTTON_PRESS_REPEAT,
+        BUTTON_PRESS_REPEAT_DONE,
+        BUTTON_SINGLE_CLICK,
+        BUTTON_DOUBLE_CLICK,
+        BUTTON_MULTIPLE_CLICK,
+        BUTTON_LONG_PRESS_START,
+        BUTTON_LONG_PRESS_HOLD,
+        BUTTON_LONG_PRESS_UP,
+        BUTTON_PRESS_END,
+        BUTTON_EVENT_MAX,
+        BUTTON_NONE_PRESS,
+    } button_event_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,164 @@
+// NVS в памяти: пространства имен и ключи без ограничений на размер.
+// Запись видна сразу, nvs_commit ничего не делает
+#include "nvs_flash.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>> nvs_namespace_t;
+
+struct nvs_open_handle_t
+{
+    std::string namespace_name;
+    bool writable;
+};
+
+static std::mutex nvs_lock;
+static bool nvs_initialized = false;
+static std::map<std::string, nvs_namespace_t> nvs_storage;
+static std::map<nvs_handle_t, nvs_open_handle_t> nvs_handles;
+static nvs_handle_t next_handle = 1;
+
+esp_err_t nvs_flash_init(void)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    nvs_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    nvs_storage.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    if (!nvs_initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (open_mode == NVS_READONLY && nvs_storage.find(namespace_name) == nvs_storage.end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    nvs_storage[namespace_name];
+    *out_handle = next_handle++;
+    nvs_handles[*out_handle] = {namespace_name, open_mode == NVS_READWRITE};
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    nvs_handles.erase(handle);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    return nvs_handles.count(handle) != 0 ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+// Вызывается под nvs_lock. NULL, если дескриптор не открыт (или открыт
+// только для чтения, а нужна запись)
+static nvs_namespace_t *nvs_lookup(nvs_handle_t handle, bool write, esp_err_t *err)
+{
+    auto it = nvs_handles.find(handle);
+    if (it == nvs_handles.end())
+    {
+        *err = ESP_ERR_NVS_INVALID_HANDLE;
+        return NULL;
+    }
+    if (write && !it->second.writable)
+    {
+        *err = ESP_ERR_NVS_READ_ONLY;
+        return NULL;
+    }
+    *err = ESP_OK;
+    return &nvs_storage[it->second.namespace_name];
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    esp_err_t err;
+    nvs_namespace_t *space = nvs_lookup(handle, true, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+    return space->erase(key) != 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    esp_err_t err;
+    nvs_namespace_t *space = nvs_lookup(handle, true, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+    const uint8_t *bytes = (const uint8_t *)value;
+    (*space)[key].assign(bytes, bytes + length);
+    return ESP_OK;
+}
+
+// Без буфера возвращает длину значения
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    std::lock_guard<std::mutex> guard(nvs_lock);
+    esp_err_t err;
+    nvs_namespace_t *space = nvs_lookup(handle, false, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+
+    auto it = space->find(key);
+    if (it == space->end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value == NULL)
+    {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size())
+    {
+        *length = it->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+    return nvs_get_blob(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+    return nvs_get_blob(handle, key, out_value, &length);
+}
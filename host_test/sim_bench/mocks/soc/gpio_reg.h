@@ -0,0 +1,7 @@
+// Адреса регистров вывода GPIO (ESP32-S3)
+#pragma once
+
+#define GPIO_OUT_W1TS_REG 0x60004008
+#define GPIO_OUT_W1TC_REG 0x6000400C
+#define GPIO_OUT1_W1TS_REG 0x60004014
+#define GPIO_OUT1_W1TC_REG 0x60004018
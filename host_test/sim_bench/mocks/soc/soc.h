@@ -0,0 +1,4 @@
+// Регистры периферии: запись на хосте ничего не делает
+#pragma once
+
+#define REG_WRITE(reg, value) ((void)(reg), (void)(value))
@@ -0,0 +1,4 @@
+// Возможности чипа: как у ESP32-S3
+#pragma once
+
+#define SOC_GPIO_PIN_COUNT 49
@@ -0,0 +1,58 @@
+// Конфигурация хост-сборки сценариев замеров: значения по умолчанию из
+// main/Kconfig, модель шторы вместо датчика, программный генератор шагов.
+// Ход модели укорочен, чтобы прогон укладывался в ctest
+#pragma once
+
+#define CONFIG_SHADE_COUNT 1
+
+#define CONFIG_MOTOR_PIN_1 13
+#define CONFIG_MOTOR_PIN_2 15
+#define CONFIG_MOTOR_PIN_3 12
+#define CONFIG_MOTOR_PIN_4 14
+#define CONFIG_MOTOR_ENABLE_PIN -1
+#define CONFIG_MOTOR_ENABLE_SETTLE_US 1000
+#define CONFIG_MOTOR_STEPS_PER_REVOLUTION 2048
+#define CONFIG_MOTOR_USE_HALF_STEP 1
+#define CONFIG_MOTOR_DEFAULT_SPEED 50
+#define CONFIG_MOTOR_START_SPEED_SPS 250
+#define CONFIG_MOTOR_MAX_SPEED_SPS 1250
+#define CONFIG_MOTOR_ACCELERATION 2000
+#define CONFIG_MOTOR_DISABLE_ON_STOP 1
+#define CONFIG_MOTOR_STEP_BACKEND_ESP_TIMER 1
+
+#define CONFIG_POSITION_SENSOR_ADC_PIN 4
+#define CONFIG_POSITION_SENSOR_POWER_PIN 5
+#define CONFIG_POSITION_SENSOR_ADC_UNIT 1
+#define CONFIG_POSITION_SENSOR_ADC_CHANNEL 3
+#define CONFIG_POSITION_SENSOR_ADC_ATTENUATION 3
+#define CONFIG_POSITION_SENSOR_STABILIZATION_MS 10
+#define CONFIG_POSITION_SENSOR_CACHE_MAX_AGE_MS 500
+#define CONFIG_POSITION_SENSOR_IDLE_SAMPLE_MS 5000
+#define CONFIG_POSITION_SENSOR_TRACK_PERIOD_MS 10
+
+#define CONFIG_POSITION_FILTER_MEDIAN_WINDOW 3
+#define CONFIG_POSITION_FILTER_KALMAN 1
+#define CONFIG_POSITION_FILTER_KALMAN_Q 2000
+#define CONFIG_POSITION_FILTER_KALMAN_R 16
+#define CONFIG_POSITION_FILTER_FEED_FORWARD 1
+
+#define CONFIG_CONTROLLER_POSITION_TOLERANCE 20
+#define CONFIG_CONTROLLER_MAX_CORRECTIONS 2
+#define CONFIG_CONTROLLER_AUTOCAL_SPEED 30
+#define CONFIG_CONTROLLER_AUTOCAL_STALL_COUNTS 6
+#define CONFIG_CONTROLLER_AUTOCAL_STALL_STEPS 200
+#define CONFIG_CONTROLLER_AUTOCAL_TIMEOUT_S 180
+
+#define CONFIG_PERSISTENCE_POSITION_DEBOUNCE_MS 30000
+
+#define CONFIG_SHADE_SIMULATION 1
+#define CONFIG_SHADE_SIM_TRAVEL_STEPS 4000
+#define CONFIG_SHADE_SIM_COUNTS_TOP 200
+#define CONFIG_SHADE_SIM_COUNTS_BOTTOM 3800
+#define CONFIG_SHADE_SIM_START_PERCENT 50
+#define CONFIG_SHADE_SIM_BACKLASH_STEPS 40
+#define CONFIG_SHADE_SIM_LATENCY_US 2000
+#define CONFIG_SHADE_SIM_NOISE_COUNTS 8
+#define CONFIG_SHADE_SIM_BENCH_BURST 20
+#define CONFIG_SHADE_SIM_BENCH_TIMEOUT_S 120
+#define CONFIG_SHADE_SIM_BENCH_MAX_ERROR 40
@@ -0,0 +1,310 @@
+#include "bench.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "bench";
+
+// Логарифмическая гистограмма: корзина N содержит значения [2^(N-1), 2^N) мкс
+#define BENCH_BUCKETS 24
+
+typedef struct
+{
+    uint32_t buckets[BENCH_BUCKETS];
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+} bench_histogram_t;
+
+typedef enum
+{
+    BENCH_LATENCY_BUTTON, // Кнопка -> первый шаг
+    BENCH_LATENCY_MQTT,   // MQTT -> первый шаг
+    BENCH_LATENCY_MATTER, // Matter -> первый шаг
+    BENCH_STAGE_DISPATCH, // Источник команды -> контроллер
+    BENCH_STAGE_PLAN,     // Контроллер -> motor_step()
+    BENCH_STAGE_START,    // motor_step() -> первый шаг
+    BENCH_STOP,           // Запрос остановки -> остановка
+    BENCH_STEP_JITTER,    // Опоздание шага относительно профиля
+    BENCH_METRIC_COUNT
+} bench_metric_t;
+
+static const char *const metric_names[BENCH_METRIC_COUNT] = {
+    "button->step",
+    "mqtt->step",
+    "matter->step",
+    "source->ctrl",
+    "ctrl->motor",
+    "motor->step",
+    "stop",
+    "step_jitter",
+};
+
+// Текущая трасса команды
+typedef struct
+{
+    int64_t origin_us;
+    int64_t controller_us;
+    int64_t motor_step_us;
+    int64_t stop_request_us;
+    bench_point_t origin;
+    bool origin_valid;
+    bool first_step_pending;
+} bench_trace_t;
+
+static const char *const boot_stage_names[BENCH_BOOT_COUNT] = {
+    "app_main",
+    "local",
+    "matter",
+    "mqtt",
+};
+
+// Запуск замеряется один раз и не сбрасывается bench_reset()
+static int64_t boot_times_us[BENCH_BOOT_COUNT];
+
+static bench_histogram_t histograms[BENCH_METRIC_COUNT];
+static bench_trace_t trace;
+static portMUX_TYPE bench_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_BENCHMARK_DUMP_PERIOD_S > 0
+static esp_timer_handle_t dump_timer = NULL;
+#endif
+
+// Отметки шагов приходят и из прерывания общего генератора шагов, поэтому
+// запись в гистограммы лежит в IRAM
+static void IRAM_ATTR bench_record(bench_metric_t metric, int64_t value_us)
+{
+    if (value_us < 0)
+    {
+        value_us = 0;
+    }
+    uint32_t value = value_us > UINT32_MAX ? UINT32_MAX : (uint32_t)value_us;
+
+    uint32_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= BENCH_BUCKETS)
+    {
+        bucket = BENCH_BUCKETS - 1;
+    }
+
+    bench_histogram_t *histogram = &histograms[metric];
+    histogram->buckets[bucket]++;
+    if (histogram->count == 0 || value < histogram->min_us)
+    {
+        histogram->min_us = value;
+    }
+    if (value > histogram->max_us)
+    {
+        histogram->max_us = value;
+    }
+    histogram->sum_us += value;
+    histogram->count++;
+}
+
+void IRAM_ATTR bench_mark(bench_point_t point)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&bench_lock);
+    switch (point)
+    {
+    case BENCH_POINT_BUTTON:
+    case BENCH_POINT_MQTT:
+    case BENCH_POINT_MATTER:
+        trace.origin = point;
+        trace.origin_us = now;
+        trace.origin_valid = true;
+        break;
+
+    case BENCH_POINT_CONTROLLER:
+        trace.controller_us = now;
+        if (trace.origin_valid)
+        {
+            bench_record(BENCH_STAGE_DISPATCH, now - trace.origin_us);
+        }
+        break;
+
+    case BENCH_POINT_MOTOR_STEP:
+        trace.motor_step_us = now;
+        trace.first_step_pending = true;
+        if (trace.controller_us != 0)
+        {
+            bench_record(BENCH_STAGE_PLAN, now - trace.controller_us);
+        }
+        break;
+
+    case BENCH_POINT_FIRST_STEP:
+        if (!trace.first_step_pending)
+        {
+            break;
+        }
+        trace.first_step_pending = false;
+        bench_record(BENCH_STAGE_START, now - trace.motor_step_us);
+        if (trace.origin_valid)
+        {
+            bench_metric_t metric = trace.origin == BENCH_POINT_BUTTON ? BENCH_LATENCY_BUTTON
+                                    : trace.origin == BENCH_POINT_MQTT ? BENCH_LATENCY_MQTT
+                                                                       : BENCH_LATENCY_MATTER;
+            bench_record(metric, now - trace.origin_us);
+        }
+        // Поправки контура не относятся к исходной команде
+        trace.origin_valid = false;
+        trace.controller_us = 0;
+        break;
+
+    case BENCH_POINT_STOP_REQUEST:
+        trace.stop_request_us = now;
+        break;
+
+    case BENCH_POINT_STOPPED:
+        if (trace.stop_request_us != 0)
+        {
+            bench_record(BENCH_STOP, now - trace.stop_request_us);
+            trace.stop_request_us = 0;
+        }
+        break;
+    }
+    portEXIT_CRITICAL_SAFE(&bench_lock);
+}
+
+void IRAM_ATTR bench_step_jitter(int32_t late_us)
+{
+    portENTER_CRITICAL_SAFE(&bench_lock);
+    bench_record(BENCH_STEP_JITTER, late_us < 0 ? -(int64_t)late_us : late_us);
+    portEXIT_CRITICAL_SAFE(&bench_lock);
+}
+
+void bench_boot_mark(bench_boot_stage_t stage)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bench_lock);
+    bool first = boot_times_us[stage] == 0;
+    if (first)
+    {
+        boot_times_us[stage] = now;
+    }
+    portEXIT_CRITICAL(&bench_lock);
+
+    if (first)
+    {
+        ESP_LOGI(TAG, "Boot %s at %lld us", boot_stage_names[stage], now);
+    }
+}
+
+void bench_reset(void)
+{
+    portENTER_CRITICAL(&bench_lock);
+    memset(histograms, 0, sizeof(histograms));
+    memset(&trace, 0, sizeof(trace));
+    portEXIT_CRITICAL(&bench_lock);
+}
+
+// Текстовый отчет: по строке на метрику, корзины как "верхняя_граница:число"
+size_t bench_format(char *buffer, size_t size)
+{
+    static bench_histogram_t snapshot[BENCH_METRIC_COUNT];
+    int64_t boot_snapshot[BENCH_BOOT_COUNT];
+
+    portENTER_CRITICAL(&bench_lock);
+    memcpy(snapshot, histograms, sizeof(snapshot));
+    memcpy(boot_snapshot, boot_times_us, sizeof(boot_snapshot));
+    portEXIT_CRITICAL(&bench_lock);
+
+    size_t length = 0;
+    if (boot_snapshot[BENCH_BOOT_APP_MAIN] != 0)
+    {
+        length += snprintf(buffer, size, "boot us:");
+        for (int stage = 0; stage < BENCH_BOOT_COUNT && length < size; stage++)
+        {
+            if (boot_snapshot[stage] != 0)
+            {
+                length += snprintf(buffer + length, size - length, " %s=%lld",
+                                   boot_stage_names[stage], boot_snapshot[stage]);
+            }
+        }
+        if (length < size)
+        {
+            length += snprintf(buffer + length, size - length, "\n");
+        }
+    }
+
+    for (int metric = 0; metric < BENCH_METRIC_COUNT && length < size; metric++)
+    {
+        const bench_histogram_t *histogram = &snapshot[metric];
+        if (histogram->count == 0)
+        {
+            continue;
+        }
+
+        length += snprintf(buffer + length, size - length, "%s n=%lu min=%lu avg=%lu max=%lu us:",
+                           metric_names[metric], histogram->count, histogram->min_us,
+                           (uint32_t)(histogram->sum_us / histogram->count), histogram->max_us);
+
+        for (int bucket = 0; bucket < BENCH_BUCKETS && length < size; bucket++)
+        {
+            if (histogram->buckets[bucket] != 0)
+            {
+                length += snprintf(buffer + length, size - length, " <%lu:%lu",
+                                   1UL << bucket, histogram->buckets[bucket]);
+            }
+        }
+
+        if (length < size)
+        {
+            length += snprintf(buffer + length, size - length, "\n");
+        }
+    }
+
+    return length < size ? length : size - 1;
+}
+
+void bench_dump(void)
+{
+    static char report[1024];
+
+    size_t length = bench_format(report, sizeof(report));
+    if (length == 0)
+    {
+        ESP_LOGI(TAG, "No samples");
+        return;
+    }
+
+    // Построчно, чтобы строки не обрезались буфером лога
+    char *line = report;
+    while (line != NULL && *line != '\0')
+    {
+        char *end = strchr(line, '\n');
+        if (end != NULL)
+        {
+            *end = '\0';
+        }
+        ESP_LOGI(TAG, "%s", line);
+        line = end != NULL ? end + 1 : NULL;
+    }
+}
+
+#if CONFIG_BENCHMARK_DUMP_PERIOD_S > 0
+static void bench_dump_timer_cb(void *arg)
+{
+    bench_dump();
+}
+#endif
+
+void bench_init(void)
+{
+    bench_reset();
+
+#if CONFIG_BENCHMARK_DUMP_PERIOD_S > 0
+    esp_timer_create_args_t timer_args = {
+        .callback = &bench_dump_timer_cb,
+        .name = "bench_dump"};
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &dump_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(dump_timer, (uint64_t)CONFIG_BENCHMARK_DUMP_PERIOD_S * 1000000));
+#endif
+
+    ESP_LOGI(TAG, "Benchmark enabled");
+}
@@ -0,0 +1,56 @@
+// Замеры задержек пути управления (включается CONFIG_BENCHMARK_ENABLED)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Контрольные точки пути от команды до первого шага
+    typedef enum
+    {
+        BENCH_POINT_BUTTON,       // Событие кнопки поставлено в очередь
+        BENCH_POINT_MQTT,         // Получена команда MQTT
+        BENCH_POINT_MATTER,       // Получена команда Matter
+        BENCH_POINT_CONTROLLER,   // Вход в команду движения контроллера
+        BENCH_POINT_MOTOR_STEP,   // Вызов motor_step()
+        BENCH_POINT_FIRST_STEP,   // Выдан первый шаг
+        BENCH_POINT_STOP_REQUEST, // Запрошена остановка
+        BENCH_POINT_STOPPED,      // Мотор остановлен
+    } bench_point_t;
+
+    // Этапы запуска. Время отсчитывается esp_timer от старта приложения
+    typedef enum
+    {
+        BENCH_BOOT_APP_MAIN,        // Вход в app_main()
+        BENCH_BOOT_LOCAL_READY,     // Кнопки, мотор и датчик готовы
+        BENCH_BOOT_MATTER_STARTED,  // esp_matter::start() завершен
+        BENCH_BOOT_MQTT_CONNECTED,  // Первое подключение к брокеру
+        BENCH_BOOT_COUNT
+    } bench_boot_stage_t;
+
+#ifdef CONFIG_BENCHMARK_ENABLED
+    void bench_init(void);
+    void bench_mark(bench_point_t point);
+    void bench_step_jitter(int32_t late_us);
+    void bench_boot_mark(bench_boot_stage_t stage);
+    void bench_reset(void);
+    void bench_dump(void);
+    size_t bench_format(char *buffer, size_t size);
+
+#define BENCH_MARK(point) bench_mark(point)
+#define BENCH_STEP_JITTER(late_us) bench_step_jitter(late_us)
+#define BENCH_BOOT(stage) bench_boot_mark(stage)
+#else
+#define BENCH_MARK(point) ((void)0)
+#define BENCH_STEP_JITTER(late_us) ((void)0)
+#define BENCH_BOOT(stage) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,10 +1,12 @@
 #include <iot_button.h>
 #include "button_handler.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
 #include "sdkconfig.h"
+#include "bench.h"
 
 static const char *TAG = "button_handler";
 
@@ -13,114 +15,175 @@ static void *g_user_data = NULL;
 static button_handle_t g_button_up = NULL;
 static button_handle_t g_button_down = NULL;
 static QueueHandle_t g_button_event_queue = NULL;
+static volatile uint32_t g_button_queue_peak = 0;
+
+#define BUTTON_COUNT 2
+#define BUTTON_SIMULTANEOUS_WINDOW_US (CONFIG_BUTTON_SIMULTANEOUS_WINDOW_MS * 1000)
 
 // Внутренняя структура для событий кнопок
 typedef struct
 {
     button_event_t event;
     button_id_t button_id;
+    int64_t timestamp_us;
 } button_event_msg_t;
 
-// Обработчики событий для кнопки вверх
-static void button_up_single_press_cb(void *button_handle, void *usr_data)
+// Состояние кнопок в задаче диспетчера
+typedef struct
 {
-    button_event_msg_t msg = {.event = BUTTON_SINGLE_CLICK, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
-}
+    bool pressed;
+    int64_t press_time_us;
+    bool suppressed; // Нажатие - часть одновременного, его события не передаются
+} button_track_t;
 
-static void button_up_double_press_cb(void *button_handle, void *usr_data)
-{
-    button_event_msg_t msg = {.event = BUTTON_DOUBLE_CLICK, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
-}
+static button_track_t g_track[BUTTON_COUNT] = {};
 
-static void button_up_long_press_cb(void *button_handle, void *usr_data)
+// Постановка события в очередь диспетчера. Callback iot_button вызывается
+// из задачи esp_timer, поэтому ждать место в очереди нельзя
+static void button_post_event(button_event_t event, button_id_t button_id)
 {
-    button_event_msg_t msg = {.event = BUTTON_LONG_PRESS_START, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
-}
+    BENCH_MARK(BENCH_POINT_BUTTON);
+    button_event_msg_t msg = {.event = event, .button_id = button_id, .timestamp_us = esp_timer_get_time()};
+    if (xQueueSend(g_button_event_queue, &msg, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Button event queue full");
+        return;
+    }
 
-// Обработчики событий для кнопки вниз
-static void button_down_single_press_cb(void *button_handle, void *usr_data)
-{
-    button_event_msg_t msg = {.event = BUTTON_SINGLE_CLICK, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    UBaseType_t depth = uxQueueMessagesWaiting(g_button_event_queue);
+    if (depth > g_button_queue_peak)
+    {
+        g_button_queue_peak = depth;
+    }
 }
 
-static void button_down_double_press_cb(void *button_handle, void *usr_data)
+// Один обработчик на все события: кнопка и событие передаются через usr_data
+#define BUTTON_CB_ARG(id, event) ((void *)(uintptr_t)(((id) << 8) | (event)))
+
+static void button_event_cb(void *button_handle, void *usr_data)
 {
-    button_event_msg_t msg = {.event = BUTTON_DOUBLE_CLICK, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    uintptr_t arg = (uintptr_t)usr_data;
+    button_post_event((button_event_t)(arg & 0xFF), (button_id_t)(arg >> 8));
 }
 
-static void button_down_long_press_cb(void *button_handle, void *usr_data)
+static void button_dispatch(button_event_t event, button_id_t button_id)
 {
-    button_event_msg_t msg = {.event = BUTTON_LONG_PRESS_START, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    if (g_user_callback != NULL)
+    {
+        g_user_callback(event, button_id, g_user_data);
+    }
 }
 
-// Функция обработки одновременного нажатия
-static void check_simultaneous_press_task(void *arg)
+// Одновременное нажатие определяется по меткам времени PRESS_DOWN:
+// вторая кнопка нажата не позже окна после первой
+static void button_process_event(const button_event_msg_t *msg)
 {
-    bool both_pressed = false;
-    TickType_t press_start_time = 0;
-    const TickType_t simultaneous_threshold = pdMS_TO_TICKS(100); // 100ms для одновременного нажатия
+    button_track_t *self = &g_track[msg->button_id];
+    button_track_t *other = &g_track[msg->button_id == BUTTON_ID_UP ? BUTTON_ID_DOWN : BUTTON_ID_UP];
 
-    while (true)
+    switch (msg->event)
     {
-        bool up_pressed = (iot_button_get_event(g_button_up) == BUTTON_PRESS_DOWN);
-        bool down_pressed = (iot_button_get_event(g_button_down) == BUTTON_PRESS_DOWN);
+    case BUTTON_PRESS_DOWN:
+        self->pressed = true;
+        self->press_time_us = msg->timestamp_us;
+        self->suppressed = false;
 
-        if (up_pressed && down_pressed && !both_pressed)
+        if (other->pressed && !other->suppressed &&
+            msg->timestamp_us - other->press_time_us <= BUTTON_SIMULTANEOUS_WINDOW_US)
         {
-            // Обе кнопки нажаты
-            both_pressed = true;
-            press_start_time = xTaskGetTickCount();
+            self->suppressed = true;
+            other->suppressed = true;
+            ESP_LOGD(TAG, "Simultaneous press detected");
+            button_dispatch((button_event_t)BUTTON_EVENT_SIMULTANEOUS_PRESS, msg->button_id);
         }
-        else if (!up_pressed || !down_pressed)
+        break;
+
+    case BUTTON_PRESS_UP:
+        self->pressed = false;
+        if (!self->suppressed)
         {
-            // Хотя бы одна кнопка отпущена
-            if (both_pressed)
-            {
-                TickType_t press_duration = xTaskGetTickCount() - press_start_time;
-                if (press_duration < simultaneous_threshold)
-                {
-                    // Кнопки были нажаты одновременно в течение короткого времени
-                    button_event_msg_t msg = {.event = (button_event_t)BUTTON_EVENT_SIMULTANEOUS_PRESS};
-                    xQueueSend(g_button_event_queue, &msg, 0);
-                }
-            }
-            both_pressed = false;
+            button_dispatch(msg->event, msg->button_id);
         }
+        break;
 
-        vTaskDelay(pdMS_TO_TICKS(10)); // Проверяем каждые 10ms
+    default:
+        // Клик и длинное нажатие приходят после PRESS_DOWN; для кнопок
+        // одновременного нажатия они подавляются до следующего нажатия
+        if (!self->suppressed)
+        {
+            button_dispatch(msg->event, msg->button_id);
+        }
+        break;
     }
 }
 
-void button_handler_init(void)
+static void button_handler_task(void *arg)
 {
-    ESP_LOGI(TAG, "Initializing button handler");
+    button_event_msg_t msg;
 
-    // Создаем очередь для событий кнопок
-    g_button_event_queue = xQueueCreate(10, sizeof(button_event_msg_t));
-    if (g_button_event_queue == NULL)
+    ESP_LOGI(TAG, "Button handler task started");
+
+    while (true)
     {
-        ESP_LOGE(TAG, "Failed to create button event queue");
-        return;
+        // Ожидаем события от кнопок
+        if (xQueueReceive(g_button_event_queue, &msg, portMAX_DELAY) == pdTRUE)
+        {
+            ESP_LOGD(TAG, "Button event received: %d", msg.event);
+            button_process_event(&msg);
+        }
     }
+}
 
-    // Инициализация кнопки вверх
-    button_config_t up_button_config = {
+static button_handle_t button_create(int gpio_num, button_id_t button_id)
+{
+    button_config_t config = {
         .type = BUTTON_TYPE_GPIO,
         .long_press_time = CONFIG_BUTTON_LONG_PRESS_MS,
         .short_press_time = 50,
         .gpio_button_config = {
-            .gpio_num = CONFIG_BUTTON_UP_PIN,
+            .gpio_num = gpio_num,
             .active_level = 0, // Активный низкий уровень (кнопка замыкает на GND)
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+            // Опрос кнопки останавливается в простое, нажатие будит чип
+            .enable_power_save = true,
+#endif
         },
     };
 
-    g_button_up = iot_button_create(&up_button_config);
+    button_handle_t button = iot_button_create(&config);
+    if (button == NULL)
+    {
+        return NULL;
+    }
+
+    // PRESS_DOWN / PRESS_UP нужны для одновременного нажатия и остановки удержания
+    const button_event_t events[] = {BUTTON_PRESS_DOWN, BUTTON_PRESS_UP, BUTTON_SINGLE_CLICK,
+                                     BUTTON_DOUBLE_CLICK, BUTTON_LONG_PRESS_START};
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++)
+    {
+        iot_button_register_cb(button, events[i], button_event_cb, BUTTON_CB_ARG(button_id, events[i]));
+    }
+
+    return button;
+}
+
+void button_handler_init(void)
+{
+    ESP_LOGI(TAG, "Initializing button handler");
+
+    // Создаем очередь для событий кнопок
+    g_button_event_queue = xQueueCreate(10, sizeof(button_event_msg_t));
+    if (g_button_event_queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create button event queue");
+        return;
+    }
+
+    // Диспетчер событий: работает только при наличии событий
+    xTaskCreate(button_handler_task, "button_handler", 3072, NULL, 6, NULL);
+
+    // Инициализация кнопки вверх
+    g_button_up = button_create(CONFIG_BUTTON_UP_PIN, BUTTON_ID_UP);
     if (g_button_up == NULL)
     {
         ESP_LOGE(TAG, "Failed to create up button");
@@ -128,36 +191,13 @@ void button_handler_init(void)
     }
 
     // Инициализация кнопки вниз
-    button_config_t down_button_config = {
-        .type = BUTTON_TYPE_GPIO,
-        .long_press_time = CONFIG_BUTTON_LONG_PRESS_MS,
-        .short_press_time = 50,
-        .gpio_button_config = {
-            .gpio_num = CONFIG_BUTTON_DOWN_PIN,
-            .active_level = 0, // Активный низкий уровень
-        },
-    };
-
-    g_button_down = iot_button_create(&down_button_config);
+    g_button_down = button_create(CONFIG_BUTTON_DOWN_PIN, BUTTON_ID_DOWN);
     if (g_button_down == NULL)
     {
         ESP_LOGE(TAG, "Failed to create down button");
         return;
     }
 
-    // Регистрация обработчиков для кнопки вверх
-    iot_button_register_cb(g_button_up, BUTTON_SINGLE_CLICK, button_up_single_press_cb, NULL);
-    iot_button_register_cb(g_button_up, BUTTON_DOUBLE_CLICK, button_up_double_press_cb, NULL);
-    iot_button_register_cb(g_button_up, BUTTON_LONG_PRESS_START, button_up_long_press_cb, NULL);
-
-    // Регистрация обработчиков для кнопки вниз
-    iot_button_register_cb(g_button_down, BUTTON_SINGLE_CLICK, button_down_single_press_cb, NULL);
-    iot_button_register_cb(g_button_down, BUTTON_DOUBLE_CLICK, button_down_double_press_cb, NULL);
-    iot_button_register_cb(g_button_down, BUTTON_LONG_PRESS_START, button_down_long_press_cb, NULL);
-
-    // Создаем задачу для определения одновременного нажатия
-    xTaskCreate(check_simultaneous_press_task, "simultaneous_press", 2048, NULL, 5, NULL);
-
     ESP_LOGI(TAG, "Button handler initialized successfully");
 }
 
@@ -167,24 +207,8 @@ void button_handler_set_callback(button_callback_t callback, void *user_data)
     g_user_data = user_data;
 }
 
-void button_handler_task(void *arg)
+void button_handler_get_queue_stats(uint32_t *depth, uint32_t *peak)
 {
-    button_event_msg_t msg;
-
-    ESP_LOGI(TAG, "Button handler task started");
-
-    while (true)
-    {
-        // Ожидаем события от кнопок
-        if (xQueueReceive(g_button_event_queue, &msg, portMAX_DELAY) == pdTRUE)
-        {
-            ESP_LOGD(TAG, "Button event received: %d", msg.event);
-
-            // Вызываем пользовательский callback если он установлен
-            if (g_user_callback != NULL)
-            {
-                g_user_callback(msg.event, msg.button_id, g_user_data);
-            }
-        }
-    }
+    *depth = g_button_event_queue != NULL ? uxQueueMessagesWaiting(g_button_event_queue) : 0;
+    *peak = g_button_queue_peak;
 }
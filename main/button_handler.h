@@ -35,7 +35,8 @@ extern "C"
 
     void button_handler_init(void);
     void button_handler_set_callback(button_callback_t callback, void *user_data);
-    void button_handler_task(void *arg);
+    // Текущая и наибольшая с запуска глубина очереди событий
+    void button_handler_get_queue_stats(uint32_t *depth, uint32_t *peak);
 
 #ifdef __cplusplus
 }
@@ -1,291 +1,812 @@
 #include "controller.h"
+#include "shade_config.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "sdkconfig.h"
+#include "esp_timer.h"
 #include "motor_control.h"
+#include "motion_planner.h"
+#include "persistence.h"
+#include "motion_model.h"
+#include "bench.h"
+#include "telemetry.h"
 
 static const char *TAG = "controller";
 
-// Кэш конфигурации
-static config_t g_config = {0};
+// Очередь команд. Моторами и датчиками управляет только задача контроллера,
+// остальные источники (кнопки, MQTT, Matter, события мотора) ставят сообщения
+#define CONTROLLER_QUEUE_LENGTH 16
+#define CONTROLLER_SUBMIT_TIMEOUT_MS 50
 
-// Флаги состояния
-static bool g_button_held = false;
-static calibration_step_callback_t g_calibration_callback = NULL;
+typedef enum
+{
+    CONTROLLER_MSG_COMMAND,
+    CONTROLLER_MSG_BUTTON,
+    CONTROLLER_MSG_MOTOR_DONE,
+    CONTROLLER_MSG_LIMIT,
+    CONTROLLER_MSG_AUTOCAL_TICK
+} controller_msg_kind_t;
+
+typedef struct
+{
+    controller_msg_kind_t kind;
+    uint8_t shade; // Штора сообщения, кнопки относятся ко всем шторам
+    union
+    {
+        controller_command_t command;
+        struct
+        {
+            button_event_t event;
+            button_id_t button_id;
+        } button;
+        bool completed;
+    };
+} controller_msg_t;
+
+static QueueHandle_t g_command_queue = NULL;
+static uint32_t g_queue_peak = 0;
+static TaskHandle_t g_controller_task = NULL;
+
+// Достигнутая граница, ожидающая обработки. Сообщение CONTROLLER_MSG_LIMIT
+// только будит задачу: если очередь полна, остановка не теряется и
+// выполняется перед следующим сообщением
+typedef struct
+{
+    bool pending;
+    position_limit_t limit;
+    uint32_t position;
+} controller_limit_t;
+
+static controller_limit_t g_pending_limits[SHADE_COUNT] = {};
+static portMUX_TYPE g_limit_lock = portMUX_INITIALIZER_UNLOCKED;
 
-// Задача для периодической проверки границ
-static TaskHandle_t g_boundary_check_task = NULL;
+// Автоматическая калибровка: проход вверх, затем вниз до упора. Упор -
+// мотор выдает шаги, а показания датчика не меняются. Проверка по таймеру,
+// обработка - в задаче контроллера
+#define CONTROLLER_AUTOCAL_TICK_MS 50
+
+typedef enum
+{
+    AUTOCAL_OFF,
+    AUTOCAL_SEEK_UPPER,
+    AUTOCAL_SEEK_LOWER
+} autocal_phase_t;
+
+// Состояние одной шторы. Меняется только задачей контроллера
+typedef struct
+{
+    uint8_t index;
+
+    // Кэш конфигурации
+    config_t config;
+
+    // Флаги состояния
+    bool button_held;
+    calibration_step_callback_t calibration_callback;
+
+    // Цель текущего позиционирования (замкнутый контур по потенциометру)
+    uint32_t target_position;
+    bool target_active;
+    uint8_t correction_count;
+
+    // Скорость движений к цели и срок прибытия текущей команды. Срок действует
+    // только на первое движение: поправки идут с обычной скоростью
+    uint32_t move_speed;
+    int64_t arrive_at_us;
+
+    // Начало текущего движения к цели: по нему уточняется модель хода
+    uint32_t move_start_position;
+    int32_t move_start_steps;
+
+    // Завершение текущей команды
+    controller_done_cb_t active_done_cb;
+    void *active_done_arg;
+    controller_result_t stop_result;
+    controller_result_t last_result;
+
+    // Автоматическая калибровка
+    autocal_phase_t autocal_phase;
+    esp_timer_handle_t autocal_timer;
+    int64_t autocal_deadline_us;
+    uint32_t autocal_upper_position;
+    uint32_t autocal_last_position; // Положение при последнем сдвиге
+    int32_t autocal_last_steps;     // Шаги мотора при последнем сдвиге
+
+    state_t reported_state;
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+    bool zebra_last_up; // Чередование направления смещения зебры
+#endif
+} controller_shade_t;
+
+static controller_shade_t g_shades[SHADE_COUNT] = {};
+
+// Для публичных функций: номер шторы приходит снаружи
+static controller_shade_t *controller_get(uint8_t shade)
+{
+    return &g_shades[shade < SHADE_COUNT ? shade : 0];
+}
+
+// Подписчики на смену состояния (интеграции). Регистрируются при
+// инициализации, вызываются из задачи контроллера
+#define CONTROLLER_MAX_LISTENERS 4
+
+typedef struct
+{
+    controller_state_listener_t callback;
+    void *arg;
+} controller_listener_t;
+
+static controller_listener_t g_listeners[CONTROLLER_MAX_LISTENERS] = {};
+static volatile uint8_t g_listener_count = 0;
 
 // Объявления функций
 static void controller_button_callback(button_event_t event, button_id_t button_id, void *user_data);
-static void controller_move_to_percentage(float percentage);
-static void controller_handle_zebra_offset(void);
-static bool controller_check_boundaries_and_stop(void);
+static void controller_task(void *parameter);
+static void controller_handle_zebra_offset(controller_shade_t *shade);
+static void controller_limit_callback(uint8_t shade, position_limit_t limit, uint32_t position, void *arg);
+static void controller_start_move(controller_shade_t *shade, uint32_t current_pos, uint32_t position);
+static void controller_motor_done_callback(uint8_t shade, bool completed, void *arg);
+static void controller_jog(controller_shade_t *shade, motor_direction_t direction);
+static void controller_autocal_tick_callback(void *arg);
+static void controller_autocal_finish(controller_shade_t *shade, controller_result_t result);
+
+static void controller_shade_init(controller_shade_t *shade, uint8_t index)
+{
+    shade->index = index;
+    shade->move_speed = CONFIG_MOTOR_DEFAULT_SPEED;
+    shade->stop_result = CONTROLLER_RESULT_STOPPED;
+    shade->last_result = CONTROLLER_RESULT_OK;
+    shade->reported_state = IDLE;
+
+    // Модель хода начинается с соотношения из калибровки
+    motion_model_init(shade->index, position_sensor_get_counts_per_step_q16(shade->index));
+    position_sensor_set_limit_lead_us(shade->index, motion_model_stop_lead_us(shade->index));
+
+    // Счетчик шагов мотора продолжается с последнего сохраненного положения
+    persistence_position_t saved_position;
+    if (persistence_get_position(shade->index, &saved_position))
+    {
+        motor_set_position_steps(shade->index, saved_position.motor_steps);
+    }
+
+    // Установка начального состояния
+    shade->config.state = IDLE;
+    shade->config.auto_calibrate = !position_sensor_is_calibrated(shade->index);
+
+    esp_timer_create_args_t autocal_timer_args = {
+        .callback = controller_autocal_tick_callback,
+        .arg = shade,
+        .name = "autocal_tick",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&autocal_timer_args, &shade->autocal_timer));
+
+    ESP_LOGI(TAG, "Shade %u calibrated: %s", index + 1,
+             position_sensor_is_calibrated(shade->index) ? "Yes" : "No");
+}
 
 void controller_init(void)
 {
-    ESP_LOGI(TAG, "Initializing controller");
+    ESP_LOGI(TAG, "Initializing controller, %d shade(s)", SHADE_COUNT);
+
+    // Сохраненная калибровка нужна датчику уже при инициализации
+    persistence_init();
 
     // Инициализация подсистем
     motor_control_init();
     position_sensor_init();
     button_handler_init();
 
+    for (uint8_t index = 0; index < SHADE_COUNT; index++)
+    {
+        controller_shade_init(&g_shades[index], index);
+    }
+
     // Установка callback для кнопок
     button_handler_set_callback(controller_button_callback, NULL);
 
-    // Установка начального состояния
-    g_config.state = IDLE;
-    g_config.auto_calibrate = !position_sensor_is_calibrated();
+    // Фильтр датчика предсказывает положение по скорости мотора
+    position_sensor_set_velocity_source(motor_get_velocity_sps);
+
+    // Крайние положения контролируются по каждому отсчету датчика во время движения
+    position_sensor_set_limit_callback(controller_limit_callback, NULL);
+
+    // Завершение движения мотора замыкает контур позиционирования
+    motor_set_done_callback(controller_motor_done_callback, NULL);
+
+    // Задача контроллера выше по приоритету, чем мотор и датчик
+    g_command_queue = xQueueCreate(CONTROLLER_QUEUE_LENGTH, sizeof(controller_msg_t));
+    xTaskCreate(controller_task, "controller", 4096, NULL, 8, &g_controller_task);
 
-    ESP_LOGI(TAG, "Controller initialized. Calibrated: %s",
-             position_sensor_is_calibrated() ? "Yes" : "No");
+    ESP_LOGI(TAG, "Controller initialized");
 }
 
-void controller_move_to_position(uint32_t position)
+// Уведомление источника текущей команды о результате
+static void controller_finish(controller_shade_t *shade, controller_result_t result)
 {
-    if (g_config.state == CALIBRATING)
+    shade->last_result = result;
+    TELEMETRY_RECORD(shade->index, TELEMETRY_EVENT_RESULT, result);
+
+    controller_done_cb_t callback = shade->active_done_cb;
+    void *arg = shade->active_done_arg;
+    shade->active_done_cb = NULL;
+    shade->active_done_arg = NULL;
+
+    if (callback != NULL)
     {
-        ESP_LOGW(TAG, "Cannot move to position during calibration");
-        return;
+        callback(result, arg);
     }
+}
 
-    uint32_t current_pos = position_sensor_read();
-
-    if (current_pos == position)
+// Новая команда движения вытесняет незавершенную
+static void controller_begin(controller_shade_t *shade, controller_done_cb_t done_cb, void *done_arg)
+{
+    if (shade->active_done_cb != NULL)
     {
-        ESP_LOGI(TAG, "Already at target position: %lu", position);
-        return;
+        controller_finish(shade, CONTROLLER_RESULT_SUPERSEDED);
     }
 
-    ESP_LOGI(TAG, "Moving from position %lu to %lu", current_pos, position);
+    shade->active_done_cb = done_cb;
+    shade->active_done_arg = done_arg;
+    shade->stop_result = CONTROLLER_RESULT_STOPPED;
+}
 
+static void controller_start_move(controller_shade_t *shade, uint32_t current_pos, uint32_t position)
+{
     // Определяем направление на основе текущей и целевой позиций
-    motor_direction_t direction = (position > current_pos
-                                   ? MOTOR_DIR_DOWN;
-                                   : MOTOR_DIR_UP);
+    motor_direction_t direction = (position > current_pos)
+                                      ? MOTOR_DIR_DOWN
+                                      : MOTOR_DIR_UP;
 
     // Устанавливаем направление мотора
-    motor_set_direction(direction);
+    motor_set_direction(shade->index, direction);
 
-    // Вычисляем количество шагов (упрощенный подход)
+    // Планируем движение в шагах мотора по модели хода (с учетом люфта)
     uint32_t position_diff = (position > current_pos) ? (position - current_pos) : (current_pos - position);
+    uint32_t steps = motion_model_begin_move(shade->index, direction, position_diff);
+    shade->move_start_position = current_pos;
+    shade->move_start_steps = motor_get_position_steps(shade->index);
 
-    // Устанавливаем скорость по умолчанию
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
+    // Движение к сроку: крейсерская скорость подбирается по оставшемуся
+    // времени, чтобы шторы группы пришли к цели одновременно
+    if (shade->arrive_at_us != 0)
+    {
+        int64_t remaining_us = shade->arrive_at_us - esp_timer_get_time();
+        shade->arrive_at_us = 0;
+
+        if (remaining_us > 0)
+        {
+            uint32_t interval = motion_planner_cruise_for_duration(steps, (uint64_t)remaining_us);
+            motor_set_cruise_interval_us(shade->index, interval);
+            ESP_LOGD(TAG, "Arrival in %lld ms: %lu us/step", remaining_us / 1000, interval);
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Arrival time already passed by %lld ms", -remaining_us / 1000);
+            motor_set_speed(shade->index, shade->move_speed);
+        }
+    }
+    else
+    {
+        motor_set_speed(shade->index, shade->move_speed);
+    }
+
+    ESP_LOGD(TAG, "Moving %lu steps (%lu ADC counts)", steps, position_diff);
+
+    // На время движения датчик читается в потоковом режиме
+    position_sensor_stream_start(shade->index);
 
     // Запускаем движение мотора
-    motor_step(position_diff);
+    motor_step(shade->index, steps);
 
     // Обновляем состояние
     if (direction == MOTOR_DIR_UP)
     {
-        g_config.state = MOVING_UP;
+        shade->config.state = MOVING_UP;
     }
     else
     {
-        g_config.state = MOVING_DOWN;
+        shade->config.state = MOVING_DOWN;
     }
+}
 
-    g_config.position.current_position = position;
+static void controller_do_move_to_position(controller_shade_t *shade, uint32_t position)
+{
+    BENCH_MARK(BENCH_POINT_CONTROLLER);
 
-    // Проверяем границы сразу после запуска движения
-    controller_check_boundaries_and_stop();
+    if (shade->config.state == CALIBRATING)
+    {
+        ESP_LOGW(TAG, "Cannot move to position during calibration");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
+        return;
+    }
+
+    position_sample_t sample;
+    position_sensor_get_cached(shade->index, &sample, POSITION_SENSOR_CACHE_MAX_AGE_MS);
+    uint32_t current_pos = sample.position;
+
+    if (current_pos == position)
+    {
+        ESP_LOGD(TAG, "Already at target position: %lu", position);
+        controller_finish(shade, CONTROLLER_RESULT_OK);
+        return;
+    }
+
+    ESP_LOGD(TAG, "Moving from position %lu to %lu", current_pos, position);
+
+    shade->target_position = position;
+    shade->target_active = true;
+    shade->correction_count = 0;
+    shade->config.position.current_position = position;
+
+    controller_start_move(shade, current_pos, position);
 }
 
-void controller_move_up(void)
+// Вызывается из задачи motor_control по окончании движения
+static void controller_motor_done_callback(uint8_t shade, bool completed, void *arg)
 {
-    if (g_config.state == CALIBRATING)
+    controller_msg_t msg = {};
+    msg.kind = CONTROLLER_MSG_MOTOR_DONE;
+    msg.shade = shade;
+    msg.completed = completed;
+    xQueueSend(g_command_queue, &msg, portMAX_DELAY);
+}
+
+static void controller_handle_motor_done(controller_shade_t *shade, bool completed)
+{
+    // Движение уже перезапущено следующей командой
+    if (motor_is_moving(shade->index))
     {
-        ESP_LOGW(TAG, "Cannot move up during calibration");
         return;
     }
 
-    ESP_LOGI(TAG, "Moving up");
-    motor_set_direction(MOTOR_DIR_UP);
+    if (shade->config.state == CALIBRATING)
+    {
+        position_sensor_stream_stop(shade->index);
+        controller_finish(shade, shade->stop_result);
+        return;
+    }
+
+    if (!shade->target_active || !completed)
+    {
+        position_sensor_stream_stop(shade->index);
+        shade->target_active = false;
+        shade->config.state = IDLE;
+        controller_finish(shade, shade->stop_result);
+        return;
+    }
+
+    // Сверяем результат с потенциометром по отсчету после остановки
+    position_sample_t sample;
+    position_sensor_get_cached(shade->index, &sample, 0);
+    uint32_t current_pos = sample.position;
+    uint32_t error = (current_pos > shade->target_position) ? (current_pos - shade->target_position) : (shade->target_position - current_pos);
+
+    int32_t steps_moved = motor_get_position_steps(shade->index) - shade->move_start_steps;
+    uint32_t counts_moved = (current_pos > shade->move_start_position) ? (current_pos - shade->move_start_position)
+                                                                 : (shade->move_start_position - current_pos);
+    motion_model_end_move(shade->index, counts_moved, (uint32_t)(steps_moved < 0 ? -steps_moved : steps_moved));
+
+    if (error > CONFIG_CONTROLLER_POSITION_TOLERANCE && shade->correction_count < CONFIG_CONTROLLER_MAX_CORRECTIONS)
+    {
+        shade->correction_count++;
+        ESP_LOGD(TAG, "Correction %d: position %lu, target %lu", shade->correction_count, current_pos, shade->target_position);
+        controller_start_move(shade, current_pos, shade->target_position);
+        return;
+    }
+
+    ESP_LOGD(TAG, "Target %lu reached: %lu (steps %ld)", shade->target_position, current_pos, motor_get_position_steps(shade->index));
+    position_sensor_stream_stop(shade->index);
+    shade->target_active = false;
+    shade->config.state = IDLE;
+    controller_finish(shade, error > CONFIG_CONTROLLER_POSITION_TOLERANCE ? CONTROLLER_RESULT_FAILED : CONTROLLER_RESULT_OK);
+}
+
+// Непрерывное движение до остановки. Доступно и во время калибровки:
+// шторы подводятся к крайним точкам кнопками, чтобы учесть шаги мотора
+static void controller_jog(controller_shade_t *shade, motor_direction_t direction)
+{
+    BENCH_MARK(BENCH_POINT_CONTROLLER);
+    shade->target_active = false;
+    motion_model_begin_jog(shade->index, direction);
+    motor_set_direction(shade->index, direction);
 
     // Устанавливаем скорость
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
+    motor_set_speed(shade->index, shade->move_speed);
+
+    position_sensor_stream_start(shade->index);
 
-    // Движение вверх - можно использовать большое количество шагов для непрерывного движения
-    motor_step(UINT32_MAX);
+    // Большое количество шагов для непрерывного движения
+    motor_step(shade->index, UINT32_MAX);
 
-    g_config.state = MOVING_UP;
+    if (shade->config.state != CALIBRATING)
+    {
+        shade->config.state = (direction == MOTOR_DIR_UP) ? MOVING_UP : MOVING_DOWN;
+    }
 }
 
-void controller_move_down(void)
+static void controller_do_move_up(controller_shade_t *shade)
 {
-    if (g_config.state == CALIBRATING)
+    if (shade->config.state == CALIBRATING)
     {
-        ESP_LOGW(TAG, "Cannot move down during calibration");
+        ESP_LOGW(TAG, "Cannot move up during calibration");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
         return;
     }
 
-    ESP_LOGI(TAG, "Moving down");
-    motor_set_direction(MOTOR_DIR_DOWN);
-
-    // Устанавливаем скорость
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
+    ESP_LOGD(TAG, "Moving up");
+    controller_jog(shade, MOTOR_DIR_UP);
+}
 
-    // Движение вниз - можно использовать большое количество шагов для непрерывного движения
-    motor_step(UINT32_MAX);
+static void controller_do_move_down(controller_shade_t *shade)
+{
+    if (shade->config.state == CALIBRATING)
+    {
+        ESP_LOGW(TAG, "Cannot move down during calibration");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
+        return;
+    }
 
-    g_config.state = MOVING_DOWN;
+    ESP_LOGD(TAG, "Moving down");
+    controller_jog(shade, MOTOR_DIR_DOWN);
 }
 
-void controller_stop(void)
+static void controller_do_stop(controller_shade_t *shade)
 {
-    ESP_LOGI(TAG, "Stopping motor");
+    BENCH_MARK(BENCH_POINT_STOP_REQUEST);
+    ESP_LOGD(TAG, "Stopping motor");
 
     // Проверяем, движется ли мотор
-    if (motor_is_moving())
+    if (motor_is_moving(shade->index))
     {
-        ESP_LOGI(TAG, "Motor is moving, stopping");
-        motor_stop();
+        ESP_LOGD(TAG, "Motor is moving, stopping");
+        motor_stop_smooth(shade->index);
     }
     else
     {
         ESP_LOGD(TAG, "Motor already stopped");
+        controller_finish(shade, shade->stop_result);
     }
 
-    g_config.state = IDLE;
-    g_button_held = false;
+    shade->target_active = false;
+    if (shade->config.state != CALIBRATING)
+    {
+        shade->config.state = IDLE;
+    }
+    shade->button_held = false;
 }
 
-void controller_calibrate(void)
+static void controller_do_calibrate(controller_shade_t *shade)
 {
     ESP_LOGI(TAG, "Starting calibration mode");
-    g_config.state = CALIBRATING;
-    controller_stop();
+    shade->config.state = CALIBRATING;
+    controller_do_stop(shade);
 
     // Получаем callback для описания шагов калибровки
-    g_calibration_callback = position_sensor_start_calibration();
+    shade->calibration_callback = position_sensor_start_calibration(shade->index);
+
+    // Калибровка начинается с верхнего положения
+    if (shade->calibration_callback)
+    {
+        const char *description = shade->calibration_callback(CALIBRATION_STEP_UPPER);
+        ESP_LOGI(TAG, "Calibration step %d: %s", CALIBRATION_STEP_UPPER, description);
+    }
+}
+
+// Таймер проверки упора, вызывается из задачи esp_timer
+static void controller_autocal_tick_callback(void *arg)
+{
+    controller_msg_t msg = {};
+    msg.kind = CONTROLLER_MSG_AUTOCAL_TICK;
+    msg.shade = ((const controller_shade_t *)arg)->index;
+    xQueueSend(g_command_queue, &msg, 0);
+}
+
+// Непрерывный ход к упору на скорости калибровки
+static void controller_autocal_seek(controller_shade_t *shade, autocal_phase_t phase)
+{
+    motor_direction_t direction = (phase == AUTOCAL_SEEK_UPPER) ? MOTOR_DIR_UP : MOTOR_DIR_DOWN;
+
+    position_sample_t sample;
+    position_sensor_get_cached(shade->index, &sample, POSITION_SENSOR_MAX_AGE_ANY);
+    shade->autocal_phase = phase;
+    shade->autocal_last_position = sample.position;
+    shade->autocal_last_steps = motor_get_position_steps(shade->index);
+
+    ESP_LOGI(TAG, "Auto calibration: seeking %s end stop", phase == AUTOCAL_SEEK_UPPER ? "upper" : "lower");
+    motion_model_begin_jog(shade->index, direction);
+    motor_set_direction(shade->index, direction);
+    motor_set_speed(shade->index, CONFIG_CONTROLLER_AUTOCAL_SPEED);
+    position_sensor_stream_start(shade->index);
+    motor_step(shade->index, UINT32_MAX);
+}
+
+static void controller_autocal_finish(controller_shade_t *shade, controller_result_t result)
+{
+    esp_timer_stop(shade->autocal_timer);
+    shade->autocal_phase = AUTOCAL_OFF;
+
+    // Упор - штатное завершение, уведомление об остановке результат не меняет
+    shade->stop_result = result;
+    motor_stop(shade->index);
+    position_sensor_stream_stop(shade->index);
+
+    if (result != CONTROLLER_RESULT_OK)
+    {
+        position_sensor_cancel_calibration(shade->index);
+    }
+
+    shade->config.state = IDLE;
+    shade->calibration_callback = NULL;
+    controller_finish(shade, result);
+}
+
+static void controller_do_auto_calibrate(controller_shade_t *shade)
+{
+    ESP_LOGI(TAG, "Starting auto calibration");
+    shade->config.state = CALIBRATING;
+    shade->target_active = false;
+    if (motor_is_moving(shade->index))
+    {
+        motor_stop(shade->index);
+    }
+
+    shade->calibration_callback = position_sensor_start_calibration(shade->index);
+    shade->autocal_deadline_us = esp_timer_get_time() + (int64_t)CONFIG_CONTROLLER_AUTOCAL_TIMEOUT_S * 1000000;
+    esp_timer_stop(shade->autocal_timer);
+    esp_timer_start_periodic(shade->autocal_timer, CONTROLLER_AUTOCAL_TICK_MS * 1000);
+
+    controller_autocal_seek(shade, AUTOCAL_SEEK_UPPER);
+}
+
+// Упор найден: точка и шаги - по последнему сдвигу показаний, шаги,
+// выданные в упор, мотор пропустил
+static void controller_autocal_end_stop(controller_shade_t *shade)
+{
+    uint32_t position = shade->autocal_last_position;
+    int32_t steps = shade->autocal_last_steps;
+
+    shade->stop_result = CONTROLLER_RESULT_OK;
+    motor_stop(shade->index);
+    motor_set_position_steps(shade->index, steps);
+
+    if (shade->autocal_phase == AUTOCAL_SEEK_UPPER)
+    {
+        ESP_LOGI(TAG, "Auto calibration: upper end at %lu (steps %ld)", position, steps);
+        shade->autocal_upper_position = position;
+        position_sensor_save_calibration_step(shade->index, position, steps);
+        position_sensor_next_calibration_step(shade->index);
+        controller_autocal_seek(shade, AUTOCAL_SEEK_LOWER);
+        return;
+    }
 
-    if (g_calibration_callback)
+    ESP_LOGI(TAG, "Auto calibration: lower end at %lu (steps %ld)", position, steps);
+    if (position <= shade->autocal_upper_position + CONFIG_CONTROLLER_AUTOCAL_STALL_COUNTS)
     {
-        calibration_step_t current_step = position_sensor_next_calibration_step();
-        const char *description = g_calibration_callback(current_step);
-        ESP_LOGI(TAG, "Calibration step %d: %s", current_step, description);
+        // Калибровка требует роста показаний сверху вниз
+        ESP_LOGE(TAG, "Auto calibration failed: no travel or reversed sensor (%lu -> %lu)",
+                 shade->autocal_upper_position, position);
+        controller_autocal_finish(shade, CONTROLLER_RESULT_FAILED);
+        return;
+    }
+
+    position_sensor_save_calibration_step(shade->index, position, steps);
+    if (position_sensor_next_calibration_step(shade->index) == CALIBRATION_STEP_ZEBRA_OFFSET)
+    {
+        // Смещение зебры проходом не определяется: остается прежнее
+        position_sensor_save_calibration_step(shade->index, position_sensor_get_zebra_offset(shade->index), steps);
+        position_sensor_next_calibration_step(shade->index);
     }
+
+    ESP_LOGI(TAG, "Auto calibration completed");
+    motion_model_reset(shade->index, position_sensor_get_counts_per_step_q16(shade->index));
+    position_sensor_set_limit_lead_us(shade->index, 0);
+    controller_autocal_finish(shade, CONTROLLER_RESULT_OK);
 }
 
-void controller_goto_top(void)
+static void controller_handle_autocal_tick(controller_shade_t *shade)
 {
-    if (position_sensor_is_calibrated())
+    if (shade->autocal_phase == AUTOCAL_OFF)
+    {
+        return;
+    }
+
+    if (esp_timer_get_time() > shade->autocal_deadline_us)
+    {
+        ESP_LOGE(TAG, "Auto calibration timed out");
+        controller_autocal_finish(shade, CONTROLLER_RESULT_FAILED);
+        return;
+    }
+
+    position_sample_t sample;
+    if (!position_sensor_get_cached(shade->index, &sample, POSITION_SENSOR_MAX_AGE_ANY))
+    {
+        return;
+    }
+
+    int32_t steps = motor_get_position_steps(shade->index);
+    uint32_t moved = (sample.position > shade->autocal_last_position) ? sample.position - shade->autocal_last_position
+                                                                 : shade->autocal_last_position - sample.position;
+    if (moved > CONFIG_CONTROLLER_AUTOCAL_STALL_COUNTS)
+    {
+        shade->autocal_last_position = sample.position;
+        shade->autocal_last_steps = steps;
+        return;
+    }
+
+    int32_t idle_steps = steps - shade->autocal_last_steps;
+    if (idle_steps < 0)
+    {
+        idle_steps = -idle_steps;
+    }
+    if (idle_steps >= CONFIG_CONTROLLER_AUTOCAL_STALL_STEPS)
+    {
+        controller_autocal_end_stop(shade);
+    }
+}
+
+static void controller_do_goto_top(controller_shade_t *shade)
+{
+    if (position_sensor_is_calibrated(shade->index))
     {
         // Получаем реальную минимальную позицию из position_sensor
-        uint32_t min_pos = position_sensor_get_min_position();
-        ESP_LOGI(TAG, "Moving to top position: %lu", min_pos);
-        controller_move_to_position(min_pos);
+        uint32_t min_pos = position_sensor_get_min_position(shade->index);
+        ESP_LOGD(TAG, "Moving to top position: %lu", min_pos);
+        controller_do_move_to_position(shade, min_pos);
     }
     else
     {
         ESP_LOGW(TAG, "Not calibrated, cannot goto top");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
     }
 }
 
-void controller_goto_bottom(void)
+static void controller_do_goto_bottom(controller_shade_t *shade)
 {
-    if (position_sensor_is_calibrated())
+    if (position_sensor_is_calibrated(shade->index))
     {
         // Получаем реальную максимальную позицию из position_sensor
-        uint32_t max_pos = position_sensor_get_max_position();
-        ESP_LOGI(TAG, "Moving to bottom position: %lu", max_pos);
-        controller_move_to_position(max_pos);
+        uint32_t max_pos = position_sensor_get_max_position(shade->index);
+        ESP_LOGD(TAG, "Moving to bottom position: %lu", max_pos);
+        controller_do_move_to_position(shade, max_pos);
     }
     else
     {
         ESP_LOGW(TAG, "Not calibrated, cannot goto bottom");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
     }
 }
 
-state_t controller_get_state(void)
+state_t controller_get_state(uint8_t shade)
 {
-    return g_config.state;
+    return controller_get(shade)->config.state;
 }
 
-bool controller_is_moving(void)
+bool controller_is_moving(uint8_t shade)
 {
-    return motor_is_moving();
+    return motor_is_moving(shade);
 }
 
-void controller_set_position_percentage(float percentage)
+// Положение для интеграций: последний отсчет без обращения к ADC
+float controller_get_position_percentage(uint8_t shade)
+{
+    position_sample_t sample;
+    if (!position_sensor_is_calibrated(shade) || !position_sensor_get_cached(shade, &sample, POSITION_SENSOR_MAX_AGE_ANY))
+    {
+        return 0.0f;
+    }
+
+    return position_sensor_to_percentage(shade, sample.position);
+}
+
+static void controller_do_set_position_percentage(controller_shade_t *shade, float percentage)
 {
     if (percentage < 0.0f)
         percentage = 0.0f;
     if (percentage > 100.0f)
         percentage = 100.0f;
 
-    if (position_sensor_is_calibrated())
+    if (position_sensor_is_calibrated(shade->index))
     {
-        uint32_t current_pos = position_sensor_read();
-        float current_percentage = position_sensor_get_percentage();
-
         // Получаем реальные границы из position_sensor
-        uint32_t min_pos = position_sensor_get_min_position();
-        uint32_t max_pos = position_sensor_get_max_position();
+        uint32_t min_pos = position_sensor_get_min_position(shade->index);
+        uint32_t max_pos = position_sensor_get_max_position(shade->index);
         uint32_t range = max_pos - min_pos;
         uint32_t target_position = min_pos + (uint32_t)(range * percentage / 100.0f);
 
-        ESP_LOGI(TAG, "Setting position %.1f%% (ADC: %lu, range: %lu-%lu)",
+        ESP_LOGD(TAG, "Setting position %.1f%% (ADC: %lu, range: %lu-%lu)",
                  percentage, target_position, min_pos, max_pos);
 
-        controller_move_to_position(target_position);
+        controller_do_move_to_position(shade, target_position);
     }
     else
     {
         ESP_LOGW(TAG, "Not calibrated, cannot set position percentage");
+        controller_finish(shade, CONTROLLER_RESULT_REJECTED);
     }
 }
 
+// Вызывается диспетчером кнопок, обработка - в задаче контроллера
 static void controller_button_callback(button_event_t event, button_id_t button_id, void *user_data)
 {
-    ESP_LOGI(TAG, "Button event: %d, button_id: %d", event, button_id);
+    controller_msg_t msg = {};
+    msg.kind = CONTROLLER_MSG_BUTTON;
+    msg.button.event = event;
+    msg.button.button_id = button_id;
+    if (xQueueSend(g_command_queue, &msg, pdMS_TO_TICKS(CONTROLLER_SUBMIT_TIMEOUT_MS)) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue full, button event %d dropped", event);
+    }
+}
+
+// Кнопки управляют всеми шторами: событие обрабатывается для каждой
+static void controller_handle_button(controller_shade_t *shade, button_event_t event, button_id_t button_id)
+{
+    ESP_LOGD(TAG, "Shade %u button event: %d, button_id: %d", shade->index + 1, event, button_id);
+    TELEMETRY_SET_SOURCE(shade->index, CONTROLLER_SOURCE_BUTTON);
+    TELEMETRY_RECORD(shade->index, TELEMETRY_EVENT_BUTTON, ((uint32_t)button_id << 8) | (uint32_t)event);
+
+    // Любое нажатие прерывает автоматическую калибровку
+    if (shade->autocal_phase != AUTOCAL_OFF)
+    {
+        if (event != BUTTON_PRESS_UP)
+        {
+            ESP_LOGI(TAG, "Auto calibration cancelled by button");
+            controller_autocal_finish(shade, CONTROLLER_RESULT_STOPPED);
+        }
+        return;
+    }
+
+    // Нажатие кнопки перехватывает управление у удаленной команды
+    if (event != BUTTON_PRESS_UP)
+    {
+        controller_begin(shade, NULL, NULL);
+    }
 
     switch (event)
     {
     case BUTTON_EVENT_SIMULTANEOUS_PRESS:
-        if (g_config.state == CALIBRATING)
+        if (shade->config.state == CALIBRATING)
         {
             // Выход из режима калибровки
             ESP_LOGI(TAG, "Exiting calibration mode");
-            g_config.state = IDLE;
-            g_calibration_callback = NULL;
-            controller_stop();
+            shade->config.state = IDLE;
+            shade->calibration_callback = NULL;
+            controller_do_stop(shade);
         }
         else
         {
             // Вход в режим калибровки
-            controller_calibrate();
+            controller_do_calibrate(shade);
         }
         break;
 
     case BUTTON_SINGLE_CLICK:
-        if (g_config.state == CALIBRATING && g_calibration_callback)
+        if (shade->config.state == CALIBRATING && shade->calibration_callback)
         {
             // Сохраняем текущую позицию для шага калибровки
-            uint32_t current_position = position_sensor_read();
-            position_sensor_save_calibration_step(current_position);
+            position_sample_t sample;
+            position_sensor_get_cached(shade->index, &sample, 0);
+            position_sensor_save_calibration_step(shade->index, sample.position, motor_get_position_steps(shade->index));
 
             // Переходим к следующему шагу
-            calibration_step_t next_step = position_sensor_next_calibration_step();
+            calibration_step_t next_step = position_sensor_next_calibration_step(shade->index);
 
             if (next_step == CALIBRATION_STEP_COMPLETE)
             {
-                // Калибровка завершена
+                // Калибровка завершена, модель хода строится заново
                 ESP_LOGI(TAG, "Calibration completed");
-                g_config.state = IDLE;
-                g_calibration_callback = NULL;
-                controller_stop();
+                motion_model_reset(shade->index, position_sensor_get_counts_per_step_q16(shade->index));
+                position_sensor_set_limit_lead_us(shade->index, 0);
+                shade->config.state = IDLE;
+                shade->calibration_callback = NULL;
+                controller_do_stop(shade);
             }
             else
             {
                 // Показываем описание следующего шага
-                const char *description = g_calibration_callback(next_step);
+                const char *description = shade->calibration_callback(next_step);
                 ESP_LOGI(TAG, "Calibration step %d: %s", next_step, description);
             }
         }
@@ -294,64 +815,60 @@ static void controller_button_callback(button_event_t event, button_id_t button_
             // Одиночное нажатие - переход в крайнее положение
             if (button_id == BUTTON_ID_UP)
             {
-                controller_goto_top();
+                controller_do_goto_top(shade);
             }
             else if (button_id == BUTTON_ID_DOWN)
             {
-                controller_goto_bottom();
+                controller_do_goto_bottom(shade);
             }
         }
         break;
 
     case BUTTON_DOUBLE_CLICK:
-        if (g_config.state != CALIBRATING)
+        if (shade->config.state == CALIBRATING)
+        {
+            // В режиме калибровки двойное нажатие запускает проход до упоров
+            controller_do_auto_calibrate(shade);
+        }
+        else
         {
             // Двойное нажатие
 #ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-            if (position_sensor_is_calibrated())
+            if (position_sensor_is_calibrated(shade->index))
             {
-                uint32_t zebra_offset = position_sensor_get_zebra_offset();
+                uint32_t zebra_offset = position_sensor_get_zebra_offset(shade->index);
                 if (zebra_offset > 0)
                 {
                     // Выполнение откалиброванного смещения для штор зебра
-                    controller_handle_zebra_offset();
+                    controller_handle_zebra_offset(shade);
                     break;
                 }
             }
 #else
             // Переход на позицию 50%
-            controller_set_position_percentage(50.0f);
+            controller_do_set_position_percentage(shade, 50.0f);
 #endif
         }
         break;
 
     case BUTTON_LONG_PRESS_START:
-        if (g_config.state != CALIBRATING)
+        // Движение пока кнопка удерживается (в калибровке - для подвода к крайним точкам)
+        shade->button_held = true;
+        if (button_id == BUTTON_ID_UP)
         {
-            // Движение пока кнопка удерживается
-            g_button_held = true;
-            if (button_id == BUTTON_ID_UP)
-            {
-                controller_move_up();
-            }
-            else if (button_id == BUTTON_ID_DOWN)
-            {
-                controller_move_down();
-            }
-
-            // Запускаем задачу проверки границ
-            if (g_boundary_check_task == NULL)
-            {
-                xTaskCreate(boundary_check_task, "boundary_check", 2048, NULL, 10, &g_boundary_check_task);
-            }
+            controller_jog(shade, MOTOR_DIR_UP);
+        }
+        else if (button_id == BUTTON_ID_DOWN)
+        {
+            controller_jog(shade, MOTOR_DIR_DOWN);
         }
         break;
 
     case BUTTON_PRESS_UP:
-        if (g_button_held)
+        if (shade->button_held)
         {
             // Остановка движения при отпускании кнопки
-            controller_stop();
+            controller_do_stop(shade);
         }
         break;
 
@@ -361,15 +878,15 @@ static void controller_button_callback(button_event_t event, button_id_t button_
 }
 
 #ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-static void controller_handle_zebra_offset(void)
+static void controller_handle_zebra_offset(controller_shade_t *shade)
 {
-    if (!position_sensor_is_calibrated())
+    if (!position_sensor_is_calibrated(shade->index))
     {
         ESP_LOGW(TAG, "Not calibrated, cannot handle zebra offset");
         return;
     }
 
-    uint32_t zebra_offset = position_sensor_get_zebra_offset();
+    uint32_t zebra_offset = position_sensor_get_zebra_offset(shade->index);
     if (zebra_offset == 0)
     {
         ESP_LOGW(TAG, "Zebra offset not configured");
@@ -377,12 +894,14 @@ static void controller_handle_zebra_offset(void)
     }
 
     // Вычисляем целевую позицию с учетом смещения
-    uint32_t current_pos = position_sensor_read();
+    position_sample_t sample;
+    position_sensor_get_cached(shade->index, &sample, POSITION_SENSOR_CACHE_MAX_AGE_MS);
+    uint32_t current_pos = sample.position;
     uint32_t target_pos;
 
     // Получаем границы из position_sensor (нужно будет добавить функции)
-    uint32_t min_pos = 0;    // position_sensor_get_min_position();
-    uint32_t max_pos = 4095; // position_sensor_get_max_position();
+    uint32_t min_pos = 0;    // position_sensor_get_min_position(shade->index);
+    uint32_t max_pos = 4095; // position_sensor_get_max_position(shade->index);
 
     // Определяем direction на основе текущей позиции
     if (current_pos <= min_pos + zebra_offset)
@@ -398,8 +917,7 @@ static void controller_handle_zebra_offset(void)
     else
     {
         // Чередуем направление движения
-        static bool last_direction_up = false;
-        if (last_direction_up)
+        if (shade->zebra_last_up)
         {
             target_pos = current_pos - zebra_offset;
         }
@@ -407,7 +925,7 @@ static void controller_handle_zebra_offset(void)
         {
             target_pos = current_pos + zebra_offset;
         }
-        last_direction_up = !last_direction_up;
+        shade->zebra_last_up = !shade->zebra_last_up;
     }
 
     // Ограничиваем целевую позицию в пределах диапазона
@@ -421,47 +939,405 @@ static void controller_handle_zebra_offset(void)
     }
 
     ESP_LOGI(TAG, "Moving to zebra offset position: %lu", target_pos);
-    controller_move_to_position(target_pos);
+    controller_do_move_to_position(shade, target_pos);
 }
 #endif
 
-// Функция проверки границ и автоматической остановки
-static bool controller_check_boundaries_and_stop(void)
+// Вызывается из задачи выборки датчика, пока мотор движется
+static void controller_limit_callback(uint8_t shade, position_limit_t limit, uint32_t position, void *arg)
+{
+    // В калибровке крайние точки только определяются
+    if (shade >= SHADE_COUNT || g_shades[shade].config.state == CALIBRATING)
+    {
+        return;
+    }
+
+    // Останавливаемся только при движении к границе, от нее можно отъехать
+    int32_t velocity = motor_get_velocity_sps(shade);
+    bool toward = (limit == POSITION_LIMIT_LOWER) ? (velocity > 0) : (velocity < 0);
+    if (!toward)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&g_limit_lock);
+    g_pending_limits[shade].pending = true;
+    g_pending_limits[shade].limit = limit;
+    g_pending_limits[shade].position = position;
+    taskEXIT_CRITICAL(&g_limit_lock);
+
+    // Остановка на границе обгоняет остальные команды в очереди. При полной
+    // очереди задача и так проснется и заберет границу из g_pending_limits
+    controller_msg_t msg = {};
+    msg.kind = CONTROLLER_MSG_LIMIT;
+    msg.shade = shade;
+    xQueueSendToFront(g_command_queue, &msg, 0);
+}
+
+static void controller_handle_limit(controller_shade_t *shade, position_limit_t limit, uint32_t position)
+{
+    if (!motor_is_moving(shade->index) || shade->config.state == CALIBRATING)
+    {
+        return;
+    }
+
+    ESP_LOGD(TAG, "%s boundary reached: %lu", limit == POSITION_LIMIT_LOWER ? "Lower" : "Upper", position);
+    TELEMETRY_RECORD(shade->index, TELEMETRY_EVENT_LIMIT, limit);
+    int32_t velocity_sps = motor_get_velocity_sps(shade->index);
+
+    // На границе останавливаемся сразу, без торможения. Крайнее положение -
+    // штатное завершение движения вверх или вниз
+    shade->stop_result = CONTROLLER_RESULT_OK;
+    motor_stop(shade->index);
+
+    // Перелет за границу после остановки уточняет упреждение остановки
+    position_sample_t sample;
+    if (position_sensor_get_cached(shade->index, &sample, 0))
+    {
+        int32_t overshoot = (limit == POSITION_LIMIT_LOWER)
+                                ? (int32_t)sample.position - (int32_t)position_sensor_get_max_position(shade->index)
+                                : (int32_t)position_sensor_get_min_position(shade->index) - (int32_t)sample.position;
+        uint32_t speed_sps = velocity_sps < 0 ? -velocity_sps : velocity_sps;
+        motor_direction_t direction = velocity_sps < 0 ? MOTOR_DIR_UP : MOTOR_DIR_DOWN;
+        uint32_t velocity_cps = (uint32_t)(((uint64_t)speed_sps * motion_model_counts_per_step_q16(shade->index, direction)) >> 16);
+        motion_model_observe_stop(shade->index, overshoot, velocity_cps);
+        position_sensor_set_limit_lead_us(shade->index, motion_model_stop_lead_us(shade->index));
+    }
+
+    controller_do_stop(shade);
+}
+
+static void controller_handle_pending_limits(void)
 {
-    if (!position_sensor_is_calibrated())
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
     {
-        return false; // Нет калибровки - не проверяем границы
+        taskENTER_CRITICAL(&g_limit_lock);
+        controller_limit_t limit = g_pending_limits[i];
+        g_pending_limits[i].pending = false;
+        taskEXIT_CRITICAL(&g_limit_lock);
+
+        if (limit.pending)
+        {
+            controller_handle_limit(&g_shades[i], limit.limit, limit.position);
+        }
     }
+}
 
-    uint32_t current_pos = position_sensor_read();
-    uint32_t min_pos = position_sensor_get_min_position();
-    uint32_t max_pos = position_sensor_get_max_position();
+// Команды, задающие цель движения: из нескольких подряд выполняется последняя
+static bool controller_is_target_command(const controller_msg_t *msg)
+{
+    if (msg->kind != CONTROLLER_MSG_COMMAND)
+    {
+        return false;
+    }
 
-    // Проверяем достижение границы
-    if (current_pos <= min_pos || current_pos >= max_pos)
+    switch (msg->command.type)
     {
-        ESP_LOGI(TAG, "%s boundary reached: %lu", current_pos >= max_pos ? "Lower" : "current_pos >= max_pos", current_pos);
-        controller_stop();
+    case CONTROLLER_CMD_MOVE_TO:
+    case CONTROLLER_CMD_SET_PERCENTAGE:
+    case CONTROLLER_CMD_GOTO_TOP:
+    case CONTROLLER_CMD_GOTO_BOTTOM:
         return true;
+    default:
+        return false;
+    }
+}
+
+static void controller_handle_command(controller_shade_t *shade, const controller_command_t *command)
+{
+    if (command->speed != 0 && command->type != CONTROLLER_CMD_STOP && command->type != CONTROLLER_CMD_CALIBRATE)
+    {
+        shade->move_speed = command->speed;
+    }
+
+    TELEMETRY_SET_SOURCE(shade->index, command->source);
+    TELEMETRY_RECORD(shade->index, TELEMETRY_EVENT_COMMAND, command->type);
+
+    // Срок учитывается при запуске движения внутри обработки команды
+    shade->arrive_at_us = command->arrive_at_us;
+
+    switch (command->type)
+    {
+    case CONTROLLER_CMD_MOVE_TO:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_move_to_position(shade, command->position);
+        break;
+
+    case CONTROLLER_CMD_SET_PERCENTAGE:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_set_position_percentage(shade, command->percentage);
+        break;
+
+    case CONTROLLER_CMD_GOTO_TOP:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_goto_top(shade);
+        break;
+
+    case CONTROLLER_CMD_GOTO_BOTTOM:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_goto_bottom(shade);
+        break;
+
+    case CONTROLLER_CMD_MOVE_UP:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_move_up(shade);
+        break;
+
+    case CONTROLLER_CMD_MOVE_DOWN:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_move_down(shade);
+        break;
+
+    case CONTROLLER_CMD_STOP:
+        if (shade->autocal_phase != AUTOCAL_OFF)
+        {
+            controller_autocal_finish(shade, CONTROLLER_RESULT_STOPPED);
+        }
+        // Прерванная команда завершается по остановке мотора
+        controller_do_stop(shade);
+        if (command->done_cb != NULL)
+        {
+            command->done_cb(CONTROLLER_RESULT_OK, command->done_arg);
+        }
+        break;
+
+    case CONTROLLER_CMD_CALIBRATE:
+        if (shade->autocal_phase != AUTOCAL_OFF)
+        {
+            controller_autocal_finish(shade, CONTROLLER_RESULT_SUPERSEDED);
+        }
+        controller_do_calibrate(shade);
+        if (command->done_cb != NULL)
+        {
+            command->done_cb(CONTROLLER_RESULT_OK, command->done_arg);
+        }
+        break;
+
+    case CONTROLLER_CMD_AUTO_CALIBRATE:
+        controller_begin(shade, command->done_cb, command->done_arg);
+        controller_do_auto_calibrate(shade);
+        break;
     }
 
-    return false;
+    shade->arrive_at_us = 0;
 }
 
-// Периодическая задача для проверки границ при удержании кнопки
-static void boundary_check_task(void *parameter)
+// Сообщает интеграциям о смене состояния. Вызывается после каждого
+// сообщения, поэтому промежуточные состояния внутри одной команды не видны
+static void controller_report_state(controller_shade_t *shade)
 {
-    while (g_button_held && motor_is_moving())
+    if (shade->config.state == shade->reported_state)
     {
-        // Проверяем границы каждые 100 мс
-        if (controller_check_boundaries_and_stop())
+        return;
+    }
+    shade->reported_state = shade->config.state;
+    TELEMETRY_SET_STATE(shade->index, shade->config.state);
+    TELEMETRY_RECORD(shade->index, TELEMETRY_EVENT_STATE, shade->config.state);
+
+    // Положение после остановки сохраняется с задержкой, без записи на каждое движение
+    if (shade->config.state == IDLE)
+    {
+        position_sample_t sample;
+        if (position_sensor_get_cached(shade->index, &sample, POSITION_SENSOR_MAX_AGE_ANY))
         {
-            break; // Вышли из цикла, так как достигли границы
+            persistence_update_position(shade->index, sample.position, motor_get_position_steps(shade->index));
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
 
-    // Задача завершается, когда кнопка отпущена или мотор остановлен
-    g_boundary_check_task = NULL;
-    vTaskDelete(NULL);
+    float position = controller_get_position_percentage(shade->index);
+    for (uint8_t i = 0; i < g_listener_count; i++)
+    {
+        g_listeners[i].callback(shade->index, shade->config.state, position, g_listeners[i].arg);
+    }
+}
+
+static void controller_task(void *parameter)
+{
+    controller_msg_t msg;
+    controller_msg_t next;
+
+    ESP_LOGI(TAG, "Controller task started");
+
+    while (true)
+    {
+        if (xQueueReceive(g_command_queue, &msg, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        // Глубина очереди вместе с полученным сообщением
+        uint32_t depth = uxQueueMessagesWaiting(g_command_queue) + 1;
+        if (depth > g_queue_peak)
+        {
+            g_queue_peak = depth;
+        }
+
+        // Границы - раньше любого сообщения, в том числе вставшего в очередь
+        // до CONTROLLER_MSG_LIMIT
+        controller_handle_pending_limits();
+
+        // Серия целей (например, от слайдера) сводится к последней,
+        // если все они адресованы одной шторе
+        while (controller_is_target_command(&msg) &&
+               xQueuePeek(g_command_queue, &next, 0) == pdTRUE &&
+               controller_is_target_command(&next) &&
+               next.command.shade == msg.command.shade)
+        {
+            xQueueReceive(g_command_queue, &next, 0);
+            if (msg.command.done_cb != NULL)
+            {
+                msg.command.done_cb(CONTROLLER_RESULT_SUPERSEDED, msg.command.done_arg);
+            }
+            msg = next;
+        }
+
+        switch (msg.kind)
+        {
+        case CONTROLLER_MSG_COMMAND:
+            controller_handle_command(&g_shades[msg.command.shade], &msg.command);
+            break;
+        case CONTROLLER_MSG_BUTTON:
+            // Кнопки общие: действуют на все шторы сразу
+            for (uint8_t i = 0; i < SHADE_COUNT; i++)
+            {
+                controller_handle_button(&g_shades[i], msg.button.event, msg.button.button_id);
+            }
+            break;
+        case CONTROLLER_MSG_MOTOR_DONE:
+            controller_handle_motor_done(&g_shades[msg.shade], msg.completed);
+            break;
+        case CONTROLLER_MSG_LIMIT:
+            // Граница уже обработана выше
+            break;
+        case CONTROLLER_MSG_AUTOCAL_TICK:
+            controller_handle_autocal_tick(&g_shades[msg.shade]);
+            break;
+        }
+
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            controller_report_state(&g_shades[i]);
+        }
+    }
+}
+
+esp_err_t controller_submit(const controller_command_t *command)
+{
+    if (g_command_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (command->shade >= SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    controller_msg_t msg = {};
+    msg.kind = CONTROLLER_MSG_COMMAND;
+    msg.shade = command->shade;
+    msg.command = *command;
+
+    if (xQueueSend(g_command_queue, &msg, pdMS_TO_TICKS(CONTROLLER_SUBMIT_TIMEOUT_MS)) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue full, command %d dropped", command->type);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+static void controller_submit_simple(uint8_t shade, controller_command_type_t type)
+{
+    controller_command_t command = {};
+    command.type = type;
+    command.shade = shade;
+    controller_submit(&command);
+}
+
+void controller_move_to_position(uint8_t shade, uint32_t position)
+{
+    controller_command_t command = {};
+    command.type = CONTROLLER_CMD_MOVE_TO;
+    command.shade = shade;
+    command.position = position;
+    controller_submit(&command);
+}
+
+void controller_set_position_percentage(uint8_t shade, float percentage)
+{
+    controller_command_t command = {};
+    command.type = CONTROLLER_CMD_SET_PERCENTAGE;
+    command.shade = shade;
+    command.percentage = percentage;
+    controller_submit(&command);
+}
+
+void controller_move_up(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_MOVE_UP);
+}
+
+void controller_move_down(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_MOVE_DOWN);
+}
+
+void controller_stop(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_STOP);
+}
+
+void controller_calibrate(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_CALIBRATE);
+}
+
+void controller_auto_calibrate(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_AUTO_CALIBRATE);
+}
+
+void controller_goto_top(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_GOTO_TOP);
+}
+
+void controller_goto_bottom(uint8_t shade)
+{
+    controller_submit_simple(shade, CONTROLLER_CMD_GOTO_BOTTOM);
+}
+
+void controller_get_queue_stats(uint32_t *depth, uint32_t *peak)
+{
+    *depth = g_command_queue != NULL ? uxQueueMessagesWaiting(g_command_queue) : 0;
+    *peak = g_queue_peak;
+}
+
+esp_err_t controller_add_state_listener(controller_state_listener_t listener, void *arg)
+{
+    if (listener == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (g_listener_count >= CONTROLLER_MAX_LISTENERS)
+    {
+        ESP_LOGE(TAG, "Too many state listeners");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Запись считается действительной только после увеличения счетчика
+    g_listeners[g_listener_count].callback = listener;
+    g_listeners[g_listener_count].arg = arg;
+    g_listener_count = g_listener_count + 1;
+    return ESP_OK;
+}
+
+void controller_get_status(uint8_t shade_index, controller_status_t *status)
+{
+    const controller_shade_t *shade = controller_get(shade_index);
+    status->state = shade->config.state;
+    status->target_active = shade->target_active;
+    status->target_position = shade->target_position;
+    status->last_result = shade->last_result;
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "esp_err.h"
 #include "position_sensor.h"
 #include "motor_control.h"
 #include "button_handler.h"
@@ -28,17 +29,89 @@ extern "C"
         bool auto_calibrate;
     } config_t;
 
+    // Результат выполнения команды
+    typedef enum
+    {
+        CONTROLLER_RESULT_OK,         // Цель достигнута / команда выполнена
+        CONTROLLER_RESULT_SUPERSEDED, // Заменена более новой командой
+        CONTROLLER_RESULT_STOPPED,    // Движение остановлено до достижения цели
+        CONTROLLER_RESULT_REJECTED,   // Команда недоступна в текущем состоянии
+        CONTROLLER_RESULT_FAILED      // Цель не достигнута после поправок
+    } controller_result_t;
+
+    // Вызывается из задачи контроллера
+    typedef void (*controller_done_cb_t)(controller_result_t result, void *arg);
+
+    typedef enum
+    {
+        CONTROLLER_CMD_MOVE_TO,
+        CONTROLLER_CMD_SET_PERCENTAGE,
+        CONTROLLER_CMD_GOTO_TOP,
+        CONTROLLER_CMD_GOTO_BOTTOM,
+        CONTROLLER_CMD_MOVE_UP,
+        CONTROLLER_CMD_MOVE_DOWN,
+        CONTROLLER_CMD_STOP,
+        CONTROLLER_CMD_CALIBRATE,
+        CONTROLLER_CMD_AUTO_CALIBRATE // Проход до упоров, результат - через done_cb
+    } controller_command_type_t;
+
+    // Источник команды, записывается в журнал движения
+    typedef enum
+    {
+        CONTROLLER_SOURCE_LOCAL, // Внутренние вызовы и API без указания источника
+        CONTROLLER_SOURCE_BUTTON,
+        CONTROLLER_SOURCE_MQTT,
+        CONTROLLER_SOURCE_MATTER
+    } controller_source_t;
+
+    typedef struct
+    {
+        controller_command_type_t type;
+        union
+        {
+            uint32_t position; // CONTROLLER_CMD_MOVE_TO, отсчеты ADC
+            float percentage;  // CONTROLLER_CMD_SET_PERCENTAGE
+        };
+        uint8_t speed;                // Скорость 1-100 для этого и следующих движений, 0 - текущая
+        int64_t arrive_at_us;         // Прибытие к цели по esp_timer_get_time(), 0 - без срока
+        controller_done_cb_t done_cb; // Может быть NULL
+        void *done_arg;
+        controller_source_t source;
+        uint8_t shade; // Номер шторы с нуля, см. shade_config.h
+    } controller_command_t;
+
+    typedef struct
+    {
+        state_t state;
+        bool target_active;
+        uint32_t target_position;
+        controller_result_t last_result;
+    } controller_status_t;
+
+    // Смена состояния шторы, position - проценты от верхнего положения.
+    // Вызывается из задачи контроллера, обработчик не должен блокироваться
+    typedef void (*controller_state_listener_t)(uint8_t shade, state_t state, float position, void *arg);
+
+    // Контроллер ведет все шторы из shade_config.h одной задачей.
+    // Функции с параметром shade принимают номер шторы с нуля
+
     void controller_init(void);
-    void controller_move_to_position(uint32_t position);
-    void controller_move_up(void);
-    void controller_move_down(void);
-    void controller_stop(void);
-    void controller_calibrate(void);
-    void controller_goto_top(void);
-    void controller_goto_bottom(void);
-    void controller_set_position_percentage(float percentage);
-    state_t controller_get_state(void);
-    bool controller_is_moving(void);
+    esp_err_t controller_add_state_listener(controller_state_listener_t listener, void *arg);
+    esp_err_t controller_submit(const controller_command_t *command);
+    void controller_get_status(uint8_t shade, controller_status_t *status);
+    void controller_get_queue_stats(uint32_t *depth, uint32_t *peak);
+    void controller_move_to_position(uint8_t shade, uint32_t position);
+    void controller_move_up(uint8_t shade);
+    void controller_move_down(uint8_t shade);
+    void controller_stop(uint8_t shade);
+    void controller_calibrate(uint8_t shade);
+    void controller_auto_calibrate(uint8_t shade);
+    void controller_goto_top(uint8_t shade);
+    void controller_goto_bottom(uint8_t shade);
+    void controller_set_position_percentage(uint8_t shade, float percentage);
+    state_t controller_get_state(uint8_t shade);
+    bool controller_is_moving(uint8_t shade);
+    float controller_get_position_percentage(uint8_t shade);
 
 #ifdef __cplusplus
 }
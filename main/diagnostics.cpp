@@ -0,0 +1,237 @@
+#include "diagnostics.h"
+#include "button_handler.h"
+#include "controller.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "diagnostics";
+
+#define DIAGNOSTICS_PERIOD_MS (CONFIG_DIAGNOSTICS_PERIOD_S * 1000)
+#define DIAGNOSTICS_MAX_CALLBACKS 2
+#define DIAGNOSTICS_REPORT_SIZE 2048
+
+// Счетчики времени задач на прошлом замере: загрузка считается по разнице
+typedef struct
+{
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} diagnostics_task_time_t;
+
+typedef struct
+{
+    diagnostics_report_cb_t callback;
+    void *arg;
+} diagnostics_callback_t;
+
+// Размер растет вместе с числом задач: задача без записи выглядела бы
+// новой и показала бы все свое время работы как загрузку за период
+static diagnostics_task_time_t *previous_times = NULL;
+static uint32_t previous_capacity = 0;
+static uint32_t previous_count = 0;
+static configRUN_TIME_COUNTER_TYPE previous_total = 0;
+
+static diagnostics_callback_t callbacks[DIAGNOSTICS_MAX_CALLBACKS] = {};
+static volatile uint8_t callback_count = 0;
+
+static char report[DIAGNOSTICS_REPORT_SIZE];
+
+static configRUN_TIME_COUNTER_TYPE diagnostics_previous_time(TaskHandle_t handle)
+{
+    for (uint32_t i = 0; i < previous_count; i++)
+    {
+        if (previous_times[i].handle == handle)
+        {
+            return previous_times[i].run_time;
+        }
+    }
+    return 0;
+}
+
+// Загрузка в десятых долях процента от времени всех ядер
+static uint32_t diagnostics_load_x10(configRUN_TIME_COUNTER_TYPE busy, configRUN_TIME_COUNTER_TYPE total)
+{
+    uint64_t capacity = (uint64_t)total * portNUM_PROCESSORS;
+    if (capacity == 0)
+    {
+        return 0;
+    }
+    uint64_t load = (uint64_t)busy * 1000 / capacity;
+    return load > 1000 ? 1000 : (uint32_t)load;
+}
+
+static size_t diagnostics_format_heap(char *buffer, size_t size, const char *name, uint32_t caps)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+
+    size_t free_bytes = info.total_free_bytes;
+    uint32_t fragmentation = free_bytes == 0 ? 0 : 100 - (uint32_t)((uint64_t)info.largest_free_block * 100 / free_bytes);
+
+    return snprintf(buffer, size, "\"%s\":{\"free\":%u,\"min_free\":%u,\"largest\":%u,\"frag\":%lu},",
+                    name, (unsigned)free_bytes, (unsigned)info.minimum_free_bytes,
+                    (unsigned)info.largest_free_block, fragmentation);
+}
+
+// Ссылки на удаленные задачи отбрасываются вместе со старым снимком
+static void diagnostics_store_times(const TaskStatus_t *tasks, UBaseType_t count, configRUN_TIME_COUNTER_TYPE total)
+{
+    if (count > previous_capacity)
+    {
+        diagnostics_task_time_t *history =
+            (diagnostics_task_time_t *)realloc(previous_times, count * sizeof(diagnostics_task_time_t));
+        if (history == NULL)
+        {
+            ESP_LOGE(TAG, "No memory for task history");
+            previous_count = 0;
+            previous_total = total;
+            return;
+        }
+        previous_times = history;
+        previous_capacity = count;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        previous_times[i].handle = tasks[i].xHandle;
+        previous_times[i].run_time = tasks[i].ulRunTimeCounter;
+    }
+    previous_count = count;
+    previous_total = total;
+}
+
+// Снимок задач, памяти и очередей в report. Возвращает длину отчета
+static size_t diagnostics_collect(void)
+{
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = (TaskStatus_t *)malloc(capacity * sizeof(TaskStatus_t));
+    if (tasks == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for task snapshot");
+        return 0;
+    }
+
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, capacity, &total);
+    configRUN_TIME_COUNTER_TYPE total_delta = total - previous_total;
+
+    configRUN_TIME_COUNTER_TYPE idle_delta = 0;
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0)
+        {
+            idle_delta += tasks[i].ulRunTimeCounter - diagnostics_previous_time(tasks[i].xHandle);
+        }
+    }
+    uint32_t idle_x10 = diagnostics_load_x10(idle_delta, total_delta);
+    uint32_t cpu_x10 = 1000 - idle_x10;
+
+    uint32_t button_depth = 0;
+    uint32_t button_peak = 0;
+    uint32_t controller_depth = 0;
+    uint32_t controller_peak = 0;
+    button_handler_get_queue_stats(&button_depth, &button_peak);
+    controller_get_queue_stats(&controller_depth, &controller_peak);
+
+    size_t length = snprintf(report, sizeof(report), "{\"uptime_s\":%lld,\"cpu\":%lu.%lu,",
+                             esp_timer_get_time() / 1000000, cpu_x10 / 10, cpu_x10 % 10);
+    length += diagnostics_format_heap(report + length, sizeof(report) - length, "heap", MALLOC_CAP_INTERNAL);
+#ifdef CONFIG_SPIRAM
+    if (length < sizeof(report))
+    {
+        length += diagnostics_format_heap(report + length, sizeof(report) - length, "psram", MALLOC_CAP_SPIRAM);
+    }
+#endif
+    if (length < sizeof(report))
+    {
+        length += snprintf(report + length, sizeof(report) - length,
+                           "\"queues\":{\"button\":{\"depth\":%lu,\"peak\":%lu},"
+                           "\"controller\":{\"depth\":%lu,\"peak\":%lu}},\"tasks\":{",
+                           button_depth, button_peak, controller_depth, controller_peak);
+    }
+
+    // Свободный стек - минимум за все время работы задачи, в байтах
+    for (UBaseType_t i = 0; i < count && length < sizeof(report); i++)
+    {
+        configRUN_TIME_COUNTER_TYPE busy = tasks[i].ulRunTimeCounter - diagnostics_previous_time(tasks[i].xHandle);
+        uint32_t load_x10 = diagnostics_load_x10(busy, total_delta);
+        length += snprintf(report + length, sizeof(report) - length,
+                           "%s\"%s\":{\"prio\":%u,\"stack_free\":%lu,\"cpu\":%lu.%lu}",
+                           i == 0 ? "" : ",", tasks[i].pcTaskName, (unsigned)tasks[i].uxCurrentPriority,
+                           (uint32_t)tasks[i].usStackHighWaterMark * sizeof(StackType_t),
+                           load_x10 / 10, load_x10 % 10);
+    }
+    if (length < sizeof(report))
+    {
+        length += snprintf(report + length, sizeof(report) - length, "}}");
+    }
+
+    // Снимок обновляется и без отчета: иначе следующий период сложился бы
+    // с пропущенным
+    diagnostics_store_times(tasks, count, total);
+    free(tasks);
+
+    if (length >= sizeof(report))
+    {
+        ESP_LOGW(TAG, "Diagnostics report truncated");
+        return 0;
+    }
+
+    ESP_LOGI(TAG, "CPU %lu.%lu%%, heap free %u (min %u), %u tasks",
+             cpu_x10 / 10, cpu_x10 % 10,
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), (unsigned)count);
+    ESP_LOGD(TAG, "%s", report);
+
+    return length;
+}
+
+static void diagnostics_task(void *parameter)
+{
+    // Первый замер только запоминает счетчики времени
+    diagnostics_collect();
+
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(DIAGNOSTICS_PERIOD_MS));
+
+        size_t length = diagnostics_collect();
+        if (length == 0)
+        {
+            continue;
+        }
+
+        for (uint8_t i = 0; i < callback_count; i++)
+        {
+            callbacks[i].callback(report, length, callbacks[i].arg);
+        }
+    }
+}
+
+void diagnostics_init(void)
+{
+    xTaskCreate(diagnostics_task, "diagnostics", CONFIG_DIAGNOSTICS_TASK_STACK_SIZE, NULL, 1, NULL);
+    ESP_LOGI(TAG, "Diagnostics every %d s", CONFIG_DIAGNOSTICS_PERIOD_S);
+}
+
+esp_err_t diagnostics_add_report_callback(diagnostics_report_cb_t callback, void *arg)
+{
+    if (callback == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (callback_count >= DIAGNOSTICS_MAX_CALLBACKS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    callbacks[callback_count].callback = callback;
+    callbacks[callback_count].arg = arg;
+    callback_count++;
+    return ESP_OK;
+}
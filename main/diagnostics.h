@@ -0,0 +1,24 @@
+// Диагностика задач и памяти (включается CONFIG_DIAGNOSTICS_ENABLED)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Готовый отчет (JSON). Вызывается из задачи диагностики раз в период
+    typedef void (*diagnostics_report_cb_t)(const char *report, size_t length, void *arg);
+
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+    void diagnostics_init(void);
+    esp_err_t diagnostics_add_report_callback(diagnostics_report_cb_t callback, void *arg);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
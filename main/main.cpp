@@ -2,6 +2,15 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "bench.h"
+#include "power_manager.h"
+#include "diagnostics.h"
+#if defined(CONFIG_ENABLE_MATTER_INTEGRATION) || defined(CONFIG_ENABLE_MQTT_INTEGRATION)
+#include "esp_netif.h"
+#include "esp_event.h"
+#endif
 
 // Условные включения интеграций
 #ifdef CONFIG_ENABLE_MATTER_INTEGRATION
@@ -12,8 +21,48 @@
 #include "mqtt_integration.h"
 #endif
 
+#ifdef CONFIG_SHADE_SIMULATION
+#include "sim_bench.h"
+#endif
+
+#ifdef CONFIG_SHADE_SCHEDULER
+#include "scheduler.h"
+#endif
+
+#ifdef CONFIG_SHADE_OTA
+#include "ota_update.h"
+#endif
+
+// Стек задач запуска сетевых стеков (инициализация Matter/MQTT)
+#define NETWORK_INIT_STACK_SIZE 6144
+#define NETWORK_INIT_PRIORITY 3
+
+#ifdef CONFIG_ENABLE_MATTER_INTEGRATION
+static void matter_init_task(void *parameter)
+{
+    ESP_LOGI("main", "Initializing Matter integration...");
+    matter_integration_init();
+    vTaskDelete(NULL);
+}
+#endif
+
+#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
+static void mqtt_init_task(void *parameter)
+{
+    ESP_LOGI("main", "Initializing MQTT integration...");
+    esp_err_t err = mqtt_integration_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE("main", "Failed to initialize MQTT integration: %s", esp_err_to_name(err));
+    }
+    vTaskDelete(NULL);
+}
+#endif
+
 extern "C" void app_main()
 {
+    BENCH_BOOT(BENCH_BOOT_APP_MAIN);
+
     // Инициализация NVS (обязательно для хранения ключей Matter и других данных)
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -23,27 +72,61 @@ extern "C" void app_main()
     }
     ESP_ERROR_CHECK(err);
 
-    // Инициализация компонентов
+    // Режим энергосбережения настраивается до создания задач и драйверов
+    power_manager_init();
+
+#ifdef CONFIG_BENCHMARK_ENABLED
+    bench_init();
+#endif
+
+    // Локальное управление (кнопки, мотор, положение из NVS) запускается
+    // первым и не ждет сети: нажатие сразу после включения не теряется
     ESP_LOGI("main", "Initializing controller...");
     controller_init();
+    BENCH_BOOT(BENCH_BOOT_LOCAL_READY);
 
-#ifdef CONFIG_ENABLE_MATTER_INTEGRATION
-    // Инициализация Matter интеграции
-    ESP_LOGI("main", "Initializing Matter integration...");
-    matter_integration_init();
+#ifdef CONFIG_SHADE_OTA
+    // Новая прошивка ждет подтверждения: локальное управление уже работает,
+    // осталось дождаться сети
+    ota_update_init();
 #endif
 
-#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
-    // Инициализация MQTT интеграции
-    ESP_LOGI("main", "Initializing MQTT integration...");
-    mqtt_integration_init();
+#ifdef CONFIG_SHADE_SCHEDULER
+    // Расписание не зависит от сети: часы могли пережить перезагрузку
+    scheduler_init();
 #endif
 
-    ESP_LOGI("main", "Shade ready");
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+    diagnostics_init();
+#endif
 
-    while (1)
+#ifdef CONFIG_SHADE_SIMULATION
+    // Сценарии замеров на модели шторы
+    sim_bench_init();
+#endif
+
+#if defined(CONFIG_ENABLE_MATTER_INTEGRATION) || defined(CONFIG_ENABLE_MQTT_INTEGRATION)
+    // Стек TCP/IP и цикл событий создаются до задач интеграций: иначе MQTT
+    // и синхронизация времени могут обогнать сетевой стек. Matter допускает
+    // уже созданный цикл событий
+    ESP_ERROR_CHECK(esp_netif_init());
+    err = esp_event_loop_create_default();
+    if (err != ESP_ERR_INVALID_STATE)
     {
-        // Интеграции обрабатываются через события
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        ESP_ERROR_CHECK(err);
     }
+#endif
+
+    // Сетевые стеки поднимаются в фоновых задачах
+#ifdef CONFIG_ENABLE_MATTER_INTEGRATION
+    xTaskCreate(matter_init_task, "matter_init", NETWORK_INIT_STACK_SIZE, NULL, NETWORK_INIT_PRIORITY, NULL);
+#endif
+
+#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
+    xTaskCreate(mqtt_init_task, "mqtt_init", NETWORK_INIT_STACK_SIZE, NULL, NETWORK_INIT_PRIORITY, NULL);
+#endif
+
+    // Интеграции обрабатываются через события и собственные задачи,
+    // поэтому app_main завершается и не мешает автоматическому сну
+    ESP_LOGI("main", "Shade ready");
 }
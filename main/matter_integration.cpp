@@ -1,4 +1,15 @@
 #include "matter_integration.h"
+#include "bench.h"
+#include "shade_config.h"
+#include "time_sync.h"
+#include "ota_update.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_matter.h>
+#include <app/clusters/window-covering-server/window-covering-delegate.h>
+#include <app/clusters/window-covering-server/window-covering-server.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD
 #include <platform/ESP32/OpenthreadLauncher.h>
@@ -7,14 +18,340 @@
 using namespace esp_matter;
 using namespace esp_matter::cluster;
 using namespace esp_matter::endpoint;
+using namespace chip::app::Clusters;
+
+static const char *TAG = "matter_integration";
+
+#define MATTER_REPORT_INTERVAL_MS CONFIG_MATTER_REPORT_INTERVAL_MS
+#define MATTER_REPORT_MIN_DELTA CONFIG_MATTER_REPORT_MIN_DELTA
+
+// OperationalStatus: биты 0-1 - общее состояние, биты 2-3 - подъем
+#define MATTER_OP_STATUS_STOPPED 0x00
+#define MATTER_OP_STATUS_OPENING 0x05
+#define MATTER_OP_STATUS_CLOSING 0x0A
+
+// Эндпоинт Window Covering одной шторы
+typedef struct
+{
+    uint16_t endpoint_id;
+
+    // Последнее состояние контроллера, передается задаче отчетов
+    state_t pending_state;
+    uint16_t pending_position;
+    bool pending_changed;
+} matter_shade_t;
+
+static matter_shade_t shades[SHADE_COUNT] = {};
+static TaskHandle_t report_task_handle = NULL;
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Внешние обработчики команд. Если не заданы, команды уходят в контроллер
+static void (*position_callback)(uint8_t shade, uint8_t position) = NULL;
+static void (*move_callback)(uint8_t shade, bool direction) = NULL;
+
+// Matter: 0 - полностью открыто (верх), 10000 - закрыто (низ).
+// Проценты контроллера отсчитываются от верхнего положения так же
+static uint16_t matter_percent_to_100ths(float percentage)
+{
+    if (percentage <= 0.0f)
+    {
+        return 0;
+    }
+    if (percentage >= 100.0f)
+    {
+        return 10000;
+    }
+    return (uint16_t)(percentage * 100.0f + 0.5f);
+}
+
+// Команды кластера Window Covering. Сервер CHIP сам записывает
+// TargetPositionLiftPercent100ths (UpOrOpen - 0, DownOrClose - 10000,
+// GoToLiftPercentage - заданное) и вызывает делегат в задаче Matter
+class ShadeWindowCoveringDelegate : public WindowCovering::Delegate
+{
+public:
+    uint8_t shade = 0;
+
+    CHIP_ERROR HandleMovement(WindowCovering::WindowCoveringType type) override
+    {
+        if (type != WindowCovering::WindowCoveringType::Lift)
+        {
+            return CHIP_ERROR_NOT_IMPLEMENTED;
+        }
+
+        BENCH_MARK(BENCH_POINT_MATTER);
+
+        chip::app::DataModel::Nullable<chip::Percent100ths> target;
+        if (WindowCovering::Attributes::TargetPositionLiftPercent100ths::Get(mEndpoint, target) !=
+                chip::Protocols::InteractionModel::Status::Success ||
+            target.IsNull())
+        {
+            return CHIP_ERROR_INVALID_ARGUMENT;
+        }
+
+        ESP_LOGI(TAG, "Matter lift target %u, shade %u", target.Value(), shade + 1);
+
+        if (move_callback != NULL && (target.Value() == 0 || target.Value() == 10000))
+        {
+            move_callback(shade, target.Value() == 0);
+            return CHIP_NO_ERROR;
+        }
+
+        if (position_callback != NULL)
+        {
+            position_callback(shade, (uint8_t)((target.Value() + 50) / 100));
+            return CHIP_NO_ERROR;
+        }
+
+        controller_command_t command = {};
+        command.source = CONTROLLER_SOURCE_MATTER;
+        command.shade = shade;
+        if (target.Value() == 0)
+        {
+            command.type = CONTROLLER_CMD_GOTO_TOP;
+        }
+        else if (target.Value() == 10000)
+        {
+            command.type = CONTROLLER_CMD_GOTO_BOTTOM;
+        }
+        else
+        {
+            command.type = CONTROLLER_CMD_SET_PERCENTAGE;
+            command.percentage = target.Value() / 100.0f;
+        }
+
+        return controller_submit(&command) == ESP_OK ? CHIP_NO_ERROR : CHIP_ERROR_BUSY;
+    }
+
+    CHIP_ERROR HandleStopMotion() override
+    {
+        BENCH_MARK(BENCH_POINT_MATTER);
+        ESP_LOGI(TAG, "Matter stop motion, shade %u", shade + 1);
+
+        controller_command_t command = {};
+        command.source = CONTROLLER_SOURCE_MATTER;
+        command.shade = shade;
+        command.type = CONTROLLER_CMD_STOP;
+        return controller_submit(&command) == ESP_OK ? CHIP_NO_ERROR : CHIP_ERROR_BUSY;
+    }
+};
+
+static ShadeWindowCoveringDelegate window_covering_delegates[SHADE_COUNT];
+
+static uint8_t matter_operational_status(uint8_t shade, state_t state)
+{
+    switch (state)
+    {
+    case MOVING_UP:
+        return MATTER_OP_STATUS_OPENING;
+    case MOVING_DOWN:
+        return MATTER_OP_STATUS_CLOSING;
+    case CALIBRATING:
+    {
+        // Калибровка сама выбирает направление, его видно по скорости мотора
+        int32_t velocity = motor_get_velocity_sps(shade);
+        if (velocity < 0)
+        {
+            return MATTER_OP_STATUS_OPENING;
+        }
+        if (velocity > 0)
+        {
+            return MATTER_OP_STATUS_CLOSING;
+        }
+        return MATTER_OP_STATUS_STOPPED;
+    }
+    default:
+        return MATTER_OP_STATUS_STOPPED;
+    }
+}
+
+static void matter_report_attributes(uint16_t endpoint_id, uint16_t position, uint8_t op_status, bool final)
+{
+    lock::ScopedChipStackLock lock(portMAX_DELAY);
+
+    esp_matter_attr_val_t val = esp_matter_nullable_uint16(position);
+    attribute::update(endpoint_id, WindowCovering::Id,
+                      WindowCovering::Attributes::CurrentPositionLiftPercent100ths::Id, &val);
+    val = esp_matter_nullable_uint8((uint8_t)((position + 50) / 100));
+    attribute::update(endpoint_id, WindowCovering::Id,
+                      WindowCovering::Attributes::CurrentPositionLiftPercentage::Id, &val);
+
+    if (final)
+    {
+        // После остановки цель совпадает с фактическим положением,
+        // иначе контроллеры будут считать движение незавершенным
+        val = esp_matter_nullable_uint16(position);
+        attribute::update(endpoint_id, WindowCovering::Id,
+                          WindowCovering::Attributes::TargetPositionLiftPercent100ths::Id, &val);
+    }
+
+    // Статус пишется после положения: сервер CHIP пересчитывает его при смене положения
+    val = esp_matter_bitmap8(op_status);
+    attribute::update(endpoint_id, WindowCovering::Id,
+                      WindowCovering::Attributes::OperationalStatus::Id, &val);
+}
+
+// Отчеты о положении. Во время движения задача просыпается раз в
+// MATTER_REPORT_INTERVAL_MS на каждую штору и берет последний отсчет
+// датчика из кэша, поэтому в сеть уходит не больше одного отчета за
+// интервал. Смена состояния (старт, смена направления, остановка)
+// сообщается сразу
+static void matter_report_task(void *parameter)
+{
+    uint16_t reported_position[SHADE_COUNT];
+    uint8_t reported_status[SHADE_COUNT];
+    int64_t last_report_us[SHADE_COUNT] = {};
+
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        reported_position[i] = UINT16_MAX;
+        reported_status[i] = 0xFF;
+    }
+
+    while (true)
+    {
+        // Ожидание до ближайшего отчета среди движущихся штор
+        TickType_t wait = portMAX_DELAY;
+        int64_t now = esp_timer_get_time();
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            portENTER_CRITICAL(&report_lock);
+            state_t state = shades[i].pending_state;
+            portEXIT_CRITICAL(&report_lock);
+            if (matter_operational_status(i, state) == MATTER_OP_STATUS_STOPPED)
+            {
+                continue;
+            }
+
+            int64_t elapsed_ms = (now - last_report_us[i]) / 1000;
+            TickType_t shade_wait = elapsed_ms >= MATTER_REPORT_INTERVAL_MS ? 0 : pdMS_TO_TICKS(MATTER_REPORT_INTERVAL_MS - elapsed_ms);
+            if (shade_wait < wait)
+            {
+                wait = shade_wait;
+            }
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+        now = esp_timer_get_time();
+
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            matter_shade_t *shade = &shades[i];
+            portENTER_CRITICAL(&report_lock);
+            state_t state = shade->pending_state;
+            uint16_t position = shade->pending_position;
+            bool changed = shade->pending_changed;
+            shade->pending_changed = false;
+            portEXIT_CRITICAL(&report_lock);
+            uint8_t status = matter_operational_status(i, state);
+
+            bool final = (status == MATTER_OP_STATUS_STOPPED);
+            if (!final)
+            {
+                if (!changed && (now - last_report_us[i]) / 1000 < MATTER_REPORT_INTERVAL_MS)
+                {
+                    continue;
+                }
+
+                // Промежуточное положение - из кэша датчика, без обращения к ADC
+                position = matter_percent_to_100ths(controller_get_position_percentage(i));
+            }
+            else if (!changed)
+            {
+                continue;
+            }
+
+            bool status_changed = (status != reported_status[i]);
+            uint16_t delta = position > reported_position[i] ? position - reported_position[i] : reported_position[i] - position;
+            bool position_changed = final ? (delta != 0) : (delta >= MATTER_REPORT_MIN_DELTA);
+
+            if (!status_changed && !position_changed)
+            {
+                if (!changed)
+                {
+                    last_report_us[i] = now;
+                }
+                continue;
+            }
+
+            matter_report_attributes(shade->endpoint_id, position, status, final);
+            reported_position[i] = position;
+            reported_status[i] = status;
+            last_report_us[i] = now;
+
+            ESP_LOGD(TAG, "Reported lift %u, status 0x%02x, shade %u", position, status, i + 1);
+        }
+    }
+}
+
+void matter_integration_update_state(uint8_t shade, state_t state, float position)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&report_lock);
+    shades[shade].pending_state = state;
+    shades[shade].pending_position = matter_percent_to_100ths(position);
+    shades[shade].pending_changed = true;
+    portEXIT_CRITICAL(&report_lock);
+
+    if (report_task_handle != NULL)
+    {
+        xTaskNotifyGive(report_task_handle);
+    }
+}
+
+static void matter_state_listener(uint8_t shade, state_t state, float position, void *arg)
+{
+    matter_integration_update_state(shade, state, position);
+}
+
+void matter_integration_set_position_callback(void (*callback)(uint8_t shade, uint8_t position))
+{
+    position_callback = callback;
+}
+
+void matter_integration_set_move_callback(void (*callback)(uint8_t shade, bool direction))
+{
+    move_callback = callback;
+}
 
 void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
 {
+    bool network_ready = false;
+    switch (event->Type)
+    {
+    case chip::DeviceLayer::DeviceEventType::kInterfaceIpAddressChanged:
+        network_ready = true;
+        break;
+    case chip::DeviceLayer::DeviceEventType::kThreadConnectivityChange:
+        network_ready = event->ThreadConnectivityChange.Result == chip::DeviceLayer::kConnectivity_Established;
+        break;
+    default:
+        break;
+    }
+
+    if (!network_ready)
+    {
+        return;
+    }
+
+#ifdef CONFIG_SHADE_TIME_SYNC
+    // С появлением сети ставим часы по SNTP для расписания
+    time_sync_start();
+#endif
+#ifdef CONFIG_SHADE_OTA
+    // Сеть есть: новая прошивка, полученная через OTA Requestor, подтверждается
+    ota_update_network_ready();
+#endif
 }
 
 esp_err_t app_attribute_update_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
                                   uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
 {
+    // Команды движения обрабатывает делегат Window Covering
     return ESP_OK;
 }
 
@@ -40,12 +377,50 @@ void matter_integration_init(void)
     node::config_t node_config;
     node_t *node = node::create(&node_config, app_attribute_update_cb, app_identification_cb);
 
-    // 2. Создание эндпоинта Window Covering (ID для штор)
-    window_covering_device::config_t window_config;
-    // Тип 0x08 = Rollershade (рулонная штора)
-    // window_config.window_covering.device_type_id = 0x08;
-    endpoint_t *endpoint = window_covering_device::create(node, &window_config, ENDPOINT_FLAG_NONE, NULL);
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+    // Свободная память и стеки задач для контроллера Matter. Данные берет
+    // платформа (DiagnosticDataProvider), метрики задач - при USE_TRACE_FACILITY
+    endpoint_t *root_endpoint = endpoint::get(node, 0);
+    cluster::software_diagnostics::config_t diagnostics_config;
+    cluster::software_diagnostics::create(root_endpoint, &diagnostics_config, CLUSTER_FLAG_SERVER,
+                                          cluster::software_diagnostics::feature::watermarks::get_id());
+#endif
+
+    // 2. Эндпоинт Window Covering на каждую штору
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        window_covering_delegates[i].shade = i;
+
+        window_covering_device::config_t window_config;
+        window_config.window_covering.type = (uint8_t)WindowCovering::Type::kRollerShade;
+        window_config.window_covering.delegate = &window_covering_delegates[i];
+        endpoint_t *endpoint = window_covering_device::create(node, &window_config, ENDPOINT_FLAG_NONE, NULL);
+        shades[i].endpoint_id = endpoint::get_id(endpoint);
+
+        // Подъем с известным положением: GoToLiftPercentage и CurrentPositionLiftPercent100ths
+        uint16_t position = matter_percent_to_100ths(controller_get_position_percentage(i));
+        cluster_t *cluster = cluster::get(endpoint, WindowCovering::Id);
+        window_covering::feature::lift::config_t lift_config;
+        window_covering::feature::lift::add(cluster, &lift_config);
+        window_covering::feature::position_aware_lift::config_t position_config;
+        position_config.current_position_lift_percentage = (uint8_t)((position + 50) / 100);
+        position_config.target_position_lift_percent_100ths = position;
+        position_config.current_position_lift_percent_100ths = position;
+        window_covering::feature::position_aware_lift::add(cluster, &position_config);
+
+        portENTER_CRITICAL(&report_lock);
+        shades[i].pending_position = position;
+        portEXIT_CRITICAL(&report_lock);
+
+        ESP_LOGI(TAG, "Shade %u: window covering endpoint %u", i + 1, shades[i].endpoint_id);
+    }
+
+    xTaskCreate(matter_report_task, "matter_report", 4096, NULL, 4, &report_task_handle);
+    controller_add_state_listener(matter_state_listener, NULL);
 
     // 3. Запуск Matter
     esp_matter::start(app_event_cb);
+    BENCH_BOOT(BENCH_BOOT_MATTER_STARTED);
+
+    ESP_LOGI(TAG, "Matter started, %u window covering endpoints", SHADE_COUNT);
 }
@@ -17,9 +17,17 @@ extern "C"
     } matter_shade_state_t;
 
     void matter_integration_init(void);
-    void matter_integration_update_state(state_t state, float position);
-    void matter_integration_set_position_callback(void (*callback)(uint8_t position));
-    void matter_integration_set_move_callback(void (*callback)(bool direction));
+
+    // Смена состояния шторы, position - проценты от верхнего положения.
+    // Подписана на контроллер при инициализации. Отчеты об атрибутах
+    // отправляются из отдельной задачи с ограничением частоты
+    void matter_integration_update_state(uint8_t shade, state_t state, float position);
+
+    // Перехват команд Matter вместо контроллера: позиция в процентах,
+    // direction = true - вверх (UpOrOpen), false - вниз (DownOrClose).
+    // Каждая штора - отдельный эндпоинт, shade - ее номер с нуля
+    void matter_integration_set_position_callback(void (*callback)(uint8_t shade, uint8_t position));
+    void matter_integration_set_move_callback(void (*callback)(uint8_t shade, bool direction));
 
 #ifdef __cplusplus
 }
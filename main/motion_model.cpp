@@ -0,0 +1,193 @@
+#include "motion_model.h"
+#include "persistence.h"
+#include "shade_config.h"
+#include "esp_log.h"
+
+static const char *TAG = "motion_model";
+
+// Наблюдения усредняются экспоненциально: новое значение входит с весом 1/2^N
+#define MOTION_MODEL_GAIN_SHIFT 3
+#define MOTION_MODEL_BACKLASH_GAIN_SHIFT 2
+
+// Короткие движения тонут в шуме датчика и в модель не попадают
+#define MOTION_MODEL_MIN_FIT_STEPS 64
+#define MOTION_MODEL_MIN_FIT_COUNTS 32
+#define MOTION_MODEL_MIN_STOP_VELOCITY_CPS 20
+
+#define MOTION_MODEL_MAX_BACKLASH_STEPS 2048
+#define MOTION_MODEL_MAX_STOP_LEAD_US 200000
+
+// Модель одной шторы
+typedef struct
+{
+    persistence_motion_model_t model;
+    motor_direction_t last_direction;
+
+    // Текущее движение к цели
+    motor_direction_t move_direction;
+    bool move_reversed;
+    bool move_pending;
+} motion_model_state_t;
+
+// Вызывается только из задачи контроллера
+static motion_model_state_t models[SHADE_COUNT];
+
+static motion_model_state_t *motion_model_get(uint8_t shade)
+{
+    return &models[shade < SHADE_COUNT ? shade : 0];
+}
+
+static int motion_model_index(motor_direction_t direction)
+{
+    return direction == MOTOR_DIR_DOWN ? 1 : 0;
+}
+
+static uint32_t motion_model_blend(uint32_t value, uint32_t observed, int shift)
+{
+    int64_t delta = (int64_t)observed - (int64_t)value;
+    return (uint32_t)((int64_t)value + delta / (1 << shift));
+}
+
+void motion_model_reset(uint8_t shade, uint32_t counts_per_step_q16)
+{
+    motion_model_state_t *state = motion_model_get(shade);
+    persistence_motion_model_t &model = state->model;
+
+    model = {};
+    model.valid = counts_per_step_q16 != 0;
+    model.counts_per_step_q16[0] = counts_per_step_q16;
+    model.counts_per_step_q16[1] = counts_per_step_q16;
+    state->last_direction = MOTOR_DIR_STOP;
+    state->move_pending = false;
+
+    if (model.valid)
+    {
+        persistence_update_motion_model(shade, &model);
+    }
+}
+
+void motion_model_init(uint8_t shade, uint32_t counts_per_step_q16)
+{
+    persistence_motion_model_t &model = motion_model_get(shade)->model;
+    if (persistence_get_motion_model(shade, &model))
+    {
+        ESP_LOGI(TAG, "Model %u loaded: up %lu, down %lu counts/step (Q16), backlash %lu steps, stop lead %lu us",
+                 shade + 1, model.counts_per_step_q16[0], model.counts_per_step_q16[1],
+                 model.backlash_steps, model.stop_lead_us);
+        return;
+    }
+
+    motion_model_reset(shade, counts_per_step_q16);
+}
+
+uint32_t motion_model_counts_per_step_q16(uint8_t shade, motor_direction_t direction)
+{
+    return motion_model_get(shade)->model.counts_per_step_q16[motion_model_index(direction)];
+}
+
+uint32_t motion_model_begin_move(uint8_t shade, motor_direction_t direction, uint32_t counts)
+{
+    motion_model_state_t *state = motion_model_get(shade);
+
+    // Направление до включения питания неизвестно: люфт не учитывается
+    state->move_reversed = state->last_direction != MOTOR_DIR_STOP && direction != state->last_direction;
+    state->move_direction = direction;
+    state->move_pending = true;
+    state->last_direction = direction;
+
+    uint32_t counts_per_step_q16 = motion_model_counts_per_step_q16(shade, direction);
+    if (counts_per_step_q16 == 0)
+    {
+        // Соотношение еще не известно - считаем отсчет ADC за шаг
+        return counts;
+    }
+
+    uint64_t steps = ((uint64_t)counts << 16) / counts_per_step_q16;
+    if (state->move_reversed)
+    {
+        steps += state->model.backlash_steps;
+    }
+    return steps >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)steps;
+}
+
+void motion_model_begin_jog(uint8_t shade, motor_direction_t direction)
+{
+    motion_model_state_t *state = motion_model_get(shade);
+    state->last_direction = direction;
+    state->move_pending = false;
+}
+
+void motion_model_end_move(uint8_t shade, uint32_t counts_moved, uint32_t steps_moved)
+{
+    motion_model_state_t *state = motion_model_get(shade);
+    persistence_motion_model_t &model = state->model;
+
+    if (!state->move_pending)
+    {
+        return;
+    }
+    state->move_pending = false;
+
+    if (!model.valid || steps_moved < MOTION_MODEL_MIN_FIT_STEPS || counts_moved < MOTION_MODEL_MIN_FIT_COUNTS)
+    {
+        return;
+    }
+
+    int index = motion_model_index(state->move_direction);
+    uint32_t counts_per_step_q16 = model.counts_per_step_q16[index];
+
+    if (state->move_reversed)
+    {
+        // После смены направления часть шагов выбирает люфт: это разница
+        // между выданными шагами и шагами, которые объясняют перемещение
+        uint32_t effective_steps = (uint32_t)(((uint64_t)counts_moved << 16) / counts_per_step_q16);
+        uint32_t backlash = steps_moved > effective_steps ? steps_moved - effective_steps : 0;
+        if (backlash > MOTION_MODEL_MAX_BACKLASH_STEPS)
+        {
+            backlash = MOTION_MODEL_MAX_BACKLASH_STEPS;
+        }
+        model.backlash_steps = motion_model_blend(model.backlash_steps, backlash, MOTION_MODEL_BACKLASH_GAIN_SHIFT);
+    }
+    else
+    {
+        uint32_t observed = (uint32_t)(((uint64_t)counts_moved << 16) / steps_moved);
+        model.counts_per_step_q16[index] = motion_model_blend(counts_per_step_q16, observed, MOTION_MODEL_GAIN_SHIFT);
+    }
+
+    ESP_LOGD(TAG, "Shade %u %s %lu counts over %lu steps: %lu counts/step (Q16), backlash %lu",
+             shade + 1, state->move_direction == MOTOR_DIR_UP ? "up" : "down", counts_moved, steps_moved,
+             model.counts_per_step_q16[index], model.backlash_steps);
+    persistence_update_motion_model(shade, &model);
+}
+
+void motion_model_observe_stop(uint8_t shade, int32_t overshoot, uint32_t velocity_cps)
+{
+    persistence_motion_model_t &model = motion_model_get(shade)->model;
+    if (!model.valid || velocity_cps < MOTION_MODEL_MIN_STOP_VELOCITY_CPS)
+    {
+        return;
+    }
+
+    // Остановка заказывается заранее на stop_lead_us: перелет за границу
+    // увеличивает упреждение, недоход - уменьшает
+    int64_t error_us = (int64_t)overshoot * 1000000 / velocity_cps;
+    int64_t lead_us = (int64_t)model.stop_lead_us + error_us / (1 << MOTION_MODEL_GAIN_SHIFT);
+    if (lead_us < 0)
+    {
+        lead_us = 0;
+    }
+    else if (lead_us > MOTION_MODEL_MAX_STOP_LEAD_US)
+    {
+        lead_us = MOTION_MODEL_MAX_STOP_LEAD_US;
+    }
+    model.stop_lead_us = (uint32_t)lead_us;
+
+    ESP_LOGD(TAG, "Shade %u stop overshoot %ld counts at %lu counts/s, lead %lu us", shade + 1, overshoot,
+             velocity_cps, model.stop_lead_us);
+    persistence_update_motion_model(shade, &model);
+}
+
+uint32_t motion_model_stop_lead_us(uint8_t shade)
+{
+    return motion_model_get(shade)->model.stop_lead_us;
+}
@@ -0,0 +1,43 @@
+// Модель хода штор: отсчеты ADC на шаг по направлениям, люфт редуктора
+// и задержка остановки. Уточняется по каждому движению, хранится в NVS
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "motor_control.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Модели ведутся по шторам, shade - номер шторы с нуля
+
+    // Загрузка сохраненной модели. counts_per_step_q16 из калибровки
+    // используется как начальное значение, если модели еще нет
+    void motion_model_init(uint8_t shade, uint32_t counts_per_step_q16);
+
+    // Новая калибровка: модель начинается заново
+    void motion_model_reset(uint8_t shade, uint32_t counts_per_step_q16);
+
+    // Шаги для перемещения на counts отсчетов ADC. После смены направления
+    // добавляется люфт. Запоминает движение для motion_model_end_move()
+    uint32_t motion_model_begin_move(uint8_t shade, motor_direction_t direction, uint32_t counts);
+
+    // Движение без цели (кнопки): только смена направления для учета люфта
+    void motion_model_begin_jog(uint8_t shade, motor_direction_t direction);
+
+    // Завершенное движение: фактическое перемещение по датчику и число шагов
+    void motion_model_end_move(uint8_t shade, uint32_t counts_moved, uint32_t steps_moved);
+
+    // Остановка на границе: overshoot - положение после остановки за границей
+    // в отсчетах ADC (отрицательное - недоход), velocity_cps - скорость
+    // в момент остановки в отсчетах ADC в секунду
+    void motion_model_observe_stop(uint8_t shade, int32_t overshoot, uint32_t velocity_cps);
+
+    uint32_t motion_model_stop_lead_us(uint8_t shade);
+    uint32_t motion_model_counts_per_step_q16(uint8_t shade, motor_direction_t direction);
+
+#ifdef __cplusplus
+}
+#endif
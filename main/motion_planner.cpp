@@ -0,0 +1,306 @@
+#include "motion_planner.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "motion_planner";
+
+// Параметры разгона из Kconfig
+#define MOTION_START_SPEED_SPS CONFIG_MOTOR_START_SPEED_SPS
+#define MOTION_MAX_SPEED_SPS CONFIG_MOTOR_MAX_SPEED_SPS
+#define MOTION_ACCELERATION CONFIG_MOTOR_ACCELERATION
+
+static_assert(MOTION_MAX_SPEED_SPS > MOTION_START_SPEED_SPS, "Max speed must be above start speed");
+
+// Наибольший интервал шага. У RMT длительность символа - 15 бит тактов,
+// более длинный интервал канал молча укоротил бы
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+#define MOTION_INTERVAL_MAX_US (0x7FFF / (CONFIG_MOTOR_RMT_RESOLUTION_HZ / 1000000))
+#else
+#define MOTION_INTERVAL_MAX_US UINT16_MAX
+#endif
+
+static_assert(1000000 / MOTION_START_SPEED_SPS <= MOTION_INTERVAL_MAX_US,
+              "Start speed interval exceeds RMT symbol duration: raise MOTOR_START_SPEED_SPS "
+              "or lower MOTOR_RMT_RESOLUTION_HZ");
+
+// Длина таблицы разгона: v(n)^2 = v0^2 + 2*a*n, от стартовой до максимальной скорости
+#define MOTION_RAMP_STEPS_FULL                                              \
+    (((uint64_t)MOTION_MAX_SPEED_SPS * MOTION_MAX_SPEED_SPS -               \
+      (uint64_t)MOTION_START_SPEED_SPS * MOTION_START_SPEED_SPS) /          \
+         (2ULL * MOTION_ACCELERATION) +                                     \
+     1)
+#define MOTION_RAMP_TABLE_MAX 2048
+#define MOTION_RAMP_STEPS \
+    (MOTION_RAMP_STEPS_FULL < MOTION_RAMP_TABLE_MAX ? MOTION_RAMP_STEPS_FULL : MOTION_RAMP_TABLE_MAX)
+
+// Таблица интервалов разгона в мкс. Читается из ISR генератора шагов,
+// поэтому размещается во внутренней памяти
+static DRAM_ATTR uint16_t ramp_table[MOTION_RAMP_STEPS];
+static DRAM_ATTR uint32_t min_interval_us = 1000000 / MOTION_MAX_SPEED_SPS;
+
+static uint32_t isqrt64(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= result + bit)
+        {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else
+        {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
+
+static inline uint32_t IRAM_ATTR ramp_at(uint32_t level)
+{
+    return level < MOTION_RAMP_STEPS ? ramp_table[level] : 0;
+}
+
+void motion_planner_init(void)
+{
+    // Таблица считается один раз: на каждом шаге остается только выборка
+    for (uint32_t n = 0; n < MOTION_RAMP_STEPS; n++)
+    {
+        uint64_t v2 = (uint64_t)MOTION_START_SPEED_SPS * MOTION_START_SPEED_SPS +
+                      2ULL * MOTION_ACCELERATION * n;
+        uint32_t interval = 1000000 / isqrt64(v2);
+        ramp_table[n] = interval > UINT16_MAX ? UINT16_MAX : interval;
+    }
+
+    // Если таблица обрезана, крейсер не может быть быстрее ее последнего элемента
+    if (ramp_table[MOTION_RAMP_STEPS - 1] > min_interval_us)
+    {
+        min_interval_us = ramp_table[MOTION_RAMP_STEPS - 1];
+        ESP_LOGW(TAG, "Ramp table truncated, max speed limited to %lu us/step", min_interval_us);
+    }
+
+    ESP_LOGI(TAG, "Motion planner: %lu..%lu us/step, ramp %u steps",
+             (uint32_t)ramp_table[0], min_interval_us, (unsigned)MOTION_RAMP_STEPS);
+}
+
+uint32_t motion_planner_min_interval_us(void)
+{
+    return min_interval_us;
+}
+
+// Уровень разгона (индекс таблицы), на котором интервал не превышает заданный
+uint32_t motion_planner_level_for_interval(uint32_t interval_us)
+{
+    uint32_t low = 0;
+    uint32_t high = MOTION_RAMP_STEPS;
+
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (ramp_table[mid] <= interval_us)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+
+    return low;
+}
+
+void motion_profile_plan(motion_profile_t *profile, uint32_t steps, uint32_t cruise_us, uint32_t start_level)
+{
+    if (cruise_us < min_interval_us)
+    {
+        cruise_us = min_interval_us;
+    }
+    if (cruise_us > MOTION_INTERVAL_MAX_US)
+    {
+        cruise_us = MOTION_INTERVAL_MAX_US;
+    }
+
+    profile->total_steps = steps;
+    profile->cruise_us = cruise_us;
+    profile->cruise_level = motion_planner_level_for_interval(cruise_us);
+    profile->ramp_offset = start_level < profile->cruise_level ? start_level : profile->cruise_level;
+}
+
+uint32_t IRAM_ATTR motion_profile_interval(const motion_profile_t *profile, uint32_t step)
+{
+    uint32_t interval = profile->cruise_us;
+
+    uint32_t accel = ramp_at(step + profile->ramp_offset);
+    if (accel > interval)
+    {
+        interval = accel;
+    }
+
+    if (profile->total_steps != MOTION_STEPS_CONTINUOUS && step < profile->total_steps)
+    {
+        uint32_t decel = ramp_at(profile->total_steps - 1 - step);
+        if (decel > interval)
+        {
+            interval = decel;
+        }
+    }
+
+    return interval;
+}
+
+// Текущий уровень скорости на шаге step в единицах таблицы разгона
+uint32_t motion_profile_level(const motion_profile_t *profile, uint32_t step)
+{
+    uint32_t level = step + profile->ramp_offset;
+    if (level > profile->cruise_level)
+    {
+        level = profile->cruise_level;
+    }
+
+    if (profile->total_steps != MOTION_STEPS_CONTINUOUS)
+    {
+        uint32_t remaining = step < profile->total_steps ? profile->total_steps - step : 0;
+        if (remaining < level)
+        {
+            level = remaining;
+        }
+    }
+
+    return level;
+}
+
+// Плавная остановка: сокращаем движение так, чтобы с шага step началось торможение
+void motion_profile_request_stop(motion_profile_t *profile, uint32_t step)
+{
+    uint32_t stop_at = step + motion_profile_level(profile, step) + 1;
+
+    if (profile->total_steps == MOTION_STEPS_CONTINUOUS || stop_at < profile->total_steps)
+    {
+        profile->total_steps = stop_at;
+    }
+}
+
+// Число начатых шагов через elapsed_us от старта движения
+uint32_t motion_profile_steps_at(const motion_profile_t *profile, uint64_t elapsed_us)
+{
+    uint32_t step = 0;
+    uint64_t t = 0;
+
+    while (step < profile->total_steps)
+    {
+        if (t > elapsed_us)
+        {
+            return step;
+        }
+
+        uint32_t interval = motion_profile_interval(profile, step);
+        if (interval == profile->cruise_us)
+        {
+            // Крейсерский участок пропускаем целиком до начала торможения
+            uint32_t decel_start = MOTION_STEPS_CONTINUOUS;
+            if (profile->total_steps != MOTION_STEPS_CONTINUOUS)
+            {
+                decel_start = profile->total_steps > profile->cruise_level ? profile->total_steps - profile->cruise_level : step;
+            }
+
+            if (decel_start > step + 1)
+            {
+                uint64_t begun = (elapsed_us - t) / profile->cruise_us + 1;
+                if (begun < decel_start - step)
+                {
+                    return step + (uint32_t)begun;
+                }
+                t += (uint64_t)(decel_start - step) * profile->cruise_us;
+                step = decel_start;
+                continue;
+            }
+        }
+
+        t += interval;
+        step++;
+    }
+
+    return profile->total_steps;
+}
+
+// Длительность всего движения, для непрерывного движения - UINT64_MAX
+uint64_t motion_profile_duration_us(const motion_profile_t *profile)
+{
+    if (profile->total_steps == MOTION_STEPS_CONTINUOUS)
+    {
+        return UINT64_MAX;
+    }
+
+    uint32_t step = 0;
+    uint64_t t = 0;
+    uint32_t decel_start = profile->total_steps > profile->cruise_level ? profile->total_steps - profile->cruise_level : 0;
+
+    while (step < profile->total_steps)
+    {
+        uint32_t interval = motion_profile_interval(profile, step);
+        if (interval == profile->cruise_us && decel_start > step + 1)
+        {
+            // Крейсерский участок целиком
+            t += (uint64_t)(decel_start - step) * profile->cruise_us;
+            step = decel_start;
+            continue;
+        }
+
+        t += interval;
+        step++;
+    }
+
+    return t;
+}
+
+// Крейсерский интервал, при котором движение на steps шагов с разгоном
+// и торможением займет не больше duration_us. Если даже на максимальной
+// скорости движение длиннее, возвращается минимальный интервал
+uint32_t motion_planner_cruise_for_duration(uint32_t steps, uint64_t duration_us)
+{
+    motion_profile_t profile;
+    if (steps == 0 || steps == MOTION_STEPS_CONTINUOUS)
+    {
+        return min_interval_us;
+    }
+
+    // Длительность растет с интервалом: ищем наибольший подходящий
+    uint64_t high = duration_us / steps;
+    if (high > MOTION_INTERVAL_MAX_US)
+    {
+        high = MOTION_INTERVAL_MAX_US;
+    }
+    uint32_t low = min_interval_us;
+    if (high <= low)
+    {
+        return min_interval_us;
+    }
+
+    uint32_t upper = (uint32_t)high;
+    while (low < upper)
+    {
+        uint32_t mid = low + (upper - low + 1) / 2;
+        motion_profile_plan(&profile, steps, mid, 0);
+        if (motion_profile_duration_us(&profile) <= duration_us)
+        {
+            low = mid;
+        }
+        else
+        {
+            upper = mid - 1;
+        }
+    }
+
+    return low;
+}
@@ -0,0 +1,38 @@
+// Планировщик профиля движения (разгон / крейсер / торможение)
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define MOTION_STEPS_CONTINUOUS UINT32_MAX
+
+    // Профиль одного движения. Интервал шага k вычисляется только целочисленно:
+    // interval(k) = max(cruise, ramp[k + ramp_offset], ramp[total - 1 - k])
+    typedef struct
+    {
+        uint32_t total_steps;  // Шагов в движении, MOTION_STEPS_CONTINUOUS - до остановки
+        uint32_t cruise_us;    // Интервал шага на крейсерской скорости
+        uint32_t cruise_level; // Индекс таблицы разгона, на котором достигается крейсер
+        uint32_t ramp_offset;  // Начальный уровень разгона (продолжение движения)
+    } motion_profile_t;
+
+    void motion_planner_init(void);
+    uint32_t motion_planner_min_interval_us(void);
+    uint32_t motion_planner_level_for_interval(uint32_t interval_us);
+    uint32_t motion_planner_cruise_for_duration(uint32_t steps, uint64_t duration_us);
+
+    void motion_profile_plan(motion_profile_t *profile, uint32_t steps, uint32_t cruise_us, uint32_t start_level);
+    uint32_t motion_profile_interval(const motion_profile_t *profile, uint32_t step);
+    uint32_t motion_profile_level(const motion_profile_t *profile, uint32_t step);
+    void motion_profile_request_stop(motion_profile_t *profile, uint32_t step);
+    uint32_t motion_profile_steps_at(const motion_profile_t *profile, uint64_t elapsed_us);
+    uint64_t motion_profile_duration_us(const motion_profile_t *profile);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,121 +1,390 @@
 #include "motor_control.h"
+#include "shade_config.h"
 #include "esp_log.h"
+#include "esp_attr.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_timer.h"
+#include "motion_planner.h"
+#include "bench.h"
+#include "telemetry.h"
+#include "power_manager.h"
+#include "stepper_driver.h"
+#include "shade_sim.h"
 #include <string.h>
 
-static const char *TAG = "motor_control";
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+#include "motor_rmt.h"
+#endif
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_GPTIMER
+#include "step_scheduler.h"
+#endif
+
+#ifdef CONFIG_MOTOR_POWER_PWM
+#include "driver/ledc.h"
+#include "esp_sleep.h"
+#endif
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+#include "esp_rom_sys.h"
+#endif
+
+#ifdef CONFIG_MOTOR_FAST_GPIO
+#include "driver/dedic_gpio.h"
+#include "hal/dedic_gpio_cpu_ll.h"
+#include "esp_cpu.h"
+#if !CONFIG_FREERTOS_UNICORE
+#include "esp_ipc.h"
+#endif
+#endif
 
-// Конфигурация GPIO пинов для ULN2003 из Kconfig
-#define MOTOR_PIN_1 CONFIG_MOTOR_PIN_1
-#define MOTOR_PIN_2 CONFIG_MOTOR_PIN_2
-#define MOTOR_PIN_3 CONFIG_MOTOR_PIN_3
-#define MOTOR_PIN_4 CONFIG_MOTOR_PIN_4
-#define MOTOR_ENABLE_PIN CONFIG_MOTOR_ENABLE_PIN
+static const char *TAG = "motor_control";
 
 // Параметры шагового двигателя из Kconfig
 #define STEPS_PER_REVOLUTION CONFIG_MOTOR_STEPS_PER_REVOLUTION
-#define MICROSECONDS_PER_STEP_MIN 800 // Минимальная задержка между шагами
-
-// Последовательности шагов для полношагового режима
-static const uint8_t step_sequence_full[][4] = {
-    {1, 0, 0, 0},
-    {0, 1, 0, 0},
-    {0, 0, 1, 0},
-    {0, 0, 0, 1}};
-
-// Последовательности шагов для полушагового режима (более плавный)
-static const uint8_t step_sequence_half[][4] = {
-    {1, 0, 0, 0},
-    {1, 1, 0, 0},
-    {0, 1, 0, 0},
-    {0, 1, 1, 0},
-    {0, 0, 1, 0},
-    {0, 0, 1, 1},
-    {0, 0, 0, 1},
-    {1, 0, 0, 1}};
-
-// Структура состояния двигателя
+#define MICROSECONDS_PER_STEP_MIN motion_planner_min_interval_us() // Минимальная задержка между шагами
+#define MICROSECONDS_PER_STEP_MAX 5000                             // Задержка для самой медленной скорости
+#define MOTOR_TIMER_MIN_TIMEOUT_US 50                              // Минимальный таймаут перезапуска таймера
+
+#define MOTOR_ENABLE_SETTLE_US CONFIG_MOTOR_ENABLE_SETTLE_US
+
+// Питание катушек через пин enable
+typedef enum
+{
+    MOTOR_POWER_OFF = 0,
+    MOTOR_POWER_HOLD, // Остановлен, удерживает позицию
+    MOTOR_POWER_RUN,
+} motor_power_t;
+
+#ifdef CONFIG_MOTOR_DISABLE_ON_STOP
+#define MOTOR_POWER_STOPPED MOTOR_POWER_OFF
+#else
+#define MOTOR_POWER_STOPPED MOTOR_POWER_HOLD
+#endif
+
+#ifdef CONFIG_MOTOR_POWER_PWM
+// Один таймер LEDC на все моторы, канал на мотор
+#define MOTOR_PWM_MODE LEDC_LOW_SPEED_MODE
+#define MOTOR_PWM_TIMER LEDC_TIMER_0
+#define MOTOR_PWM_RESOLUTION LEDC_TIMER_8_BIT
+// Заполнение 100% - 2^8: выход постоянно включен
+#define MOTOR_PWM_DUTY(percent) (((uint32_t)(percent) << 8) / 100)
+#ifdef CONFIG_MOTOR_PWM_HOLD_DUTY
+#define MOTOR_PWM_HOLD_DUTY CONFIG_MOTOR_PWM_HOLD_DUTY
+#else
+// MOTOR_DISABLE_ON_STOP или RMT: катушки после остановки обесточены
+#define MOTOR_PWM_HOLD_DUTY 0
+#endif
+#endif
+
+// Бит уведомления задачи motor_control для каждого мотора
+#define MOTOR_NOTIFY_BIT(shade) (1UL << (shade))
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+// Четыре канала RMT заняты катушками одного мотора
+static_assert(SHADE_COUNT == 1, "RMT step backend drives a single motor");
+#endif
+
+// Последовательности полного шага и полушага (более плавный) строятся
+// при компиляции в stepper_driver.h
+typedef stepper_sequence<false> motor_sequence_full;
+typedef stepper_sequence<true> motor_sequence_half;
+
+// Структура состояния двигателя, по одной на штору
 typedef struct
 {
+    uint8_t shade;
+    int pins[4];    // IN1-IN4
+    int enable_pin; // -1 - не используется
     bool is_moving;
     motor_direction_t current_direction;
     uint32_t current_speed;
-    uint32_t remaining_steps;
-    uint32_t current_step;
+    uint32_t cruise_interval_us; // Заданный крейсерский интервал, 0 - по current_speed
+    motion_profile_t profile;    // Профиль текущего движения
+    uint32_t step_index;         // Шагов выполнено в текущем профиле
+    int64_t next_deadline_us;    // Время следующего шага (программный или общий таймер)
+    uint32_t current_step;       // Фаза в последовательности шагов
+    int32_t position_steps;      // Абсолютная позиция: вниз +1, вверх -1
     bool use_half_step;
-    bool enable_pin_active;
+    motor_power_t power;
+    int64_t power_on_us; // Момент подачи питания, от него отсчитывается стабилизация
+    // Шаг по направлению и режиму: фаза сдвигается на phase_delta по маске
+    // длины последовательности, позиция - на position_delta
+    uint8_t phase_mask;
+    uint8_t phase_delta;
+    int8_t position_delta;
+#ifdef CONFIG_MOTOR_STEP_BACKEND_ESP_TIMER
     esp_timer_handle_t step_timer;
-    TaskHandle_t motor_task_handle;
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+    uint8_t step_channel; // Канал общего генератора шагов
+#endif
+#ifdef CONFIG_MOTOR_FAST_GPIO
+    // Быстрый вывод: каждая строка последовательности заранее переведена в значение
+    // для регистра выделенных GPIO, шаг выводится одной записью на все катушки
+    dedic_gpio_bundle_handle_t bundle;
+    uint32_t out_mask;
+    uint32_t half[motor_sequence_half::size];
+    uint32_t full[motor_sequence_full::size];
+    const uint32_t *coil_values; // Значения для регистра выделенных GPIO по фазам
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_RMT)
+    const uint8_t *coils; // Катушки по фазам для энкодера RMT
+#else
+    // Маски регистров GPIO по фазам для выводов этого мотора. Копии таблиц
+    // из stepper_driver.h в DRAM: шаг выводится из прерывания
+    stepper_phase_t half[motor_sequence_half::size];
+    stepper_phase_t full[motor_sequence_full::size];
+    const stepper_phase_t *phases;
+#endif
+    volatile bool done_pending;
+    bool done_completed;
 } motor_state_t;
 
-static motor_state_t motor_state = {0};
+static motor_state_t motors[SHADE_COUNT] = {};
+
+// Одна задача и один обработчик завершения на все моторы
+static TaskHandle_t motor_task_handle = NULL;
+static motor_done_callback_t done_callback = NULL;
+static void *done_callback_arg = NULL;
+
+#ifdef CONFIG_MOTOR_FAST_GPIO
+// Выделенные GPIO привязаны к ядру, на котором создан bundle. Bundle и
+// генератор шагов создаются на одном ядре, чтобы шаг писал в регистр без проверок
+#define MOTOR_FAST_GPIO_CORE 0
+#endif
 
 // Прототипы внутренних функций
-static void motor_set_gpio_mode(void);
-static void motor_write_step(uint8_t step_index);
+static void motor_set_gpio_mode(motor_state_t *motor);
+static void motor_select_sequence(motor_state_t *motor);
+static void motor_write_step(motor_state_t *motor, uint8_t step_index);
+#ifdef CONFIG_MOTOR_FAST_GPIO
+static esp_err_t motor_fast_gpio_init(motor_state_t *motor);
+#endif
+#ifdef CONFIG_MOTOR_STEP_BACKEND_ESP_TIMER
 static void motor_step_callback(void *arg);
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+static uint64_t motor_step_isr(uint64_t now_us, void *arg, bool *task_woken);
+#endif
 static void motor_control_task(void *parameter);
 static uint32_t calculate_delay_from_speed(uint32_t speed);
-static void motor_enable(bool enable);
+static uint32_t motor_cruise_interval(const motor_state_t *motor);
+static void motor_set_power(motor_state_t *motor, motor_power_t power);
+#ifdef CONFIG_MOTOR_POWER_PWM
+static esp_err_t motor_pwm_timer_init(void);
+static esp_err_t motor_pwm_init(motor_state_t *motor);
+#endif
+static esp_err_t motor_start_stepping(motor_state_t *motor);
+static void motor_pause_stepping(motor_state_t *motor);
+static uint32_t motor_remaining_steps(const motor_state_t *motor);
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+static void motor_rmt_done(void *arg);
+#endif
 
-void motor_control_init(void)
+static motor_state_t *motor_get(uint8_t shade)
 {
-    ESP_LOGI(TAG, "Initializing motor control for ULN2003");
+    return &motors[shade < SHADE_COUNT ? shade : 0];
+}
+
+#if defined(CONFIG_MOTOR_FAST_GPIO) || defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+// Привязанные к ядру операции (bundle, прерывание шагов) выполняются на
+// ядре выделенных GPIO
+static void motor_call_on_step_core(void (*func)(void *), void *arg)
+{
+#if defined(CONFIG_MOTOR_FAST_GPIO) && !CONFIG_FREERTOS_UNICORE
+    if (esp_cpu_get_core_id() != MOTOR_FAST_GPIO_CORE)
+    {
+        esp_ipc_call_blocking(MOTOR_FAST_GPIO_CORE, func, arg);
+        return;
+    }
+#endif
+    func(arg);
+}
+#endif
+
+#if !defined(CONFIG_MOTOR_STEP_BACKEND_RMT) && !defined(CONFIG_MOTOR_FAST_GPIO)
+// Таблицы фаз для выводов, известных при компиляции
+template <int Pin1, int Pin2, int Pin3, int Pin4>
+static void motor_load_phases(motor_state_t *motor)
+{
+    typedef stepper_driver<Pin1, Pin2, Pin3, Pin4, true> half;
+    typedef stepper_driver<Pin1, Pin2, Pin3, Pin4, false> full;
+    static_assert(sizeof(motor->half) == sizeof(half::table.phases), "Half-step table size mismatch");
+    static_assert(sizeof(motor->full) == sizeof(full::table.phases), "Full-step table size mismatch");
+
+    memcpy(motor->half, half::table.phases, sizeof(motor->half));
+    memcpy(motor->full, full::table.phases, sizeof(motor->full));
+}
+
+static void motor_init_phases(motor_state_t *motor)
+{
+    switch (motor->shade)
+    {
+#if SHADE_COUNT >= 2
+    case 1:
+        motor_load_phases<SHADE2_MOTOR_PINS>(motor);
+        break;
+#endif
+#if SHADE_COUNT >= 3
+    case 2:
+        motor_load_phases<SHADE3_MOTOR_PINS>(motor);
+        break;
+#endif
+#if SHADE_COUNT >= 4
+    case 3:
+        motor_load_phases<SHADE4_MOTOR_PINS>(motor);
+        break;
+#endif
+    default:
+        motor_load_phases<SHADE1_MOTOR_PINS>(motor);
+        break;
+    }
+}
+#endif
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_GPTIMER
+static void motor_scheduler_create(void *arg)
+{
+    *(esp_err_t *)arg = step_scheduler_init();
+}
+#endif
+
+static esp_err_t motor_instance_init(motor_state_t *motor, uint8_t shade)
+{
+    const shade_pins_t *pins = shade_get_pins(shade);
 
-    // Инициализация состояния
-    memset(&motor_state, 0, sizeof(motor_state));
-    motor_state.current_direction = MOTOR_DIR_STOP;
-    motor_state.current_speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_state.use_half_step = CONFIG_MOTOR_USE_HALF_STEP;
+    motor->shade = shade;
+    memcpy(motor->pins, pins->motor_pins, sizeof(motor->pins));
+    motor->enable_pin = pins->motor_enable_pin;
+    motor->current_direction = MOTOR_DIR_STOP;
+    motor->current_speed = CONFIG_MOTOR_DEFAULT_SPEED;
+    motor->use_half_step = CONFIG_MOTOR_USE_HALF_STEP;
 
     // Настройка GPIO
-    motor_set_gpio_mode();
+    motor_set_gpio_mode(motor);
+
+#ifdef CONFIG_MOTOR_POWER_PWM
+    esp_err_t pwm_ret = motor_pwm_init(motor);
+    if (pwm_ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init motor power PWM: %s", esp_err_to_name(pwm_ret));
+        return pwm_ret;
+    }
+#endif
 
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    // Шаги выдает RMT, катушки подключаются к каналам RMT
+    esp_err_t ret = motor_rmt_init(motor->pins, motor_rmt_done, motor);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init RMT step backend: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    motor_select_sequence(motor);
+#else
+#ifdef CONFIG_MOTOR_STEP_BACKEND_ESP_TIMER
     // Создание таймера для шагов
     esp_timer_create_args_t timer_args = {
         .callback = &motor_step_callback,
+        .arg = motor,
         .name = "motor_step_timer"};
 
-    esp_err_t ret = esp_timer_create(&timer_args, &motor_state.step_timer);
+    esp_err_t ret = esp_timer_create(&timer_args, &motor->step_timer);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to create step timer: %s", esp_err_to_name(ret));
-        return;
+        return ret;
     }
+#else
+    // Канал общего генератора шагов
+    esp_err_t ret = step_scheduler_add_channel(motor_step_isr, motor, &motor->step_channel);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to add step channel: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#endif
+
+#ifdef CONFIG_MOTOR_FAST_GPIO
+    ret = motor_fast_gpio_init(motor);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init fast GPIO path: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#else
+    motor_init_phases(motor);
+#endif
+    motor_select_sequence(motor);
 
     // Установка всех пинов в LOW
-    motor_write_step(0);
+    motor_write_step(motor, 0);
+#endif
 
-    // Включение двигателя
-    motor_enable(true);
+    // Питание до первого движения - как после остановки
+    motor_set_power(motor, MOTOR_POWER_STOPPED);
 
-    // Создание задачи управления
-    xTaskCreate(motor_control_task, "motor_control", 2048, NULL, 5, &motor_state.task_handle);
+    ESP_LOGI(TAG, "Motor %u initialized. Pins: IN1=%d, IN2=%d, IN3=%d, IN4=%d, EN=%d", shade,
+             motor->pins[0], motor->pins[1], motor->pins[2], motor->pins[3], motor->enable_pin);
+    return ESP_OK;
+}
+
+void motor_control_init(void)
+{
+    ESP_LOGI(TAG, "Initializing motor control for ULN2003, %d motor(s)", SHADE_COUNT);
+
+    // Таблица разгона для планировщика движения
+    motion_planner_init();
+
+#ifdef CONFIG_MOTOR_POWER_PWM
+    if (motor_pwm_timer_init() != ESP_OK)
+    {
+        return;
+    }
+#endif
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_GPTIMER
+    // Один таймер и одно прерывание на все моторы
+    esp_err_t ret = ESP_OK;
+    motor_call_on_step_core(motor_scheduler_create, &ret);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start step scheduler: %s", esp_err_to_name(ret));
+        return;
+    }
+#endif
 
-    ESP_LOGI(TAG, "Motor control initialized. Pins: IN1=%d, IN2=%d, IN3=%d, IN4=%d, EN=%d",
-             MOTOR_PIN_1, MOTOR_PIN_2, MOTOR_PIN_3, MOTOR_PIN_4, MOTOR_ENABLE_PIN);
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        if (motor_instance_init(&motors[shade], shade) != ESP_OK)
+        {
+            return;
+        }
+    }
+
+    // Создание задачи управления
+    xTaskCreate(motor_control_task, "motor_control", 3072, NULL, 5, &motor_task_handle);
 }
 
-static void motor_set_gpio_mode(void)
+static void motor_set_gpio_mode(motor_state_t *motor)
 {
+#ifndef CONFIG_MOTOR_STEP_BACKEND_RMT
     // Настройка пинов управления катушками
     gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << MOTOR_PIN_1) | (1ULL << MOTOR_PIN_2) |
-                        (1ULL << MOTOR_PIN_3) | (1ULL << MOTOR_PIN_4),
+        .pin_bit_mask = (1ULL << motor->pins[0]) | (1ULL << motor->pins[1]) |
+                        (1ULL << motor->pins[2]) | (1ULL << motor->pins[3]),
         .mode = GPIO_MODE_OUTPUT,
         .pull_up_en = GPIO_PULLUP_DISABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
         .intr_type = GPIO_INTR_DISABLE};
     gpio_config(&io_conf);
+#endif
 
     // Настройка пина управления питанием (если используется)
-    if (MOTOR_ENABLE_PIN >= 0)
+    if (motor->enable_pin >= 0)
     {
         gpio_config_t enable_conf = {
-            .pin_bit_mask = (1ULL << MOTOR_ENABLE_PIN),
+            .pin_bit_mask = (1ULL << motor->enable_pin),
             .mode = GPIO_MODE_OUTPUT,
             .pull_up_en = GPIO_PULLUP_DISABLE,
             .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -124,55 +393,217 @@ static void motor_set_gpio_mode(void)
     }
 }
 
-static void motor_enable(bool enable)
+#ifdef CONFIG_MOTOR_POWER_PWM
+static esp_err_t motor_pwm_timer_init(void)
 {
-    if (MOTOR_ENABLE_PIN >= 0)
+    ledc_timer_config_t timer_config = {
+        .speed_mode = MOTOR_PWM_MODE,
+        .duty_resolution = MOTOR_PWM_RESOLUTION,
+        .timer_num = MOTOR_PWM_TIMER,
+        .freq_hz = CONFIG_MOTOR_PWM_FREQ_HZ,
+#if defined(CONFIG_SHADE_POWER_SAVE) && !defined(CONFIG_MOTOR_DISABLE_ON_STOP)
+        // Удержание продолжается в light sleep: RC_FAST не выключается во сне
+        .clk_cfg = LEDC_USE_RC_FAST_CLK,
+#else
+        .clk_cfg = LEDC_AUTO_CLK,
+#endif
+    };
+    esp_err_t ret = ledc_timer_config(&timer_config);
+    if (ret != ESP_OK)
     {
-        gpio_set_level(MOTOR_ENABLE_PIN, enable ? 1 : 0);
-        motor_state.enable_pin_active = enable;
+        ESP_LOGE(TAG, "Failed to configure PWM timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+#if defined(CONFIG_SHADE_POWER_SAVE) && !defined(CONFIG_MOTOR_DISABLE_ON_STOP)
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RC_FAST, ESP_PD_OPTION_ON);
+#endif
+
+    ESP_LOGI(TAG, "Motor power PWM %d Hz, run %d%%, hold %d%%", CONFIG_MOTOR_PWM_FREQ_HZ,
+             CONFIG_MOTOR_PWM_RUN_DUTY, MOTOR_PWM_HOLD_DUTY);
+    return ESP_OK;
+}
 
-        // Небольшая задержка для стабилизации
-        vTaskDelay(pdMS_TO_TICKS(1));
+static esp_err_t motor_pwm_init(motor_state_t *motor)
+{
+    if (motor->enable_pin < 0)
+    {
+        ESP_LOGW(TAG, "Motor %u has no enable pin, coils run at full current", motor->shade);
+        return ESP_OK;
     }
+
+    ledc_channel_config_t channel_config = {
+        .gpio_num = motor->enable_pin,
+        .speed_mode = MOTOR_PWM_MODE,
+        .channel = (ledc_channel_t)(LEDC_CHANNEL_0 + motor->shade),
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = MOTOR_PWM_TIMER,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    return ledc_channel_config(&channel_config);
 }
+#endif
 
-static void motor_write_step(uint8_t step_index)
+// Питание меняется только на границах движения. Драйвер стабилизируется
+// после включения без ожидания: срок первого шага отодвигается
+// motor_settle_remaining_us()
+static void motor_set_power(motor_state_t *motor, motor_power_t power)
 {
-    const uint8_t *sequence;
-    uint8_t sequence_size;
+    if (motor->enable_pin < 0 || power == motor->power)
+    {
+        return;
+    }
+
+#ifdef CONFIG_MOTOR_POWER_PWM
+    static const uint32_t duty[] = {
+        0,
+        MOTOR_PWM_DUTY(MOTOR_PWM_HOLD_DUTY),
+        MOTOR_PWM_DUTY(CONFIG_MOTOR_PWM_RUN_DUTY),
+    };
+    ledc_channel_t channel = (ledc_channel_t)(LEDC_CHANNEL_0 + motor->shade);
+    ledc_set_duty(MOTOR_PWM_MODE, channel, duty[power]);
+    ledc_update_duty(MOTOR_PWM_MODE, channel);
+    bool was_on = duty[motor->power] != 0;
+    bool on = duty[power] != 0;
+#else
+    bool was_on = motor->power != MOTOR_POWER_OFF;
+    bool on = power != MOTOR_POWER_OFF;
+    gpio_set_level((gpio_num_t)motor->enable_pin, on ? 1 : 0);
+#endif
 
-    if (motor_state.use_half_step)
+    if (on && !was_on)
     {
-        sequence = step_sequence_half[0];
-        sequence_size = 8;
+        motor->power_on_us = esp_timer_get_time();
     }
-    else
+    motor->power = power;
+}
+
+// Сколько еще стабилизируется драйвер после подачи питания
+static uint32_t motor_settle_remaining_us(const motor_state_t *motor)
+{
+    if (motor->power_on_us == 0)
     {
-        sequence = step_sequence_full[0];
-        sequence_size = 4;
+        return 0;
     }
+    int64_t remaining = motor->power_on_us + MOTOR_ENABLE_SETTLE_US - esp_timer_get_time();
+    return remaining > 0 ? (uint32_t)remaining : 0;
+}
 
-    if (step_index >= sequence_size)
+#ifdef CONFIG_MOTOR_FAST_GPIO
+typedef struct
+{
+    motor_state_t *motor;
+    esp_err_t result;
+} motor_fast_gpio_request_t;
+
+static void motor_fast_gpio_create(void *arg)
+{
+    motor_fast_gpio_request_t *request = (motor_fast_gpio_request_t *)arg;
+    dedic_gpio_bundle_config_t bundle_config = {
+        .gpio_array = request->motor->pins,
+        .array_size = 4,
+        .flags = {
+            .out_en = 1,
+        },
+    };
+    request->result = dedic_gpio_new_bundle(&bundle_config, &request->motor->bundle);
+}
+
+static esp_err_t motor_fast_gpio_init(motor_state_t *motor)
+{
+    motor_fast_gpio_request_t request = {motor, ESP_OK};
+    motor_call_on_step_core(motor_fast_gpio_create, &request);
+    if (request.result != ESP_OK)
     {
-        step_index = 0;
+        return request.result;
     }
 
-    // Копируем нужный шаг из последовательности
-    uint8_t step[4];
-    if (motor_state.use_half_step)
+    uint32_t offset = 0;
+    dedic_gpio_get_out_offset(motor->bundle, &offset);
+    dedic_gpio_get_out_mask(motor->bundle, &motor->out_mask);
+
+    // Бит i значения соответствует катушке i (порядок gpio_array). Смещение
+    // каналов известно только после создания bundle, поэтому сдвиг - здесь
+    for (int phase = 0; phase < motor_sequence_half::size; phase++)
     {
-        memcpy(step, step_sequence_half[step_index], 4);
+        motor->half[phase] = (uint32_t)motor_sequence_half::table.coils[phase] << offset;
     }
-    else
+    for (int phase = 0; phase < motor_sequence_full::size; phase++)
+    {
+        motor->full[phase] = (uint32_t)motor_sequence_full::table.coils[phase] << offset;
+    }
+    return ESP_OK;
+}
+
+// Горячий путь: выборка из таблицы и одна запись в регистр выходов.
+// Маска bundle затрагивает только катушки этого мотора
+static inline void IRAM_ATTR motor_write_coils(motor_state_t *motor, uint8_t step_index)
+{
+    dedic_gpio_cpu_ll_write_mask(motor->out_mask, motor->coil_values[step_index]);
+}
+
+typedef struct
+{
+    motor_state_t *motor;
+    uint8_t step_index;
+} motor_write_request_t;
+
+static void motor_write_coils_request(void *arg)
+{
+    motor_write_request_t *request = (motor_write_request_t *)arg;
+    motor_write_coils(request->motor, request->step_index);
+}
+
+// Вывод шага из произвольной задачи (инициализация, остановка)
+static void motor_write_step(motor_state_t *motor, uint8_t step_index)
+{
+    motor_write_request_t request = {motor, (uint8_t)(step_index & motor->phase_mask)};
+    motor_call_on_step_core(motor_write_coils_request, &request);
+}
+#elif !defined(CONFIG_MOTOR_STEP_BACKEND_RMT)
+// Уровни всех катушек записываются в регистры GPIO по готовым маскам
+static void IRAM_ATTR motor_write_step(motor_state_t *motor, uint8_t step_index)
+{
+    stepper_write(&motor->phases[step_index & motor->phase_mask]);
+}
+#endif
+
+// Приращения фазы и позиции для текущего направления: в горячем пути
+// шаг не зависит от направления и режима
+static void motor_update_stride(motor_state_t *motor)
+{
+    switch (motor->current_direction)
     {
-        memcpy(step, step_sequence_full[step_index], 4);
+    case MOTOR_DIR_UP:
+        motor->phase_delta = 1;
+        motor->position_delta = -1;
+        break;
+    case MOTOR_DIR_DOWN:
+        // Шаг назад по модулю длины последовательности
+        motor->phase_delta = motor->phase_mask;
+        motor->position_delta = 1;
+        break;
+    default:
+        motor->phase_delta = 0;
+        motor->position_delta = 0;
+        break;
     }
+}
 
-    // Устанавливаем уровни на пины
-    gpio_set_level(MOTOR_PIN_1, step[0]);
-    gpio_set_level(MOTOR_PIN_2, step[1]);
-    gpio_set_level(MOTOR_PIN_3, step[2]);
-    gpio_set_level(MOTOR_PIN_4, step[3]);
+// Таблица фаз для режима шага
+static void motor_select_sequence(motor_state_t *motor)
+{
+    motor->phase_mask = motor->use_half_step ? motor_sequence_half::mask : motor_sequence_full::mask;
+#ifdef CONFIG_MOTOR_FAST_GPIO
+    motor->coil_values = motor->use_half_step ? motor->half : motor->full;
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_RMT)
+    motor->coils = motor->use_half_step ? motor_sequence_half::table.coils : motor_sequence_full::table.coils;
+#else
+    motor->phases = motor->use_half_step ? motor->half : motor->full;
+#endif
+    motor->current_step &= motor->phase_mask;
+    motor_update_stride(motor);
 }
 
 static uint32_t calculate_delay_from_speed(uint32_t speed)
@@ -185,152 +616,388 @@ static uint32_t calculate_delay_from_speed(uint32_t speed)
 
     // Конвертируем скорость в задержку
     // Чем выше скорость, тем меньше задержка
-    uint32_t max_delay = 5000;                      // 5ms для самой медленной скорости
-    uint32_t min_delay = MICROSECONDS_PER_STEP_MIN; // 0.8ms для самой быстрой скорости
+    uint32_t max_delay = MICROSECONDS_PER_STEP_MAX; // 5ms для самой медленной скорости
+    uint32_t min_delay = MICROSECONDS_PER_STEP_MIN; // Из CONFIG_MOTOR_MAX_SPEED_SPS для самой быстрой
+    if (min_delay > max_delay)
+    {
+        min_delay = max_delay;
+    }
 
     uint32_t delay = max_delay - (speed * (max_delay - min_delay) / 100);
 
     return delay;
 }
 
+static uint32_t motor_cruise_interval(const motor_state_t *motor)
+{
+    if (motor->cruise_interval_us != 0)
+    {
+        return motor->cruise_interval_us;
+    }
+    return calculate_delay_from_speed(motor->current_speed);
+}
+
+static uint32_t IRAM_ATTR motor_remaining_steps(const motor_state_t *motor)
+{
+    if (motor->profile.total_steps == MOTION_STEPS_CONTINUOUS)
+    {
+        return MOTION_STEPS_CONTINUOUS;
+    }
+    return motor->step_index < motor->profile.total_steps
+               ? motor->profile.total_steps - motor->step_index
+               : 0;
+}
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+// Учет шагов, выданных RMT: фаза и индекс пересчитываются по числу шагов
+static void motor_account_steps(motor_state_t *motor, uint32_t steps_done)
+{
+    uint32_t steps = steps_done - motor->step_index;
+
+    motor->current_step = (motor->current_step + steps * motor->phase_delta) & motor->phase_mask;
+    motor->position_steps += (int32_t)steps * motor->position_delta;
+    motor->step_index = steps_done;
+}
+
+// Вызывается из ISR RMT после выдачи последнего шага
+static void IRAM_ATTR motor_rmt_done(void *arg)
+{
+    motor_state_t *motor = (motor_state_t *)arg;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (motor_task_handle != NULL)
+    {
+        xTaskNotifyFromISR(motor_task_handle, MOTOR_NOTIFY_BIT(motor->shade), eSetBits, &higher_priority_task_woken);
+    }
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+#else
+// Следующая фаза последовательности и ее вывод на катушки
+static void IRAM_ATTR motor_advance(motor_state_t *motor)
+{
+    motor->current_step = (motor->current_step + motor->phase_delta) & motor->phase_mask;
+    motor->position_steps += motor->position_delta;
+
+    // Выводим шаг на пины
+#ifdef CONFIG_MOTOR_FAST_GPIO
+    motor_write_coils(motor, motor->current_step);
+#else
+    motor_write_step(motor, motor->current_step);
+#endif
+
+    if (motor->step_index == 0)
+    {
+        BENCH_MARK(BENCH_POINT_FIRST_STEP);
+    }
+    motor->step_index++;
+}
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_ESP_TIMER
 static void motor_step_callback(void *arg)
 {
-    if (!motor_state.is_moving || motor_state.remaining_steps == 0)
+    motor_state_t *motor = (motor_state_t *)arg;
+    if (!motor->is_moving || motor_remaining_steps(motor) == 0)
     {
         return;
     }
 
-    // Вычисляем следующий шаг
-    uint8_t sequence_size = motor_state.use_half_step ? 8 : 4;
+    BENCH_STEP_JITTER((int32_t)(esp_timer_get_time() - motor->next_deadline_us));
+    motor_advance(motor);
 
-    if (motor_state.current_direction == MOTOR_DIR_UP)
+    // Если шаги закончились, останавливаем двигатель
+    if (motor_remaining_steps(motor) == 0)
     {
-        motor_state.current_step = (motor_state.current_step + 1) % sequence_size;
+        motor_stop(motor->shade);
+        return;
     }
-    else if (motor_state.current_direction == MOTOR_DIR_DOWN)
+
+    // Следующий шаг по профилю. Отсчет от расчетного времени, а не от момента
+    // вызова, чтобы задержка callback не накапливалась
+    motor->next_deadline_us += motion_profile_interval(&motor->profile, motor->step_index);
+    int64_t timeout = motor->next_deadline_us - esp_timer_get_time();
+    if (timeout < MOTOR_TIMER_MIN_TIMEOUT_US)
     {
-        motor_state.current_step = (motor_state.current_step == 0) ? (sequence_size - 1) : (motor_state.current_step - 1);
+        timeout = MOTOR_TIMER_MIN_TIMEOUT_US;
+    }
+    esp_timer_start_once(motor->step_timer, timeout);
+}
+#else
+// Вызывается из прерывания общего генератора на сроке шага этого мотора
+static uint64_t IRAM_ATTR motor_step_isr(uint64_t now_us, void *arg, bool *task_woken)
+{
+    motor_state_t *motor = (motor_state_t *)arg;
+    if (!motor->is_moving || motor_remaining_steps(motor) == 0)
+    {
+        return STEP_SCHEDULER_IDLE;
     }
 
-    // Выводим шаг на пины
-    motor_write_step(motor_state.current_step);
+    BENCH_STEP_JITTER((int32_t)((int64_t)now_us - motor->next_deadline_us));
+    motor_advance(motor);
+
+    // Шаги закончились: остановка с журналом и уведомлениями - в задаче
+    if (motor_remaining_steps(motor) == 0)
+    {
+        BaseType_t woken = pdFALSE;
+        xTaskNotifyFromISR(motor_task_handle, MOTOR_NOTIFY_BIT(motor->shade), eSetBits, &woken);
+        *task_woken |= (woken == pdTRUE);
+        return STEP_SCHEDULER_IDLE;
+    }
 
-    // Уменьшаем количество оставшихся шагов
-    motor_state.remaining_steps--;
+    // Срок следующего шага от расчетного, а не от фактического времени
+    motor->next_deadline_us += motion_profile_interval(&motor->profile, motor->step_index);
+    return (uint64_t)motor->next_deadline_us;
+}
+#endif
+#endif
 
-    // Если шаги закончились, останавливаем двигатель
-    if (motor_state.remaining_steps == 0)
+// Запуск генерации шагов по подготовленному профилю
+static esp_err_t motor_start_stepping(motor_state_t *motor)
+{
+    motor->step_index = 0;
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    if (motor->current_direction == MOTOR_DIR_STOP)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // RMT выдает первый шаг сразу после запуска каналов: остаток времени
+    // стабилизации (не больше MOTOR_ENABLE_SETTLE_US) выжидается здесь
+    uint32_t settle = motor_settle_remaining_us(motor);
+    if (settle > 0)
+    {
+        esp_rom_delay_us(settle);
+    }
+
+    return motor_rmt_start(motor->coils, motor->phase_mask, motor->current_step,
+                           motor->current_direction == MOTOR_DIR_UP,
+                           &motor->profile);
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+    uint32_t first = motion_profile_interval(&motor->profile, 0);
+    uint32_t settle = motor_settle_remaining_us(motor);
+    uint64_t deadline = step_scheduler_now_us() + (first > settle ? first : settle);
+    motor->next_deadline_us = (int64_t)deadline;
+    step_scheduler_start(motor->step_channel, deadline);
+    return ESP_OK;
+#else
+    uint32_t first = motion_profile_interval(&motor->profile, 0);
+    uint32_t settle = motor_settle_remaining_us(motor);
+    if (first < settle)
     {
-        motor_stop();
+        first = settle;
     }
+    motor->next_deadline_us = esp_timer_get_time() + first;
+    return esp_timer_start_once(motor->step_timer, first);
+#endif
 }
 
-void motor_set_direction(motor_direction_t direction)
+// Остановка генерации шагов без сброса состояния движения
+static void motor_pause_stepping(motor_state_t *motor)
 {
-    if (direction == motor_state.current_direction)
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    motor_account_steps(motor, motor_rmt_stop());
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+    step_scheduler_stop(motor->step_channel);
+#else
+    esp_timer_stop(motor->step_timer);
+#endif
+}
+
+// Перепланирование остатка движения. start_level сохраняет набранную скорость
+static void motor_replan(motor_state_t *motor, uint32_t start_level)
+{
+    uint32_t remaining = motor_remaining_steps(motor);
+    uint32_t delay = motor_cruise_interval(motor);
+
+    motion_profile_plan(&motor->profile, remaining, delay, start_level);
+    motor_start_stepping(motor);
+}
+
+void motor_set_direction(uint8_t shade, motor_direction_t direction)
+{
+    motor_state_t *motor = motor_get(shade);
+    if (direction == motor->current_direction)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Setting motor direction: %d", direction);
+    ESP_LOGD(TAG, "Motor %u direction: %d", shade, direction);
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_DIRECTION, direction);
 
-    motor_state.current_direction = direction;
+    bool restart = motor->is_moving && motor_remaining_steps(motor) > 0;
 
-    // Если двигатель движется, перезапускаем с новым направлением
-    if (motor_state.is_moving && motor_state.remaining_steps > 0)
+    // Шаги в старом направлении должны быть учтены до смены направления
+    if (restart)
     {
-        // Останавливаем текущий таймер
-        esp_timer_stop(motor_state.step_timer);
+        motor_pause_stepping(motor);
+    }
+
+    motor->current_direction = direction;
+    motor_update_stride(motor);
 
-        // Перезапускаем с новым направлением
-        uint32_t delay = calculate_delay_from_speed(motor_state.current_speed);
-        esp_timer_start_periodic(motor_state.step_timer, delay);
+    // Если двигатель движется, перезапускаем с новым направлением с разгона
+    if (restart)
+    {
+        motor_replan(motor, 0);
     }
 }
 
-void motor_set_speed(uint32_t speed)
+void motor_set_speed(uint8_t shade, uint32_t speed)
 {
-    if (speed == motor_state.current_speed)
+    motor_state_t *motor = motor_get(shade);
+    if (speed == motor->current_speed && motor->cruise_interval_us == 0)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Setting motor speed: %lu", speed);
+    ESP_LOGD(TAG, "Motor %u speed: %lu", shade, speed);
+
+    motor->current_speed = speed;
+    motor->cruise_interval_us = 0;
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_SPEED, motor_cruise_interval(motor));
 
-    motor_state.current_speed = speed;
+    // Если двигатель движется, перестраиваем профиль без потери набранной скорости
+    if (motor->is_moving && motor_remaining_steps(motor) > 0)
+    {
+        motor_pause_stepping(motor);
+        motor_replan(motor, motion_profile_level(&motor->profile, motor->step_index));
+    }
+}
 
-    // Если двигатель движется, обновляем задержку таймера
-    if (motor_state.is_moving && motor_state.remaining_steps > 0)
+// Точная скорость в интервале шага (мкс) вместо уровня 1-100.
+// Действует до следующего вызова motor_set_speed()
+void motor_set_cruise_interval_us(uint8_t shade, uint32_t interval_us)
+{
+    motor_state_t *motor = motor_get(shade);
+    if (interval_us == motor->cruise_interval_us)
     {
-        uint32_t delay = calculate_delay_from_speed(speed);
+        return;
+    }
+
+    ESP_LOGD(TAG, "Motor %u cruise interval: %lu us", shade, interval_us);
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_SPEED, interval_us);
 
-        // Перезапускаем таймер с новой задержкой
-        esp_timer_stop(motor_state.step_timer);
-        esp_timer_start_periodic(motor_state.step_timer, delay);
+    motor->cruise_interval_us = interval_us;
+
+    if (motor->is_moving && motor_remaining_steps(motor) > 0)
+    {
+        motor_pause_stepping(motor);
+        motor_replan(motor, motion_profile_level(&motor->profile, motor->step_index));
     }
 }
 
-void motor_step(uint32_t steps)
+void motor_step(uint8_t shade, uint32_t steps)
 {
+    motor_state_t *motor = motor_get(shade);
     if (steps == 0)
     {
-        motor_stop();
+        motor_stop(shade);
         return;
     }
 
-    ESP_LOGI(TAG, "Starting motor for %lu steps", steps);
+    BENCH_MARK(BENCH_POINT_MOTOR_STEP);
+    ESP_LOGD(TAG, "Starting motor %u for %lu steps", shade, steps);
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_START, steps);
 
     // Останавливаем текущее движение
-    esp_timer_stop(motor_state.step_timer);
+    if (motor->is_moving)
+    {
+        motor_pause_stepping(motor);
+    }
+    else
+    {
+        // Пока генерируются шаги, light sleep запрещен
+        power_manager_acquire(POWER_LOCK_MOTOR);
+    }
 
-    // Устанавливаем параметры движения
-    motor_state.remaining_steps = steps;
-    motor_state.is_moving = true;
+    // Движение целиком: разгон, крейсер и торможение
+    uint32_t delay = motor_cruise_interval(motor);
+    motion_profile_plan(&motor->profile, steps, delay, 0);
+    motor->is_moving = true;
 
-    // Включаем двигатель
-    motor_enable(true);
+    // Питание на ток движения. Повторная команда во время движения уровень не меняет
+    motor_set_power(motor, MOTOR_POWER_RUN);
 
-    // Запускаем таймер
-    uint32_t delay = calculate_delay_from_speed(motor_state.current_speed);
-    esp_err_t ret = esp_timer_start_periodic(motor_state.step_timer, delay);
+    // Запускаем генерацию шагов
+    esp_err_t ret = motor_start_stepping(motor);
 
     if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to start step timer: %s", esp_err_to_name(ret));
-        motor_state.is_moving = false;
+        ESP_LOGE(TAG, "Failed to start stepping: %s", esp_err_to_name(ret));
+        motor->is_moving = false;
+        power_manager_release(POWER_LOCK_MOTOR);
         return;
     }
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    // Каналы RMT запущены, дальше шаги выдаются аппаратно
+    BENCH_MARK(BENCH_POINT_FIRST_STEP);
+#endif
 }
 
-bool motor_is_moving(void)
+bool motor_is_moving(uint8_t shade)
 {
-    return motor_state.is_moving;
+    return motor_get(shade)->is_moving;
 }
 
-void motor_stop(void)
+void motor_stop_smooth(uint8_t shade)
 {
-    if (!motor_state.is_moving)
+    motor_state_t *motor = motor_get(shade);
+    if (!motor->is_moving)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Stopping motor");
+    ESP_LOGD(TAG, "Decelerating motor %u", shade);
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_DECEL, 0);
+
+    // Сокращаем профиль: двигатель сам завершит движение после торможения
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    motor_rmt_request_stop();
+#else
+    motion_profile_request_stop(&motor->profile, motor->step_index);
+#endif
+}
 
-    // Останавливаем таймер
-    esp_timer_stop(motor_state.step_timer);
+void motor_stop(uint8_t shade)
+{
+    motor_state_t *motor = motor_get(shade);
+    if (!motor->is_moving)
+    {
+        return;
+    }
 
-    // Сбрасываем состояние
-    motor_state.is_moving = false;
-    motor_state.remaining_steps = 0;
-    motor_state.current_direction = MOTOR_DIR_STOP;
+    ESP_LOGD(TAG, "Stopping motor %u", shade);
 
-    // Устанавливаем все пины в LOW для экономии энергии
-    motor_write_step(0);
+    // Останавливаем генерацию шагов
+    motor->is_moving = false;
+    motor_pause_stepping(motor);
+    BENCH_MARK(BENCH_POINT_STOPPED);
+    bool completed = (motor_remaining_steps(motor) == 0);
+    TELEMETRY_RECORD(shade, TELEMETRY_EVENT_MOTOR_STOP, completed);
 
-// Выключаем питание двигателя (если есть пин включения)
-#ifdef CONFIG_MOTOR_DISABLE_ON_STOP
-    motor_enable(false);
+    // Сбрасываем состояние
+    motor->profile.total_steps = 0;
+    motor->step_index = 0;
+    motor->current_direction = MOTOR_DIR_STOP;
+    motor_update_stride(motor);
+
+#ifndef CONFIG_MOTOR_STEP_BACKEND_RMT
+    // Катушки остаются в текущей фазе, чтобы ротор не перескакивал на
+    // фазу 0. Ток ограничивает питание: удержание или выключение
+    // (в режиме RMT выходы переходят в уровень покоя сами)
+    motor_write_step(motor, motor->current_step);
 #endif
+
+    motor_set_power(motor, MOTOR_POWER_STOPPED);
+
+    // Уведомление о завершении движения отдается из задачи motor_control
+    motor->done_completed = completed;
+    motor->done_pending = true;
+    power_manager_release(POWER_LOCK_MOTOR);
+    if (motor_task_handle != NULL)
+    {
+        xTaskNotify(motor_task_handle, MOTOR_NOTIFY_BIT(shade), eSetBits);
+    }
 }
 
 static void motor_control_task(void *parameter)
@@ -339,45 +1006,141 @@ static void motor_control_task(void *parameter)
 
     while (1)
     {
-        // Задача для мониторинга состояния и обработки крайних случаев
-        vTaskDelay(pdMS_TO_TICKS(100));
+        // Ожидаем уведомления о завершении движения от генераторов шагов,
+        // бит на каждый мотор
+        uint32_t pending = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &pending, portMAX_DELAY);
 
-        // Проверка на зависание таймера
-        if (motor_state.is_moving && motor_state.remaining_steps > 0)
+        for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
         {
-            // Можно добавить проверку таймаута здесь
+            if (!(pending & MOTOR_NOTIFY_BIT(shade)))
+            {
+                continue;
+            }
+            motor_state_t *motor = &motors[shade];
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+            // RMT выдал все шаги: завершаем движение в контексте задачи.
+            // Уведомление могло устареть, если движение уже перезапущено
+            if (motor->is_moving && !motor_rmt_is_running())
+            {
+                motor_stop(shade);
+            }
+#elif defined(CONFIG_MOTOR_STEP_BACKEND_GPTIMER)
+            // Прерывание выдало последний шаг профиля
+            if (motor->is_moving && motor_remaining_steps(motor) == 0)
+            {
+                motor_stop(shade);
+            }
+#endif
+
+            if (motor->done_pending)
+            {
+                motor->done_pending = false;
+                if (done_callback != NULL)
+                {
+                    done_callback(shade, motor->done_completed, done_callback_arg);
+                }
+            }
         }
     }
 }
 
+void motor_set_done_callback(motor_done_callback_t callback, void *arg)
+{
+    done_callback = callback;
+    done_callback_arg = arg;
+}
+
 // Дополнительные функции для расширенного управления
 
-void motor_set_step_mode(bool half_step)
+// Медленный путь: смена таблицы фаз вне прерывания шага. Движение
+// приостанавливается и продолжается с набранной скоростью
+void motor_set_step_mode(uint8_t shade, bool half_step)
 {
-    motor_state.use_half_step = half_step;
-    ESP_LOGI(TAG, "Step mode set to: %s", half_step ? "half-step" : "full-step");
+    motor_state_t *motor = motor_get(shade);
+    if (half_step == motor->use_half_step)
+    {
+        return;
+    }
+
+    bool restart = motor->is_moving && motor_remaining_steps(motor) > 0;
+    if (restart)
+    {
+        motor_pause_stepping(motor);
+    }
+
+    // Фаза 2k полушага и фаза k полного шага включают одну катушку:
+    // ротор не смещается при переключении
+    motor->current_step = half_step ? motor->current_step << 1 : motor->current_step >> 1;
+    motor->use_half_step = half_step;
+    motor_select_sequence(motor);
+
+    if (restart)
+    {
+        motor_replan(motor, motion_profile_level(&motor->profile, motor->step_index));
+    }
+    ESP_LOGI(TAG, "Motor %u step mode set to: %s", shade, half_step ? "half-step" : "full-step");
+}
+
+int32_t motor_get_position_steps(uint8_t shade)
+{
+    const motor_state_t *motor = motor_get(shade);
+
+    // Абсолютная позиция в шагах. Во время движения RMT учитывает шаги,
+    // выданные с момента старта
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    if (motor->is_moving)
+    {
+        int32_t done = (int32_t)(motor_rmt_get_steps_done() - motor->step_index);
+        return motor->position_steps + done * motor->position_delta;
+    }
+#endif
+    return motor->position_steps;
+}
+
+// Текущая скорость по профилю движения, вниз - положительная
+int32_t motor_get_velocity_sps(uint8_t shade)
+{
+    const motor_state_t *motor = motor_get(shade);
+    if (!motor->is_moving || motor->current_direction == MOTOR_DIR_STOP)
+    {
+        return 0;
+    }
+
+#ifdef CONFIG_MOTOR_STEP_BACKEND_RMT
+    uint32_t step = motor_rmt_get_steps_done();
+#else
+    uint32_t step = motor->step_index;
+#endif
+    uint32_t interval = motion_profile_interval(&motor->profile, step);
+    if (interval == 0)
+    {
+        return 0;
+    }
+
+    int32_t speed = (int32_t)(1000000 / interval);
+    return motor->current_direction == MOTOR_DIR_UP ? -speed : speed;
 }
 
-uint32_t motor_get_position_steps(void)
+void motor_set_position_steps(uint8_t shade, int32_t steps)
 {
-    // Возвращает текущую позицию в шагах от начала
-    // Для этого нужно добавить счетчик абсолютной позиции
-    return motor_state.current_step;
+    SHADE_SIM_SET_POSITION_STEPS(shade, motor_get(shade)->position_steps, steps);
 }
 
-void motor_move_degrees(float degrees)
+void motor_move_degrees(uint8_t shade, float degrees)
 {
     // Конвертируем градусы в шаги
     // 360 градусов = STEPS_PER_REVOLUTION шагов
     float steps_f = (degrees * STEPS_PER_REVOLUTION) / 360.0f;
     uint32_t steps = (uint32_t)steps_f;
 
-    motor_step(steps);
+    motor_step(shade, steps);
 }
 
-void motor_move_rotations(float rotations)
+void motor_move_rotations(uint8_t shade, float rotations)
 {
     // Конвертируем обороты в шаги
     uint32_t steps = (uint32_t)(rotations * STEPS_PER_REVOLUTION);
-    motor_step(steps);
+    motor_step(shade, steps);
 }
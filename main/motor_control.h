@@ -16,17 +16,30 @@ extern "C"
         MOTOR_DIR_STOP
     } motor_direction_t;
 
+    // Вызывается из задачи motor_control по окончании движения.
+    // completed = true, если профиль движения выполнен полностью
+    typedef void (*motor_done_callback_t)(uint8_t shade, bool completed, void *arg);
+
+    // Моторы всех штор (shade_config.h). Остальные функции принимают
+    // номер шторы с нуля
     void motor_control_init(void);
-    void motor_set_direction(motor_direction_t direction);
-    void motor_set_speed(uint32_t speed);
-    void motor_step(uint32_t steps);
-    bool motor_is_moving(void);
-    void motor_stop(void);
-
-    void motor_set_step_mode(bool half_step);
-    uint32_t motor_get_position_steps(void);
-    void motor_move_degrees(float degrees);
-    void motor_move_rotations(float rotations);
+    void motor_set_direction(uint8_t shade, motor_direction_t direction);
+    void motor_set_speed(uint8_t shade, uint32_t speed);
+    void motor_set_cruise_interval_us(uint8_t shade, uint32_t interval_us);
+    void motor_step(uint8_t shade, uint32_t steps);
+    bool motor_is_moving(uint8_t shade);
+    void motor_stop(uint8_t shade);
+    void motor_stop_smooth(uint8_t shade);
+
+    // Общий обработчик для всех моторов
+    void motor_set_done_callback(motor_done_callback_t callback, void *arg);
+
+    void motor_set_step_mode(uint8_t shade, bool half_step);
+    int32_t motor_get_position_steps(uint8_t shade);
+    void motor_set_position_steps(uint8_t shade, int32_t steps);
+    int32_t motor_get_velocity_sps(uint8_t shade);
+    void motor_move_degrees(uint8_t shade, float degrees);
+    void motor_move_rotations(uint8_t shade, float rotations);
 
 #ifdef __cplusplus
 }
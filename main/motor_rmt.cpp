@@ -0,0 +1,312 @@
+#include "motor_rmt.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/rmt_tx.h"
+#include "driver/rmt_encoder.h"
+#include "soc/soc_caps.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+#if !SOC_RMT_SUPPORT_TX_SYNCHRO || SOC_RMT_TX_CANDIDATES_PER_GROUP < 4
+#error "RMT backend requires 4 synchronized TX channels"
+#endif
+
+static const char *TAG = "motor_rmt";
+
+#define MOTOR_RMT_COILS 4
+#define MOTOR_RMT_RESOLUTION_HZ CONFIG_MOTOR_RMT_RESOLUTION_HZ
+#define MOTOR_RMT_TICKS_PER_US (MOTOR_RMT_RESOLUTION_HZ / 1000000)
+#define MOTOR_RMT_MAX_DURATION 0x7FFF // 15 бит на длительность в символе RMT
+
+// Интервалы шагов задаются в микросекундах и переводятся в такты умножением
+static_assert(MOTOR_RMT_RESOLUTION_HZ % 1000000 == 0, "MOTOR_RMT_RESOLUTION_HZ must be a multiple of 1 MHz");
+
+// Параметры текущего движения. Общие для всех каналов: каждый канал
+// вычисляет свой уровень из номера шага, поэтому каналы не расходятся.
+typedef struct
+{
+    uint8_t coil_pattern[MOTOR_RMT_COILS]; // Бит N = уровень катушки в фазе N
+    uint8_t phase_mask;  // Длина последовательности - 1, степень двойки
+    uint8_t phase_delta; // 1 вперед, phase_mask назад
+    uint8_t start_phase;
+    motion_profile_t *profile; // Интервалы шагов, общие для всех каналов
+} motor_rmt_move_t;
+
+// Контекст энкодера конкретного канала
+typedef struct
+{
+    uint8_t coil;
+    uint32_t encoded_steps; // Сколько шагов уже передано в память канала
+} motor_rmt_coil_t;
+
+typedef struct
+{
+    rmt_channel_handle_t channels[MOTOR_RMT_COILS];
+    rmt_encoder_handle_t encoders[MOTOR_RMT_COILS];
+    motor_rmt_coil_t coils[MOTOR_RMT_COILS];
+    rmt_sync_manager_handle_t sync;
+    motor_rmt_done_cb_t done_cb;
+    void *done_arg;
+    motor_rmt_move_t move;
+    int64_t start_time_us;
+    portMUX_TYPE lock; // Согласует энкодеры каналов с изменением профиля
+    volatile bool running;
+} motor_rmt_state_t;
+
+static DRAM_ATTR motor_rmt_state_t rmt_state = {};
+
+static inline uint16_t IRAM_ATTR motor_rmt_ticks(const motor_rmt_move_t *move, uint32_t step)
+{
+    uint32_t ticks = motion_profile_interval(move->profile, step) * MOTOR_RMT_TICKS_PER_US;
+    return ticks > MOTOR_RMT_MAX_DURATION ? MOTOR_RMT_MAX_DURATION : ticks;
+}
+
+static inline uint8_t IRAM_ATTR motor_rmt_level(const motor_rmt_move_t *move, uint8_t coil, uint32_t step)
+{
+    // Шаг k выводит фазу start_phase ± (k + 1), как и программный таймер
+    uint32_t phase = (move->start_phase + (step + 1) * move->phase_delta) & move->phase_mask;
+    return (move->coil_pattern[coil] >> phase) & 1;
+}
+
+// Энкодер вызывается драйвером из ISR по мере освобождения памяти канала.
+// Один символ RMT несет два шага.
+static size_t IRAM_ATTR motor_rmt_encode(const void *data, size_t data_size,
+                                         size_t symbols_written, size_t symbols_free,
+                                         rmt_symbol_word_t *symbols, bool *done, void *arg)
+{
+    const motor_rmt_move_t *move = (const motor_rmt_move_t *)data;
+    const motor_rmt_coil_t *coil = (const motor_rmt_coil_t *)arg;
+
+    // Непрерывное движение идет до UINT32_MAX шагов: 32-битный счетчик
+    // переполнился бы на последнем символе и энкодер начал бы сначала
+    uint64_t step = (uint64_t)symbols_written * 2;
+    size_t count = 0;
+
+    portENTER_CRITICAL_ISR(&rmt_state.lock);
+    uint32_t total_steps = move->profile->total_steps;
+
+    while (count < symbols_free && step < total_steps)
+    {
+        rmt_symbol_word_t *symbol = &symbols[count++];
+        uint32_t current = (uint32_t)step;
+        uint16_t ticks = motor_rmt_ticks(move, current);
+        symbol->level0 = motor_rmt_level(move, coil->coil, current);
+        symbol->duration0 = ticks;
+
+        if (step + 1 < total_steps)
+        {
+            symbol->level1 = motor_rmt_level(move, coil->coil, current + 1);
+            symbol->duration1 = motor_rmt_ticks(move, current + 1);
+        }
+        else
+        {
+            // Нечетное число шагов: делим последний шаг пополам, чтобы не
+            // записать нулевую длительность (маркер конца) раньше времени
+            symbol->duration0 = ticks / 2;
+            symbol->level1 = symbol->level0;
+            symbol->duration1 = ticks - ticks / 2;
+        }
+        step += 2;
+    }
+
+    rmt_state.coils[coil->coil].encoded_steps = step < total_steps ? (uint32_t)step : total_steps;
+    portEXIT_CRITICAL_ISR(&rmt_state.lock);
+
+    *done = (step >= total_steps);
+    return count;
+}
+
+static bool IRAM_ATTR motor_rmt_on_trans_done(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t *edata, void *user_ctx)
+{
+    rmt_state.running = false;
+    if (rmt_state.done_cb != NULL)
+    {
+        rmt_state.done_cb(rmt_state.done_arg);
+    }
+    return false;
+}
+
+esp_err_t motor_rmt_init(const int pins[4], motor_rmt_done_cb_t done_cb, void *arg)
+{
+    memset(&rmt_state, 0, sizeof(rmt_state));
+    portMUX_INITIALIZE(&rmt_state.lock);
+    rmt_state.done_cb = done_cb;
+    rmt_state.done_arg = arg;
+
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        rmt_tx_channel_config_t channel_config = {
+            .gpio_num = (gpio_num_t)pins[i],
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = MOTOR_RMT_RESOLUTION_HZ,
+            .mem_block_symbols = CONFIG_MOTOR_RMT_MEM_BLOCK_SYMBOLS,
+            .trans_queue_depth = 1,
+        };
+        esp_err_t ret = rmt_new_tx_channel(&channel_config, &rmt_state.channels[i]);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create RMT channel for pin %d: %s", pins[i], esp_err_to_name(ret));
+            return ret;
+        }
+
+        rmt_state.coils[i].coil = i;
+        rmt_simple_encoder_config_t encoder_config = {
+            .callback = motor_rmt_encode,
+            .arg = &rmt_state.coils[i],
+            .min_chunk_size = 1,
+        };
+        ret = rmt_new_simple_encoder(&encoder_config, &rmt_state.encoders[i]);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create RMT encoder: %s", esp_err_to_name(ret));
+            return ret;
+        }
+
+        ESP_ERROR_CHECK(rmt_enable(rmt_state.channels[i]));
+    }
+
+    // Завершение движения отслеживаем по первому каналу, остальные идут синхронно
+    rmt_tx_event_callbacks_t callbacks = {
+        .on_trans_done = motor_rmt_on_trans_done,
+    };
+    ESP_ERROR_CHECK(rmt_tx_register_event_callbacks(rmt_state.channels[0], &callbacks, NULL));
+
+    rmt_sync_manager_config_t sync_config = {
+        .tx_channel_array = rmt_state.channels,
+        .array_size = MOTOR_RMT_COILS,
+    };
+    esp_err_t ret = rmt_new_sync_manager(&sync_config, &rmt_state.sync);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create RMT sync manager: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "RMT step backend initialized, resolution %d Hz", MOTOR_RMT_RESOLUTION_HZ);
+    return ESP_OK;
+}
+
+esp_err_t motor_rmt_start(const uint8_t *sequence, uint8_t phase_mask,
+                          uint8_t start_phase, bool forward,
+                          motion_profile_t *profile)
+{
+    if (rmt_state.running)
+    {
+        motor_rmt_stop();
+    }
+
+    // Таблицу шагов переводим в битовые маски: энкодер работает из ISR
+    // и не должен обращаться к константам во flash
+    motor_rmt_move_t *move = &rmt_state.move;
+    memset(move, 0, sizeof(*move));
+    for (uint8_t phase = 0; phase <= phase_mask; phase++)
+    {
+        for (int coil = 0; coil < MOTOR_RMT_COILS; coil++)
+        {
+            if (sequence[phase] & (1 << coil))
+            {
+                move->coil_pattern[coil] |= (1 << phase);
+            }
+        }
+    }
+    move->phase_mask = phase_mask;
+    move->phase_delta = forward ? 1 : phase_mask;
+    move->start_phase = start_phase;
+    move->profile = profile;
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        rmt_state.coils[i].encoded_steps = 0;
+    }
+
+    ESP_ERROR_CHECK(rmt_sync_reset(rmt_state.sync));
+
+    // Конец передачи обесточивает катушки: последняя фаза неизвестна заранее
+    // (остановка укорачивает профиль), поэтому удержания с RMT нет, см.
+    // MOTOR_PWM_HOLD_DUTY
+    rmt_transmit_config_t tx_config = {
+        .loop_count = 0,
+        .flags = {
+            .eot_level = 0,
+        },
+    };
+
+    rmt_state.running = true;
+    // Каналы стартуют одновременно после передачи в последний из них
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        esp_err_t ret = rmt_transmit(rmt_state.channels[i], rmt_state.encoders[i], move, sizeof(*move), &tx_config);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to start RMT transmission: %s", esp_err_to_name(ret));
+            motor_rmt_stop();
+            return ret;
+        }
+    }
+    rmt_state.start_time_us = esp_timer_get_time();
+
+    return ESP_OK;
+}
+
+uint32_t motor_rmt_get_steps_done(void)
+{
+    if (rmt_state.move.profile == NULL)
+    {
+        return 0;
+    }
+
+    if (!rmt_state.running)
+    {
+        return rmt_state.move.profile->total_steps;
+    }
+
+    // Позиция определяется временем от старта по профилю движения
+    int64_t elapsed = esp_timer_get_time() - rmt_state.start_time_us;
+    return motion_profile_steps_at(rmt_state.move.profile, elapsed > 0 ? (uint64_t)elapsed : 0);
+}
+
+// Плавная остановка. Торможение начинается после шагов, уже переданных
+// в память каналов, чтобы все каналы получили одинаковый профиль
+void motor_rmt_request_stop(void)
+{
+    if (!rmt_state.running)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&rmt_state.lock);
+    uint32_t encoded = 0;
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        if (rmt_state.coils[i].encoded_steps > encoded)
+        {
+            encoded = rmt_state.coils[i].encoded_steps;
+        }
+    }
+    motion_profile_request_stop(rmt_state.move.profile, encoded);
+    portEXIT_CRITICAL(&rmt_state.lock);
+}
+
+bool motor_rmt_is_running(void)
+{
+    return rmt_state.running;
+}
+
+uint32_t motor_rmt_stop(void)
+{
+    uint32_t done = motor_rmt_get_steps_done();
+
+    // rmt_disable прерывает текущую передачу, выход принимает уровень покоя
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        rmt_disable(rmt_state.channels[i]);
+    }
+    rmt_state.running = false;
+    for (int i = 0; i < MOTOR_RMT_COILS; i++)
+    {
+        rmt_enable(rmt_state.channels[i]);
+    }
+
+    return done;
+}
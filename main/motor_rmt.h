@@ -0,0 +1,31 @@
+// Аппаратный генератор шагов на RMT
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "motion_planner.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Вызывается из ISR после выдачи последнего шага
+    typedef void (*motor_rmt_done_cb_t)(void *arg);
+
+    esp_err_t motor_rmt_init(const int pins[4], motor_rmt_done_cb_t done_cb, void *arg);
+
+    // sequence - катушки по фазам (бит i - катушка i), phase_mask - длина
+    // последовательности минус один, длина - степень двойки
+    esp_err_t motor_rmt_start(const uint8_t *sequence, uint8_t phase_mask,
+                              uint8_t start_phase, bool forward,
+                              motion_profile_t *profile);
+    void motor_rmt_request_stop(void);
+    uint32_t motor_rmt_stop(void);
+    uint32_t motor_rmt_get_steps_done(void);
+    bool motor_rmt_is_running(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,41 +6,240 @@
 #include "freertos/semphr.h"
 #include "esp_mac.h"
 #include "esp_random.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
 #include "controller.h"
+#include "shade_config.h"
+#include "bench.h"
+#include "telemetry.h"
+#include "diagnostics.h"
+#ifdef CONFIG_SHADE_SIMULATION
+#include "sim_bench.h"
+#endif
+#ifdef CONFIG_SHADE_SCHEDULER
+#include "scheduler.h"
+#endif
+#ifdef CONFIG_SHADE_OTA
+#include "ota_update.h"
+#endif
 #include <string.h>
+#include <stdlib.h>
+
+#include "time_sync.h"
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+#include <sys/time.h>
+#endif
 
 static const char *TAG = "mqtt_integration";
 static esp_mqtt_client_handle_t mqtt_client = NULL;
 static SemaphoreHandle_t mqtt_mutex = NULL;
 static bool mqtt_connected = false;
 
-// Обработка MQTT команд
-static void mqtt_handle_command(const char *payload, int payload_len)
+// Топики и неизменяемые сообщения формируются один раз в mqtt_integration_init,
+// при публикации форматируется только переменная часть
+#define MQTT_TOPIC_MAX_LEN 128
+#define MQTT_DISCOVERY_PAYLOAD_MAX_LEN 1024
+
+// Команды движения подписываются с QoS 1 и доставляются через постоянную
+// сессию. Устаревшие кадры отбрасываются по CONFIG_MQTT_COMMAND_MAX_AGE_MS
+#define MQTT_COMMAND_QOS 1
+
+// Подписки хранит постоянная сессия брокера. Версия набора подписок - хэш
+// топиков и QoS - хранится в NVS после подтверждения: сессия с подписками
+// прежней прошивки или другой конфигурации подписывается заново один раз
+#define MQTT_NVS_NAMESPACE "mqtt"
+#define MQTT_NVS_SUBSCRIPTION_VERSION "sub_ver"
+
+// Обход набора подписок: с отправкой или только для хэша
+typedef struct
+{
+    bool send;
+    int msg_id; // Последняя отправленная подписка
+    uint32_t hash;
+} mqtt_subscription_set_t;
+
+static uint32_t subscription_version = 0;
+static uint32_t subscription_stored_version = 0;
+static int subscription_msg_id = -1;
+
+static void mqtt_store_u32(const char *key, uint32_t value);
+
+// Топики и состояние публикации одной шторы. Первая штора использует
+// топики из Kconfig, остальные - те же топики с суффиксом "/<номер>"
+typedef struct
+{
+    char position_topic[MQTT_TOPIC_MAX_LEN];
+    char movement_topic[MQTT_TOPIC_MAX_LEN];
+    char command_topic[MQTT_TOPIC_MAX_LEN];
+    char state_topic[MQTT_TOPIC_MAX_LEN];
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+    char compact_topic[MQTT_TOPIC_MAX_LEN];
+    esp_timer_handle_t scheduled_timer;
+    controller_command_t scheduled_command;
+#endif
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+    char discovery_topic[MQTT_TOPIC_MAX_LEN];
+    char discovery_payload[MQTT_DISCOVERY_PAYLOAD_MAX_LEN];
+    int discovery_payload_len;
+    uint32_t discovery_hash;
+    uint32_t discovery_stored_hash;
+    int discovery_msg_id;
+#endif
+
+    // Последнее состояние контроллера для задачи публикации
+    state_t publisher_state;
+    float publisher_position;
+    bool publisher_resync; // Опубликовать все заново (после подключения)
+} mqtt_shade_t;
+
+static mqtt_shade_t shades[SHADE_COUNT] = {};
+static char availability_topic[MQTT_TOPIC_MAX_LEN];
+#ifdef CONFIG_TELEMETRY_ENABLED
+static char telemetry_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+static char diagnostics_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_BENCHMARK_ENABLED
+static char bench_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_SHADE_SIMULATION
+static char sim_bench_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_SHADE_SCHEDULER
+static char schedule_topic[MQTT_TOPIC_MAX_LEN];
+static char schedule_set_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_SHADE_OTA
+static char ota_topic[MQTT_TOPIC_MAX_LEN];
+static char ota_state_topic[MQTT_TOPIC_MAX_LEN];
+#endif
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+static char device_unique_id[32];
+static char ha_status_topic[MQTT_TOPIC_MAX_LEN];
+
+// Конфигурация публикуется повторно, только если изменилось ее содержимое.
+// Хэш последней подтвержденной брокером публикации хранится в NVS
+#define MQTT_NVS_DISCOVERY_HASH "disc_hash"
+
+static void mqtt_store_discovery_hash(mqtt_shade_t *shade, uint32_t hash);
+static esp_err_t mqtt_publish_discovery(mqtt_shade_t *shade);
+#endif
+
+#define MQTT_PUBLISH_MIN_INTERVAL_MS CONFIG_MQTT_PUBLISH_MIN_INTERVAL_MS
+#define MQTT_PUBLISH_POSITION_DELTA CONFIG_MQTT_PUBLISH_POSITION_DELTA
+#define MQTT_PUBLISH_MAX_INTERVAL_MS (CONFIG_MQTT_PUBLISH_MAX_INTERVAL_S * 1000LL)
+
+// Задача публикации состояния. Контроллер сообщает о смене состояния,
+// положение во время движения берется из кэша датчика
+static TaskHandle_t publisher_task_handle = NULL;
+static portMUX_TYPE publisher_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t mqtt_shade_index(const mqtt_shade_t *shade)
+{
+    return (uint8_t)(shade - shades);
+}
+
+// Положение для Home Assistant: 100 - открыто (верх), 0 - закрыто (низ),
+// в контроллере проценты отсчитываются от верхнего положения
+static uint8_t mqtt_position_from_percentage(float percentage)
+{
+    if (percentage <= 0.0f)
+    {
+        return 100;
+    }
+    if (percentage >= 100.0f)
+    {
+        return 0;
+    }
+    return 100 - (uint8_t)(percentage + 0.5f);
+}
+
+static void mqtt_submit_command(uint8_t shade, controller_command_type_t type, float percentage)
+{
+    controller_command_t command = {};
+    command.type = type;
+    command.percentage = percentage;
+    command.source = CONTROLLER_SOURCE_MQTT;
+    command.shade = shade;
+    controller_submit(&command);
+}
+
+// Обработка MQTT команд. Команды журнала и замеров относятся ко всему
+// устройству и принимаются в топике любой шторы
+static void mqtt_handle_command(uint8_t shade, const char *payload, int payload_len)
 {
     if (payload_len <= 0)
         return;
 
+    BENCH_MARK(BENCH_POINT_MQTT);
+
     // Создаем нуль-терминированную строку из payload
     char command[32];
     int copy_len = (payload_len < sizeof(command) - 1) ? payload_len : sizeof(command) - 1;
     memcpy(command, payload, copy_len);
     command[copy_len] = '\0';
 
-    ESP_LOGI(TAG, "Processing MQTT command: %s", command);
+    ESP_LOGI(TAG, "Processing MQTT command: %s, shade %u", command, shade + 1);
 
     // Обрабатываем команды от Home Assistant
     if (strcmp(command, "OPEN") == 0)
     {
-        controller_move_up();
+        mqtt_submit_command(shade, CONTROLLER_CMD_MOVE_UP, 0.0f);
     }
     else if (strcmp(command, "CLOSE") == 0)
     {
-        controller_move_down();
+        mqtt_submit_command(shade, CONTROLLER_CMD_MOVE_DOWN, 0.0f);
     }
     else if (strcmp(command, "STOP") == 0)
     {
-        controller_stop();
+        mqtt_submit_command(shade, CONTROLLER_CMD_STOP, 0.0f);
+    }
+    else if (strcmp(command, "AUTO_CALIBRATE") == 0)
+    {
+        mqtt_submit_command(shade, CONTROLLER_CMD_AUTO_CALIBRATE, 0.0f);
+    }
+#ifdef CONFIG_TELEMETRY_ENABLED
+    else if (strcmp(command, "TELEMETRY") == 0)
+    {
+        // Двоичный снимок журнала в топик <позиция>/telemetry
+        uint8_t *snapshot = NULL;
+        size_t length = telemetry_export(&snapshot);
+        if (snapshot != NULL)
+        {
+            esp_mqtt_client_publish(mqtt_client, telemetry_topic, (const char *)snapshot, length, 0, 0);
+            free(snapshot);
+        }
+        telemetry_dump();
+    }
+#endif
+#ifdef CONFIG_BENCHMARK_ENABLED
+    else if (strcmp(command, "BENCH") == 0)
+    {
+        // Отчет замеров в топик <позиция>/bench
+        static char report[1024];
+        size_t length = bench_format(report, sizeof(report));
+        esp_mqtt_client_publish(mqtt_client, bench_topic, report, length, 0, 0);
+        bench_dump();
+    }
+    else if (strcmp(command, "BENCH_RESET") == 0)
+    {
+        bench_reset();
     }
+#endif
+#ifdef CONFIG_SHADE_SIMULATION
+    else if (strcmp(command, "SIM_BENCH") == 0)
+    {
+        // Прогон идет минуты, отчет - командой SIM_BENCH_REPORT
+        sim_bench_start();
+    }
+    else if (strcmp(command, "SIM_BENCH_REPORT") == 0)
+    {
+        static char report[768];
+        size_t length = sim_bench_format(report, sizeof(report));
+        esp_mqtt_client_publish(mqtt_client, sim_bench_topic, report, length, 0, 0);
+    }
+#endif
     else
     {
         // Проверяем, является ли команда числом (позиция в процентах)
@@ -48,7 +247,7 @@ static void mqtt_handle_command(const char *payload, int payload_len)
         long position = strtol(command, &endptr, 10);
         if (*endptr == '\0' && position >= 0 && position <= 100)
         {
-            controller_set_position_percentage((float)position);
+            mqtt_submit_command(shade, CONTROLLER_CMD_SET_PERCENTAGE, 100.0f - (float)position);
         }
         else
         {
@@ -57,6 +256,199 @@ static void mqtt_handle_command(const char *payload, int payload_len)
     }
 }
 
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+// Компактный кадр команд (little-endian):
+//   [0]    версия, MQTT_FRAME_VERSION
+//   [1]    флаги: MQTT_FRAME_FLAG_START_TIME, MQTT_FRAME_FLAG_ARRIVE_TIME
+//   8 байт  время старта, мс от 1970 года (только с флагом)
+//   8 байт  время прибытия к цели, мс от 1970 года (только с флагом):
+//           скорость подбирается по расстоянию, шторы группы приходят вместе
+//   далее записи по 3 байта: номер шторы в группе, положение, скорость
+// Положение 0-100 (100 - открыто) или MQTT_FRAME_TARGET_STOP, скорость 1-100
+// или 0 - текущая. В топике устройства выполняется первая запись, в групповом -
+// запись со своим номером или с MQTT_FRAME_MEMBER_ALL. Шторы устройства
+// занимают в группе номера с CONFIG_MQTT_GROUP_MEMBER подряд
+#define MQTT_FRAME_VERSION 1
+#define MQTT_FRAME_FLAG_START_TIME 0x01
+#define MQTT_FRAME_FLAG_ARRIVE_TIME 0x02
+#define MQTT_FRAME_HEADER_SIZE 2
+#define MQTT_FRAME_TIME_SIZE 8
+#define MQTT_FRAME_ENTRY_SIZE 3
+#define MQTT_FRAME_TARGET_STOP 0xFF
+#define MQTT_FRAME_MEMBER_ALL 0xFF
+
+static void mqtt_scheduled_start(void *arg)
+{
+    mqtt_shade_t *shade = (mqtt_shade_t *)arg;
+    controller_submit(&shade->scheduled_command);
+}
+
+static bool mqtt_frame_read_time(const uint8_t *frame, int length, int *offset, uint64_t *time_ms)
+{
+    if (length < *offset + MQTT_FRAME_TIME_SIZE + MQTT_FRAME_ENTRY_SIZE)
+    {
+        ESP_LOGW(TAG, "Compact frame too short for time field");
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (int i = MQTT_FRAME_TIME_SIZE - 1; i >= 0; i--)
+    {
+        value = (value << 8) | frame[*offset + i];
+    }
+    *offset += MQTT_FRAME_TIME_SIZE;
+    *time_ms = value;
+    return true;
+}
+
+static int64_t mqtt_unix_time_ms(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static void mqtt_handle_compact_frame(mqtt_shade_t *shade, const uint8_t *frame, int length, bool group)
+{
+    uint8_t index = mqtt_shade_index(shade);
+
+    BENCH_MARK(BENCH_POINT_MQTT);
+
+    if (length < MQTT_FRAME_HEADER_SIZE + MQTT_FRAME_ENTRY_SIZE || frame[0] != MQTT_FRAME_VERSION)
+    {
+        ESP_LOGW(TAG, "Invalid compact frame, %d bytes", length);
+        return;
+    }
+
+    int offset = MQTT_FRAME_HEADER_SIZE;
+    uint64_t start_ms = 0;
+    uint64_t arrive_ms = 0;
+    if (frame[1] & MQTT_FRAME_FLAG_START_TIME)
+    {
+        if (!mqtt_frame_read_time(frame, length, &offset, &start_ms))
+        {
+            return;
+        }
+    }
+    if (frame[1] & MQTT_FRAME_FLAG_ARRIVE_TIME)
+    {
+        if (!mqtt_frame_read_time(frame, length, &offset, &arrive_ms))
+        {
+            return;
+        }
+    }
+
+    // Запись для этой шторы
+    const uint8_t *entry = NULL;
+    for (; offset + MQTT_FRAME_ENTRY_SIZE <= length; offset += MQTT_FRAME_ENTRY_SIZE)
+    {
+        uint8_t member = frame[offset];
+        if (!group || member == CONFIG_MQTT_GROUP_MEMBER + index || member == MQTT_FRAME_MEMBER_ALL)
+        {
+            entry = &frame[offset];
+            break;
+        }
+    }
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    uint8_t target = entry[1];
+    uint8_t speed = entry[2];
+    if ((target > 100 && target != MQTT_FRAME_TARGET_STOP) || speed > 100)
+    {
+        ESP_LOGW(TAG, "Invalid compact command: target %u, speed %u", target, speed);
+        return;
+    }
+
+    controller_command_t command = {};
+    command.source = CONTROLLER_SOURCE_MQTT;
+    command.shade = index;
+    if (target == MQTT_FRAME_TARGET_STOP)
+    {
+        command.type = CONTROLLER_CMD_STOP;
+    }
+    else
+    {
+        command.type = CONTROLLER_CMD_SET_PERCENTAGE;
+        command.percentage = 100.0f - (float)target;
+        command.speed = speed;
+    }
+
+    // Старт по времени: без синхронизации часов или с прошедшим временем - сразу
+    int64_t delay_ms = 0;
+    int64_t now_ms = mqtt_unix_time_ms();
+    if (start_ms != 0 && time_sync_is_synced())
+    {
+        delay_ms = (int64_t)start_ms - now_ms;
+        if (delay_ms > CONFIG_MQTT_START_TIME_MAX_AHEAD_MS)
+        {
+            ESP_LOGW(TAG, "Start time %lld ms ahead, command dropped", delay_ms);
+            return;
+        }
+    }
+
+    // Кадр, доставленный с опозданием (очередь брокера, повтор QoS),
+    // уже не отражает намерение отправителя
+    uint64_t sent_ms = start_ms != 0 ? start_ms : arrive_ms;
+    if (sent_ms != 0 && time_sync_is_synced() && now_ms - (int64_t)sent_ms > CONFIG_MQTT_COMMAND_MAX_AGE_MS)
+    {
+        ESP_LOGW(TAG, "Compact command %lld ms old, dropped", now_ms - (int64_t)sent_ms);
+        return;
+    }
+
+    // Время прибытия переводится в шкалу esp_timer, на которой работает контроллер
+    if (arrive_ms != 0 && time_sync_is_synced() && command.type != CONTROLLER_CMD_STOP)
+    {
+        command.arrive_at_us = esp_timer_get_time() + ((int64_t)arrive_ms - now_ms) * 1000;
+    }
+
+    // Новая команда заменяет ожидающую старта
+    esp_timer_stop(shade->scheduled_timer);
+    if (delay_ms <= 0)
+    {
+        controller_submit(&command);
+        return;
+    }
+
+    shade->scheduled_command = command;
+    esp_timer_start_once(shade->scheduled_timer, delay_ms * 1000);
+    ESP_LOGD(TAG, "Compact command for shade %u scheduled in %lld ms", index + 1, delay_ms);
+}
+
+#endif
+
+static bool mqtt_topic_matches(esp_mqtt_event_handle_t event, const char *topic)
+{
+    return event->topic_len == (int)strlen(topic) && memcmp(event->topic, topic, event->topic_len) == 0;
+}
+
+#ifdef CONFIG_SHADE_OTA
+// Состояние обновления с retain: после перезагрузки в топике остается
+// версия новой прошивки
+static void mqtt_publish_ota_status(const char *status, void *arg)
+{
+    if (mqtt_connected && mqtt_client != NULL)
+    {
+        esp_mqtt_client_publish(mqtt_client, ota_state_topic, status, 0, 1, true);
+    }
+}
+#endif
+
+#ifdef CONFIG_SHADE_SCHEDULER
+// Действующие правила с retain: концентратор видит расписание устройства
+static void mqtt_publish_schedule(void)
+{
+    static char payload[SCHEDULER_TEXT_MAX_LEN];
+    size_t length = scheduler_format_rules(payload, sizeof(payload));
+    if (esp_mqtt_client_publish(mqtt_client, schedule_topic, payload, length, 1, true) == -1)
+    {
+        ESP_LOGE(TAG, "Failed to publish schedule");
+    }
+}
+#endif
+
 // Обработчик событий MQTT
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -65,37 +457,173 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     switch (event->event_id)
     {
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT connected");
+        ESP_LOGI(TAG, "MQTT connected, session present: %d", event->session_present);
         mqtt_connected = true;
-        mqtt_integration_subscribe_commands();
+        BENCH_BOOT(BENCH_BOOT_MQTT_CONNECTED);
+
+#ifdef CONFIG_SHADE_TIME_SYNC
+        // Сеть уже доступна: запускаем синхронизацию времени для старта
+        // по времени и расписания
+        time_sync_start();
+#endif
+
+        // Постоянная сессия: брокер сохранил подписки с прошлого подключения.
+        // Подписки другой версии (прежняя прошивка) обновляются один раз
+        if (!event->session_present || subscription_stored_version != subscription_version)
+        {
+            mqtt_integration_subscribe_commands();
+        }
+
+        // Сообщение "offline" брокер публикует сам (Last Will) при обрыве связи
+        esp_mqtt_client_publish(mqtt_client, availability_topic, "online", 0, 1, true);
+#ifdef CONFIG_SHADE_SCHEDULER
+        mqtt_publish_schedule();
+#endif
+#ifdef CONFIG_SHADE_OTA
+        {
+            // Связь с брокером - условие подтверждения новой прошивки
+            ota_update_network_ready();
+            char status[64];
+            ota_update_get_status(status, sizeof(status));
+            mqtt_publish_ota_status(status, NULL);
+        }
+#endif
+
+        // Брокер мог пропустить публикации, пока клиент был отключен
+        portENTER_CRITICAL(&publisher_lock);
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            shades[i].publisher_resync = true;
+        }
+        portEXIT_CRITICAL(&publisher_lock);
+        if (publisher_task_handle != NULL)
+        {
+            xTaskNotifyGive(publisher_task_handle);
+        }
 #ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
-        // Публикуем конфигурацию для Home Assistant
-        mqtt_integration_publish_discovery_config();
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            if (shades[i].discovery_stored_hash != shades[i].discovery_hash)
+            {
+                mqtt_publish_discovery(&shades[i]);
+            }
+        }
 #endif
         break;
 
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT disconnected");
         mqtt_connected = false;
+        break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+        // Брокер подтвердил весь набор подписок: версия сохраняется в сессии
+        if (event->msg_id == subscription_msg_id)
+        {
+            subscription_msg_id = -1;
+            if (subscription_stored_version != subscription_version)
+            {
+                subscription_stored_version = subscription_version;
+                mqtt_store_u32(MQTT_NVS_SUBSCRIPTION_VERSION, subscription_version);
+            }
+        }
+        break;
+
 #ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
-        // Публикуем статус недоступности для Home Assistant
-        char availability_topic[256];
-        snprintf(availability_topic, sizeof(availability_topic),
-                 "%s/availability", CONFIG_MQTT_TOPIC_POSITION);
-        // Публикуем статус offline с retain flag
-        esp_mqtt_client_publish(mqtt_client, availability_topic, "offline", 0, 1, true);
-#endif
+    case MQTT_EVENT_PUBLISHED:
+        // Конфигурация доставлена: запоминаем ее хэш
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            if (event->msg_id == shades[i].discovery_msg_id)
+            {
+                shades[i].discovery_msg_id = -1;
+                mqtt_store_discovery_hash(&shades[i], shades[i].discovery_hash);
+            }
+        }
         break;
+#endif
 
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT data received, topic: %.*s", event->topic_len, event->topic);
 
-        // Проверяем является ли это командным топиком
-        if (event->topic_len == strlen(CONFIG_MQTT_TOPIC_COMMAND) &&
-            memcmp(event->topic, CONFIG_MQTT_TOPIC_COMMAND, event->topic_len) == 0)
+        // Командные топики штор
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            if (mqtt_topic_matches(event, shades[i].command_topic))
+            {
+                mqtt_handle_command(i, event->data, event->data_len);
+                return;
+            }
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+            if (mqtt_topic_matches(event, shades[i].compact_topic))
+            {
+                mqtt_handle_compact_frame(&shades[i], (const uint8_t *)event->data, event->data_len, false);
+                return;
+            }
+#endif
+        }
+
+#ifdef CONFIG_SHADE_SCHEDULER
+        if (mqtt_topic_matches(event, schedule_set_topic))
+        {
+            // Набор правил целиком заменяет прежний, пустое сообщение их удаляет.
+            // В ответ публикуются действующие правила, в том числе при ошибке
+            esp_err_t err = event->data_len == event->total_data_len
+                                ? scheduler_parse_rules(event->data, event->data_len)
+                                : ESP_ERR_INVALID_SIZE;
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Schedule rejected: %s", esp_err_to_name(err));
+            }
+            mqtt_publish_schedule();
+            break;
+        }
+#endif
+
+#ifdef CONFIG_SHADE_OTA_HTTPS
+        if (mqtt_topic_matches(event, ota_topic))
         {
-            mqtt_handle_command(event->data, event->data_len);
+            // Адрес образа, ход загрузки сообщает ota_update. Сохраненное
+            // брокером сообщение повторило бы загрузку после каждой подписки
+            esp_err_t err = ESP_ERR_INVALID_SIZE;
+            if (event->retain)
+            {
+                err = ESP_ERR_NOT_SUPPORTED;
+            }
+            else if (event->data_len == event->total_data_len)
+            {
+                err = ota_update_start(event->data, event->data_len);
+            }
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Update rejected: %s", esp_err_to_name(err));
+                char status[64];
+                snprintf(status, sizeof(status), "failed %s", esp_err_to_name(err));
+                mqtt_publish_ota_status(status, NULL);
+            }
+            break;
         }
+#endif
+
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+        if (sizeof(CONFIG_MQTT_TOPIC_GROUP) > 1 && mqtt_topic_matches(event, CONFIG_MQTT_TOPIC_GROUP))
+        {
+            // Один кадр группы адресован всем шторам устройства
+            for (uint8_t i = 0; i < SHADE_COUNT; i++)
+            {
+                mqtt_handle_compact_frame(&shades[i], (const uint8_t *)event->data, event->data_len, true);
+            }
+            break;
+        }
+#endif
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+        // Home Assistant перезапущен и мог потерять конфигурацию (брокер без хранения)
+        if (mqtt_topic_matches(event, ha_status_topic) &&
+            event->data_len == 6 && memcmp(event->data, "online", 6) == 0)
+        {
+            mqtt_integration_publish_discovery_config();
+        }
+#endif
         break;
 
     default:
@@ -103,6 +631,249 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+static esp_err_t mqtt_prepare_discovery(void);
+#endif
+
+// Топик шторы: у первой - заданный в Kconfig, у остальных - с номером
+static bool mqtt_shade_topic(char *topic, const char *base, uint8_t shade)
+{
+    int length = shade == 0 ? snprintf(topic, MQTT_TOPIC_MAX_LEN, "%s", base)
+                            : snprintf(topic, MQTT_TOPIC_MAX_LEN, "%s/%u", base, shade + 1);
+    return length < MQTT_TOPIC_MAX_LEN;
+}
+
+// Служебный топик устройства: под топиком положения первой шторы
+static bool mqtt_suffix_topic(char *topic, const char *suffix)
+{
+    int length = snprintf(topic, MQTT_TOPIC_MAX_LEN, "%s/%s", CONFIG_MQTT_TOPIC_POSITION, suffix);
+    return length < MQTT_TOPIC_MAX_LEN;
+}
+
+// Топики и сообщения, не меняющиеся во время работы
+static esp_err_t mqtt_prepare_messages(void)
+{
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        mqtt_shade_t *shade = &shades[i];
+        bool ok = mqtt_shade_topic(shade->position_topic, CONFIG_MQTT_TOPIC_POSITION, i) &&
+                  mqtt_shade_topic(shade->movement_topic, CONFIG_MQTT_TOPIC_MOVEMENT, i) &&
+                  mqtt_shade_topic(shade->command_topic, CONFIG_MQTT_TOPIC_COMMAND, i) &&
+                  mqtt_shade_topic(shade->state_topic, CONFIG_MQTT_TOPIC_STATE, i);
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+        ok = ok && mqtt_shade_topic(shade->compact_topic, CONFIG_MQTT_TOPIC_COMMAND_COMPACT, i);
+#endif
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "Topics of shade %u too long", i + 1);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    bool ok = mqtt_suffix_topic(availability_topic, "availability");
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+    ok = ok && mqtt_suffix_topic(diagnostics_topic, "diagnostics");
+#endif
+#ifdef CONFIG_TELEMETRY_ENABLED
+    ok = ok && mqtt_suffix_topic(telemetry_topic, "telemetry");
+#endif
+#ifdef CONFIG_BENCHMARK_ENABLED
+    ok = ok && mqtt_suffix_topic(bench_topic, "bench");
+#endif
+#ifdef CONFIG_SHADE_SIMULATION
+    ok = ok && mqtt_suffix_topic(sim_bench_topic, "sim_bench");
+#endif
+#ifdef CONFIG_SHADE_SCHEDULER
+    ok = ok && mqtt_suffix_topic(schedule_topic, "schedule") &&
+         mqtt_suffix_topic(schedule_set_topic, "schedule/set");
+#endif
+#ifdef CONFIG_SHADE_OTA
+    ok = ok && mqtt_suffix_topic(ota_topic, "ota") && mqtt_suffix_topic(ota_state_topic, "ota/state");
+#endif
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Service topics too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+    return mqtt_prepare_discovery();
+#else
+    return ESP_OK;
+#endif
+}
+
+static bool mqtt_state_is_moving(uint8_t shade, state_t state, bool *direction_up)
+{
+    switch (state)
+    {
+    case MOVING_UP:
+        *direction_up = true;
+        return true;
+    case MOVING_DOWN:
+        *direction_up = false;
+        return true;
+    case CALIBRATING:
+    {
+        int32_t velocity = motor_get_velocity_sps(shade);
+        *direction_up = velocity < 0;
+        return velocity != 0;
+    }
+    default:
+        *direction_up = false;
+        return false;
+    }
+}
+
+// Публикация положения и состояния за одно пробуждение. Во время движения
+// каждая штора публикует положение не чаще MQTT_PUBLISH_MIN_INTERVAL_MS,
+// если оно сдвинулось на MQTT_PUBLISH_POSITION_DELTA. Начало движения и
+// остановка публикуются сразу; конечное состояние повторяется после
+// переподключения, пока не будет отправлено
+static void mqtt_publisher_task(void *parameter)
+{
+    uint8_t published_position[SHADE_COUNT] = {};
+    bool published_moving[SHADE_COUNT] = {};
+    bool published_up[SHADE_COUNT] = {};
+    bool published[SHADE_COUNT] = {};
+    int64_t last_publish_us[SHADE_COUNT] = {};
+
+    while (true)
+    {
+        // Ожидание до ближайшей публикации среди всех штор
+        TickType_t wait = portMAX_DELAY;
+        int64_t now = esp_timer_get_time();
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            portENTER_CRITICAL(&publisher_lock);
+            state_t state = shades[i].publisher_state;
+            portEXIT_CRITICAL(&publisher_lock);
+
+            bool direction_up;
+            bool moving = mqtt_state_is_moving(i, state, &direction_up);
+            int64_t elapsed_ms = (now - last_publish_us[i]) / 1000;
+
+            TickType_t shade_wait = portMAX_DELAY;
+            if (moving)
+            {
+                shade_wait = elapsed_ms >= MQTT_PUBLISH_MIN_INTERVAL_MS ? 0 : pdMS_TO_TICKS(MQTT_PUBLISH_MIN_INTERVAL_MS - elapsed_ms);
+            }
+            else if (MQTT_PUBLISH_MAX_INTERVAL_MS > 0)
+            {
+                shade_wait = elapsed_ms >= MQTT_PUBLISH_MAX_INTERVAL_MS ? 0 : pdMS_TO_TICKS(MQTT_PUBLISH_MAX_INTERVAL_MS - elapsed_ms);
+            }
+            if (shade_wait < wait)
+            {
+                wait = shade_wait;
+            }
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+        now = esp_timer_get_time();
+
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            mqtt_shade_t *shade = &shades[i];
+            portENTER_CRITICAL(&publisher_lock);
+            state_t state = shade->publisher_state;
+            float percentage = shade->publisher_position;
+            bool resync = shade->publisher_resync;
+            shade->publisher_resync = false;
+            portEXIT_CRITICAL(&publisher_lock);
+
+            bool direction_up;
+            bool moving = mqtt_state_is_moving(i, state, &direction_up);
+            if (moving)
+            {
+                percentage = controller_get_position_percentage(i);
+            }
+            uint8_t position = mqtt_position_from_percentage(percentage);
+
+            int64_t elapsed_ms = (now - last_publish_us[i]) / 1000;
+            bool due = elapsed_ms >= MQTT_PUBLISH_MIN_INTERVAL_MS;
+            bool heartbeat = MQTT_PUBLISH_MAX_INTERVAL_MS > 0 && elapsed_ms >= MQTT_PUBLISH_MAX_INTERVAL_MS;
+            bool movement_changed = !published[i] || moving != published_moving[i] || (moving && direction_up != published_up[i]);
+            uint8_t delta = position > published_position[i] ? position - published_position[i] : published_position[i] - position;
+            bool position_changed = !published[i] || (moving ? due && delta >= MQTT_PUBLISH_POSITION_DELTA : delta != 0);
+
+            if (!resync && !heartbeat && !movement_changed && !position_changed)
+            {
+                // Во время движения без изменений ждем следующий интервал
+                if (moving && due)
+                {
+                    last_publish_us[i] = now;
+                }
+                continue;
+            }
+
+            if (!mqtt_connected)
+            {
+                // Конечное состояние будет опубликовано после подключения
+                portENTER_CRITICAL(&publisher_lock);
+                shade->publisher_resync = true;
+                portEXIT_CRITICAL(&publisher_lock);
+                last_publish_us[i] = now;
+                continue;
+            }
+
+            bool ok = mqtt_integration_publish_position(i, position) == ESP_OK;
+            if (resync || heartbeat || movement_changed)
+            {
+                ok &= mqtt_integration_publish_movement(i, moving, direction_up) == ESP_OK;
+                ok &= mqtt_integration_publish_state(i, position, moving, direction_up) == ESP_OK;
+            }
+            else if (!moving)
+            {
+                // Остановка без смены направления: состояние open/closed зависит от положения
+                ok &= mqtt_integration_publish_state(i, position, moving, direction_up) == ESP_OK;
+            }
+
+            last_publish_us[i] = now;
+            if (!ok)
+            {
+                portENTER_CRITICAL(&publisher_lock);
+                shade->publisher_resync = true;
+                portEXIT_CRITICAL(&publisher_lock);
+                continue;
+            }
+
+            published[i] = true;
+            published_position[i] = position;
+            published_moving[i] = moving;
+            published_up[i] = direction_up;
+        }
+    }
+}
+
+static void mqtt_state_listener(uint8_t shade, state_t state, float position, void *arg)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&publisher_lock);
+    shades[shade].publisher_state = state;
+    shades[shade].publisher_position = position;
+    portEXIT_CRITICAL(&publisher_lock);
+
+    if (publisher_task_handle != NULL)
+    {
+        xTaskNotifyGive(publisher_task_handle);
+    }
+}
+
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+// Отчет диагностики, вызывается из задачи диагностики
+static void mqtt_diagnostics_report(const char *report, size_t length, void *arg)
+{
+    if (mqtt_connected && mqtt_client != NULL)
+    {
+        esp_mqtt_client_publish(mqtt_client, diagnostics_topic, report, length, 0, 0);
+    }
+}
+#endif
+
 esp_err_t mqtt_integration_init(void)
 {
     if (mqtt_client != NULL)
@@ -111,6 +882,30 @@ esp_err_t mqtt_integration_init(void)
         return ESP_ERR_INVALID_STATE;
     }
 
+    esp_err_t ret = mqtt_prepare_messages();
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    mqtt_load_subscription_version();
+
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        esp_timer_create_args_t timer_args = {
+            .callback = mqtt_scheduled_start,
+            .arg = &shades[i],
+            .name = "mqtt_scheduled_start",
+        };
+        ret = esp_timer_create(&timer_args, &shades[i].scheduled_timer);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create start timer");
+            return ret;
+        }
+    }
+#endif
+
     // Create mutex
     mqtt_mutex = xSemaphoreCreateMutex();
     if (mqtt_mutex == NULL)
@@ -131,9 +926,21 @@ esp_err_t mqtt_integration_init(void)
     }
 
     // Конфигурация MQTT клиента
+    // Постоянная сессия сохраняет подписки между подключениями, поэтому
+    // идентификатор клиента должен быть постоянным
     esp_mqtt_client_config_t mqtt_config = {
         .broker.address.uri = broker_url,
         .credentials.client_id = CONFIG_MQTT_CLIENT_ID,
+        .session = {
+            .last_will = {
+                .topic = availability_topic,
+                .msg = "offline",
+                .msg_len = 0,
+                .qos = 1,
+                .retain = 1,
+            },
+            .disable_clean_session = true,
+        },
     };
 
     // Добавляем аутентификацию если настроена
@@ -158,7 +965,7 @@ esp_err_t mqtt_integration_init(void)
     }
 
     // Регистрируем обработчик событий
-    esp_err_t ret = esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    ret = esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to register event handler");
@@ -177,6 +984,27 @@ esp_err_t mqtt_integration_init(void)
         return ret;
     }
 
+    // Начальное положение публикуется после первого подключения
+    portENTER_CRITICAL(&publisher_lock);
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        shades[i].publisher_state = controller_get_state(i);
+        shades[i].publisher_position = controller_get_position_percentage(i);
+        shades[i].publisher_resync = true;
+    }
+    portEXIT_CRITICAL(&publisher_lock);
+    if (publisher_task_handle == NULL)
+    {
+        xTaskCreate(mqtt_publisher_task, "mqtt_publisher", 3072, NULL, 4, &publisher_task_handle);
+        controller_add_state_listener(mqtt_state_listener, NULL);
+#ifdef CONFIG_DIAGNOSTICS_ENABLED
+        diagnostics_add_report_callback(mqtt_diagnostics_report, NULL);
+#endif
+#ifdef CONFIG_SHADE_OTA
+        ota_update_set_status_callback(mqtt_publish_ota_status, NULL);
+#endif
+    }
+
     ESP_LOGI(TAG, "MQTT integration initialized");
     return ESP_OK;
 }
@@ -199,9 +1027,24 @@ esp_err_t mqtt_integration_deinit(void)
     mqtt_integration_remove_discovery_config();
 #endif
 
+    // При штатном отключении Last Will не отправляется
+    if (mqtt_connected)
+    {
+        esp_mqtt_client_publish(mqtt_client, availability_topic, "offline", 0, 1, true);
+    }
+
     esp_mqtt_client_stop(mqtt_client);
     esp_mqtt_client_destroy(mqtt_client);
     mqtt_client = NULL;
+
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        esp_timer_stop(shades[i].scheduled_timer);
+        esp_timer_delete(shades[i].scheduled_timer);
+        shades[i].scheduled_timer = NULL;
+    }
+#endif
     mqtt_connected = false;
 
     xSemaphoreGive(mqtt_mutex);
@@ -212,102 +1055,196 @@ esp_err_t mqtt_integration_deinit(void)
     return ESP_OK;
 }
 
-esp_err_t mqtt_integration_publish_position(uint8_t position)
+esp_err_t mqtt_integration_publish_position(uint8_t shade, uint8_t position)
 {
+    if (shade >= SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
     if (!mqtt_connected || mqtt_client == NULL)
     {
         return ESP_ERR_INVALID_STATE;
     }
 
-    char payload[16];
-    snprintf(payload, sizeof(payload), "%d", position);
+    char payload[4];
+    snprintf(payload, sizeof(payload), "%u", position);
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_POSITION, payload, 0, 1, 0);
+    const char *topic = shades[shade].position_topic;
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, payload, 0, 1, 0);
     if (msg_id == -1)
     {
         ESP_LOGE(TAG, "Failed to publish position");
         return ESP_FAIL;
     }
 
-    ESP_LOGD(TAG, "Position published to topic %s: %s", CONFIG_MQTT_TOPIC_POSITION, payload);
+    ESP_LOGD(TAG, "Position published to topic %s: %s", topic, payload);
     return ESP_OK;
 }
 
-esp_err_t mqtt_integration_publish_movement(bool is_moving, bool direction_up)
+esp_err_t mqtt_integration_publish_movement(uint8_t shade, bool is_moving, bool direction_up)
 {
+    if (shade >= SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
     if (!mqtt_connected || mqtt_client == NULL)
     {
         return ESP_ERR_INVALID_STATE;
     }
 
-    char payload[32];
+    const char *payload = is_moving ? (direction_up ? "moving_up" : "moving_down") : "stopped";
+
+    const char *topic = shades[shade].movement_topic;
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, payload, 0, 1, 0);
+    if (msg_id == -1)
+    {
+        ESP_LOGE(TAG, "Failed to publish movement");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Movement published to topic %s: %s", topic, payload);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_integration_publish_state(uint8_t shade, uint8_t position, bool is_moving, bool direction_up)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mqtt_connected || mqtt_client == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Состояние согласно спецификации Home Assistant Cover. Для промежуточных
+    // позиций используется "open", положение передается отдельным топиком
+    const char *state_payload;
     if (is_moving)
     {
-        snprintf(payload, sizeof(payload), "%s", direction_up ? "moving_up" : "moving_down");
+        state_payload = direction_up ? "opening" : "closing";
     }
     else
     {
-        snprintf(payload, sizeof(payload), "stopped");
+        state_payload = (position == 0) ? "closed" : "open";
     }
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_MOVEMENT, payload, 0, 1, 0);
+    const char *topic = shades[shade].state_topic;
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, state_payload, 0, 1, true);
     if (msg_id == -1)
     {
-        ESP_LOGE(TAG, "Failed to publish movement");
+        ESP_LOGE(TAG, "Failed to publish state");
         return ESP_FAIL;
     }
 
-    ESP_LOGD(TAG, "Movement published to topic %s: %s", CONFIG_MQTT_TOPIC_MOVEMENT, payload);
+    ESP_LOGD(TAG, "State published to topic %s: %s", topic, state_payload);
     return ESP_OK;
 }
 
-esp_err_t mqtt_integration_publish_state(uint8_t position, bool is_moving, bool direction_up)
+static void mqtt_store_u32(const char *key, uint32_t value)
 {
-    if (!mqtt_connected || mqtt_client == NULL)
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(MQTT_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
     {
-        return ESP_ERR_INVALID_STATE;
+        ESP_LOGW(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return;
     }
 
-    char state_payload[32];
+    err = nvs_set_u32(nvs_handle, key, value);
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
 
-    // Определяем состояние согласно спецификации Home Assistant Cover
-    if (is_moving)
+    if (err != ESP_OK)
     {
-        if (direction_up)
-        {
-            snprintf(state_payload, sizeof(state_payload), "opening");
-        }
-        else
-        {
-            snprintf(state_payload, sizeof(state_payload), "closing");
-        }
+        ESP_LOGW(TAG, "Failed to store %s: %s", key, esp_err_to_name(err));
     }
-    else
+}
+
+static bool mqtt_subscribe_all(mqtt_subscription_set_t *set);
+
+// Версия текущего набора подписок и версия, подтвержденная в сессии
+static void mqtt_load_subscription_version(void)
+{
+    mqtt_subscription_set_t set = {false, -1, 2166136261u};
+    mqtt_subscribe_all(&set);
+    subscription_version = set.hash;
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(MQTT_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK)
     {
-        if (position == 0)
-        {
-            snprintf(state_payload, sizeof(state_payload), "closed");
-        }
-        else if (position == 100)
+        nvs_get_u32(nvs_handle, MQTT_NVS_SUBSCRIPTION_VERSION, &subscription_stored_version);
+        nvs_close(nvs_handle);
+    }
+}
+
+// FNV-1a по топику и QoS, как у хэша конфигурации Home Assistant
+static bool mqtt_subscribe(const char *topic, int qos, mqtt_subscription_set_t *set)
+{
+    for (const char *c = topic; *c != '\0'; c++)
+    {
+        set->hash = (set->hash ^ (uint8_t)*c) * 16777619u;
+    }
+    set->hash = (set->hash ^ (uint8_t)qos) * 16777619u;
+    if (!set->send)
+    {
+        return true;
+    }
+
+    int msg_id = esp_mqtt_client_subscribe(mqtt_client, topic, qos);
+    if (msg_id == -1)
+    {
+        ESP_LOGE(TAG, "Failed to subscribe to %s", topic);
+        return false;
+    }
+    set->msg_id = msg_id;
+    return true;
+}
+
+static bool mqtt_subscribe_all(mqtt_subscription_set_t *set)
+{
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        if (!mqtt_subscribe(shades[i].command_topic, MQTT_COMMAND_QOS, set))
         {
-            snprintf(state_payload, sizeof(state_payload), "open");
+            return false;
         }
-        else
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+        if (!mqtt_subscribe(shades[i].compact_topic, MQTT_COMMAND_QOS, set))
         {
-            // Для промежуточных позиций используем "open" с позиционной информацией
-            snprintf(state_payload, sizeof(state_payload), "open");
+            return false;
         }
+#endif
     }
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_STATE, state_payload, 0, 1, true);
-    if (msg_id == -1)
+#ifdef CONFIG_MQTT_COMPACT_COMMANDS
+    if (sizeof(CONFIG_MQTT_TOPIC_GROUP) > 1 && !mqtt_subscribe(CONFIG_MQTT_TOPIC_GROUP, MQTT_COMMAND_QOS, set))
     {
-        ESP_LOGE(TAG, "Failed to publish state");
-        return ESP_FAIL;
+        return false;
     }
-
-    ESP_LOGD(TAG, "State published to topic %s: %s", CONFIG_MQTT_TOPIC_STATE, state_payload);
-    return ESP_OK;
+#endif
+#ifdef CONFIG_SHADE_SCHEDULER
+    if (!mqtt_subscribe(schedule_set_topic, 1, set))
+    {
+        return false;
+    }
+#endif
+#ifdef CONFIG_SHADE_OTA_HTTPS
+    if (!mqtt_subscribe(ota_topic, 1, set))
+    {
+        return false;
+    }
+#endif
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+    if (!mqtt_subscribe(ha_status_topic, 0, set))
+    {
+        return false;
+    }
+#endif
+    return true;
 }
 
 esp_err_t mqtt_integration_subscribe_commands(void)
@@ -317,14 +1254,15 @@ esp_err_t mqtt_integration_subscribe_commands(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    int msg_id = esp_mqtt_client_subscribe(mqtt_client, CONFIG_MQTT_TOPIC_COMMAND, 1);
-    if (msg_id == -1)
+    mqtt_subscription_set_t set = {true, -1, 2166136261u};
+    if (!mqtt_subscribe_all(&set))
     {
-        ESP_LOGE(TAG, "Failed to subscribe to commands");
         return ESP_FAIL;
     }
+    ESP_LOGI(TAG, "Subscribed to commands");
 
-    ESP_LOGI(TAG, "Subscribed to commands: %s", CONFIG_MQTT_TOPIC_COMMAND);
+    // Версия запоминается после подтверждения (MQTT_EVENT_SUBSCRIBED)
+    subscription_msg_id = set.msg_id;
     return ESP_OK;
 }
 
@@ -343,86 +1281,184 @@ static void get_device_unique_id(char *buffer, size_t buffer_size)
              CONFIG_MQTT_HA_DEVICE_ID, mac[3], mac[4], mac[5]);
 }
 
-// Публикация конфигурации для Home Assistant MQTT Discovery
-esp_err_t mqtt_integration_publish_discovery_config(void)
+// Топик и JSON конфигурации для Home Assistant MQTT Discovery. Все шторы
+// входят в одно устройство, топики указаны полностью
+static esp_err_t mqtt_prepare_shade_discovery(mqtt_shade_t *shade)
 {
-    if (!mqtt_connected || mqtt_client == NULL)
+    uint8_t index = mqtt_shade_index(shade);
+    char object_id[sizeof(device_unique_id) + 4];
+    char cover_name[64];
+    if (index == 0)
     {
-        ESP_LOGW(TAG, "MQTT not connected, cannot publish discovery config");
-        return ESP_ERR_INVALID_STATE;
+        snprintf(object_id, sizeof(object_id), "%s", device_unique_id);
+        snprintf(cover_name, sizeof(cover_name), "%s", CONFIG_MQTT_HA_COVER_NAME);
+    }
+    else
+    {
+        snprintf(object_id, sizeof(object_id), "%s_%u", device_unique_id, index + 1);
+        snprintf(cover_name, sizeof(cover_name), "%s %u", CONFIG_MQTT_HA_COVER_NAME, index + 1);
+    }
+
+    int length = snprintf(shade->discovery_topic, sizeof(shade->discovery_topic),
+                          "%s/cover/%s/config",
+                          CONFIG_MQTT_HA_DISCOVERY_PREFIX, object_id);
+    if (length >= (int)sizeof(shade->discovery_topic))
+    {
+        ESP_LOGE(TAG, "Discovery topic too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    shade->discovery_payload_len = snprintf(shade->discovery_payload, sizeof(shade->discovery_payload),
+                                            "{"
+                                            "\"name\":\"%s\","
+                                            "\"unique_id\":\"%s_cover\","
+                                            "\"device\":{"
+                                            "\"identifiers\":[\"%s\"],"
+                                            "\"name\":\"%s\","
+                                            "\"model\":\"MatterBlinds ESP32\","
+                                            "\"manufacturer\":\"MatterBlinds Project\""
+                                            "},"
+                                            "\"position_topic\":\"%s\","
+                                            "\"position_open\":100,"
+                                            "\"position_closed\":0,"
+                                            "\"set_position_topic\":\"%s\","
+                                            "\"command_topic\":\"%s\","
+                                            "\"state_topic\":\"%s\","
+                                            "\"payload_open\":\"OPEN\","
+                                            "\"payload_close\":\"CLOSE\","
+                                            "\"payload_stop\":\"STOP\","
+                                            "\"state_open\":\"open\","
+                                            "\"state_closed\":\"closed\","
+                                            "\"state_closing\":\"closing\","
+                                            "\"state_opening\":\"opening\","
+                                            "\"availability_topic\":\"%s\","
+                                            "\"payload_available\":\"online\","
+                                            "\"payload_not_available\":\"offline\""
+                                            "}",
+                                            cover_name,
+                                            object_id,
+                                            device_unique_id,
+                                            CONFIG_MQTT_HA_DEVICE_NAME,
+                                            shade->position_topic,
+                                            shade->command_topic,
+                                            shade->command_topic,
+                                            shade->state_topic,
+                                            availability_topic);
+    if (shade->discovery_payload_len >= (int)sizeof(shade->discovery_payload))
+    {
+        ESP_LOGE(TAG, "Discovery payload too long");
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    char device_unique_id[32];
+    // FNV-1a по топику и содержимому конфигурации
+    uint32_t hash = 2166136261u;
+    for (const char *c = shade->discovery_topic; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    for (int i = 0; i < shade->discovery_payload_len; i++)
+    {
+        hash = (hash ^ (uint8_t)shade->discovery_payload[i]) * 16777619u;
+    }
+    shade->discovery_hash = hash;
+    shade->discovery_msg_id = -1;
+    return ESP_OK;
+}
+
+// Ключ хэша в NVS: у первой шторы прежний, у остальных - с номером
+static void mqtt_discovery_hash_key(const mqtt_shade_t *shade, char *key, size_t key_size)
+{
+    uint8_t index = mqtt_shade_index(shade);
+    if (index == 0)
+    {
+        snprintf(key, key_size, "%s", MQTT_NVS_DISCOVERY_HASH);
+    }
+    else
+    {
+        snprintf(key, key_size, "%s%u", MQTT_NVS_DISCOVERY_HASH, index + 1);
+    }
+}
+
+static esp_err_t mqtt_prepare_discovery(void)
+{
     get_device_unique_id(device_unique_id, sizeof(device_unique_id));
+    int length = snprintf(ha_status_topic, sizeof(ha_status_topic), "%s/status", CONFIG_MQTT_HA_DISCOVERY_PREFIX);
+    if (length >= (int)sizeof(ha_status_topic))
+    {
+        ESP_LOGE(TAG, "Home Assistant status topic too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
 
-    // Формируем топик для конфигурации cover
-    char discovery_topic[256];
-    snprintf(discovery_topic, sizeof(discovery_topic),
-             "%s/cover/%s/config",
-             CONFIG_MQTT_HA_DISCOVERY_PREFIX, device_unique_id);
-
-    // Формируем JSON конфигурацию для Home Assistant
-    char config_payload[1024];
-    snprintf(config_payload, sizeof(config_payload),
-             "{"
-             "\"~\":\"%s\","
-             "\"name\":\"%s\","
-             "\"unique_id\":\"%s_cover\","
-             "\"device\":{"
-             "\"identifiers\":[\"%s\"],"
-             "\"name\":\"%s\","
-             "\"model\":\"MatterBlinds ESP32\","
-             "\"manufacturer\":\"MatterBlinds Project\""
-             "},"
-             "\"position_topic\":\"~/position\","
-             "\"position_open\":100,"
-             "\"position_closed\":0,"
-             "\"set_position_topic\":\"~/command\","
-             "\"command_topic\":\"~/command\","
-             "\"state_topic\":\"~/state\","
-             "\"payload_open\":\"OPEN\","
-             "\"payload_close\":\"CLOSE\","
-             "\"payload_stop\":\"STOP\","
-             "\"state_open\":\"open\","
-             "\"state_closed\":\"closed\","
-             "\"state_closing\":\"closing\","
-             "\"state_opening\":\"opening\","
-             "\"availability_topic\":\"~/availability\","
-             "\"payload_available\":\"online\","
-             "\"payload_not_available\":\"offline\""
-             "}",
-             CONFIG_MQTT_TOPIC_POSITION,
-             CONFIG_MQTT_HA_COVER_NAME,
-             device_unique_id,
-             device_unique_id,
-             CONFIG_MQTT_HA_DEVICE_NAME);
-
-    // Публикуем конфигурацию сretain flag
-    int msg_id = esp_mqtt_client_publish(mqtt_client, discovery_topic, config_payload, 0, 1, true);
-    if (msg_id == -1)
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
     {
-        ESP_LOGE(TAG, "Failed to publish discovery config");
-        return ESP_FAIL;
+        esp_err_t ret = mqtt_prepare_shade_discovery(&shades[i]);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(MQTT_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK)
+    {
+        for (uint8_t i = 0; i < SHADE_COUNT; i++)
+        {
+            char key[16];
+            mqtt_discovery_hash_key(&shades[i], key, sizeof(key));
+            nvs_get_u32(nvs_handle, key, &shades[i].discovery_stored_hash);
+        }
+        nvs_close(nvs_handle);
     }
 
-    ESP_LOGI(TAG, "Published HA discovery config to %s", discovery_topic);
+    return ESP_OK;
+}
 
-    // Публикуем статус доступности
-    char availability_topic[256];
-    snprintf(availability_topic, sizeof(availability_topic),
-             "%s/availability", CONFIG_MQTT_TOPIC_POSITION);
+static void mqtt_store_discovery_hash(mqtt_shade_t *shade, uint32_t hash)
+{
+    shade->discovery_stored_hash = hash;
+
+    char key[16];
+    mqtt_discovery_hash_key(shade, key, sizeof(key));
+    mqtt_store_u32(key, hash);
+}
 
-    int avail_msg_id = esp_mqtt_client_publish(mqtt_client, availability_topic, "online", 0, 1, true);
-    if (avail_msg_id == -1)
+// Публикуем конфигурацию с retain flag. Хэш сохраняется в NVS
+// после подтверждения (MQTT_EVENT_PUBLISHED)
+static esp_err_t mqtt_publish_discovery(mqtt_shade_t *shade)
+{
+    int msg_id = esp_mqtt_client_publish(mqtt_client, shade->discovery_topic, shade->discovery_payload,
+                                         shade->discovery_payload_len, 1, true);
+    if (msg_id == -1)
     {
-        ESP_LOGE(TAG, "Failed to publish availability status");
+        ESP_LOGE(TAG, "Failed to publish discovery config");
         return ESP_FAIL;
     }
+    shade->discovery_msg_id = msg_id;
 
-    ESP_LOGI(TAG, "Published HA availability status to %s", availability_topic);
+    ESP_LOGI(TAG, "Published HA discovery config to %s", shade->discovery_topic);
     return ESP_OK;
 }
 
+// Публикация конфигурации для Home Assistant MQTT Discovery
+esp_err_t mqtt_integration_publish_discovery_config(void)
+{
+    if (!mqtt_connected || mqtt_client == NULL)
+    {
+        ESP_LOGW(TAG, "MQTT not connected, cannot publish discovery config");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        if (mqtt_publish_discovery(&shades[i]) != ESP_OK)
+        {
+            ret = ESP_FAIL;
+        }
+    }
+    return ret;
+}
+
 // Удаление конфигурации из Home Assistant
 esp_err_t mqtt_integration_remove_discovery_config(void)
 {
@@ -431,25 +1467,25 @@ esp_err_t mqtt_integration_remove_discovery_config(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    char device_unique_id[32];
-    get_device_unique_id(device_unique_id, sizeof(device_unique_id));
+    esp_err_t ret = ESP_OK;
+    for (uint8_t i = 0; i < SHADE_COUNT; i++)
+    {
+        // Публикуем пустое сообщение для удаления конфигурации
+        mqtt_shade_t *shade = &shades[i];
+        int msg_id = esp_mqtt_client_publish(mqtt_client, shade->discovery_topic, "", 0, 1, true);
+        if (msg_id == -1)
+        {
+            ESP_LOGE(TAG, "Failed to remove discovery config");
+            ret = ESP_FAIL;
+            continue;
+        }
 
-    // Формируем топик для конфигурации cover
-    char discovery_topic[256];
-    snprintf(discovery_topic, sizeof(discovery_topic),
-             "%s/cover/%s/config",
-             CONFIG_MQTT_HA_DISCOVERY_PREFIX, device_unique_id);
+        // После удаления конфигурация публикуется заново при следующем подключении
+        mqtt_store_discovery_hash(shade, 0);
 
-    // Публикуем пустое сообщение для удаления конфигурации
-    int msg_id = esp_mqtt_client_publish(mqtt_client, discovery_topic, "", 0, 1, true);
-    if (msg_id == -1)
-    {
-        ESP_LOGE(TAG, "Failed to remove discovery config");
-        return ESP_FAIL;
+        ESP_LOGI(TAG, "Removed HA discovery config from %s", shade->discovery_topic);
     }
-
-    ESP_LOGI(TAG, "Removed HA discovery config from %s", discovery_topic);
-    return ESP_OK;
+    return ret;
 }
 
 #else
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
 
@@ -14,11 +15,12 @@ extern "C"
     // Деинициализация MQTT клиента
     esp_err_t mqtt_integration_deinit(void);
 
-    // Публикация состояния штор
-    esp_err_t mqtt_integration_publish_position(uint8_t position);
+    // Публикация положения шторы. shade - номер шторы с нуля: первая
+    // публикует в топики из Kconfig, остальные - в топики с суффиксом "/<номер>"
+    esp_err_t mqtt_integration_publish_position(uint8_t shade, uint8_t position);
 
     // Публикация статуса движения
-    esp_err_t mqtt_integration_publish_movement(bool is_moving, bool direction_up);
+    esp_err_t mqtt_integration_publish_movement(uint8_t shade, bool is_moving, bool direction_up);
 
     // Подписка на команды управления
     esp_err_t mqtt_integration_subscribe_commands(void);
@@ -26,12 +28,12 @@ extern "C"
     // Проверка подключения
     bool mqtt_integration_is_connected(void);
 
-    // Home Assistant MQTT Discovery
+    // Home Assistant MQTT Discovery, отдельный cover на каждую штору
     esp_err_t mqtt_integration_publish_discovery_config(void);
     esp_err_t mqtt_integration_remove_discovery_config(void);
 
     // Публикация состояния штор для Home Assistant
-    esp_err_t mqtt_integration_publish_state(uint8_t position, bool is_moving, bool direction_up);
+    esp_err_t mqtt_integration_publish_state(uint8_t shade, uint8_t position, bool is_moving, bool direction_up);
 
 #ifdef __cplusplus
 }
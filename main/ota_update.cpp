@@ -0,0 +1,331 @@
+#include "ota_update.h"
+#include "controller.h"
+#include "shade_config.h"
+#include "power_manager.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#ifdef CONFIG_SHADE_OTA_HTTPS
+#include "esp_https_ota.h"
+#include "esp_crt_bundle.h"
+#endif
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ota_update";
+
+#define OTA_HEALTH_TIMEOUT_MS (CONFIG_SHADE_OTA_HEALTH_TIMEOUT_S * 1000)
+#define OTA_STATUS_MAX_LEN 48
+#define OTA_TASK_PRIORITY 2
+
+static SemaphoreHandle_t network_ready = NULL;
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+static char status[OTA_STATUS_MAX_LEN] = "";
+static ota_update_status_cb_t status_callback = NULL;
+static void *status_arg = NULL;
+static bool pending_verify = false;
+
+#ifdef CONFIG_SHADE_OTA_HTTPS
+#define OTA_URL_MAX_LEN 256
+#define OTA_HTTP_TIMEOUT_MS 10000
+#define OTA_TASK_STACK_SIZE 8192 // Рукопожатие TLS
+#define OTA_PROGRESS_STEP 10     // Проценты между сообщениями о ходе загрузки
+
+// Пауза перед перезагрузкой: состояние уходит брокеру, шторы останавливаются
+#define OTA_REBOOT_DELAY_MS 1000
+
+// Префикс заканчивается на '/', чтобы "https://host" не пропускал
+// "https://host.example.org"
+static constexpr bool ota_update_prefix_valid(const char *prefix, size_t length)
+{
+    const char scheme[] = "https://";
+    if (length == 0)
+    {
+        return true;
+    }
+    if (length <= sizeof(scheme) - 1 || prefix[length - 1] != '/')
+    {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(scheme) - 1; i++)
+    {
+        if (prefix[i] != scheme[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(ota_update_prefix_valid(CONFIG_SHADE_OTA_URL_PREFIX, sizeof(CONFIG_SHADE_OTA_URL_PREFIX) - 1),
+              "SHADE_OTA_URL_PREFIX must start with https:// and end with /");
+
+#define OTA_URL_PREFIX_LEN (sizeof(CONFIG_SHADE_OTA_URL_PREFIX) - 1)
+
+static bool download_active = false;
+static char download_url[OTA_URL_MAX_LEN];
+#endif
+
+static void ota_update_set_status(const char *format, ...)
+{
+    char text[OTA_STATUS_MAX_LEN];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    portENTER_CRITICAL(&status_lock);
+    memcpy(status, text, sizeof(status));
+    ota_update_status_cb_t callback = status_callback;
+    void *arg = status_arg;
+    portEXIT_CRITICAL(&status_lock);
+
+    if (callback != NULL)
+    {
+        callback(text, arg);
+    }
+}
+
+// Новая прошивка считается рабочей, когда поднялось локальное управление
+// и интеграция вышла в сеть: только так ее можно обновить снова. Сбой или
+// перезагрузка до подтверждения возвращают прежнюю прошивку загрузчиком
+static void ota_health_task(void *parameter)
+{
+    const esp_app_desc_t *app = esp_app_get_description();
+
+    if (xSemaphoreTake(network_ready, pdMS_TO_TICKS(OTA_HEALTH_TIMEOUT_MS)) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Firmware %s got no network in %d s, rolling back", app->version,
+                 CONFIG_SHADE_OTA_HEALTH_TIMEOUT_S);
+        esp_err_t err = esp_ota_mark_app_invalid_rollback_and_reboot();
+
+        // Возвращается только без прежней рабочей прошивки
+        ESP_LOGE(TAG, "Rollback impossible: %s", esp_err_to_name(err));
+    }
+
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to confirm firmware: %s", esp_err_to_name(err));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Firmware %s confirmed", app->version);
+    }
+
+    portENTER_CRITICAL(&status_lock);
+    pending_verify = false;
+    portEXIT_CRITICAL(&status_lock);
+    ota_update_set_status("running %s", app->version);
+    vTaskDelete(NULL);
+}
+
+void ota_update_init(void)
+{
+    network_ready = xSemaphoreCreateBinary();
+
+    const esp_app_desc_t *app = esp_app_get_description();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    ESP_LOGI(TAG, "Firmware %s from %s", app->version, running->label);
+#if defined(CONFIG_SHADE_OTA_HTTPS) && !defined(CONFIG_SECURE_SIGNED_APPS)
+    ESP_LOGW(TAG, "Update images are not signature-checked");
+#endif
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        ota_update_set_status("running %s", app->version);
+        return;
+    }
+
+    ESP_LOGW(TAG, "Firmware not confirmed, waiting up to %d s for network", CONFIG_SHADE_OTA_HEALTH_TIMEOUT_S);
+    pending_verify = true;
+    ota_update_set_status("verifying %s", app->version);
+    xTaskCreate(ota_health_task, "ota_health", 3072, NULL, OTA_TASK_PRIORITY, NULL);
+}
+
+void ota_update_network_ready(void)
+{
+    if (network_ready != NULL)
+    {
+        xSemaphoreGive(network_ready);
+    }
+}
+
+size_t ota_update_get_status(char *buffer, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&status_lock);
+    snprintf(buffer, size, "%s", status);
+    portEXIT_CRITICAL(&status_lock);
+    return strlen(buffer);
+}
+
+void ota_update_set_status_callback(ota_update_status_cb_t callback, void *arg)
+{
+    portENTER_CRITICAL(&status_lock);
+    status_callback = callback;
+    status_arg = arg;
+    portEXIT_CRITICAL(&status_lock);
+}
+
+#ifdef CONFIG_SHADE_OTA_HTTPS
+// Образ другого проекта отбрасывается до записи во flash
+static esp_err_t ota_update_check_image(esp_https_ota_handle_t handle)
+{
+    esp_app_desc_t image;
+    esp_err_t err = esp_https_ota_get_img_desc(handle, &image);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    const esp_app_desc_t *app = esp_app_get_description();
+    if (strncmp(image.project_name, app->project_name, sizeof(image.project_name)) != 0)
+    {
+        ESP_LOGE(TAG, "Image is for %.*s, not %s", (int)sizeof(image.project_name), image.project_name,
+                 app->project_name);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    ESP_LOGI(TAG, "Image %.*s, running %s", (int)sizeof(image.version), image.version, app->version);
+    return ESP_OK;
+}
+
+static void ota_update_task(void *parameter)
+{
+    power_manager_acquire(POWER_LOCK_OTA);
+
+    esp_http_client_config_t http_config = {};
+    http_config.url = download_url;
+    http_config.crt_bundle_attach = esp_crt_bundle_attach;
+    http_config.timeout_ms = OTA_HTTP_TIMEOUT_MS;
+    http_config.keep_alive_enable = true;
+    // Перенаправление увело бы загрузку с разрешенного сервера
+    http_config.disable_auto_redirect = true;
+
+    esp_https_ota_config_t ota_config = {};
+    ota_config.http_config = &http_config;
+
+    esp_https_ota_handle_t handle = NULL;
+    esp_err_t err = esp_https_ota_begin(&ota_config, &handle);
+    if (err == ESP_OK)
+    {
+        err = ota_update_check_image(handle);
+    }
+
+    // Образ пишется в свободный слот по мере приема, в памяти - только
+    // буфер HTTP. О 0% уже сообщил ota_update_start
+    int reported = 0;
+    while (err == ESP_OK)
+    {
+        err = esp_https_ota_perform(handle);
+        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS)
+        {
+            break;
+        }
+        err = ESP_OK;
+
+        int size = esp_https_ota_get_image_size(handle);
+        int percent = size > 0 ? (int)((int64_t)esp_https_ota_get_image_len_read(handle) * 100 / size) : 0;
+        if (percent / OTA_PROGRESS_STEP != reported)
+        {
+            reported = percent / OTA_PROGRESS_STEP;
+            ota_update_set_status("downloading %d%%", percent);
+        }
+    }
+
+    if (err == ESP_OK && !esp_https_ota_is_complete_data_received(handle))
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK)
+    {
+        // Проверка образа и выбор нового слота для загрузки
+        err = esp_https_ota_finish(handle);
+    }
+    else if (handle != NULL)
+    {
+        esp_https_ota_abort(handle);
+    }
+    power_manager_release(POWER_LOCK_OTA);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Update failed: %s", esp_err_to_name(err));
+        ota_update_set_status("failed %s", esp_err_to_name(err));
+        portENTER_CRITICAL(&status_lock);
+        download_active = false;
+        portEXIT_CRITICAL(&status_lock);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Update written, rebooting");
+    ota_update_set_status("rebooting");
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        controller_stop(shade);
+    }
+    vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+
+    // Отложенные записи в NVS сохраняются при перезагрузке (persistence)
+    esp_restart();
+}
+
+esp_err_t ota_update_start(const char *url, size_t length)
+{
+    if (length == 0 || length >= sizeof(download_url))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Командный топик открыт всем клиентам брокера: образ берется только
+    // с сервера из конфигурации
+    if (OTA_URL_PREFIX_LEN == 0)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (length <= OTA_URL_PREFIX_LEN || memcmp(url, CONFIG_SHADE_OTA_URL_PREFIX, OTA_URL_PREFIX_LEN) != 0 ||
+        memchr(url, '\0', length) != NULL)
+    {
+        ESP_LOGW(TAG, "Update URL outside %s rejected", CONFIG_SHADE_OTA_URL_PREFIX);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&status_lock);
+    bool busy = download_active || pending_verify;
+    if (!busy)
+    {
+        download_active = true;
+    }
+    portEXIT_CRITICAL(&status_lock);
+    if (busy)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(download_url, url, length);
+    download_url[length] = '\0';
+    if (xTaskCreate(ota_update_task, "ota_update", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        portENTER_CRITICAL(&status_lock);
+        download_active = false;
+        portEXIT_CRITICAL(&status_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Update from %s", download_url);
+    ota_update_set_status("downloading 0%%");
+    return ESP_OK;
+}
+#endif
@@ -0,0 +1,38 @@
+// Обновление прошивки: проверка после запуска и загрузка по HTTPS (CONFIG_SHADE_OTA)
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Изменение состояния обновления, текст как в ota_update_get_status
+    typedef void (*ota_update_status_cb_t)(const char *status, void *arg);
+
+#ifdef CONFIG_SHADE_OTA
+    // Запуск непроверенной прошивки: ожидание сети, затем подтверждение
+    // или откат. Вызывается после запуска контроллера
+    void ota_update_init(void);
+
+    // Интеграция подключилась к сети (брокер MQTT, адрес Matter)
+    void ota_update_network_ready(void);
+
+    // Состояние: "running <версия>", "verifying <версия>", "downloading <n>%",
+    // "failed <ошибка>", "rebooting"
+    size_t ota_update_get_status(char *buffer, size_t size);
+    void ota_update_set_status_callback(ota_update_status_cb_t callback, void *arg);
+
+#ifdef CONFIG_SHADE_OTA_HTTPS
+    // Загрузка образа в фоновой задаче. ESP_ERR_INVALID_STATE - загрузка уже
+    // идет или текущая прошивка еще не подтверждена
+    esp_err_t ota_update_start(const char *url, size_t length);
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,529 @@
+#include "persistence.h"
+#include "shade_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "persistence";
+
+#define PERSISTENCE_NAMESPACE "shade"
+#define PERSISTENCE_KEY "state" // Первая штора, у остальных номер в конце: "state2"
+#define PERSISTENCE_VERSION 2
+#define PERSISTENCE_DEBOUNCE_MS CONFIG_PERSISTENCE_POSITION_DEBOUNCE_MS
+
+// Калибровка до блоков: отдельные ключи position_sensor, одна штора
+#define PERSISTENCE_LEGACY_NAMESPACE "position_sensor"
+
+// Правила расписания - один блок на устройство
+#define PERSISTENCE_SCHEDULE_KEY "schedule"
+#define PERSISTENCE_SCHEDULE_VERSION 1
+
+// Положение считается изменившимся, если сдвинулось больше, чем на шум датчика
+#define PERSISTENCE_POSITION_HYSTERESIS 8
+
+// Формат блока в NVS. При изменении структуры увеличивается PERSISTENCE_VERSION.
+// В структурах есть выравнивание после bool: CRC и сравнение с сохраненным
+// блоком идут по байтам, поэтому блоки копируются через memcpy, а данные
+// снаружи переносятся по полям в обнуленную память
+typedef struct
+{
+    uint16_t version;
+    uint16_t size;
+    persistence_calibration_t calibration;
+    persistence_position_t position;
+    persistence_motion_model_t motion_model;
+    uint32_t crc; // CRC32 всех предыдущих полей
+} persistence_blob_t;
+
+// Версия 1: без модели хода. Калибровка и положение переносятся как есть
+typedef struct
+{
+    uint16_t version;
+    uint16_t size;
+    persistence_calibration_t calibration;
+    persistence_position_t position;
+    uint32_t crc;
+} persistence_blob_v1_t;
+
+typedef struct
+{
+    uint16_t version;
+    uint16_t count;
+    persistence_schedule_rule_t rules[PERSISTENCE_SCHEDULE_MAX_RULES]; // Неиспользуемые - нули
+    uint32_t crc;
+} persistence_schedule_blob_t;
+
+static persistence_blob_t stored[SHADE_COUNT];  // Содержимое NVS
+static persistence_blob_t current[SHADE_COUNT]; // Актуальные данные
+static bool loaded[SHADE_COUNT];
+static portMUX_TYPE blob_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t flush_timer = NULL;
+
+// Запись в NVS идет из таймера, задачи контроллера и обработчика перезагрузки
+static SemaphoreHandle_t write_mutex = NULL;
+
+static uint32_t persistence_crc(const persistence_blob_t *blob)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)blob, offsetof(persistence_blob_t, crc));
+}
+
+static bool persistence_migrate_v1(const void *data, size_t length, persistence_blob_t *blob)
+{
+    persistence_blob_v1_t old;
+    if (length != sizeof(old))
+    {
+        return false;
+    }
+
+    // data и blob могут указывать на один буфер
+    memcpy(&old, data, sizeof(old));
+    if (old.version != 1 || old.size != sizeof(old) ||
+        old.crc != esp_rom_crc32_le(0, (const uint8_t *)&old, offsetof(persistence_blob_v1_t, crc)))
+    {
+        return false;
+    }
+
+    memset(blob, 0, sizeof(*blob));
+    memcpy(&blob->calibration, &old.calibration, sizeof(old.calibration));
+    memcpy(&blob->position, &old.position, sizeof(old.position));
+    return true;
+}
+
+// Выравнивание в копии обнулено: вызывающий мог заполнить структуру на стеке
+static void persistence_copy_calibration(persistence_calibration_t *copy, const persistence_calibration_t *calibration)
+{
+    memset(copy, 0, sizeof(*copy));
+    copy->calibrated = calibration->calibrated;
+    copy->zebra_enabled = calibration->zebra_enabled;
+    copy->upper_position = calibration->upper_position;
+    copy->lower_position = calibration->lower_position;
+    copy->upper_steps = calibration->upper_steps;
+    copy->lower_steps = calibration->lower_steps;
+    copy->zebra_offset = calibration->zebra_offset;
+    copy->counts_per_step_q16 = calibration->counts_per_step_q16;
+}
+
+static void persistence_copy_motion_model(persistence_motion_model_t *copy, const persistence_motion_model_t *model)
+{
+    memset(copy, 0, sizeof(*copy));
+    copy->valid = model->valid;
+    copy->counts_per_step_q16[0] = model->counts_per_step_q16[0];
+    copy->counts_per_step_q16[1] = model->counts_per_step_q16[1];
+    copy->backlash_steps = model->backlash_steps;
+    copy->stop_lead_us = model->stop_lead_us;
+}
+
+// Ключ первой шторы совпадает с прежним единственным ключом: сохраненные
+// данные переживают обновление
+static void persistence_key(uint8_t shade, char *key, size_t size)
+{
+    if (shade == 0)
+    {
+        snprintf(key, size, "%s", PERSISTENCE_KEY);
+    }
+    else
+    {
+        snprintf(key, size, "%s%u", PERSISTENCE_KEY, shade + 1);
+    }
+}
+
+static esp_err_t persistence_write_locked(uint8_t shade)
+{
+    persistence_blob_t blob;
+    portENTER_CRITICAL(&blob_lock);
+    memcpy(&blob, &current[shade], sizeof(blob));
+    portEXIT_CRITICAL(&blob_lock);
+
+    if (loaded[shade] && memcmp(&blob, &stored[shade], offsetof(persistence_blob_t, crc)) == 0)
+    {
+        return ESP_OK;
+    }
+
+    blob.version = PERSISTENCE_VERSION;
+    blob.size = sizeof(blob);
+    blob.crc = persistence_crc(&blob);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(PERSISTENCE_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    persistence_key(shade, key, sizeof(key));
+    err = nvs_set_blob(nvs_handle, key, &blob, sizeof(blob));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error saving state %u: %s", shade + 1, esp_err_to_name(err));
+        return err;
+    }
+
+    // stored читает persistence_update_position
+    portENTER_CRITICAL(&blob_lock);
+    memcpy(&stored[shade], &blob, sizeof(blob));
+    loaded[shade] = true;
+    portEXIT_CRITICAL(&blob_lock);
+    ESP_LOGD(TAG, "State %u saved", shade + 1);
+    return ESP_OK;
+}
+
+static esp_err_t persistence_write(uint8_t shade)
+{
+    if (write_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(write_mutex, portMAX_DELAY);
+    esp_err_t err = persistence_write_locked(shade);
+    xSemaphoreGive(write_mutex);
+    return err;
+}
+
+// Запись всех штор, неизменившиеся блоки пропускаются
+static esp_err_t persistence_write_all(void)
+{
+    esp_err_t result = ESP_OK;
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        esp_err_t err = persistence_write(shade);
+        if (err != ESP_OK)
+        {
+            result = err;
+        }
+    }
+    return result;
+}
+
+static void persistence_flush_timer_cb(void *arg)
+{
+    persistence_write_all();
+}
+
+static void persistence_load(nvs_handle_t nvs_handle, uint8_t shade)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    persistence_key(shade, key, sizeof(key));
+
+    persistence_blob_t blob;
+    size_t length = sizeof(blob);
+    esp_err_t err = nvs_get_blob(nvs_handle, key, &blob, &length);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No saved state for shade %u", shade + 1);
+        return;
+    }
+
+    if (persistence_migrate_v1(&blob, length, &blob))
+    {
+        // Блок старой версии перезапишется при следующем сохранении
+        ESP_LOGI(TAG, "Saved state %u migrated from version 1", shade + 1);
+        memcpy(&current[shade], &blob, sizeof(blob));
+    }
+    else if (length != sizeof(blob) || blob.version != PERSISTENCE_VERSION || blob.size != sizeof(blob) ||
+             blob.crc != persistence_crc(&blob))
+    {
+        ESP_LOGW(TAG, "Saved state %u is invalid (version %u, %u bytes), ignored", shade + 1, blob.version,
+                 (unsigned)length);
+        return;
+    }
+    else
+    {
+        memcpy(&stored[shade], &blob, sizeof(blob));
+        memcpy(&current[shade], &blob, sizeof(blob));
+        loaded[shade] = true;
+    }
+
+    ESP_LOGI(TAG, "State %u loaded: calibrated %d, position %lu", shade + 1,
+             blob.calibration.calibrated, blob.position.valid ? blob.position.position : 0);
+}
+
+// Калибровка прежних прошивок: ключи position_sensor. Читается один раз -
+// перенесенная калибровка сразу записывается блоком первой шторы. Положение
+// мотора в крайних точках там не хранилось, оно нужно только при калибровке
+static bool persistence_load_legacy_calibration(persistence_calibration_t *calibration)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(PERSISTENCE_LEGACY_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    persistence_calibration_t legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    uint8_t zebra_enabled = 0;
+    bool found = nvs_get_u32(nvs_handle, "upper_position", &legacy.upper_position) == ESP_OK &&
+                 nvs_get_u32(nvs_handle, "lower_position", &legacy.lower_position) == ESP_OK;
+    if (found)
+    {
+        legacy.zebra_offset = 100;
+        nvs_get_u32(nvs_handle, "zebra_offset", &legacy.zebra_offset);
+        nvs_get_u8(nvs_handle, "zebra_enabled", &zebra_enabled);
+        nvs_get_u32(nvs_handle, "counts_step", &legacy.counts_per_step_q16);
+    }
+    nvs_close(nvs_handle);
+
+    if (!found || legacy.upper_position == legacy.lower_position)
+    {
+        return false;
+    }
+
+    legacy.calibrated = true;
+    legacy.zebra_enabled = zebra_enabled != 0;
+    memcpy(calibration, &legacy, sizeof(legacy));
+    return true;
+}
+
+void persistence_init(void)
+{
+    write_mutex = xSemaphoreCreateMutex();
+
+    esp_timer_create_args_t timer_args = {
+        .callback = persistence_flush_timer_cb,
+        .name = "persistence_flush",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &flush_timer));
+
+    // Перезагрузка через esp_restart (обновление прошивки, откат, Matter)
+    // не теряет отложенное положение
+    esp_register_shutdown_handler(persistence_flush);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(PERSISTENCE_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK)
+    {
+        for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+        {
+            persistence_load(nvs_handle, shade);
+        }
+        nvs_close(nvs_handle);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "No saved state");
+    }
+
+    if (!current[0].calibration.calibrated && persistence_load_legacy_calibration(&current[0].calibration))
+    {
+        ESP_LOGI(TAG, "Calibration migrated from previous firmware: %lu-%lu", current[0].calibration.upper_position,
+                 current[0].calibration.lower_position);
+        persistence_write(0);
+    }
+}
+
+bool persistence_get_calibration(uint8_t shade, persistence_calibration_t *calibration)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        memset(calibration, 0, sizeof(*calibration));
+        return false;
+    }
+
+    portENTER_CRITICAL(&blob_lock);
+    *calibration = current[shade].calibration;
+    portEXIT_CRITICAL(&blob_lock);
+    return calibration->calibrated;
+}
+
+bool persistence_get_position(uint8_t shade, persistence_position_t *position)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        memset(position, 0, sizeof(*position));
+        return false;
+    }
+
+    portENTER_CRITICAL(&blob_lock);
+    *position = current[shade].position;
+    portEXIT_CRITICAL(&blob_lock);
+    return position->valid;
+}
+
+bool persistence_get_motion_model(uint8_t shade, persistence_motion_model_t *model)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        memset(model, 0, sizeof(*model));
+        return false;
+    }
+
+    portENTER_CRITICAL(&blob_lock);
+    *model = current[shade].motion_model;
+    portEXIT_CRITICAL(&blob_lock);
+    return model->valid;
+}
+
+esp_err_t persistence_save_calibration(uint8_t shade, const persistence_calibration_t *calibration)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    persistence_calibration_t copy;
+    persistence_copy_calibration(&copy, calibration);
+    portENTER_CRITICAL(&blob_lock);
+    memcpy(&current[shade].calibration, &copy, sizeof(copy));
+    portEXIT_CRITICAL(&blob_lock);
+
+    // Отложенные положения всех штор уходят вместе с калибровкой
+    if (flush_timer != NULL)
+    {
+        esp_timer_stop(flush_timer);
+    }
+    esp_err_t err = persistence_write(shade);
+    persistence_write_all();
+    return err;
+}
+
+void persistence_update_position(uint8_t shade, uint32_t position, int32_t motor_steps)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&blob_lock);
+    const persistence_position_t *saved = &stored[shade].position;
+    uint32_t delta = position > saved->position ? position - saved->position
+                                                : saved->position - position;
+    bool changed = !saved->valid || delta > PERSISTENCE_POSITION_HYSTERESIS ||
+                   motor_steps != saved->motor_steps;
+    current[shade].position.valid = true;
+    current[shade].position.position = position;
+    current[shade].position.motor_steps = motor_steps;
+    portEXIT_CRITICAL(&blob_lock);
+
+    if (!changed || flush_timer == NULL)
+    {
+        return;
+    }
+
+    // Каждое новое положение откладывает запись: пишется только последнее.
+    // Запись идет из задачи esp_timer, когда шторы уже стоят
+    esp_timer_stop(flush_timer);
+    esp_timer_start_once(flush_timer, (uint64_t)PERSISTENCE_DEBOUNCE_MS * 1000);
+}
+
+void persistence_update_motion_model(uint8_t shade, const persistence_motion_model_t *model)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+
+    persistence_motion_model_t copy;
+    persistence_copy_motion_model(&copy, model);
+    portENTER_CRITICAL(&blob_lock);
+    memcpy(&current[shade].motion_model, &copy, sizeof(copy));
+    portEXIT_CRITICAL(&blob_lock);
+
+    if (flush_timer == NULL)
+    {
+        return;
+    }
+
+    esp_timer_stop(flush_timer);
+    esp_timer_start_once(flush_timer, (uint64_t)PERSISTENCE_DEBOUNCE_MS * 1000);
+}
+
+void persistence_flush(void)
+{
+    if (flush_timer != NULL)
+    {
+        esp_timer_stop(flush_timer);
+    }
+    persistence_write_all();
+}
+
+static uint32_t persistence_schedule_crc(const persistence_schedule_blob_t *blob)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)blob, offsetof(persistence_schedule_blob_t, crc));
+}
+
+bool persistence_get_schedule(persistence_schedule_rule_t *rules, size_t max, size_t *count)
+{
+    *count = 0;
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(PERSISTENCE_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    persistence_schedule_blob_t blob;
+    size_t length = sizeof(blob);
+    esp_err_t err = nvs_get_blob(nvs_handle, PERSISTENCE_SCHEDULE_KEY, &blob, &length);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK)
+    {
+        return false;
+    }
+
+    if (length != sizeof(blob) || blob.version != PERSISTENCE_SCHEDULE_VERSION ||
+        blob.count > PERSISTENCE_SCHEDULE_MAX_RULES || blob.crc != persistence_schedule_crc(&blob))
+    {
+        ESP_LOGW(TAG, "Saved schedule is invalid (version %u, %u bytes), ignored", blob.version,
+                 (unsigned)length);
+        return false;
+    }
+
+    *count = blob.count < max ? blob.count : max;
+    memcpy(rules, blob.rules, *count * sizeof(rules[0]));
+    return true;
+}
+
+esp_err_t persistence_save_schedule(const persistence_schedule_rule_t *rules, size_t count)
+{
+    if (count > PERSISTENCE_SCHEDULE_MAX_RULES)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    persistence_schedule_blob_t blob = {};
+    blob.version = PERSISTENCE_SCHEDULE_VERSION;
+    blob.count = (uint16_t)count;
+    memcpy(blob.rules, rules, count * sizeof(rules[0]));
+    blob.crc = persistence_schedule_crc(&blob);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(PERSISTENCE_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(nvs_handle, PERSISTENCE_SCHEDULE_KEY, &blob, sizeof(blob));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error saving schedule: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Schedule saved: %u rules", (unsigned)count);
+    return ESP_OK;
+}
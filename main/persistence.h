@@ -0,0 +1,84 @@
+// Хранение калибровки и последнего положения в NVS, по блоку с CRC на штору
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        bool calibrated;
+        bool zebra_enabled;
+        uint32_t upper_position; // Отсчеты ADC в верхнем положении
+        uint32_t lower_position; // Отсчеты ADC в нижнем положении
+        int32_t upper_steps;     // Положение мотора в крайних точках
+        int32_t lower_steps;
+        uint32_t zebra_offset;
+        uint32_t counts_per_step_q16;
+    } persistence_calibration_t;
+
+    typedef struct
+    {
+        bool valid;
+        uint32_t position; // Отсчеты ADC
+        int32_t motor_steps;
+    } persistence_position_t;
+
+    // Модель хода мотора, уточняется по каждому движению (motion_model)
+    typedef struct
+    {
+        bool valid;
+        uint32_t counts_per_step_q16[2]; // По направлениям: вверх, вниз (Q16.16)
+        uint32_t backlash_steps;         // Холостые шаги после смены направления
+        uint32_t stop_lead_us;           // Задержка от отсчета до остановки катушек
+    } persistence_motion_model_t;
+
+    // Правило расписания устройства (scheduler)
+    typedef struct
+    {
+        uint8_t event;    // schedule_event_t: время суток, восход или закат
+        uint8_t days;     // Дни недели, бит 0 - воскресенье (как tm_wday)
+        int16_t minutes;  // Минуты от полуночи или смещение от восхода/заката
+        uint8_t shades;   // Маска штор, бит 0 - первая
+        uint8_t position; // Цель в процентах от верхнего положения
+    } persistence_schedule_rule_t;
+
+#define PERSISTENCE_SCHEDULE_MAX_RULES 16
+
+    // Читает блоки всех штор из NVS. Поврежденный или старый блок отбрасывается.
+    // Без блока калибровка первой шторы переносится из ключей прежних прошивок
+    void persistence_init(void);
+
+    // Копии загруженных данных. false - данных нет
+    bool persistence_get_calibration(uint8_t shade, persistence_calibration_t *calibration);
+    bool persistence_get_position(uint8_t shade, persistence_position_t *position);
+    bool persistence_get_motion_model(uint8_t shade, persistence_motion_model_t *model);
+
+    // Калибровка записывается сразу
+    esp_err_t persistence_save_calibration(uint8_t shade, const persistence_calibration_t *calibration);
+
+    // Положение записывается с задержкой: серия движений дает одну запись
+    void persistence_update_position(uint8_t shade, uint32_t position, int32_t motor_steps);
+
+    // Модель записывается так же с задержкой, вместе с положением
+    void persistence_update_motion_model(uint8_t shade, const persistence_motion_model_t *model);
+
+    // Немедленная запись отложенных изменений (например, перед перезагрузкой)
+    void persistence_flush(void);
+
+    // Правила расписания читаются из NVS при каждом вызове. false - правил
+    // не сохраняли (пустой список после сохранения - true с count = 0)
+    bool persistence_get_schedule(persistence_schedule_rule_t *rules, size_t max, size_t *count);
+
+    // Правила записываются сразу, не больше PERSISTENCE_SCHEDULE_MAX_RULES
+    esp_err_t persistence_save_schedule(const persistence_schedule_rule_t *rules, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,108 @@
+#include "position_filter.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+#define POSITION_FILTER_MEDIAN_WINDOW CONFIG_POSITION_FILTER_MEDIAN_WINDOW
+
+static_assert(POSITION_FILTER_MEDIAN_WINDOW >= 1 && POSITION_FILTER_MEDIAN_WINDOW <= POSITION_FILTER_MEDIAN_MAX,
+              "Median window out of range");
+
+// Предсказание по скорости не экстраполируется дальше этого интервала
+#define POSITION_FILTER_MAX_DT_US 1000000
+
+void position_filter_reset(position_filter_t *filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+// Медиана по заполненной части окна (сортировка вставками, окно не больше 9)
+static uint32_t position_filter_median(const position_filter_t *filter)
+{
+    uint16_t sorted[POSITION_FILTER_MEDIAN_MAX];
+    uint8_t count = filter->window_count;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint16_t value = filter->window[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+
+    return sorted[count / 2];
+}
+
+uint32_t position_filter_update(position_filter_t *filter, uint32_t raw,
+                                int32_t velocity_q8, int64_t timestamp_us)
+{
+    // Окно заполняется постепенно: до заполнения медиана берется по имеющимся
+    // отсчетам, поэтому первые показания после старта не тянутся к нулю
+    filter->window[filter->window_index] = raw > UINT16_MAX ? UINT16_MAX : raw;
+    filter->window_index = (filter->window_index + 1) % POSITION_FILTER_MEDIAN_WINDOW;
+    if (filter->window_count < POSITION_FILTER_MEDIAN_WINDOW)
+    {
+        filter->window_count++;
+    }
+
+    int32_t measurement_q8 = (int32_t)(position_filter_median(filter) << 8);
+
+    if (!filter->primed)
+    {
+        filter->estimate_q8 = measurement_q8;
+#ifdef CONFIG_POSITION_FILTER_KALMAN
+        filter->variance_q8 = (uint32_t)CONFIG_POSITION_FILTER_KALMAN_R << 8;
+#endif
+        filter->timestamp_us = timestamp_us;
+        filter->primed = true;
+        return raw;
+    }
+
+    int64_t dt_us = timestamp_us - filter->timestamp_us;
+    if (dt_us < 0)
+    {
+        dt_us = 0;
+    }
+    else if (dt_us > POSITION_FILTER_MAX_DT_US)
+    {
+        dt_us = POSITION_FILTER_MAX_DT_US;
+    }
+    filter->timestamp_us = timestamp_us;
+
+#ifdef CONFIG_POSITION_FILTER_FEED_FORWARD
+    // Предсказание по скорости мотора: сглаживание не отстает от движения
+    filter->estimate_q8 += (int32_t)((int64_t)velocity_q8 * dt_us / 1000000);
+#endif
+
+    int32_t innovation_q8 = measurement_q8 - filter->estimate_q8;
+
+#ifdef CONFIG_POSITION_FILTER_KALMAN
+    // Одномерный фильтр Калмана: P += Q*dt, K = P / (P + R), P = (1 - K) * P
+    uint64_t variance = filter->variance_q8 +
+                        (((uint64_t)CONFIG_POSITION_FILTER_KALMAN_Q << 8) * (uint64_t)dt_us) / 1000000;
+    if (variance > UINT32_MAX)
+    {
+        variance = UINT32_MAX;
+    }
+
+    uint64_t noise_q8 = (uint64_t)CONFIG_POSITION_FILTER_KALMAN_R << 8;
+    uint32_t gain_q16 = (uint32_t)((variance << 16) / (variance + noise_q8));
+
+    filter->estimate_q8 += (int32_t)(((int64_t)innovation_q8 * gain_q16) >> 16);
+    filter->variance_q8 = (uint32_t)((variance * (65536 - gain_q16)) >> 16);
+#else
+    // Экспоненциальное сглаживание с коэффициентом alpha / 256
+    filter->estimate_q8 += (innovation_q8 * CONFIG_POSITION_FILTER_EMA_ALPHA) / 256;
+#endif
+
+    if (filter->estimate_q8 < 0)
+    {
+        filter->estimate_q8 = 0;
+    }
+
+    // Округление до целого отсчета
+    return (uint32_t)((filter->estimate_q8 + 128) >> 8);
+}
@@ -0,0 +1,35 @@
+// Фильтр показаний датчика положения: медиана + EMA / Калман
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define POSITION_FILTER_MEDIAN_MAX 9
+
+    // Все вычисления целочисленные, оценка хранится в отсчетах ADC * 256 (Q8)
+    typedef struct
+    {
+        uint16_t window[POSITION_FILTER_MEDIAN_MAX]; // Последние сырые отсчеты
+        uint8_t window_count;
+        uint8_t window_index;
+        int32_t estimate_q8; // Текущая оценка положения
+        uint32_t variance_q8; // Дисперсия оценки (Калман), отсчеты^2 * 256
+        int64_t timestamp_us; // Время последнего обновления
+        bool primed;          // Получен первый отсчет
+    } position_filter_t;
+
+    void position_filter_reset(position_filter_t *filter);
+
+    // Новый отсчет. velocity_q8 - ожидаемая скорость изменения показаний
+    // по данным мотора в отсчетах ADC в секунду * 256 (0 - неизвестна)
+    uint32_t position_filter_update(position_filter_t *filter, uint32_t raw,
+                                    int32_t velocity_q8, int64_t timestamp_us);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,24 +1,136 @@
 #include "position_sensor.h"
+#include "position_filter.h"
+#include "power_manager.h"
+#include "shade_config.h"
 #include "esp_log.h"
-#include "driver/adc.h"
+#include "esp_adc/adc_oneshot.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
+#include "esp_attr.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "nvs_flash.h"
-#include "nvs.h"
+#include "freertos/event_groups.h"
+#include "persistence.h"
+#include "telemetry.h"
+#include "shade_sim.h"
 #include "sdkconfig.h"
 
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+#include "esp_adc/adc_continuous.h"
+#endif
+
 static const char *TAG = "position_sensor";
-static position_config_t position_config = {0};
+
+// Датчик одной шторы. Все датчики на одном блоке ADC
+typedef struct
+{
+    uint8_t shade;
+    adc_channel_t adc_channel;
+    gpio_num_t power_pin;
+    position_config_t config;
+
+    // Последний отфильтрованный отсчет. Пишет только задача выборки,
+    // читатели получают копию под спинлоком и ADC не трогают
+    position_sample_t latest_sample;
+
+    // Состояние фильтра, обновляется только задачей выборки
+    position_filter_t filter;
+
+    // Слежение во время движения: датчик запитан постоянно. Без потокового
+    // режима задача выборки опрашивает ADC с периодом POSITION_SENSOR_TRACK_PERIOD_MS
+    volatile bool stream_active;
+
+    // Одиночное измерение, пока ADC занят слежением за другими шторами:
+    // датчик запитывается и получает значение из того же слежения.
+    // Ведется только задачей выборки
+    bool probe_active;
+
+    // Питание включено (поток или проба), отсчеты верны после valid_after_us.
+    // Меняется под sample_lock
+    bool powered;
+    int64_t valid_after_us;
+
+    // Упреждение проверки границ: граница сравнивается с положением, ожидаемым
+    // через limit_lead_us при текущей скорости (задержка до остановки катушек)
+    uint32_t limit_lead_us;
+    int32_t sample_velocity_q8;
+
+    // Состояние пошаговой калибровки
+    calibration_step_t calibration_step;
+    uint32_t calibration_upper_position;
+    uint32_t calibration_lower_position;
+    int32_t calibration_upper_steps;
+    int32_t calibration_lower_steps;
+    uint32_t calibration_zebra_offset;
+    bool calibration_zebra_enabled;
+} position_sensor_t;
+
+static position_sensor_t sensors[SHADE_COUNT] = {};
 static bool sensor_initialized = false;
+static adc_oneshot_unit_handle_t adc_oneshot_handle = NULL;
+
+static portMUX_TYPE sample_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t sampler_task_handle = NULL;
+static EventGroupHandle_t sample_events = NULL;
+
+// Бит готовности нового отсчета шторы
+#define SAMPLE_READY_BIT(shade) BIT(shade)
+
+static position_velocity_source_t velocity_source = NULL;
+
+// Биты уведомления задачи выборки
+#define SAMPLER_NOTIFY_REFRESH(shade) BIT(shade) // Запрошено новое измерение шторы
+#define SAMPLER_NOTIFY_REFRESH_ALL (BIT(SHADE_COUNT) - 1)
+#define SAMPLER_NOTIFY_FRAME BIT(8)  // Готов кадр DMA потокового режима
+#define SAMPLER_NOTIFY_STREAM BIT(9) // Включено или выключено слежение
+
+// Запас времени ожидания нового отсчета сверх стабилизации питания
+#define SAMPLE_WAIT_MARGIN_MS 50
+
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+#define SAMPLE_WAIT_MS (POSITION_SENSOR_STABILIZATION_MS + SAMPLE_WAIT_MARGIN_MS)
+#else
+// Проба во время слежения ждет еще и очередного периода опроса
+#define SAMPLE_WAIT_MS (POSITION_SENSOR_STABILIZATION_MS + CONFIG_POSITION_SENSOR_TRACK_PERIOD_MS + SAMPLE_WAIT_MARGIN_MS)
+#endif
+
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+// Формат кадра DMA зависит от чипа
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define POSITION_ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define POSITION_ADC_GET_CHANNEL(p) ((p)->type1.channel)
+#define POSITION_ADC_GET_DATA(p) ((p)->type1.data)
+#else
+#define POSITION_ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define POSITION_ADC_GET_CHANNEL(p) ((p)->type2.channel)
+#define POSITION_ADC_GET_DATA(p) ((p)->type2.data)
+#endif
+
+// Каналы всех штор идут в одном кадре по очереди
+#define POSITION_STREAM_FRAME_BYTES (CONFIG_POSITION_SENSOR_STREAM_FRAME_SAMPLES * SHADE_COUNT * SOC_ADC_DIGI_RESULT_BYTES)
 
-// Состояние пошаговой калибровки
-static calibration_step_t current_calibration_step = CALIBRATION_STEP_COMPLETE;
-static uint32_t calibration_upper_position = 0;
-static uint32_t calibration_lower_position = 0;
-static uint32_t calibration_zebra_offset = 100;
-static bool calibration_zebra_enabled = false;
+// Потоковый режим: датчики запитаны, ADC пишет кадры в кольцевой буфер DMA,
+// задача выборки усредняет каждый кадр по каналам и обновляет последние значения.
+// ADC запускает и останавливает только задача выборки
+static adc_continuous_handle_t adc_stream_handle = NULL;
+static bool adc_stream_running = false;
+
+static void position_sensor_stream_init(void);
+#endif
+
+// Контроль крайних положений по каждому отсчету во время движения
+static position_limit_callback_t limit_callback = NULL;
+static void *limit_callback_arg = NULL;
+
+static void position_sensor_sampler_task(void *parameter);
+
+static void position_sensor_apply_saved_state(position_sensor_t *sensor);
+static void position_sensor_save_calibration_data(position_sensor_t *sensor);
+
+static position_sensor_t *position_sensor_get(uint8_t shade)
+{
+    return &sensors[shade < SHADE_COUNT ? shade : 0];
+}
 
 // Получение описания шага калибровки
 static const char *get_calibration_step_description(calibration_step_t step)
@@ -38,337 +150,835 @@ static const char *get_calibration_step_description(calibration_step_t step)
     }
 }
 
-// Внутренние функции для управления питанием
-static void position_sensor_power_on(void)
+// Питание датчика по потоку и пробе. Вызывается под sample_lock
+static void position_sensor_apply_power(position_sensor_t *sensor)
 {
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 1);
-    vTaskDelay(pdMS_TO_TICKS(POSITION_SENSOR_STABILIZATION_MS));
+    bool on = sensor->stream_active || sensor->probe_active;
+    if (on && !sensor->powered)
+    {
+        // Ожидание стабилизации не блокирует: до его окончания
+        // читатели получают прежнее значение
+        sensor->valid_after_us = esp_timer_get_time() + POSITION_SENSOR_STABILIZATION_MS * 1000;
+    }
+    sensor->powered = on;
+    gpio_set_level(sensor->power_pin, on ? 1 : 0);
 }
 
-static void position_sensor_power_off(void)
+static bool position_sensor_any_powered(void)
 {
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 0);
+    bool powered = false;
+    portENTER_CRITICAL(&sample_lock);
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        powered |= sensors[shade].powered;
+    }
+    portEXIT_CRITICAL(&sample_lock);
+    return powered;
 }
 
 void position_sensor_init(void)
 {
-    ESP_LOGI(TAG, "Инициализация датчика положения");
+    ESP_LOGI(TAG, "Инициализация датчиков положения: %d", SHADE_COUNT);
 
-    // Инициализация GPIO для питания потенциометра
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << POSITION_SENSOR_POWER_PIN),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE};
-    gpio_config(&io_conf);
+    // Инициализация ADC в режиме одиночных измерений
+    adc_oneshot_unit_init_cfg_t unit_config = {
+        .unit_id = (adc_unit_t)POSITION_SENSOR_ADC_UNIT,
+    };
+    ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit_config, &adc_oneshot_handle));
 
-    // Изначально выключаем питание
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 0);
+    adc_oneshot_chan_cfg_t channel_config = {
+        .atten = (adc_atten_t)POSITION_SENSOR_ADC_ATTENUATION,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
 
-    // Инициализация ADC
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(POSITION_SENSOR_ADC_CHANNEL, POSITION_SENSOR_ADC_ATTENUATION);
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        position_sensor_t *sensor = &sensors[shade];
+        const shade_pins_t *pins = shade_get_pins(shade);
+
+        sensor->shade = shade;
+        sensor->adc_channel = (adc_channel_t)pins->sensor_adc_channel;
+        sensor->power_pin = (gpio_num_t)pins->sensor_power_pin;
+
+        // Инициализация GPIO для питания потенциометра
+        gpio_config_t io_conf = {
+            .pin_bit_mask = (1ULL << sensor->power_pin),
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE};
+        gpio_config(&io_conf);
+
+        // Изначально выключаем питание
+        gpio_set_level(sensor->power_pin, 0);
+
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc_oneshot_handle, sensor->adc_channel, &channel_config));
+
+        // Инициализация конфигурации
+        sensor->config.min_position = 100;  // Минимальное значение ADC
+        sensor->config.max_position = 3900; // Максимальное значение ADC
+        sensor->config.current_position = 0;
+        sensor->config.counts_per_step_q16 = 0;
+        sensor->config.calibrated = false;
+        sensor->calibration_step = CALIBRATION_STEP_COMPLETE;
+        sensor->calibration_zebra_offset = 100;
+        position_filter_reset(&sensor->filter);
+
+        // Калибровка и последнее положение из NVS: после перезагрузки
+        // повторная калибровка не нужна
+        position_sensor_apply_saved_state(sensor);
+
+        ESP_LOGI(TAG, "Штора %u: канал ADC %d, пин питания %d", shade + 1, sensor->adc_channel, sensor->power_pin);
+    }
 
-    // Инициализация конфигурации
-    position_config.min_position = 100;  // Минимальное значение ADC
-    position_config.max_position = 3900; // Максимальное значение ADC
-    position_config.current_position = 0;
-    position_config.calibrated = false;
+#ifdef CONFIG_SHADE_SIMULATION
+    // Отсчеты дает модель шторы, ADC настроен, но не читается
+    shade_sim_init();
+#endif
+
+    // Фоновая задача выборки владеет ADC и фильтрами
+    sample_events = xEventGroupCreate();
+    xTaskCreate(position_sensor_sampler_task, "position_sampler", 3072, NULL, 6, &sampler_task_handle);
+
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+    position_sensor_stream_init();
+#endif
 
     sensor_initialized = true;
+
+    // Первое измерение, чтобы кэш был заполнен сразу после запуска
+    xTaskNotify(sampler_task_handle, SAMPLER_NOTIFY_REFRESH_ALL, eSetBits);
     ESP_LOGI(TAG, "Датчик положения инициализирован");
-    ESP_LOGI(TAG, "ADC пин: %d, пин питания: %d", POSITION_SENSOR_ADC_PIN, POSITION_SENSOR_POWER_PIN);
 }
 
-uint32_t position_sensor_read(void)
+// Фильтрация и ограничение нового значения ADC
+static uint32_t position_sensor_filter(position_sensor_t *sensor, uint32_t adc_value, int64_t timestamp_us)
 {
-    if (!sensor_initialized)
+    // Ожидаемая скорость изменения показаний по скорости мотора
+    int32_t velocity_q8 = 0;
+    if (velocity_source != NULL && sensor->config.counts_per_step_q16 != 0)
     {
-        ESP_LOGE(TAG, "Датчик не инициализирован");
-        return 0;
+        int64_t steps_per_second = velocity_source(sensor->shade);
+        velocity_q8 = (int32_t)((steps_per_second * (int64_t)sensor->config.counts_per_step_q16) >> 8);
     }
+    sensor->sample_velocity_q8 = velocity_q8;
 
-    // Включаем питание для измерения
-    position_sensor_power_on();
+    return position_filter_update(&sensor->filter, adc_value, velocity_q8, timestamp_us);
+}
 
-    // Читаем ADC значение
-    int raw_value = adc1_get_raw(POSITION_SENSOR_ADC_CHANNEL);
+// Публикация нового отсчета для читателей кэша
+static void position_sensor_publish(position_sensor_t *sensor, uint32_t raw_value)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t adc_value = position_sensor_filter(sensor, raw_value, now);
+    const position_config_t *config = &sensor->config;
 
-    // Выключаем питание
-    position_sensor_power_off();
+    // Граница проверяется до ограничения диапазона, в том же отсчете
+    if (sensor->stream_active && config->calibrated && limit_callback != NULL)
+    {
+        int64_t predicted = (int64_t)adc_value + ((int64_t)sensor->sample_velocity_q8 * sensor->limit_lead_us) / (256LL * 1000000);
+        if (predicted <= (int64_t)config->min_position)
+        {
+            limit_callback(sensor->shade, POSITION_LIMIT_UPPER, adc_value, limit_callback_arg);
+        }
+        else if (predicted >= (int64_t)config->max_position)
+        {
+            limit_callback(sensor->shade, POSITION_LIMIT_LOWER, adc_value, limit_callback_arg);
+        }
+    }
 
-    if (raw_value < 0)
+    // Ограничиваем диапазон. Во время калибровки крайние точки ищутся
+    // заново, поэтому старые границы к отсчетам не применяются
+    bool clamp = (sensor->calibration_step == CALIBRATION_STEP_COMPLETE);
+    if (clamp && adc_value < config->min_position)
     {
-        ESP_LOGE(TAG, "Ошибка чтения ADC");
-        return position_config.current_position;
+        adc_value = config->min_position;
+    }
+    else if (clamp && adc_value > config->max_position)
+    {
+        adc_value = config->max_position;
     }
 
-    uint32_t adc_value = (uint32_t)raw_value;
+    portENTER_CRITICAL(&sample_lock);
+    sensor->latest_sample.position = adc_value;
+    sensor->latest_sample.timestamp_us = now;
+    sensor->config.current_position = adc_value;
+    portEXIT_CRITICAL(&sample_lock);
 
-    // Временная стабилизация значения (усреднение)
-    static uint32_t filter_buffer[5] = {0};
-    static uint8_t filter_index = 0;
+    xEventGroupSetBits(sample_events, SAMPLE_READY_BIT(sensor->shade));
+    TELEMETRY_SAMPLE(sensor->shade, adc_value, raw_value);
 
-    filter_buffer[filter_index] = adc_value;
-    filter_index = (filter_index + 1) % 5;
+    ESP_LOGD(TAG, "Штора %u, прочитано значение: %lu", sensor->shade + 1, adc_value);
+}
 
-    uint32_t sum = 0;
-    for (int i = 0; i < 5; i++)
+// Окончание пробы после полученного отсчета
+static void position_sensor_end_probe(position_sensor_t *sensor)
+{
+    if (!sensor->probe_active)
     {
-        sum += filter_buffer[i];
+        return;
+    }
+
+    portENTER_CRITICAL(&sample_lock);
+    sensor->probe_active = false;
+    position_sensor_apply_power(sensor);
+    portEXIT_CRITICAL(&sample_lock);
+    power_manager_release(POWER_LOCK_SENSOR);
+}
+
+// Запросы для незапитанных датчиков во время слежения: проба вместо
+// одиночного измерения, которое помешало бы слежению за другими шторами
+static void position_sensor_begin_probes(uint32_t refresh)
+{
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        position_sensor_t *sensor = &sensors[shade];
+        if (!(refresh & SAMPLER_NOTIFY_REFRESH(shade)) || sensor->probe_active)
+        {
+            continue;
+        }
+
+        portENTER_CRITICAL(&sample_lock);
+        bool start = !sensor->powered;
+        if (start)
+        {
+            sensor->probe_active = true;
+            position_sensor_apply_power(sensor);
+        }
+        portEXIT_CRITICAL(&sample_lock);
+
+        // Запитанный датчик получит значение из слежения
+        if (start)
+        {
+            power_manager_acquire(POWER_LOCK_SENSOR);
+        }
     }
-    adc_value = sum / 5;
+}
+
+// Одиночное чтение ADC при уже включенном питании
+static void position_sensor_read_adc(position_sensor_t *sensor)
+{
+#ifdef CONFIG_SHADE_SIMULATION
+    int raw_value = (int)shade_sim_read(sensor->shade);
+    esp_err_t err = ESP_OK;
+#else
+    int raw_value = 0;
+    esp_err_t err = adc_oneshot_read(adc_oneshot_handle, sensor->adc_channel, &raw_value);
+#endif
 
-    // Ограничиваем диапазон
-    if (adc_value < position_config.min_position)
+    if (err != ESP_OK || raw_value < 0)
     {
-        adc_value = position_config.min_position;
+        ESP_LOGE(TAG, "Ошибка чтения ADC: %s", esp_err_to_name(err));
+        return;
     }
-    else if (adc_value > position_config.max_position)
+
+    position_sensor_publish(sensor, (uint32_t)raw_value);
+}
+
+// Одиночные измерения запрошенных штор с общим ожиданием стабилизации
+static void position_sensor_sample_oneshot(uint32_t refresh)
+{
+    // Сон запрещен до конца измерения: ADC и ожидание стабилизации
+    power_manager_acquire(POWER_LOCK_SENSOR);
+
+    // Включаем питание для измерения
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
     {
-        adc_value = position_config.max_position;
+        if (refresh & SAMPLER_NOTIFY_REFRESH(shade))
+        {
+            gpio_set_level(sensors[shade].power_pin, 1);
+        }
     }
+    vTaskDelay(pdMS_TO_TICKS(POSITION_SENSOR_STABILIZATION_MS));
+
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        position_sensor_t *sensor = &sensors[shade];
+        if (!(refresh & SAMPLER_NOTIFY_REFRESH(shade)))
+        {
+            continue;
+        }
 
-    position_config.current_position = adc_value;
+        // Читаем ADC значение
+        position_sensor_read_adc(sensor);
+
+        // Выключаем питание, если за это время не началось слежение
+        portENTER_CRITICAL(&sample_lock);
+        if (!sensor->powered)
+        {
+            gpio_set_level(sensor->power_pin, 0);
+        }
+        portEXIT_CRITICAL(&sample_lock);
+    }
 
-    ESP_LOGD(TAG, "Прочитано значение: %lu", adc_value);
+    power_manager_release(POWER_LOCK_SENSOR);
+}
 
-    return adc_value;
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+// Вызывается из ISR драйвера по заполнении кадра
+static bool IRAM_ATTR position_sensor_on_conv_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(sampler_task_handle, SAMPLER_NOTIFY_FRAME, eSetBits, &woken);
+    return woken == pdTRUE;
 }
 
-void position_sensor_set_calibration(uint32_t min_pos, uint32_t max_pos)
+// ADC в непрерывном режиме, пока запитан хотя бы один датчик
+static void position_sensor_stream_update(void)
 {
-    if (min_pos >= max_pos)
+    bool wanted = position_sensor_any_powered();
+    if (wanted == adc_stream_running)
     {
-        ESP_LOGE(TAG, "Некорректные значения калибровки");
         return;
     }
 
-    position_config.min_position = min_pos;
-    position_config.max_position = max_pos;
-    position_config.calibrated = true;
+    if (!wanted)
+    {
+        adc_continuous_stop(adc_stream_handle);
+        adc_stream_running = false;
+        return;
+    }
+
+    esp_err_t err = adc_continuous_start(adc_stream_handle);
+    if (err == ESP_OK)
+    {
+        adc_stream_running = true;
+        return;
+    }
 
-    ESP_LOGI(TAG, "Калибровка установлена: min=%lu, max=%lu", min_pos, max_pos);
+    // Слежение невозможно: датчики обесточиваются, чтение идет по запросу
+    ESP_LOGE(TAG, "Ошибка запуска потокового режима: %s", esp_err_to_name(err));
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        position_sensor_t *sensor = &sensors[shade];
+        portENTER_CRITICAL(&sample_lock);
+        bool was_powered = sensor->powered;
+        sensor->stream_active = false;
+        sensor->probe_active = false;
+        position_sensor_apply_power(sensor);
+        portEXIT_CRITICAL(&sample_lock);
+        if (was_powered)
+        {
+            power_manager_release(POWER_LOCK_SENSOR);
+        }
+    }
 }
 
-void position_sensor_calibrate_start(void)
+// Разбор накопившихся кадров DMA, актуален только последний
+static void position_sensor_drain_stream(void)
 {
-    ESP_LOGI(TAG, "Начало калибровки датчика положения");
+    static uint8_t frame[POSITION_STREAM_FRAME_BYTES];
+    uint32_t length = 0;
+
+    while (adc_continuous_read(adc_stream_handle, frame, sizeof(frame), &length, 0) == ESP_OK)
+    {
+        uint32_t sum[SHADE_COUNT] = {};
+        uint32_t count[SHADE_COUNT] = {};
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES)
+        {
+            const adc_digi_output_data_t *sample = (const adc_digi_output_data_t *)&frame[i];
+            for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+            {
+                if (POSITION_ADC_GET_CHANNEL(sample) == sensors[shade].adc_channel)
+                {
+                    sum[shade] += POSITION_ADC_GET_DATA(sample);
+                    count[shade]++;
+                    break;
+                }
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+        {
+            position_sensor_t *sensor = &sensors[shade];
 
-    // Измеряем минимальное значение (полностью закрыто)
-    ESP_LOGI(TAG, "Установите жалюзи в полностью закрытое положение");
-    vTaskDelay(pdMS_TO_TICKS(5000)); // Ожидание 5 секунд
+            // Кадры обесточенных датчиков и кадры до стабилизации питания отбрасываем
+            if (count[shade] == 0 || !sensor->powered || now < sensor->valid_after_us)
+            {
+                continue;
+            }
 
-    uint32_t min_val = 0;
-    for (int i = 0; i < 10; i++)
+            position_sensor_publish(sensor, sum[shade] / count[shade]);
+            position_sensor_end_probe(sensor);
+        }
+    }
+}
+#else
+// Опрос запитанных датчиков во время слежения
+static void position_sensor_track_oneshot(void)
+{
+    int64_t now = esp_timer_get_time();
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
     {
-        min_val += position_sensor_read();
-        vTaskDelay(pdMS_TO_TICKS(100));
+        position_sensor_t *sensor = &sensors[shade];
+
+        // Питание уже включено, ждем только окончания стабилизации
+        if (!sensor->powered || now < sensor->valid_after_us)
+        {
+            continue;
+        }
+
+        position_sensor_read_adc(sensor);
+        position_sensor_end_probe(sensor);
     }
-    min_val /= 10;
+}
+#endif
 
-    // Измеряем максимальное значение (полностью открыто)
-    ESP_LOGI(TAG, "Установите жалюзи в полностью открытое положение");
-    vTaskDelay(pdMS_TO_TICKS(5000)); // Ожидание 5 секунд
+// Задача выборки: кадры потокового режима во время движения,
+// одиночные измерения по запросу и периодически в покое
+static void position_sensor_sampler_task(void *parameter)
+{
+#if CONFIG_POSITION_SENSOR_IDLE_SAMPLE_MS > 0
+    const TickType_t idle_period = pdMS_TO_TICKS(CONFIG_POSITION_SENSOR_IDLE_SAMPLE_MS);
+#else
+    const TickType_t idle_period = portMAX_DELAY;
+#endif
 
-    uint32_t max_val = 0;
-    for (int i = 0; i < 10; i++)
+    while (true)
     {
-        max_val += position_sensor_read();
-        vTaskDelay(pdMS_TO_TICKS(100));
+        bool tracking = position_sensor_any_powered();
+        uint32_t events = 0;
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+        TickType_t wait = tracking ? portMAX_DELAY : idle_period;
+#else
+        TickType_t wait = tracking ? pdMS_TO_TICKS(CONFIG_POSITION_SENSOR_TRACK_PERIOD_MS) : idle_period;
+#endif
+        bool notified = xTaskNotifyWait(0, UINT32_MAX, &events, wait) == pdTRUE;
+
+        // Периодическое измерение в покое - для всех штор
+        uint32_t refresh = events & SAMPLER_NOTIFY_REFRESH_ALL;
+        if (!notified && !tracking)
+        {
+            refresh = SAMPLER_NOTIFY_REFRESH_ALL;
+        }
+
+        if (position_sensor_any_powered())
+        {
+            position_sensor_begin_probes(refresh);
+            refresh = 0;
+        }
+
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+        // Запрос нового значения обслуживается следующим кадром
+        position_sensor_stream_update();
+        if (adc_stream_running)
+        {
+            position_sensor_drain_stream();
+            continue;
+        }
+#else
+        if (position_sensor_any_powered())
+        {
+            position_sensor_track_oneshot();
+            continue;
+        }
+#endif
+
+        if (refresh != 0)
+        {
+            position_sensor_sample_oneshot(refresh);
+        }
+    }
+}
+
+bool position_sensor_get_cached(uint8_t shade, position_sample_t *sample, uint32_t max_age_ms)
+{
+    if (!sensor_initialized)
+    {
+        ESP_LOGE(TAG, "Датчик не инициализирован");
+        return false;
+    }
+
+    position_sensor_t *sensor = position_sensor_get(shade);
+    int64_t max_age_us = (int64_t)max_age_ms * 1000;
+
+    portENTER_CRITICAL(&sample_lock);
+    *sample = sensor->latest_sample;
+    portEXIT_CRITICAL(&sample_lock);
+
+    if (max_age_ms == POSITION_SENSOR_MAX_AGE_ANY)
+    {
+        return sample->timestamp_us != 0;
+    }
+
+    if (max_age_ms != 0 && sample->timestamp_us != 0 &&
+        esp_timer_get_time() - sample->timestamp_us <= max_age_us)
+    {
+        return true;
     }
-    max_val /= 10;
 
-    position_sensor_set_calibration(min_val, max_val);
-    ESP_LOGI(TAG, "Калибровка завершена");
+    // Отсчет устарел: просим задачу выборки обновить его и ждем
+    EventBits_t ready = SAMPLE_READY_BIT(sensor->shade);
+    xEventGroupClearBits(sample_events, ready);
+    xTaskNotify(sampler_task_handle, SAMPLER_NOTIFY_REFRESH(sensor->shade), eSetBits);
+    EventBits_t bits = xEventGroupWaitBits(sample_events, ready, pdFALSE, pdTRUE, pdMS_TO_TICKS(SAMPLE_WAIT_MS));
+
+    portENTER_CRITICAL(&sample_lock);
+    *sample = sensor->latest_sample;
+    portEXIT_CRITICAL(&sample_lock);
+
+    if (!(bits & ready))
+    {
+        ESP_LOGW(TAG, "Нет нового отсчета шторы %u, используется прежний", sensor->shade + 1);
+        return false;
+    }
+
+    return true;
 }
 
-bool position_sensor_is_calibrated(void)
+uint32_t position_sensor_read(uint8_t shade)
 {
-    return position_config.calibrated;
+    // Свежее измерение через задачу выборки
+    position_sample_t sample;
+    position_sensor_get_cached(shade, &sample, 0);
+    return sample.position;
 }
 
-float position_sensor_get_percentage(void)
+#ifdef CONFIG_POSITION_SENSOR_STREAMING
+static void position_sensor_stream_init(void)
 {
-    if (!position_config.calibrated)
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = POSITION_STREAM_FRAME_BYTES * 4,
+        .conv_frame_size = POSITION_STREAM_FRAME_BYTES,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc_stream_handle));
+
+    // Все каналы в одном шаблоне: отсчеты штор чередуются в кадре
+    adc_digi_pattern_config_t patterns[SHADE_COUNT] = {};
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
     {
-        ESP_LOGW(TAG, "Датчик не откалиброван");
-        return 0.0f;
+        patterns[shade].atten = (uint8_t)POSITION_SENSOR_ADC_ATTENUATION;
+        patterns[shade].channel = (uint8_t)sensors[shade].adc_channel;
+        patterns[shade].unit = (uint8_t)POSITION_SENSOR_ADC_UNIT;
+        patterns[shade].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+    adc_continuous_config_t stream_config = {
+        .pattern_num = SHADE_COUNT,
+        .adc_pattern = patterns,
+        .sample_freq_hz = CONFIG_POSITION_SENSOR_STREAM_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = POSITION_ADC_OUTPUT_TYPE,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc_stream_handle, &stream_config));
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = position_sensor_on_conv_done,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_stream_handle, &callbacks, NULL));
+
+    ESP_LOGI(TAG, "Потоковый режим ADC: %d Гц, %d отсчетов в кадре на канал",
+             CONFIG_POSITION_SENSOR_STREAM_SAMPLE_FREQ_HZ, CONFIG_POSITION_SENSOR_STREAM_FRAME_SAMPLES);
+}
+#endif
+
+void position_sensor_stream_start(uint8_t shade)
+{
+    position_sensor_t *sensor = position_sensor_get(shade);
+    if (!sensor_initialized || sensor->stream_active)
+    {
+        return;
     }
 
-    uint32_t current = position_sensor_read();
+    power_manager_acquire(POWER_LOCK_SENSOR);
+
+    // Питание остается включенным на все время движения. ADC переходит
+    // в режим слежения в задаче выборки
+    portENTER_CRITICAL(&sample_lock);
+    sensor->stream_active = true;
+    position_sensor_apply_power(sensor);
+    portEXIT_CRITICAL(&sample_lock);
+
+    xTaskNotify(sampler_task_handle, SAMPLER_NOTIFY_STREAM, eSetBits);
 
-    if (current <= position_config.min_position)
+    ESP_LOGD(TAG, "Потоковый режим шторы %u включен", shade + 1);
+}
+
+void position_sensor_stream_stop(uint8_t shade)
+{
+    position_sensor_t *sensor = position_sensor_get(shade);
+    if (!sensor->stream_active)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&sample_lock);
+    sensor->stream_active = false;
+    position_sensor_apply_power(sensor);
+    portEXIT_CRITICAL(&sample_lock);
+    power_manager_release(POWER_LOCK_SENSOR);
+
+    // Последний поток: задача выборки останавливает непрерывный режим
+    xTaskNotify(sampler_task_handle, SAMPLER_NOTIFY_STREAM, eSetBits);
+
+    ESP_LOGD(TAG, "Потоковый режим шторы %u выключен, позиция %lu", shade + 1, sensor->config.current_position);
+}
+
+bool position_sensor_is_streaming(uint8_t shade)
+{
+    return position_sensor_get(shade)->stream_active;
+}
+
+void position_sensor_set_limit_lead_us(uint8_t shade, uint32_t lead_us)
+{
+    position_sensor_get(shade)->limit_lead_us = lead_us;
+}
+
+void position_sensor_set_limit_callback(position_limit_callback_t callback, void *arg)
+{
+    limit_callback = callback;
+    limit_callback_arg = arg;
+}
+
+void position_sensor_set_velocity_source(position_velocity_source_t source)
+{
+    velocity_source = source;
+}
+
+void position_sensor_set_calibration(uint8_t shade, uint32_t min_pos, uint32_t max_pos)
+{
+    if (min_pos >= max_pos)
+    {
+        ESP_LOGE(TAG, "Некорректные значения калибровки");
+        return;
+    }
+
+    position_config_t *config = &position_sensor_get(shade)->config;
+    config->min_position = min_pos;
+    config->max_position = max_pos;
+    config->calibrated = true;
+
+    ESP_LOGI(TAG, "Калибровка шторы %u установлена: min=%lu, max=%lu", shade + 1, min_pos, max_pos);
+}
+
+bool position_sensor_is_calibrated(uint8_t shade)
+{
+    return position_sensor_get(shade)->config.calibrated;
+}
+
+float position_sensor_to_percentage(uint8_t shade, uint32_t position)
+{
+    const position_config_t *config = &position_sensor_get(shade)->config;
+    if (position <= config->min_position)
     {
         return 0.0f;
     }
 
-    if (current >= position_config.max_position)
+    if (position >= config->max_position)
     {
         return 100.0f;
     }
 
-    float percentage = ((float)(current - position_config.min_position) /
-                        (float)(position_config.max_position - position_config.min_position)) *
-                       100.0f;
+    return ((float)(position - config->min_position) /
+            (float)(config->max_position - config->min_position)) *
+           100.0f;
+}
+
+float position_sensor_get_percentage(uint8_t shade)
+{
+    if (!position_sensor_is_calibrated(shade))
+    {
+        ESP_LOGW(TAG, "Датчик не откалиброван");
+        return 0.0f;
+    }
+
+    position_sample_t sample;
+    position_sensor_get_cached(shade, &sample, POSITION_SENSOR_CACHE_MAX_AGE_MS);
+
+    float percentage = position_sensor_to_percentage(shade, sample.position);
 
-    ESP_LOGD(TAG, "Позиция: %.1f%% (%lu)", percentage, current);
+    ESP_LOGD(TAG, "Позиция шторы %u: %.1f%% (%lu)", shade + 1, percentage, sample.position);
 
     return percentage;
 }
 
 // Новые функции для пошаговой калибровки
-calibration_step_callback_t position_sensor_start_calibration(void)
+calibration_step_callback_t position_sensor_start_calibration(uint8_t shade)
 {
-    ESP_LOGI(TAG, "Starting step-by-step calibration");
+    position_sensor_t *sensor = position_sensor_get(shade);
+    ESP_LOGI(TAG, "Starting step-by-step calibration of shade %u", shade + 1);
 
     // Инициализация zebra_enabled из Kconfig
 #ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-    calibration_zebra_enabled = true;
+    sensor->calibration_zebra_enabled = true;
 #else
-    calibration_zebra_enabled = false;
+    sensor->calibration_zebra_enabled = false;
 #endif
 
-    // Загружаем предыдущие значения калибровки
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open("position_sensor", NVS_READONLY, &nvs_handle);
+    // Предыдущие значения калибровки загружены при инициализации и остаются
+    // в силе для шагов, которые пользователь пропустит
 
-    if (err == ESP_OK)
-    {
-        err = nvs_get_u32(nvs_handle, "upper_position", &calibration_upper_position);
-        if (err != ESP_OK)
-            calibration_upper_position = 0;
-
-        err = nvs_get_u32(nvs_handle, "lower_position", &calibration_lower_position);
-        if (err != ESP_OK)
-            calibration_lower_position = 4095;
-
-        err = nvs_get_u32(nvs_handle, "zebra_offset", &calibration_zebra_offset);
-        if (err != ESP_OK)
-            calibration_zebra_offset = 100;
-
-        nvs_close(nvs_handle);
-    }
-
-    current_calibration_step = CALIBRATION_STEP_UPPER;
+    sensor->calibration_step = CALIBRATION_STEP_UPPER;
 
     ESP_LOGI(TAG, "Calibration started. Zebra support: %s",
-             calibration_zebra_enabled ? "enabled" : "disabled");
+             sensor->calibration_zebra_enabled ? "enabled" : "disabled");
 
     return get_calibration_step_description;
 }
 
-calibration_step_t position_sensor_next_calibration_step(void)
+// Выход из калибровки без сохранения: остается прежняя калибровка
+void position_sensor_cancel_calibration(uint8_t shade)
+{
+    position_sensor_t *sensor = position_sensor_get(shade);
+    if (sensor->calibration_step != CALIBRATION_STEP_COMPLETE)
+    {
+        ESP_LOGI(TAG, "Calibration of shade %u cancelled", shade + 1);
+        sensor->calibration_step = CALIBRATION_STEP_COMPLETE;
+    }
+}
+
+calibration_step_t position_sensor_next_calibration_step(uint8_t shade)
 {
-    if (current_calibration_step == CALIBRATION_STEP_COMPLETE)
+    position_sensor_t *sensor = position_sensor_get(shade);
+    if (sensor->calibration_step == CALIBRATION_STEP_COMPLETE)
     {
         return CALIBRATION_STEP_COMPLETE;
     }
 
-    switch (current_calibration_step)
+    switch (sensor->calibration_step)
     {
     case CALIBRATION_STEP_UPPER:
-        current_calibration_step = CALIBRATION_STEP_LOWER;
+        sensor->calibration_step = CALIBRATION_STEP_LOWER;
         break;
     case CALIBRATION_STEP_LOWER:
-        if (calibration_zebra_enabled)
+        if (sensor->calibration_zebra_enabled)
         {
-            current_calibration_step = CALIBRATION_STEP_ZEBRA_OFFSET;
+            sensor->calibration_step = CALIBRATION_STEP_ZEBRA_OFFSET;
         }
         else
         {
-            current_calibration_step = CALIBRATION_STEP_COMPLETE;
+            sensor->calibration_step = CALIBRATION_STEP_COMPLETE;
         }
         break;
     case CALIBRATION_STEP_ZEBRA_OFFSET:
-        current_calibration_step = CALIBRATION_STEP_COMPLETE;
+        sensor->calibration_step = CALIBRATION_STEP_COMPLETE;
         break;
     default:
-        current_calibration_step = CALIBRATION_STEP_COMPLETE;
+        sensor->calibration_step = CALIBRATION_STEP_COMPLETE;
         break;
     }
 
-    ESP_LOGI(TAG, "Next calibration step: %d", current_calibration_step);
-    return current_calibration_step;
+    // Все шаги пройдены: сохраняем результат
+    if (sensor->calibration_step == CALIBRATION_STEP_COMPLETE)
+    {
+        position_sensor_save_calibration_data(sensor);
+    }
+
+    ESP_LOGI(TAG, "Next calibration step of shade %u: %d", shade + 1, sensor->calibration_step);
+    return sensor->calibration_step;
 }
 
-void position_sensor_save_calibration_step(uint32_t position)
+void position_sensor_save_calibration_step(uint8_t shade, uint32_t position, int32_t motor_steps)
 {
-    switch (current_calibration_step)
+    position_sensor_t *sensor = position_sensor_get(shade);
+    switch (sensor->calibration_step)
     {
     case CALIBRATION_STEP_UPPER:
-        calibration_upper_position = position;
-        ESP_LOGI(TAG, "Upper position saved: %lu", position);
+        sensor->calibration_upper_position = position;
+        sensor->calibration_upper_steps = motor_steps;
+        ESP_LOGI(TAG, "Upper position saved: %lu (steps %ld)", position, motor_steps);
         break;
     case CALIBRATION_STEP_LOWER:
-        calibration_lower_position = position;
-        ESP_LOGI(TAG, "Lower position saved: %lu", position);
+        sensor->calibration_lower_position = position;
+        sensor->calibration_lower_steps = motor_steps;
+        ESP_LOGI(TAG, "Lower position saved: %lu (steps %ld)", position, motor_steps);
+
+        // Соотношение отсчетов ADC и шагов мотора по проходу между крайними точками
+        {
+            uint32_t delta_counts = (sensor->calibration_lower_position > sensor->calibration_upper_position)
+                                        ? sensor->calibration_lower_position - sensor->calibration_upper_position
+                                        : sensor->calibration_upper_position - sensor->calibration_lower_position;
+            int32_t delta_steps = sensor->calibration_lower_steps - sensor->calibration_upper_steps;
+            if (delta_steps < 0)
+                delta_steps = -delta_steps;
+
+            if (delta_steps > 0 && delta_counts > 0)
+            {
+                sensor->config.counts_per_step_q16 = (uint32_t)(((uint64_t)delta_counts << 16) / (uint32_t)delta_steps);
+                ESP_LOGI(TAG, "Learned %lu ADC counts over %ld steps", delta_counts, delta_steps);
+            }
+        }
 
         // Устанавливаем калибровку в position_sensor
-        if (calibration_upper_position < calibration_lower_position)
+        if (sensor->calibration_upper_position < sensor->calibration_lower_position)
         {
-            position_sensor_set_calibration(calibration_upper_position, calibration_lower_position);
+            position_sensor_set_calibration(shade, sensor->calibration_upper_position, sensor->calibration_lower_position);
         }
         break;
     case CALIBRATION_STEP_ZEBRA_OFFSET:
-        calibration_zebra_offset = position;
+        sensor->calibration_zebra_offset = position;
         ESP_LOGI(TAG, "Zebra offset saved: %lu", position);
         break;
     case CALIBRATION_STEP_COMPLETE:
         // Сохраняем все данные в NVS
-        position_sensor_save_calibration_data();
+        position_sensor_save_calibration_data(sensor);
         break;
     }
 }
 
-uint32_t position_sensor_get_zebra_offset(void)
+uint32_t position_sensor_get_zebra_offset(uint8_t shade)
 {
-    return calibration_zebra_offset;
+    return position_sensor_get(shade)->calibration_zebra_offset;
 }
 
-uint32_t position_sensor_get_min_position(void)
+uint32_t position_sensor_get_min_position(uint8_t shade)
 {
-    return position_config.min_position;
+    return position_sensor_get(shade)->config.min_position;
 }
 
-uint32_t position_sensor_get_max_position(void)
+uint32_t position_sensor_get_max_position(uint8_t shade)
 {
-    return position_config.max_position;
+    return position_sensor_get(shade)->config.max_position;
 }
 
-static void position_sensor_save_calibration_data(void)
+uint32_t position_sensor_get_counts_per_step_q16(uint8_t shade)
 {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open("position_sensor", NVS_READWRITE, &nvs_handle);
+    return position_sensor_get(shade)->config.counts_per_step_q16;
+}
 
-    if (err != ESP_OK)
+static void position_sensor_apply_saved_state(position_sensor_t *sensor)
+{
+    persistence_calibration_t calibration;
+    if (persistence_get_calibration(sensor->shade, &calibration))
     {
-        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
-        return;
+        sensor->calibration_upper_position = calibration.upper_position;
+        sensor->calibration_lower_position = calibration.lower_position;
+        sensor->calibration_upper_steps = calibration.upper_steps;
+        sensor->calibration_lower_steps = calibration.lower_steps;
+        sensor->calibration_zebra_offset = calibration.zebra_offset;
+        sensor->calibration_zebra_enabled = calibration.zebra_enabled;
+        sensor->config.counts_per_step_q16 = calibration.counts_per_step_q16;
+        position_sensor_set_calibration(sensor->shade, calibration.upper_position, calibration.lower_position);
     }
 
-    err = nvs_set_u32(nvs_handle, "upper_position", calibration_upper_position);
-    if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error saving upper position: %s", esp_err_to_name(err));
-
-    err = nvs_set_u32(nvs_handle, "lower_position", calibration_lower_position);
-    if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error saving lower position: %s", esp_err_to_name(err));
-
-    err = nvs_set_u32(nvs_handle, "zebra_offset", calibration_zebra_offset);
-    if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error saving zebra offset: %s", esp_err_to_name(err));
-
-    err = nvs_set_u8(nvs_handle, "zebra_enabled", calibration_zebra_enabled ? 1 : 0);
-    if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error saving zebra enabled: %s", esp_err_to_name(err));
-
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error committing NVS: %s", esp_err_to_name(err));
+    persistence_position_t position;
+    if (persistence_get_position(sensor->shade, &position))
+    {
+        sensor->config.current_position = position.position;
 
-    nvs_close(nvs_handle);
+        // До первого измерения интеграции получают сохраненное положение.
+        // Метка времени из начала работы: любой запрос со сроком свежести
+        // все равно дождется настоящего отсчета
+        sensor->latest_sample.position = position.position;
+        sensor->latest_sample.timestamp_us = 1;
+    }
+}
 
-    ESP_LOGI(TAG, "Calibration data saved to NVS");
+static void position_sensor_save_calibration_data(position_sensor_t *sensor)
+{
+    persistence_calibration_t calibration = {};
+    calibration.calibrated = sensor->config.calibrated;
+    calibration.zebra_enabled = sensor->calibration_zebra_enabled;
+    calibration.upper_position = sensor->calibration_upper_position;
+    calibration.lower_position = sensor->calibration_lower_position;
+    calibration.upper_steps = sensor->calibration_upper_steps;
+    calibration.lower_steps = sensor->calibration_lower_steps;
+    calibration.zebra_offset = sensor->calibration_zebra_offset;
+    calibration.counts_per_step_q16 = sensor->config.counts_per_step_q16;
+
+    // Все поля записываются одним блоком за одну фиксацию NVS
+    if (persistence_save_calibration(sensor->shade, &calibration) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Calibration data of shade %u saved to NVS", sensor->shade + 1);
+    }
 }
@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_log.h"
-#include "driver/adc.h"
 #include "driver/gpio.h"
 
 // Пины конфигурации из Kconfig
@@ -14,6 +13,10 @@
 #define POSITION_SENSOR_ADC_CHANNEL CONFIG_POSITION_SENSOR_ADC_CHANNEL
 #define POSITION_SENSOR_ADC_ATTENUATION CONFIG_POSITION_SENSOR_ADC_ATTENUATION
 #define POSITION_SENSOR_STABILIZATION_MS CONFIG_POSITION_SENSOR_STABILIZATION_MS
+#define POSITION_SENSOR_CACHE_MAX_AGE_MS CONFIG_POSITION_SENSOR_CACHE_MAX_AGE_MS
+
+// Любой возраст отсчета: чтение кэша никогда не ждет
+#define POSITION_SENSOR_MAX_AGE_ANY UINT32_MAX
 
 #ifdef __cplusplus
 extern "C"
@@ -24,9 +27,17 @@ extern "C"
         uint32_t min_position;
         uint32_t max_position;
         uint32_t current_position;
+        uint32_t counts_per_step_q16; // Отсчетов ADC на шаг мотора (Q16.16), 0 - неизвестно
         bool calibrated;
     } position_config_t;
 
+    // Отфильтрованный отсчет с моментом измерения (esp_timer_get_time)
+    typedef struct
+    {
+        uint32_t position;
+        int64_t timestamp_us; // 0 - измерений еще не было
+    } position_sample_t;
+
     typedef enum
     {
         CALIBRATION_STEP_UPPER,
@@ -37,21 +48,55 @@ extern "C"
 
     typedef const char *(*calibration_step_callback_t)(calibration_step_t step);
 
+    typedef enum
+    {
+        POSITION_LIMIT_UPPER, // Достигнуто min_position (верх)
+        POSITION_LIMIT_LOWER  // Достигнуто max_position (низ)
+    } position_limit_t;
+
+    // Вызывается из задачи выборки на каждом отсчете за границей калибровки
+    // во время движения
+    typedef void (*position_limit_callback_t)(uint8_t shade, position_limit_t limit, uint32_t position, void *arg);
+
+    // Скорость мотора шторы в шагах в секунду со знаком (вниз - положительная)
+    typedef int32_t (*position_velocity_source_t)(uint8_t shade);
+
+    // Датчики всех штор (shade_config.h) на одном блоке ADC. Остальные
+    // функции принимают номер шторы с нуля
     void position_sensor_init(void);
-    uint32_t position_sensor_read(void);
-    void position_sensor_set_calibration(uint32_t min_pos, uint32_t max_pos);
-    void position_sensor_calibrate_start(void);
-    bool position_sensor_is_calibrated(void);
-    float position_sensor_get_percentage(void);
+    uint32_t position_sensor_read(uint8_t shade);
+    void position_sensor_set_calibration(uint8_t shade, uint32_t min_pos, uint32_t max_pos);
+    bool position_sensor_is_calibrated(uint8_t shade);
+    float position_sensor_get_percentage(uint8_t shade);
+    float position_sensor_to_percentage(uint8_t shade, uint32_t position);
+
+    // Последний отсчет фоновой выборки. Если он старше max_age_ms, запрашивается
+    // новое измерение и вызывающий ждет его (0 - всегда новое измерение).
+    // Возвращает false, если свежий отсчет получить не удалось
+    bool position_sensor_get_cached(uint8_t shade, position_sample_t *sample, uint32_t max_age_ms);
+
+    // Источник скорости для предсказания в фильтре (вызывается из задачи выборки)
+    void position_sensor_set_velocity_source(position_velocity_source_t source);
+    void position_sensor_set_limit_callback(position_limit_callback_t callback, void *arg);
+
+    // Граница срабатывает раньше на lead_us при текущей скорости движения
+    void position_sensor_set_limit_lead_us(uint8_t shade, uint32_t lead_us);
+
+    // Потоковый режим на время движения: датчик запитан, чтение не блокирует.
+    // Пока следится хотя бы одна штора, измерения остальных идут через то же слежение
+    void position_sensor_stream_start(uint8_t shade);
+    void position_sensor_stream_stop(uint8_t shade);
+    bool position_sensor_is_streaming(uint8_t shade);
 
     // Новые функции для пошаговой калибровки
-    calibration_step_callback_t position_sensor_start_calibration(void);
-    calibration_step_t position_sensor_next_calibration_step(void);
-    void position_sensor_save_calibration_step(uint32_t position);
-    uint32_t position_sensor_get_zebra_offset(void);
-    uint32_t position_sensor_get_min_position(void);
-    uint32_t position_sensor_get_max_position(void);
-    static void position_sensor_save_calibration_data(void);
+    calibration_step_callback_t position_sensor_start_calibration(uint8_t shade);
+    calibration_step_t position_sensor_next_calibration_step(uint8_t shade);
+    void position_sensor_cancel_calibration(uint8_t shade);
+    void position_sensor_save_calibration_step(uint8_t shade, uint32_t position, int32_t motor_steps);
+    uint32_t position_sensor_get_zebra_offset(uint8_t shade);
+    uint32_t position_sensor_get_min_position(uint8_t shade);
+    uint32_t position_sensor_get_max_position(uint8_t shade);
+    uint32_t position_sensor_get_counts_per_step_q16(uint8_t shade);
 
 #ifdef __cplusplus
 }
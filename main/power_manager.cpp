@@ -0,0 +1,65 @@
+#include "power_manager.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+
+static const char *TAG = "power_manager";
+
+static const char *const lock_names[POWER_LOCK_COUNT] = {
+    "motor",
+    "sensor",
+    "ota",
+};
+
+// Блокировка light sleep на подсистему. Блокировки esp_pm считают
+// захваты, поэтому вызовы acquire/release должны быть парными
+static esp_pm_lock_handle_t pm_locks[POWER_LOCK_COUNT] = {};
+
+void power_manager_init(void)
+{
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#else
+        .light_sleep_enable = false,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure PM: %s", esp_err_to_name(err));
+        return;
+    }
+
+    for (int i = 0; i < POWER_LOCK_COUNT; i++)
+    {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, lock_names[i], &pm_locks[i]));
+    }
+
+    // Пробуждение по нажатию кнопок (активный низкий уровень)
+    gpio_wakeup_enable((gpio_num_t)CONFIG_BUTTON_UP_PIN, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)CONFIG_BUTTON_DOWN_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    ESP_LOGI(TAG, "Power save enabled: %d..%d MHz, light sleep %s",
+             pm_config.min_freq_mhz, pm_config.max_freq_mhz, pm_config.light_sleep_enable ? "on" : "off");
+}
+
+void power_manager_acquire(power_lock_t lock)
+{
+    if (pm_locks[lock] != NULL)
+    {
+        esp_pm_lock_acquire(pm_locks[lock]);
+    }
+}
+
+void power_manager_release(power_lock_t lock)
+{
+    if (pm_locks[lock] != NULL)
+    {
+        esp_pm_lock_release(pm_locks[lock]);
+    }
+}
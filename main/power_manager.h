@@ -0,0 +1,34 @@
+// Управление энергопотреблением: автоматический light sleep в простое
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Подсистемы, при работе которых сон запрещен
+    typedef enum
+    {
+        POWER_LOCK_MOTOR,  // Генерация шагов
+        POWER_LOCK_SENSOR, // Измерение положения
+        POWER_LOCK_OTA,    // Загрузка прошивки
+        POWER_LOCK_COUNT
+    } power_lock_t;
+
+#ifdef CONFIG_SHADE_POWER_SAVE
+    void power_manager_init(void);
+    void power_manager_acquire(power_lock_t lock);
+    void power_manager_release(power_lock_t lock);
+#else
+static inline void power_manager_init(void) {}
+static inline void power_manager_acquire(power_lock_t lock) {}
+static inline void power_manager_release(power_lock_t lock) {}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
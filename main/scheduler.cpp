@@ -0,0 +1,602 @@
+#include "scheduler.h"
+#include "controller.h"
+#include "shade_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+static const char *TAG = "scheduler";
+
+// Без синхронизации часы начинают с 1970 года: до этой даты правила не выполняются
+#define SCHEDULER_VALID_TIME 1704067200 // 2024-01-01 UTC
+
+// Таймер, сработавший позже (часы переведены вперед), правило пропускает
+#define SCHEDULER_LATE_S 60
+
+#define SCHEDULER_MINUTES_PER_DAY (24 * 60)
+#define SCHEDULER_MAX_OFFSET 720
+#define SCHEDULER_ALL_DAYS 0x7F
+#define SCHEDULER_ALL_SHADES ((1 << SHADE_COUNT) - 1)
+
+// Зенит центра солнца на восходе и закате: радиус диска и рефракция
+#define SCHEDULER_SUN_ZENITH 90.833f
+#define SCHEDULER_RAD (3.14159265f / 180.0f)
+
+static schedule_rule_t rules[SCHEDULER_MAX_RULES];
+static size_t rule_count = 0;
+static SemaphoreHandle_t schedule_mutex = NULL;
+static esp_timer_handle_t schedule_timer = NULL;
+static time_t armed_deadline = 0; // 0 - таймер не заведен
+static float latitude = 0.0f;
+static float longitude = 0.0f;
+
+static float scheduler_wrap(float value, float range)
+{
+    value = fmodf(value, range);
+    return value < 0.0f ? value + range : value;
+}
+
+// Дни от 1970-01-01 для даты григорианского календаря
+static int64_t scheduler_days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int year_of_era = year - era * 400;
+    const int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return (int64_t)era * 146097 + day_of_era - 719468;
+}
+
+// Восход или закат местной даты по упрощенному алгоритму NOAA (точность
+// 1-2 минуты). false - полярный день или ночь, события нет
+static bool scheduler_sun_event(const struct tm *date, bool sunrise, time_t *event)
+{
+    float lng_hour = longitude / 15.0f;
+    float t = (date->tm_yday + 1) + ((sunrise ? 6.0f : 18.0f) - lng_hour) / 24.0f;
+
+    // Средняя аномалия, эклиптическая долгота и прямое восхождение
+    float m = 0.9856f * t - 3.289f;
+    float l = scheduler_wrap(m + 1.916f * sinf(m * SCHEDULER_RAD) + 0.020f * sinf(2.0f * m * SCHEDULER_RAD) + 282.634f,
+                             360.0f);
+    float ra = scheduler_wrap(atanf(0.91764f * tanf(l * SCHEDULER_RAD)) / SCHEDULER_RAD, 360.0f);
+    ra += floorf(l / 90.0f) * 90.0f - floorf(ra / 90.0f) * 90.0f;
+    ra /= 15.0f;
+
+    float sin_dec = 0.39782f * sinf(l * SCHEDULER_RAD);
+    float cos_dec = cosf(asinf(sin_dec));
+    float cos_h = (cosf(SCHEDULER_SUN_ZENITH * SCHEDULER_RAD) - sin_dec * sinf(latitude * SCHEDULER_RAD)) /
+                  (cos_dec * cosf(latitude * SCHEDULER_RAD));
+    if (cos_h > 1.0f || cos_h < -1.0f)
+    {
+        return false;
+    }
+
+    float h = acosf(cos_h) / SCHEDULER_RAD;
+    if (sunrise)
+    {
+        h = 360.0f - h;
+    }
+    float local_mean = h / 15.0f + ra - 0.06571f * t - 6.622f;
+    float ut = scheduler_wrap(local_mean - lng_hour, 24.0f);
+
+    // Час UTC отложен от полуночи UTC той же даты. Вдали от нулевого
+    // меридиана событие может попасть на соседние сутки UTC
+    time_t result = (time_t)(scheduler_days_from_civil(date->tm_year + 1900, date->tm_mon + 1, date->tm_mday) * 86400 +
+                             (int64_t)(ut * 3600.0f));
+    struct tm local;
+    localtime_r(&result, &local);
+    int shift = (date->tm_year - local.tm_year) * 400 + (date->tm_yday - local.tm_yday);
+    if (shift > 0)
+    {
+        result += 86400;
+    }
+    else if (shift < 0)
+    {
+        result -= 86400;
+    }
+
+    *event = result;
+    return true;
+}
+
+// Полдень местной даты со сдвигом на day дней: mktime нормализует дату,
+// а полдень не попадает на переход летнего времени
+static bool scheduler_local_date(time_t now, int day, struct tm *date)
+{
+    localtime_r(&now, date);
+    date->tm_mday += day;
+    date->tm_hour = 12;
+    date->tm_min = 0;
+    date->tm_sec = 0;
+    date->tm_isdst = -1;
+    return mktime(date) != (time_t)-1;
+}
+
+// Срабатывание правила в заданную местную дату
+static bool scheduler_rule_time(const schedule_rule_t *rule, const struct tm *date, time_t *when)
+{
+    if ((rule->days & (1 << date->tm_wday)) == 0)
+    {
+        return false;
+    }
+
+    if (rule->event == SCHEDULE_EVENT_TIME)
+    {
+        struct tm local = *date;
+        local.tm_hour = rule->minutes / 60;
+        local.tm_min = rule->minutes % 60;
+        local.tm_sec = 0;
+        local.tm_isdst = -1;
+        *when = mktime(&local);
+        return *when != (time_t)-1;
+    }
+
+    time_t event;
+    if (!scheduler_sun_event(date, rule->event == SCHEDULE_EVENT_SUNRISE, &event))
+    {
+        return false;
+    }
+    *when = event + (time_t)rule->minutes * 60;
+    return true;
+}
+
+// Ближайшее срабатывание строго позже after. Смещение до 12 часов переносит
+// событие вчерашней даты на сегодня, поэтому проверка начинается со вчера
+static bool scheduler_next(time_t after, time_t *next)
+{
+    bool found = false;
+    for (int day = -1; day <= 7; day++)
+    {
+        struct tm date;
+        if (!scheduler_local_date(after, day, &date))
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < rule_count; i++)
+        {
+            time_t when;
+            if (scheduler_rule_time(&rules[i], &date, &when) && when > after && (!found || when < *next))
+            {
+                *next = when;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+static void scheduler_execute(const schedule_rule_t *rule)
+{
+    ESP_LOGI(TAG, "Rule: position %u%% from top, shades 0x%02x", rule->position, rule->shades);
+
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        if ((rule->shades & (1 << shade)) == 0)
+        {
+            continue;
+        }
+
+        controller_command_t command = {};
+        command.type = CONTROLLER_CMD_SET_PERCENTAGE;
+        command.percentage = (float)rule->position;
+        command.source = CONTROLLER_SOURCE_LOCAL;
+        command.shade = shade;
+        if (controller_submit(&command) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Scheduled move of shade %u rejected", shade + 1);
+        }
+    }
+}
+
+// Один таймер на все правила, заводится до ближайшего срабатывания позже
+// not_before. Вызывается под schedule_mutex
+static void scheduler_arm_locked(time_t not_before)
+{
+    esp_timer_stop(schedule_timer);
+    armed_deadline = 0;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < SCHEDULER_VALID_TIME)
+    {
+        if (rule_count > 0)
+        {
+            ESP_LOGI(TAG, "Clock not set, schedule waits for time sync");
+        }
+        return;
+    }
+
+    time_t next;
+    if (!scheduler_next(now.tv_sec > not_before ? now.tv_sec : not_before, &next))
+    {
+        return;
+    }
+
+    armed_deadline = next;
+    int64_t delay_us = ((int64_t)next - now.tv_sec) * 1000000 - now.tv_usec;
+    esp_timer_start_once(schedule_timer, delay_us > 0 ? delay_us : 0);
+
+    struct tm local;
+    localtime_r(&next, &local);
+    ESP_LOGI(TAG, "Next rule at %04d-%02d-%02d %02d:%02d", local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+             local.tm_hour, local.tm_min);
+}
+
+static void scheduler_timer_cb(void *arg)
+{
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    time_t deadline = armed_deadline;
+    time_t now = time(NULL);
+
+    // Часы переведены назад больше чем на секунду - таймер заводится заново
+    // до того же срабатывания
+    if (deadline != 0 && now + 1 >= deadline && now <= deadline + SCHEDULER_LATE_S)
+    {
+        for (int day = -1; day <= 1; day++)
+        {
+            struct tm date;
+            if (!scheduler_local_date(deadline, day, &date))
+            {
+                continue;
+            }
+
+            for (size_t i = 0; i < rule_count; i++)
+            {
+                time_t when;
+                if (scheduler_rule_time(&rules[i], &date, &when) && when == deadline)
+                {
+                    scheduler_execute(&rules[i]);
+                }
+            }
+        }
+    }
+    else if (deadline != 0 && now > deadline + SCHEDULER_LATE_S)
+    {
+        ESP_LOGW(TAG, "Rule missed by %lld s, skipped", (long long)(now - deadline));
+    }
+
+    scheduler_arm_locked(now + 1 >= deadline ? deadline : 0);
+    xSemaphoreGive(schedule_mutex);
+}
+
+static bool scheduler_rule_valid(const schedule_rule_t *rule)
+{
+    if (rule->days == 0 || (rule->days & ~SCHEDULER_ALL_DAYS) != 0 || rule->position > 100 ||
+        (rule->shades & SCHEDULER_ALL_SHADES) == 0 || (rule->shades & ~SCHEDULER_ALL_SHADES) != 0)
+    {
+        return false;
+    }
+
+    switch (rule->event)
+    {
+    case SCHEDULE_EVENT_TIME:
+        return rule->minutes >= 0 && rule->minutes < SCHEDULER_MINUTES_PER_DAY;
+    case SCHEDULE_EVENT_SUNRISE:
+    case SCHEDULE_EVENT_SUNSET:
+        return rule->minutes >= -SCHEDULER_MAX_OFFSET && rule->minutes <= SCHEDULER_MAX_OFFSET;
+    default:
+        return false;
+    }
+}
+
+static bool scheduler_parse_rule(char *line, schedule_rule_t *rule)
+{
+    char *save = NULL;
+    char *when = strtok_r(line, " \t", &save);
+    char *days = strtok_r(NULL, " \t", &save);
+    char *position = strtok_r(NULL, " \t", &save);
+    char *shades = strtok_r(NULL, " \t", &save);
+    if (when == NULL || days == NULL || position == NULL || strtok_r(NULL, " \t", &save) != NULL)
+    {
+        return false;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+    char *end;
+    bool sunrise = strncmp(when, "sunrise", 7) == 0;
+    if (sunrise || strncmp(when, "sunset", 6) == 0)
+    {
+        rule->event = sunrise ? SCHEDULE_EVENT_SUNRISE : SCHEDULE_EVENT_SUNSET;
+        const char *offset = when + (sunrise ? 7 : 6);
+        if (*offset != '\0')
+        {
+            long minutes = strtol(offset, &end, 10);
+            if ((*offset != '+' && *offset != '-') || end == offset + 1 || *end != '\0' ||
+                minutes < -SCHEDULER_MAX_OFFSET || minutes > SCHEDULER_MAX_OFFSET)
+            {
+                return false;
+            }
+            rule->minutes = (int16_t)minutes;
+        }
+    }
+    else
+    {
+        long hours = strtol(when, &end, 10);
+        if (end == when || *end != ':')
+        {
+            return false;
+        }
+        const char *start = end + 1;
+        long minutes = strtol(start, &end, 10);
+        if (end == start || *end != '\0' || hours < 0 || hours > 23 || minutes < 0 || minutes > 59)
+        {
+            return false;
+        }
+        rule->event = SCHEDULE_EVENT_TIME;
+        rule->minutes = (int16_t)(hours * 60 + minutes);
+    }
+
+    // Дни с понедельника, в маске бит 0 - воскресенье
+    if (strcmp(days, "*") == 0)
+    {
+        rule->days = SCHEDULER_ALL_DAYS;
+    }
+    else
+    {
+        if (strlen(days) != 7)
+        {
+            return false;
+        }
+        for (int i = 0; i < 7; i++)
+        {
+            if (days[i] != '-')
+            {
+                rule->days |= 1 << ((i + 1) % 7);
+            }
+        }
+    }
+
+    // Положение как в командном топике: 100 - открыто
+    long open = strtol(position, &end, 10);
+    if (end == position || *end != '\0' || open < 0 || open > 100)
+    {
+        return false;
+    }
+    rule->position = (uint8_t)(100 - open);
+
+    if (shades == NULL || strcmp(shades, "*") == 0)
+    {
+        rule->shades = SCHEDULER_ALL_SHADES;
+    }
+    else
+    {
+        const char *item = shades;
+        while (*item != '\0')
+        {
+            long number = strtol(item, &end, 10);
+            if (end == item || number < 1 || number > SHADE_COUNT || (*end != ',' && *end != '\0'))
+            {
+                return false;
+            }
+            rule->shades |= 1 << (number - 1);
+            item = *end == ',' ? end + 1 : end;
+        }
+    }
+
+    return scheduler_rule_valid(rule);
+}
+
+static esp_err_t scheduler_parse_text(const char *text, size_t length, schedule_rule_t *parsed, size_t *count)
+{
+    char buffer[SCHEDULER_TEXT_MAX_LEN];
+    if (length >= sizeof(buffer))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+
+    *count = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(buffer, "\r\n;", &save); line != NULL; line = strtok_r(NULL, "\r\n;", &save))
+    {
+        if (line[strspn(line, " \t")] == '\0')
+        {
+            continue;
+        }
+        if (*count >= SCHEDULER_MAX_RULES)
+        {
+            ESP_LOGW(TAG, "More than %d rules", SCHEDULER_MAX_RULES);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (!scheduler_parse_rule(line, &parsed[*count]))
+        {
+            ESP_LOGW(TAG, "Invalid rule %u", (unsigned)(*count + 1));
+            return ESP_ERR_INVALID_ARG;
+        }
+        (*count)++;
+    }
+    return ESP_OK;
+}
+
+void scheduler_init(void)
+{
+    schedule_mutex = xSemaphoreCreateMutex();
+    esp_timer_create_args_t timer_args = {
+        .callback = scheduler_timer_cb,
+        .name = "scheduler",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &schedule_timer));
+
+    // Правила по часам задаются в местном времени
+    setenv("TZ", CONFIG_SHADE_SCHEDULER_TIMEZONE, 1);
+    tzset();
+    latitude = strtof(CONFIG_SHADE_SCHEDULER_LATITUDE, NULL);
+    longitude = strtof(CONFIG_SHADE_SCHEDULER_LONGITUDE, NULL);
+
+    schedule_rule_t loaded[SCHEDULER_MAX_RULES];
+    size_t count = 0;
+    if (persistence_get_schedule(loaded, SCHEDULER_MAX_RULES, &count))
+    {
+        // После смены числа штор правила с лишними шторами отбрасываются
+        for (size_t i = 0; i < count; i++)
+        {
+            if (scheduler_rule_valid(&loaded[i]))
+            {
+                rules[rule_count++] = loaded[i];
+            }
+        }
+        ESP_LOGI(TAG, "%u rules loaded", (unsigned)rule_count);
+    }
+    else if (sizeof(CONFIG_SHADE_SCHEDULER_DEFAULT_RULES) > 1)
+    {
+        // Правила прошивки не записываются в NVS: они действуют, пока
+        // правила не заданы по сети
+        if (scheduler_parse_text(CONFIG_SHADE_SCHEDULER_DEFAULT_RULES, strlen(CONFIG_SHADE_SCHEDULER_DEFAULT_RULES),
+                                 rules, &rule_count) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Invalid default rules");
+            rule_count = 0;
+        }
+        ESP_LOGI(TAG, "%u default rules", (unsigned)rule_count);
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    scheduler_arm_locked(0);
+    xSemaphoreGive(schedule_mutex);
+}
+
+esp_err_t scheduler_set_rules(const schedule_rule_t *new_rules, size_t count)
+{
+    if (schedule_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count > SCHEDULER_MAX_RULES)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!scheduler_rule_valid(&new_rules[i]))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    memcpy(rules, new_rules, count * sizeof(rules[0]));
+    rule_count = count;
+    esp_err_t err = persistence_save_schedule(rules, rule_count);
+    scheduler_arm_locked(0);
+    xSemaphoreGive(schedule_mutex);
+
+    ESP_LOGI(TAG, "%u rules set", (unsigned)count);
+    return err;
+}
+
+size_t scheduler_get_rules(schedule_rule_t *copy, size_t max)
+{
+    if (schedule_mutex == NULL)
+    {
+        return 0;
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    size_t count = rule_count < max ? rule_count : max;
+    memcpy(copy, rules, count * sizeof(rules[0]));
+    xSemaphoreGive(schedule_mutex);
+    return count;
+}
+
+esp_err_t scheduler_parse_rules(const char *text, size_t length)
+{
+    schedule_rule_t parsed[SCHEDULER_MAX_RULES];
+    size_t count = 0;
+    esp_err_t err = scheduler_parse_text(text, length, parsed, &count);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return scheduler_set_rules(parsed, count);
+}
+
+size_t scheduler_format_rules(char *buffer, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    buffer[0] = '\0';
+
+    schedule_rule_t copy[SCHEDULER_MAX_RULES];
+    size_t count = scheduler_get_rules(copy, SCHEDULER_MAX_RULES);
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const schedule_rule_t *rule = &copy[i];
+
+        char when[16];
+        if (rule->event == SCHEDULE_EVENT_TIME)
+        {
+            snprintf(when, sizeof(when), "%02d:%02d", rule->minutes / 60, rule->minutes % 60);
+        }
+        else
+        {
+            const char *name = rule->event == SCHEDULE_EVENT_SUNRISE ? "sunrise" : "sunset";
+            if (rule->minutes != 0)
+            {
+                snprintf(when, sizeof(when), "%s%+d", name, rule->minutes);
+            }
+            else
+            {
+                snprintf(when, sizeof(when), "%s", name);
+            }
+        }
+
+        char days[8] = "*";
+        if (rule->days != SCHEDULER_ALL_DAYS)
+        {
+            for (int day = 0; day < 7; day++)
+            {
+                days[day] = (rule->days & (1 << ((day + 1) % 7))) ? "MTWTFSS"[day] : '-';
+            }
+            days[7] = '\0';
+        }
+
+        char shades[2 * SHADE_COUNT + 1] = "*";
+        if (rule->shades != SCHEDULER_ALL_SHADES)
+        {
+            size_t used = 0;
+            for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+            {
+                if (rule->shades & (1 << shade))
+                {
+                    used += snprintf(shades + used, sizeof(shades) - used, "%s%u", used ? "," : "", shade + 1);
+                }
+            }
+        }
+
+        // Обрезка - только по целым правилам
+        int written = snprintf(buffer + length, size - length, "%s%s %s %u %s", length ? "\n" : "", when, days,
+                               100 - rule->position, shades);
+        if (written < 0 || (size_t)written >= size - length)
+        {
+            buffer[length] = '\0';
+            break;
+        }
+        length += written;
+    }
+    return length;
+}
+
+void scheduler_time_changed(void)
+{
+    if (schedule_mutex == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    scheduler_arm_locked(0);
+    xSemaphoreGive(schedule_mutex);
+}
@@ -0,0 +1,49 @@
+// Локальное расписание движений: время суток, восход и закат (CONFIG_SHADE_SCHEDULER)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "persistence.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        SCHEDULE_EVENT_TIME,    // minutes - время суток
+        SCHEDULE_EVENT_SUNRISE, // minutes - смещение от восхода, -720..720
+        SCHEDULE_EVENT_SUNSET   // minutes - смещение от заката
+    } schedule_event_t;
+
+    typedef persistence_schedule_rule_t schedule_rule_t;
+
+#define SCHEDULER_MAX_RULES PERSISTENCE_SCHEDULE_MAX_RULES
+#define SCHEDULER_TEXT_MAX_LEN 768 // Все правила в текстовом формате
+
+    // Правила из NVS (или CONFIG_SHADE_SCHEDULER_DEFAULT_RULES, если их не
+    // сохраняли) и таймер ближайшего правила. Работает без сети: часы после
+    // перезагрузки без потери питания остаются верными
+    void scheduler_init(void);
+
+    // Замена всех правил: проверка, запись в NVS и пересчет таймера
+    esp_err_t scheduler_set_rules(const schedule_rule_t *rules, size_t count);
+    size_t scheduler_get_rules(schedule_rule_t *rules, size_t max);
+
+    // Текстовый формат, по правилу на строку (или через ';'):
+    //   <время> <дни> <положение> [<шторы>]
+    // время - "07:30", "sunrise", "sunset-15", "sunrise+30";
+    // дни - "*" или семь знаков с понедельника, '-' - выходной: "MTWTF--";
+    // положение - 0-100, 100 - открыто (как в командном топике MQTT);
+    // шторы - "*" (по умолчанию) или номера через запятую: "1,3"
+    esp_err_t scheduler_parse_rules(const char *text, size_t length);
+    size_t scheduler_format_rules(char *buffer, size_t size);
+
+    // Часы переведены (синхронизация времени): пересчет ближайшего правила
+    void scheduler_time_changed(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,40 @@
+#include "shade_config.h"
+
+// Первая штора - выводы из разделов мотора и датчика положения
+static const shade_pins_t shade_pins[SHADE_COUNT] = {
+    {
+        .motor_pins = {SHADE1_MOTOR_PINS},
+        .motor_enable_pin = CONFIG_MOTOR_ENABLE_PIN,
+        .sensor_adc_channel = CONFIG_POSITION_SENSOR_ADC_CHANNEL,
+        .sensor_power_pin = CONFIG_POSITION_SENSOR_POWER_PIN,
+    },
+#if SHADE_COUNT >= 2
+    {
+        .motor_pins = {SHADE2_MOTOR_PINS},
+        .motor_enable_pin = CONFIG_SHADE2_MOTOR_ENABLE_PIN,
+        .sensor_adc_channel = CONFIG_SHADE2_SENSOR_ADC_CHANNEL,
+        .sensor_power_pin = CONFIG_SHADE2_SENSOR_POWER_PIN,
+    },
+#endif
+#if SHADE_COUNT >= 3
+    {
+        .motor_pins = {SHADE3_MOTOR_PINS},
+        .motor_enable_pin = CONFIG_SHADE3_MOTOR_ENABLE_PIN,
+        .sensor_adc_channel = CONFIG_SHADE3_SENSOR_ADC_CHANNEL,
+        .sensor_power_pin = CONFIG_SHADE3_SENSOR_POWER_PIN,
+    },
+#endif
+#if SHADE_COUNT >= 4
+    {
+        .motor_pins = {SHADE4_MOTOR_PINS},
+        .motor_enable_pin = CONFIG_SHADE4_MOTOR_ENABLE_PIN,
+        .sensor_adc_channel = CONFIG_SHADE4_SENSOR_ADC_CHANNEL,
+        .sensor_power_pin = CONFIG_SHADE4_SENSOR_POWER_PIN,
+    },
+#endif
+};
+
+const shade_pins_t *shade_get_pins(uint8_t shade)
+{
+    return &shade_pins[shade < SHADE_COUNT ? shade : 0];
+}
@@ -0,0 +1,40 @@
+// Состав устройства: число штор и выводы каждой из них (Kconfig)
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define SHADE_COUNT CONFIG_SHADE_COUNT
+
+// Выводы IN1-IN4 каждой шторы списком: подставляются и в таблицу выводов,
+// и в параметры шаблона драйвера, чтобы маски регистров считались при компиляции
+#define SHADE1_MOTOR_PINS CONFIG_MOTOR_PIN_1, CONFIG_MOTOR_PIN_2, CONFIG_MOTOR_PIN_3, CONFIG_MOTOR_PIN_4
+#if SHADE_COUNT >= 2
+#define SHADE2_MOTOR_PINS CONFIG_SHADE2_MOTOR_PIN_1, CONFIG_SHADE2_MOTOR_PIN_2, CONFIG_SHADE2_MOTOR_PIN_3, CONFIG_SHADE2_MOTOR_PIN_4
+#endif
+#if SHADE_COUNT >= 3
+#define SHADE3_MOTOR_PINS CONFIG_SHADE3_MOTOR_PIN_1, CONFIG_SHADE3_MOTOR_PIN_2, CONFIG_SHADE3_MOTOR_PIN_3, CONFIG_SHADE3_MOTOR_PIN_4
+#endif
+#if SHADE_COUNT >= 4
+#define SHADE4_MOTOR_PINS CONFIG_SHADE4_MOTOR_PIN_1, CONFIG_SHADE4_MOTOR_PIN_2, CONFIG_SHADE4_MOTOR_PIN_3, CONFIG_SHADE4_MOTOR_PIN_4
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        int motor_pins[4];    // IN1-IN4 ULN2003
+        int motor_enable_pin; // -1 - не используется
+        int sensor_adc_channel;
+        int sensor_power_pin;
+    } shade_pins_t;
+
+    // shade - номер шторы с нуля, 0..SHADE_COUNT-1
+    const shade_pins_t *shade_get_pins(uint8_t shade);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,165 @@
+#include "shade_sim.h"
+#include "shade_config.h"
+#include "motor_control.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "shade_sim";
+
+// Параметры модели из Kconfig
+#define SIM_TRAVEL_STEPS CONFIG_SHADE_SIM_TRAVEL_STEPS
+#define SIM_COUNTS_TOP CONFIG_SHADE_SIM_COUNTS_TOP
+#define SIM_COUNTS_BOTTOM CONFIG_SHADE_SIM_COUNTS_BOTTOM
+#define SIM_BACKLASH_STEPS CONFIG_SHADE_SIM_BACKLASH_STEPS
+#define SIM_LATENCY_US CONFIG_SHADE_SIM_LATENCY_US
+#define SIM_NOISE_COUNTS CONFIG_SHADE_SIM_NOISE_COUNTS
+#define SIM_ADC_MAX 4095
+
+// Модель одной шторы. Положение вала - шаги от верхнего упора
+typedef struct
+{
+    int32_t offset; // Вал = счетчик шагов мотора + offset
+    int32_t load;   // Положение шторы за люфтом
+    bool engaged;   // Зазор выбран, штора движется вместе с валом
+    uint32_t noise_state;
+} shade_sim_t;
+
+static shade_sim_t sims[SHADE_COUNT] = {};
+static portMUX_TYPE sim_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static shade_sim_t *shade_sim_get(uint8_t shade)
+{
+    return &sims[shade < SHADE_COUNT ? shade : 0];
+}
+
+// Воспроизводимый шум: xorshift32 со своим зерном на штору
+static int32_t shade_sim_noise(shade_sim_t *sim)
+{
+#if SIM_NOISE_COUNTS > 0
+    uint32_t x = sim->noise_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->noise_state = x;
+
+    // Сумма двух равномерных - треугольное распределение в ±SIM_NOISE_COUNTS
+    int32_t span = 2 * SIM_NOISE_COUNTS + 1;
+    int32_t a = (int32_t)((x & 0xFFFF) % span) - SIM_NOISE_COUNTS;
+    int32_t b = (int32_t)((x >> 16) % span) - SIM_NOISE_COUNTS;
+    return (a + b) / 2;
+#else
+    return 0;
+#endif
+}
+
+// Механика на текущий момент: упоры и люфт. Вызывается под sim_lock,
+// чтобы счетчик шагов не переустановили между чтением и пересчетом
+static void shade_sim_update(shade_sim_t *sim, uint8_t shade)
+{
+    int32_t shaft = motor_get_position_steps(shade) + sim->offset;
+
+    // На упоре мотор проскальзывает: шаги идут, вал стоит
+    if (shaft < 0)
+    {
+        sim->offset -= shaft;
+        shaft = 0;
+    }
+    else if (shaft > SIM_TRAVEL_STEPS)
+    {
+        sim->offset -= shaft - SIM_TRAVEL_STEPS;
+        shaft = SIM_TRAVEL_STEPS;
+    }
+
+    // Люфт: штора стоит, пока вал выбирает зазор в половину люфта в каждую сторону
+    const int32_t half = SIM_BACKLASH_STEPS / 2;
+    sim->engaged = true;
+    if (shaft - sim->load > half)
+    {
+        sim->load = shaft - half;
+    }
+    else if (sim->load - shaft > half)
+    {
+        sim->load = shaft + half;
+    }
+    else
+    {
+        sim->engaged = false;
+    }
+}
+
+static uint32_t shade_sim_counts(int32_t load)
+{
+    if (load < 0)
+    {
+        load = 0;
+    }
+    else if (load > SIM_TRAVEL_STEPS)
+    {
+        load = SIM_TRAVEL_STEPS;
+    }
+    return SIM_COUNTS_TOP + (uint32_t)((int64_t)load * (SIM_COUNTS_BOTTOM - SIM_COUNTS_TOP) / SIM_TRAVEL_STEPS);
+}
+
+void shade_sim_init(void)
+{
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        shade_sim_t *sim = &sims[shade];
+        sim->load = SIM_TRAVEL_STEPS * CONFIG_SHADE_SIM_START_PERCENT / 100;
+        sim->offset = sim->load - motor_get_position_steps(shade);
+        sim->engaged = false;
+        sim->noise_state = 0x9E3779B9u ^ (shade + 1);
+    }
+
+    ESP_LOGW(TAG, "Simulated plant: %d steps, counts %d..%d, backlash %d steps, latency %d us, noise %d",
+             SIM_TRAVEL_STEPS, SIM_COUNTS_TOP, SIM_COUNTS_BOTTOM, SIM_BACKLASH_STEPS, SIM_LATENCY_US,
+             SIM_NOISE_COUNTS);
+}
+
+uint32_t shade_sim_read(uint8_t shade)
+{
+    shade_sim_t *sim = shade_sim_get(shade);
+    int32_t velocity = motor_get_velocity_sps(shade);
+
+    portENTER_CRITICAL(&sim_lock);
+    shade_sim_update(sim, shade);
+
+    // Датчик видит положение на SIM_LATENCY_US раньше: пока штора движется
+    // вместе с валом, это откат по текущей скорости
+    int32_t seen = sim->load;
+    if (sim->engaged)
+    {
+        seen -= (int32_t)((int64_t)velocity * SIM_LATENCY_US / 1000000);
+    }
+    int32_t counts = (int32_t)shade_sim_counts(seen) + shade_sim_noise(sim);
+    portEXIT_CRITICAL(&sim_lock);
+
+    if (counts < 0)
+    {
+        counts = 0;
+    }
+    else if (counts > SIM_ADC_MAX)
+    {
+        counts = SIM_ADC_MAX;
+    }
+    return (uint32_t)counts;
+}
+
+uint32_t shade_sim_true_position(uint8_t shade)
+{
+    shade_sim_t *sim = shade_sim_get(shade);
+
+    portENTER_CRITICAL(&sim_lock);
+    shade_sim_update(sim, shade);
+    uint32_t counts = shade_sim_counts(sim->load);
+    portEXIT_CRITICAL(&sim_lock);
+    return counts;
+}
+
+void shade_sim_set_position_steps(uint8_t shade, int32_t *position_steps, int32_t steps)
+{
+    portENTER_CRITICAL(&sim_lock);
+    shade_sim_get(shade)->offset -= steps - *position_steps;
+    *position_steps = steps;
+    portEXIT_CRITICAL(&sim_lock);
+}
@@ -0,0 +1,35 @@
+// Модель шторы для отладки без механики (включается CONFIG_SHADE_SIMULATION)
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef CONFIG_SHADE_SIMULATION
+    // Потенциометр на валу шторы: положение вала следует за шагами мотора
+    // с люфтом и упорами, отсчет датчика - с запаздыванием и шумом
+    void shade_sim_init(void);
+
+    // Отсчет "ADC" для датчика положения (вызывается задачей выборки)
+    uint32_t shade_sim_read(uint8_t shade);
+
+    // Истинное положение шторы в отсчетах, без шума и запаздывания
+    uint32_t shade_sim_true_position(uint8_t shade);
+
+    // Переустановка счетчика шагов мотора: вал остается на месте. Счетчик
+    // и смещение модели меняются под одной блокировкой с чтением отсчета
+    void shade_sim_set_position_steps(uint8_t shade, int32_t *position_steps, int32_t steps);
+
+#define SHADE_SIM_SET_POSITION_STEPS(shade, position_steps, steps) \
+    shade_sim_set_position_steps(shade, &(position_steps), steps)
+#else
+#define SHADE_SIM_SET_POSITION_STEPS(shade, position_steps, steps) ((position_steps) = (steps))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
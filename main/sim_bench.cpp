@@ -0,0 +1,435 @@
+#include "sim_bench.h"
+#include "shade_sim.h"
+#include "shade_config.h"
+#include "controller.h"
+#include "position_sensor.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "sim_bench";
+
+#define SIM_BENCH_STACK_SIZE 3072
+#define SIM_BENCH_PRIORITY 2
+#define SIM_BENCH_BOOT_DELAY_MS 2000 // Датчики и контроллер успевают выйти на первый отсчет
+#define SIM_BENCH_POLL_MS 10         // Период наблюдения за истинным положением
+#define SIM_BENCH_BURST_GAP_MS 20    // Интервал команд в пачке, как при перетаскивании ползунка
+#define SIM_BENCH_BURST_SEED 0x2545F491u
+#define SIM_BENCH_TIMEOUT_MS (CONFIG_SHADE_SIM_BENCH_TIMEOUT_S * 1000)
+#define SIM_BENCH_MAX_ERROR CONFIG_SHADE_SIM_BENCH_MAX_ERROR
+
+// Цели серии перемещений в процентах хода: большие и малые перемещения,
+// смены направления (люфт) и упоры
+static const uint8_t move_targets[] = {10, 90, 50, 55, 45, 100, 0, 75, 25};
+#define SIM_BENCH_MOVES (sizeof(move_targets) / sizeof(move_targets[0]))
+
+typedef enum
+{
+    SIM_BENCH_CAL_PRESENT, // Калибровка уже была
+    SIM_BENCH_CAL_DONE,
+    SIM_BENCH_CAL_FAILED,
+} sim_bench_cal_t;
+
+// Результаты одной шторы. Ошибка и перелет - в отсчетах датчика по
+// истинному положению модели
+typedef struct
+{
+    bool valid;
+    sim_bench_cal_t calibration;
+    uint32_t calibration_ms;
+
+    uint32_t moves;
+    uint32_t moves_failed;
+    uint32_t error_sum;
+    uint32_t error_max;
+    uint32_t overshoot_sum;
+    uint32_t overshoot_max;
+    uint32_t time_sum_ms;
+    uint32_t time_max_ms;
+
+    uint32_t burst_commands;
+    uint32_t burst_dropped;
+    uint32_t burst_results[CONTROLLER_RESULT_FAILED + 1];
+    uint32_t burst_error;
+    uint32_t burst_settle_ms;
+    bool burst_completed;
+} sim_bench_report_t;
+
+static sim_bench_report_t reports[SHADE_COUNT];
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t bench_task_handle = NULL;
+static SemaphoreHandle_t done_semaphore = NULL;
+static volatile bool bench_running = false;
+
+// Каждая команда несет свой номер: завершение команды, брошенной по
+// таймауту, не примется за завершение следующей
+static uint32_t next_sequence = 1;
+static volatile uint32_t wait_sequence = 0;
+static volatile controller_result_t wait_result;
+
+// Итоги пачки, пишутся из задачи контроллера
+static volatile uint32_t burst_first_sequence = UINT32_MAX;
+static volatile uint32_t burst_results[CONTROLLER_RESULT_FAILED + 1];
+
+static void sim_bench_done(controller_result_t result, void *arg)
+{
+    uint32_t sequence = (uint32_t)(uintptr_t)arg;
+
+    if (sequence >= burst_first_sequence && result <= CONTROLLER_RESULT_FAILED)
+    {
+        burst_results[result]++;
+    }
+    if (sequence == wait_sequence)
+    {
+        wait_result = result;
+        xSemaphoreGive(done_semaphore);
+    }
+}
+
+static esp_err_t sim_bench_submit(uint8_t shade, controller_command_type_t type, uint32_t position, uint32_t *sequence)
+{
+    controller_command_t command = {};
+    command.type = type;
+    command.position = position;
+    command.shade = shade;
+    command.done_cb = sim_bench_done;
+    *sequence = next_sequence++;
+    command.done_arg = (void *)(uintptr_t)*sequence;
+
+    // Ожидание взводится до отправки: команда может завершиться сразу.
+    // Завершение предыдущей команды пачки из семафора убирается
+    wait_sequence = *sequence;
+    xSemaphoreTake(done_semaphore, 0);
+    return controller_submit(&command);
+}
+
+static uint32_t sim_bench_elapsed_ms(int64_t start_us)
+{
+    return (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+}
+
+static uint32_t sim_bench_distance(uint32_t a, uint32_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static uint32_t sim_bench_target(uint8_t shade, uint8_t percent)
+{
+    uint32_t min_position = position_sensor_get_min_position(shade);
+    uint32_t max_position = position_sensor_get_max_position(shade);
+    return min_position + (max_position - min_position) * percent / 100;
+}
+
+// Ожидание завершения команды, отправленной последней, с наблюдением за
+// истинным положением. Возвращает false по таймауту
+static bool sim_bench_wait(uint8_t shade, uint32_t target, uint32_t *overshoot)
+{
+    uint32_t start = shade_sim_true_position(shade);
+    bool increasing = target > start;
+    uint32_t worst = 0;
+
+    int64_t start_us = esp_timer_get_time();
+    bool done = false;
+    while (!done && sim_bench_elapsed_ms(start_us) < SIM_BENCH_TIMEOUT_MS)
+    {
+        done = xSemaphoreTake(done_semaphore, pdMS_TO_TICKS(SIM_BENCH_POLL_MS)) == pdTRUE;
+
+        // Перелет - уход за цель по направлению движения
+        uint32_t position = shade_sim_true_position(shade);
+        uint32_t beyond = increasing ? (position > target ? position - target : 0)
+                                     : (position < target ? target - position : 0);
+        if (beyond > worst)
+        {
+            worst = beyond;
+        }
+    }
+
+    wait_sequence = 0;
+    if (overshoot != NULL)
+    {
+        *overshoot = worst;
+    }
+    return done;
+}
+
+static void sim_bench_calibrate(uint8_t shade, sim_bench_report_t *report)
+{
+    if (position_sensor_is_calibrated(shade))
+    {
+        report->calibration = SIM_BENCH_CAL_PRESENT;
+        return;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    uint32_t sequence = 0;
+    report->calibration = SIM_BENCH_CAL_FAILED;
+    if (sim_bench_submit(shade, CONTROLLER_CMD_AUTO_CALIBRATE, 0, &sequence) == ESP_OK &&
+        sim_bench_wait(shade, shade_sim_true_position(shade), NULL) &&
+        wait_result == CONTROLLER_RESULT_OK)
+    {
+        report->calibration = SIM_BENCH_CAL_DONE;
+    }
+    report->calibration_ms = sim_bench_elapsed_ms(start_us);
+}
+
+// Серия перемещений: точность, перелет и время до цели
+static void sim_bench_moves(uint8_t shade, sim_bench_report_t *report)
+{
+    for (size_t i = 0; i < SIM_BENCH_MOVES; i++)
+    {
+        uint32_t target = sim_bench_target(shade, move_targets[i]);
+        uint32_t sequence = 0;
+        uint32_t overshoot = 0;
+
+        int64_t start_us = esp_timer_get_time();
+        bool done = sim_bench_submit(shade, CONTROLLER_CMD_MOVE_TO, target, &sequence) == ESP_OK &&
+                    sim_bench_wait(shade, target, &overshoot);
+        uint32_t time_ms = sim_bench_elapsed_ms(start_us);
+        uint32_t error = sim_bench_distance(shade_sim_true_position(shade), target);
+
+        // Неудачные перемещения в статистику точности не входят
+        report->moves++;
+        if (!done || wait_result != CONTROLLER_RESULT_OK)
+        {
+            report->moves_failed++;
+            ESP_LOGW(TAG, "Shade %u move to %u%% failed", shade + 1, move_targets[i]);
+            if (!done)
+            {
+                controller_stop(shade);
+            }
+            continue;
+        }
+
+        report->error_sum += error;
+        report->overshoot_sum += overshoot;
+        report->time_sum_ms += time_ms;
+        if (error > report->error_max)
+        {
+            report->error_max = error;
+        }
+        if (overshoot > report->overshoot_max)
+        {
+            report->overshoot_max = overshoot;
+        }
+        if (time_ms > report->time_max_ms)
+        {
+            report->time_max_ms = time_ms;
+        }
+        ESP_LOGI(TAG, "Shade %u move to %u%%: error %lu, overshoot %lu, %lu ms", shade + 1, move_targets[i],
+                 error, overshoot, time_ms);
+    }
+}
+
+// Пачка команд подряд: очередь, слияние и замена целей, итоговая точность
+static void sim_bench_burst(uint8_t shade, sim_bench_report_t *report)
+{
+    uint32_t seed = SIM_BENCH_BURST_SEED;
+    uint32_t target = 0;
+    uint32_t last_sequence = 0;
+    bool last_submitted = false;
+
+    memset((void *)burst_results, 0, sizeof(burst_results));
+    burst_first_sequence = next_sequence;
+
+    for (int i = 0; i < CONFIG_SHADE_SIM_BENCH_BURST; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        target = sim_bench_target(shade, 5 + seed % 91);
+
+        last_submitted = sim_bench_submit(shade, CONTROLLER_CMD_MOVE_TO, target, &last_sequence) == ESP_OK;
+        if (!last_submitted)
+        {
+            report->burst_dropped++;
+        }
+        report->burst_commands++;
+        vTaskDelay(pdMS_TO_TICKS(SIM_BENCH_BURST_GAP_MS));
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    report->burst_completed = last_submitted && sim_bench_wait(shade, target, NULL);
+    report->burst_settle_ms = sim_bench_elapsed_ms(start_us);
+    report->burst_error = sim_bench_distance(shade_sim_true_position(shade), target);
+    if (!report->burst_completed)
+    {
+        controller_stop(shade);
+    }
+
+    burst_first_sequence = UINT32_MAX;
+    for (int result = 0; result <= CONTROLLER_RESULT_FAILED; result++)
+    {
+        report->burst_results[result] = burst_results[result];
+    }
+}
+
+static void sim_bench_run(void)
+{
+    ESP_LOGI(TAG, "Benchmark started");
+
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        sim_bench_report_t report = {};
+
+        sim_bench_calibrate(shade, &report);
+        if (report.calibration != SIM_BENCH_CAL_FAILED)
+        {
+            sim_bench_moves(shade, &report);
+            sim_bench_burst(shade, &report);
+        }
+        report.valid = true;
+
+        portENTER_CRITICAL(&report_lock);
+        reports[shade] = report;
+        portEXIT_CRITICAL(&report_lock);
+    }
+
+    // Построчно, чтобы строки не обрезались буфером лога
+    static char text[768];
+    sim_bench_format(text, sizeof(text));
+    char *line = text;
+    while (line != NULL && *line != '\0')
+    {
+        char *end = strchr(line, '\n');
+        if (end != NULL)
+        {
+            *end = '\0';
+        }
+        ESP_LOGI(TAG, "%s", line);
+        line = end != NULL ? end + 1 : NULL;
+    }
+}
+
+static void sim_bench_task(void *parameter)
+{
+#ifdef CONFIG_SHADE_SIM_BENCH_ON_BOOT
+    vTaskDelay(pdMS_TO_TICKS(SIM_BENCH_BOOT_DELAY_MS));
+    bench_running = true;
+    xTaskNotifyGive(bench_task_handle);
+#endif
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sim_bench_run();
+        bench_running = false;
+    }
+}
+
+void sim_bench_init(void)
+{
+    done_semaphore = xSemaphoreCreateBinary();
+    xTaskCreate(sim_bench_task, "sim_bench", SIM_BENCH_STACK_SIZE, NULL, SIM_BENCH_PRIORITY, &bench_task_handle);
+}
+
+esp_err_t sim_bench_start(void)
+{
+    if (bench_task_handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (bench_running)
+    {
+        ESP_LOGW(TAG, "Benchmark already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bench_running = true;
+    xTaskNotifyGive(bench_task_handle);
+    return ESP_OK;
+}
+
+bool sim_bench_running(void)
+{
+    return bench_running;
+}
+
+bool sim_bench_passed(void)
+{
+    static sim_bench_report_t snapshot[SHADE_COUNT];
+
+    portENTER_CRITICAL(&report_lock);
+    memcpy(snapshot, reports, sizeof(snapshot));
+    portEXIT_CRITICAL(&report_lock);
+
+    for (uint8_t shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        const sim_bench_report_t *report = &snapshot[shade];
+        if (!report->valid || report->calibration == SIM_BENCH_CAL_FAILED || report->moves_failed != 0 ||
+            !report->burst_completed || report->error_max > SIM_BENCH_MAX_ERROR ||
+            report->burst_error > SIM_BENCH_MAX_ERROR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *sim_bench_cal_name(sim_bench_cal_t calibration)
+{
+    switch (calibration)
+    {
+    case SIM_BENCH_CAL_DONE:
+        return "done";
+    case SIM_BENCH_CAL_FAILED:
+        return "failed";
+    default:
+        return "present";
+    }
+}
+
+// Текстовый отчет: строка перемещений и строка пачки на штору
+size_t sim_bench_format(char *buffer, size_t size)
+{
+    static sim_bench_report_t snapshot[SHADE_COUNT];
+
+    portENTER_CRITICAL(&report_lock);
+    memcpy(snapshot, reports, sizeof(snapshot));
+    portEXIT_CRITICAL(&report_lock);
+
+    size_t length = 0;
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    for (uint8_t shade = 0; shade < SHADE_COUNT && length < size; shade++)
+    {
+        const sim_bench_report_t *report = &snapshot[shade];
+        if (!report->valid)
+        {
+            continue;
+        }
+
+        uint32_t counted = report->moves - report->moves_failed;
+        uint32_t divisor = counted != 0 ? counted : 1;
+        length += snprintf(buffer + length, size - length,
+                           "shade %u cal=%s %lu ms moves n=%lu failed=%lu err avg=%lu max=%lu"
+                           " overshoot avg=%lu max=%lu time ms avg=%lu max=%lu\n",
+                           shade + 1, sim_bench_cal_name(report->calibration), report->calibration_ms,
+                           report->moves, report->moves_failed, report->error_sum / divisor, report->error_max,
+                           report->overshoot_sum / divisor, report->overshoot_max,
+                           report->time_sum_ms / divisor, report->time_max_ms);
+
+        if (length < size && report->burst_commands != 0)
+        {
+            length += snprintf(buffer + length, size - length,
+                               "shade %u burst n=%lu dropped=%lu ok=%lu superseded=%lu stopped=%lu"
+                               " rejected=%lu failed=%lu completed=%d err=%lu settle ms=%lu\n",
+                               shade + 1, report->burst_commands, report->burst_dropped,
+                               report->burst_results[CONTROLLER_RESULT_OK],
+                               report->burst_results[CONTROLLER_RESULT_SUPERSEDED],
+                               report->burst_results[CONTROLLER_RESULT_STOPPED],
+                               report->burst_results[CONTROLLER_RESULT_REJECTED],
+                               report->burst_results[CONTROLLER_RESULT_FAILED],
+                               report->burst_completed, report->burst_error, report->burst_settle_ms);
+        }
+    }
+
+    return length < size ? length : size - 1;
+}
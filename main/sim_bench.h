@@ -0,0 +1,33 @@
+// Сценарии замеров контроллера на модели шторы (CONFIG_SHADE_SIMULATION)
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Задача сценариев. Прогон после запуска - CONFIG_SHADE_SIM_BENCH_ON_BOOT
+    void sim_bench_init(void);
+
+    // Прогон всех сценариев по всем шторам в фоне. ESP_ERR_INVALID_STATE,
+    // если прогон уже идет
+    esp_err_t sim_bench_start(void);
+
+    // Прогон запущен и еще не завершен
+    bool sim_bench_running(void);
+
+    // Итог последнего прогона: у всех штор калибровка, перемещения и пачка
+    // завершились, ошибка не больше CONFIG_SHADE_SIM_BENCH_MAX_ERROR.
+    // false, если прогона не было
+    bool sim_bench_passed(void);
+
+    // Текстовый отчет последнего прогона, по строке на сценарий и штору
+    size_t sim_bench_format(char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
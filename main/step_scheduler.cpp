@@ -0,0 +1,175 @@
+#include "step_scheduler.h"
+#include "shade_config.h"
+#include "esp_attr.h"
+#include "driver/gptimer.h"
+#include "freertos/FreeRTOS.h"
+
+#define STEP_SCHEDULER_RESOLUTION_HZ 1000000 // 1 отсчет таймера = 1 мкс
+#define STEP_SCHEDULER_MAX_CHANNELS SHADE_COUNT
+
+// Сроки ближе этого окна выполняются в том же прерывании: моторы
+// с почти совпадающими шагами не требуют отдельных прерываний
+#define STEP_SCHEDULER_MERGE_US 5
+
+// Аппарат не успеет сработать на аларм ближе этого запаса
+#define STEP_SCHEDULER_MIN_LEAD_US 10
+
+// Проходов по каналам за одно прерывание, если сроки уже наступили
+#define STEP_SCHEDULER_MAX_PASSES 4
+
+typedef struct
+{
+    step_scheduler_cb_t callback;
+    void *arg;
+    uint64_t deadline_us;
+} step_scheduler_channel_t;
+
+static gptimer_handle_t timer = NULL;
+static step_scheduler_channel_t channels[STEP_SCHEDULER_MAX_CHANNELS];
+static uint8_t channel_count = 0;
+static uint64_t armed_us = STEP_SCHEDULER_IDLE; // Срок взведенного аларма
+static portMUX_TYPE scheduler_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Вызывается под scheduler_lock
+static void IRAM_ATTR step_scheduler_arm(uint64_t deadline_us, uint64_t now_us)
+{
+    if (deadline_us < now_us + STEP_SCHEDULER_MIN_LEAD_US)
+    {
+        deadline_us = now_us + STEP_SCHEDULER_MIN_LEAD_US;
+    }
+
+    gptimer_alarm_config_t alarm = {};
+    alarm.alarm_count = deadline_us;
+    gptimer_set_alarm_action(timer, &alarm);
+    armed_us = deadline_us;
+}
+
+// Все наступившие шаги за одно прерывание, затем аларм на ближайший срок
+static bool IRAM_ATTR step_scheduler_on_alarm(gptimer_handle_t handle, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    bool task_woken = false;
+    uint64_t now = edata->count_value;
+
+    portENTER_CRITICAL_ISR(&scheduler_lock);
+    armed_us = STEP_SCHEDULER_IDLE;
+
+    for (int pass = 0; pass < STEP_SCHEDULER_MAX_PASSES; pass++)
+    {
+        uint64_t next = STEP_SCHEDULER_IDLE;
+        for (uint8_t i = 0; i < channel_count; i++)
+        {
+            step_scheduler_channel_t *channel = &channels[i];
+            if (channel->deadline_us <= now + STEP_SCHEDULER_MERGE_US)
+            {
+                channel->deadline_us = channel->callback(now, channel->arg, &task_woken);
+            }
+            if (channel->deadline_us < next)
+            {
+                next = channel->deadline_us;
+            }
+        }
+
+        if (next == STEP_SCHEDULER_IDLE)
+        {
+            break;
+        }
+
+        gptimer_get_raw_count(handle, &now);
+        if (next > now + STEP_SCHEDULER_MIN_LEAD_US || pass == STEP_SCHEDULER_MAX_PASSES - 1)
+        {
+            step_scheduler_arm(next, now);
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL_ISR(&scheduler_lock);
+    return task_woken;
+}
+
+esp_err_t step_scheduler_init(void)
+{
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = STEP_SCHEDULER_RESOLUTION_HZ,
+    };
+    esp_err_t ret = gptimer_new_timer(&timer_config, &timer);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // Прерывание выделяется на ядре, которое регистрирует обработчик
+    gptimer_event_callbacks_t callbacks = {
+        .on_alarm = step_scheduler_on_alarm,
+    };
+    ret = gptimer_register_event_callbacks(timer, &callbacks, NULL);
+    if (ret == ESP_OK)
+    {
+        ret = gptimer_enable(timer);
+    }
+    if (ret == ESP_OK)
+    {
+        // Счетчик идет непрерывно: 64 бита на 1 МГц не переполняются
+        ret = gptimer_start(timer);
+    }
+    if (ret != ESP_OK)
+    {
+        gptimer_del_timer(timer);
+        timer = NULL;
+    }
+    return ret;
+}
+
+esp_err_t step_scheduler_add_channel(step_scheduler_cb_t callback, void *arg, uint8_t *channel)
+{
+    if (timer == NULL || callback == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    portENTER_CRITICAL(&scheduler_lock);
+    if (channel_count >= STEP_SCHEDULER_MAX_CHANNELS)
+    {
+        portEXIT_CRITICAL(&scheduler_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    channels[channel_count].callback = callback;
+    channels[channel_count].arg = arg;
+    channels[channel_count].deadline_us = STEP_SCHEDULER_IDLE;
+    *channel = channel_count;
+    channel_count++;
+    portEXIT_CRITICAL(&scheduler_lock);
+
+    return ESP_OK;
+}
+
+uint64_t IRAM_ATTR step_scheduler_now_us(void)
+{
+    uint64_t now = 0;
+    gptimer_get_raw_count(timer, &now);
+    return now;
+}
+
+void step_scheduler_start(uint8_t channel, uint64_t deadline_us)
+{
+    portENTER_CRITICAL(&scheduler_lock);
+    channels[channel].deadline_us = deadline_us;
+
+    // Срок раньше взведенного аларма: аларм переносится. Иначе шаг
+    // выполнится в прерывании одного из более ранних сроков
+    if (deadline_us < armed_us)
+    {
+        step_scheduler_arm(deadline_us, step_scheduler_now_us());
+    }
+    portEXIT_CRITICAL(&scheduler_lock);
+}
+
+void step_scheduler_stop(uint8_t channel)
+{
+    // Аларм остается взведенным: прерывание без наступивших сроков
+    // просто не выполнит ни одного шага
+    portENTER_CRITICAL(&scheduler_lock);
+    channels[channel].deadline_us = STEP_SCHEDULER_IDLE;
+    portEXIT_CRITICAL(&scheduler_lock);
+}
@@ -0,0 +1,34 @@
+// Общий генератор шагов: один GPTimer и одно прерывание на все моторы
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Срок канала без запланированного шага
+#define STEP_SCHEDULER_IDLE UINT64_MAX
+
+    // Вызывается из ISR на сроке шага. Возвращает срок следующего шага
+    // (мкс по step_scheduler_now_us) или STEP_SCHEDULER_IDLE.
+    // task_woken выставляется, если ISR разбудил задачу
+    typedef uint64_t (*step_scheduler_cb_t)(uint64_t now_us, void *arg, bool *task_woken);
+
+    // Таймер и прерывание создаются на ядре вызывающего
+    esp_err_t step_scheduler_init(void);
+    esp_err_t step_scheduler_add_channel(step_scheduler_cb_t callback, void *arg, uint8_t *channel);
+
+    uint64_t step_scheduler_now_us(void);
+
+    // Первый шаг канала в deadline_us. Останов гарантирует, что callback
+    // канала больше не вызывается и сейчас не выполняется
+    void step_scheduler_start(uint8_t channel, uint64_t deadline_us);
+    void step_scheduler_stop(uint8_t channel);
+
+#ifdef __cplusplus
+}
+#endif
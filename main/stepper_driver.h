@@ -0,0 +1,119 @@
+// Шаговый драйвер ULN2003: таблицы фаз, вычисляемые при компиляции
+#pragma once
+
+#include <stdint.h>
+#include "esp_attr.h"
+#include "soc/soc.h"
+#include "soc/soc_caps.h"
+#include "soc/gpio_reg.h"
+
+#define STEPPER_COILS 4
+
+// Вывод фазы: маски регистров W1TS/W1TC. Катушки, включенные в обеих
+// фазах, не переключаются, поэтому порядок записей не дает провалов
+typedef struct
+{
+    uint32_t set;
+    uint32_t clear;
+#if SOC_GPIO_PIN_COUNT > 32
+    uint32_t set_high; // GPIO32 и выше
+    uint32_t clear_high;
+#endif
+} stepper_phase_t;
+
+// Катушки фазы: бит i - вывод IN(i+1). Полный шаг включает одну катушку,
+// полушаг чередует одну и две соседние
+constexpr uint8_t stepper_coils(bool half_step, uint8_t phase)
+{
+    if (!half_step)
+    {
+        return (uint8_t)(1 << phase);
+    }
+    uint8_t coil = phase >> 1;
+    uint8_t bits = (uint8_t)(1 << coil);
+    if (phase & 1)
+    {
+        bits |= (uint8_t)(1 << ((coil + 1) & (STEPPER_COILS - 1)));
+    }
+    return bits;
+}
+
+// Длина последовательности - степень двойки: переход к следующей фазе
+// в любую сторону выполняется маской без деления
+template <bool HalfStep>
+struct stepper_sequence
+{
+    static constexpr uint8_t size = HalfStep ? 8 : 4;
+    static constexpr uint8_t mask = size - 1;
+
+    struct table_t
+    {
+        uint8_t coils[size];
+    };
+
+    static constexpr table_t make()
+    {
+        table_t table = {};
+        for (uint8_t phase = 0; phase < size; phase++)
+        {
+            table.coils[phase] = stepper_coils(HalfStep, phase);
+        }
+        return table;
+    }
+
+    static constexpr table_t table = make();
+};
+
+// Таблица фаз для набора выводов IN1-IN4 и режима шага
+template <int Pin1, int Pin2, int Pin3, int Pin4, bool HalfStep>
+struct stepper_driver
+{
+    using sequence = stepper_sequence<HalfStep>;
+
+    static_assert(Pin1 >= 0 && Pin1 < SOC_GPIO_PIN_COUNT && Pin2 >= 0 && Pin2 < SOC_GPIO_PIN_COUNT &&
+                      Pin3 >= 0 && Pin3 < SOC_GPIO_PIN_COUNT && Pin4 >= 0 && Pin4 < SOC_GPIO_PIN_COUNT,
+                  "Motor pin is not an output GPIO of this target");
+
+    struct table_t
+    {
+        stepper_phase_t phases[sequence::size];
+    };
+
+    static constexpr table_t make()
+    {
+        constexpr int pins[STEPPER_COILS] = {Pin1, Pin2, Pin3, Pin4};
+        table_t table = {};
+        for (uint8_t phase = 0; phase < sequence::size; phase++)
+        {
+            stepper_phase_t &out = table.phases[phase];
+            for (uint8_t coil = 0; coil < STEPPER_COILS; coil++)
+            {
+                bool on = (sequence::table.coils[phase] >> coil) & 1;
+#if SOC_GPIO_PIN_COUNT > 32
+                if (pins[coil] >= 32)
+                {
+                    uint32_t bit = 1UL << (pins[coil] - 32);
+                    (on ? out.set_high : out.clear_high) |= bit;
+                    continue;
+                }
+#endif
+                uint32_t bit = 1UL << pins[coil];
+                (on ? out.set : out.clear) |= bit;
+            }
+        }
+        return table;
+    }
+
+    static constexpr table_t table = make();
+};
+
+// Горячий путь: две записи в регистры на все катушки, без ветвлений
+static inline void IRAM_ATTR stepper_write(const stepper_phase_t *phase)
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, phase->clear);
+    REG_WRITE(GPIO_OUT_W1TS_REG, phase->set);
+#if SOC_GPIO_PIN_COUNT > 32
+    REG_WRITE(GPIO_OUT1_W1TC_REG, phase->clear_high);
+    REG_WRITE(GPIO_OUT1_W1TS_REG, phase->set_high);
+#endif
+}
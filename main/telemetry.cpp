@@ -0,0 +1,182 @@
+#include "telemetry.h"
+#include "motor_control.h"
+#include "shade_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "telemetry";
+
+#define TELEMETRY_RING_SIZE CONFIG_TELEMETRY_RING_RECORDS
+#define TELEMETRY_RING_MASK (TELEMETRY_RING_SIZE - 1)
+
+static_assert((TELEMETRY_RING_SIZE & TELEMETRY_RING_MASK) == 0, "Ring size must be a power of two");
+static_assert(sizeof(telemetry_record_t) == 16, "Telemetry record must stay 16 bytes");
+
+// Ячейка буфера. seq - номер записи + 1, пока запись не дописана - 0:
+// читатель по seq отличает готовую запись от перезаписываемой
+typedef struct
+{
+    std::atomic<uint32_t> seq;
+    telemetry_record_t record;
+} telemetry_slot_t;
+
+static telemetry_slot_t ring[TELEMETRY_RING_SIZE];
+
+// Писатели не блокируются: номер ячейки резервируется атомарным инкрементом
+static std::atomic<uint32_t> head{0};
+
+// Контекст, который добавляется к каждой записи
+static std::atomic<uint16_t> context_position[SHADE_COUNT];
+static std::atomic<uint8_t> context_state[SHADE_COUNT];
+static std::atomic<uint8_t> context_source[SHADE_COUNT];
+
+static uint32_t sample_counter[SHADE_COUNT];
+
+static const char *const event_names[] = {
+    "command",
+    "button",
+    "state",
+    "result",
+    "limit",
+    "motor_start",
+    "direction",
+    "speed",
+    "decel",
+    "motor_stop",
+    "sample",
+};
+
+void telemetry_record(uint8_t shade, telemetry_event_t event, uint32_t arg)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+
+    uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+    telemetry_slot_t *slot = &ring[index & TELEMETRY_RING_MASK];
+
+    slot->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    telemetry_record_t *record = &slot->record;
+    record->time_us = (uint32_t)esp_timer_get_time();
+    record->steps = motor_get_position_steps(shade);
+    record->arg = arg;
+    record->position = context_position[shade].load(std::memory_order_relaxed);
+    record->event = (uint8_t)event;
+    record->context = (uint8_t)((context_state[shade].load(std::memory_order_relaxed) & 0x0F) |
+                                ((context_source[shade].load(std::memory_order_relaxed) & 0x03) << 4) |
+                                (shade << 6));
+
+    slot->seq.store(index + 1, std::memory_order_release);
+}
+
+void telemetry_set_state(uint8_t shade, uint8_t state)
+{
+    if (shade < SHADE_COUNT)
+    {
+        context_state[shade].store(state, std::memory_order_relaxed);
+    }
+}
+
+void telemetry_set_source(uint8_t shade, uint8_t source)
+{
+    if (shade < SHADE_COUNT)
+    {
+        context_source[shade].store(source, std::memory_order_relaxed);
+    }
+}
+
+// Вызывается задачей датчика на каждый отсчет: положение обновляется всегда,
+// запись в журнал - на каждый CONFIG_TELEMETRY_SAMPLE_DIVIDER-й отсчет
+void telemetry_sample(uint8_t shade, uint32_t position, uint32_t raw)
+{
+    if (shade >= SHADE_COUNT)
+    {
+        return;
+    }
+    context_position[shade].store((uint16_t)position, std::memory_order_relaxed);
+
+    if (++sample_counter[shade] >= CONFIG_TELEMETRY_SAMPLE_DIVIDER)
+    {
+        sample_counter[shade] = 0;
+        telemetry_record(shade, TELEMETRY_EVENT_SAMPLE, raw);
+    }
+}
+
+// Копия записи index, false - ячейка уже перезаписана или дописывается
+static bool telemetry_read(uint32_t index, telemetry_record_t *record)
+{
+    const telemetry_slot_t *slot = &ring[index & TELEMETRY_RING_MASK];
+
+    if (slot->seq.load(std::memory_order_acquire) != index + 1)
+    {
+        return false;
+    }
+    memcpy(record, &slot->record, sizeof(*record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->seq.load(std::memory_order_relaxed) == index + 1;
+}
+
+size_t telemetry_export(uint8_t **buffer)
+{
+    uint32_t end = head.load(std::memory_order_acquire);
+    uint32_t start = end > TELEMETRY_RING_SIZE ? end - TELEMETRY_RING_SIZE : 0;
+
+    size_t size = sizeof(telemetry_header_t) + (size_t)(end - start) * sizeof(telemetry_record_t);
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (data == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for telemetry export (%u bytes)", (unsigned)size);
+        *buffer = NULL;
+        return 0;
+    }
+
+    telemetry_record_t *records = (telemetry_record_t *)(data + sizeof(telemetry_header_t));
+    uint16_t count = 0;
+    for (uint32_t index = start; index != end; index++)
+    {
+        if (telemetry_read(index, &records[count]))
+        {
+            count++;
+        }
+    }
+
+    telemetry_header_t header = {};
+    header.version = TELEMETRY_FORMAT_VERSION;
+    header.record_size = sizeof(telemetry_record_t);
+    header.count = count;
+    header.dropped = start;
+    header.time_us = (uint32_t)esp_timer_get_time();
+    memcpy(data, &header, sizeof(header));
+
+    *buffer = data;
+    return sizeof(telemetry_header_t) + (size_t)count * sizeof(telemetry_record_t);
+}
+
+void telemetry_dump(void)
+{
+    uint32_t end = head.load(std::memory_order_acquire);
+    uint32_t start = end > TELEMETRY_RING_SIZE ? end - TELEMETRY_RING_SIZE : 0;
+
+    ESP_LOGI(TAG, "Telemetry: %lu records, %lu dropped", end - start, start);
+    for (uint32_t index = start; index != end; index++)
+    {
+        telemetry_record_t record;
+        if (!telemetry_read(index, &record))
+        {
+            continue;
+        }
+
+        const char *name = record.event < sizeof(event_names) / sizeof(event_names[0])
+                               ? event_names[record.event]
+                               : "?";
+        ESP_LOGI(TAG, "%10lu us  #%u %-11s arg=%-6lu steps=%-7ld pos=%-5u state=%u src=%u",
+                 record.time_us, (record.context >> 6) + 1, name, record.arg, record.steps,
+                 record.position, record.context & 0x0F, (record.context >> 4) & 0x03);
+    }
+}
@@ -0,0 +1,76 @@
+// Журнал движения в кольцевом буфере (включается CONFIG_TELEMETRY_ENABLED)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TELEMETRY_FORMAT_VERSION 2
+
+    typedef enum
+    {
+        TELEMETRY_EVENT_COMMAND,         // Команда принята контроллером, arg - тип команды
+        TELEMETRY_EVENT_BUTTON,          // Событие кнопки, arg - (кнопка << 8) | событие
+        TELEMETRY_EVENT_STATE,           // Смена состояния контроллера, arg - состояние
+        TELEMETRY_EVENT_RESULT,          // Команда завершена, arg - controller_result_t
+        TELEMETRY_EVENT_LIMIT,           // Достигнута граница, arg - position_limit_t
+        TELEMETRY_EVENT_MOTOR_START,     // motor_step(), arg - число шагов
+        TELEMETRY_EVENT_MOTOR_DIRECTION, // Смена направления, arg - motor_direction_t
+        TELEMETRY_EVENT_MOTOR_SPEED,     // Смена крейсерской скорости, arg - мкс на шаг
+        TELEMETRY_EVENT_MOTOR_DECEL,     // Запрошено плавное торможение
+        TELEMETRY_EVENT_MOTOR_STOP,      // Мотор остановлен, arg - 1 если движение завершено
+        TELEMETRY_EVENT_SAMPLE,          // Отсчет датчика, arg - сырое значение ADC
+    } telemetry_event_t;
+
+    // Запись журнала, 16 байт. Формат экспорта совпадает с размещением в памяти
+    // (little-endian), перед записями идет telemetry_header_t
+    typedef struct __attribute__((packed))
+    {
+        uint32_t time_us;   // Младшие 32 бита esp_timer_get_time()
+        int32_t steps;      // Абсолютная позиция мотора в шагах
+        uint32_t arg;       // Параметр события
+        uint16_t position;  // Последний отфильтрованный отсчет ADC
+        uint8_t event;      // telemetry_event_t
+        uint8_t context;    // Биты 0-3 - state_t, 4-5 - controller_source_t, 6-7 - штора
+    } telemetry_record_t;
+
+    typedef struct __attribute__((packed))
+    {
+        uint8_t version;     // TELEMETRY_FORMAT_VERSION
+        uint8_t record_size; // sizeof(telemetry_record_t)
+        uint16_t count;      // Число записей после заголовка, от старых к новым
+        uint32_t dropped;    // Записи, вытесненные из буфера с момента старта
+        uint32_t time_us;    // Время экспорта, для пересчета time_us записей
+    } telemetry_header_t;
+
+#ifdef CONFIG_TELEMETRY_ENABLED
+    // Записи и контекст ведутся по шторам, номер шторы сохраняется в context
+    void telemetry_record(uint8_t shade, telemetry_event_t event, uint32_t arg);
+    void telemetry_set_state(uint8_t shade, uint8_t state);
+    void telemetry_set_source(uint8_t shade, uint8_t source);
+    void telemetry_sample(uint8_t shade, uint32_t position, uint32_t raw);
+
+    // Снимок буфера: заголовок и записи. Возвращает размер в байтах,
+    // буфер освобождается вызывающим через free()
+    size_t telemetry_export(uint8_t **buffer);
+    void telemetry_dump(void);
+
+#define TELEMETRY_RECORD(shade, event, arg) telemetry_record(shade, event, arg)
+#define TELEMETRY_SET_STATE(shade, state) telemetry_set_state(shade, (uint8_t)(state))
+#define TELEMETRY_SET_SOURCE(shade, source) telemetry_set_source(shade, (uint8_t)(source))
+#define TELEMETRY_SAMPLE(shade, position, raw) telemetry_sample(shade, position, raw)
+#else
+#define TELEMETRY_RECORD(shade, event, arg) ((void)0)
+#define TELEMETRY_SET_STATE(shade, state) ((void)0)
+#define TELEMETRY_SET_SOURCE(shade, source) ((void)0)
+#define TELEMETRY_SAMPLE(shade, position, raw) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+#include "time_sync.h"
+#include "esp_log.h"
+#include "esp_netif_sntp.h"
+#include <sys/time.h>
+#include <atomic>
+#ifdef CONFIG_SHADE_SCHEDULER
+#include "scheduler.h"
+#endif
+
+static const char *TAG = "time_sync";
+
+// time_sync_start вызывается из событий MQTT и Matter в разных задачах
+static std::atomic<bool> time_synced{false};
+static std::atomic<bool> sntp_started{false};
+
+static void time_sync_cb(struct timeval *tv)
+{
+    time_synced = true;
+    ESP_LOGI(TAG, "Time synchronized");
+
+#ifdef CONFIG_SHADE_SCHEDULER
+    // Часы могли сдвинуться: ближайшее правило пересчитывается
+    scheduler_time_changed();
+#endif
+}
+
+void time_sync_start(void)
+{
+    bool expected = false;
+    if (!sntp_started.compare_exchange_strong(expected, true))
+    {
+        return;
+    }
+
+    esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_MQTT_SNTP_SERVER);
+    sntp_config.sync_cb = time_sync_cb;
+    esp_err_t err = esp_netif_sntp_init(&sntp_config);
+    if (err != ESP_OK)
+    {
+        // Повтор при следующем появлении сети
+        ESP_LOGW(TAG, "Failed to start SNTP: %s", esp_err_to_name(err));
+        sntp_started = false;
+    }
+}
+
+bool time_sync_is_synced(void)
+{
+    return time_synced;
+}
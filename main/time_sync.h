@@ -0,0 +1,22 @@
+// Время суток по SNTP: старт команд по времени (MQTT) и расписание
+#pragma once
+
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef CONFIG_SHADE_TIME_SYNC
+    // Запуск синхронизации после появления сети. Повторные вызовы ничего не делают
+    void time_sync_start(void);
+
+    // Время получено от сервера с момента запуска
+    bool time_sync_is_synced(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif